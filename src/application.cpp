@@ -1,7 +1,5 @@
 #include "application.hpp"
 
-#include "ocean.hpp"
-
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
@@ -16,7 +14,7 @@ static const int HEIGHT = 720;
 GLFWwindow *Application::window = nullptr;
 std::unique_ptr<Stage> Application::stage = nullptr;
 
-void Application::run() {
+void Application::run(std::unique_ptr<Stage> first_stage) {
     glfwSetErrorCallback(Application::on_glfw_error);
 
     if (!glfwInit()) {
@@ -51,7 +49,7 @@ void Application::run() {
     glfwSetFramebufferSizeCallback(window, Application::on_window_resize);
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
-    stage = std::make_unique<Ocean>();
+    stage = std::move(first_stage);
     stage->init(window);
 
     double prev = glfwGetTime();
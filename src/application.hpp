@@ -8,7 +8,10 @@ typedef struct GLFWwindow GLFWwindow;
 
 class Application {
 public:
-    static void run();
+    /**
+     * Open the window and run a stage until it's closed.
+     */
+    static void run(std::unique_ptr<Stage> first_stage);
 
 private:
     static GLFWwindow *window;
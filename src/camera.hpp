@@ -120,6 +120,34 @@ public:
         return this->position;
     }
 
+    /**
+     * Unit direction, in world coordinates, of the ray from the camera
+     * through a point on the screen.
+     *
+     * @param ndc: normalized device coordinates of the point, (0, 0)
+     * being the centre of the screen and (1, 1) its top right corner
+     * @param fov_y: vertical field of view, in degrees
+     * @param aspect: width of the screen over its height
+     */
+    glm::vec3 get_ray(glm::vec2 ndc, float fov_y, float aspect) {
+        vec3 right = glm::normalize(glm::cross(front, up));
+        vec3 true_up = glm::cross(right, front);
+
+        float half_height = (float)glm::tan(glm::radians(fov_y) * 0.5f);
+        float half_width = half_height * aspect;
+        return glm::normalize(
+            front + (right * (ndc.x * half_width)) +
+            (true_up * (ndc.y * half_height)));
+    }
+
+    /**
+     * Move the camera to a position in world coordinates, keeping its
+     * orientation.
+     */
+    void set_position(glm::vec3 pos) {
+        this->position = pos;
+    }
+
 private:
     // Location of the camera in world coordinates
     glm::vec3 position;
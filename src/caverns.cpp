@@ -0,0 +1,205 @@
+#include "caverns.hpp"
+
+#include "frustum.hpp"
+#include "util.hpp"
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <iostream>
+
+// How far the camera can see, in world units; about as far as chunks
+// are loaded
+const float VIEW_DISTANCE = 160.0f;
+
+// Vertical field of view, in degrees
+const float FIELD_OF_VIEW = 60.0f;
+
+// Flying speed, in world units per second
+const float MOVE_SPEED = 16.0f;
+
+void Caverns::init(GLFWwindow *win) {
+    try {
+        auto vert = compile_shader("../src/voxel.vert", GL_VERTEX_SHADER);
+        auto frag = compile_shader("../src/voxel.frag", GL_FRAGMENT_SHADER);
+        program = link_program({vert, frag});
+
+        glDeleteShader(vert);
+        glDeleteShader(frag);
+    } catch (const std::runtime_error &e) {
+        std::cerr << e.what() << std::endl;
+        return;
+    }
+
+    this->window = win;
+
+    glUseProgram(program);
+
+    int viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    screen_size = vec2((float)viewport[2], (float)viewport[3]);
+
+    // Move the cursor to the center of the screen
+    mouse_pos = screen_size / 2.0f;
+    glfwSetCursorPos(win, mouse_pos.x, mouse_pos.y);
+
+    generator = std::make_unique<TerrainGenerator>();
+    field = std::make_unique<DensityField>(*generator);
+    terrain = std::make_unique<VoxelTerrain>(pool, *field);
+
+    // Start a little above the unwarped surface
+    camera = Camera(
+        vec3(0.0f, generator->height_at(0.0f, 0.0f) + 16.0f, 0.0f),
+        vec3(0.0f, 0.0f, -1.0f),
+        vec3(0.0f, 1.0f, 0.0f));
+    update_view_matrix();
+    update_eye_position();
+    update_perspective_matrix();
+
+    // LIGHTING: a sun from above, plus a lamp at the eye for the caves
+    GLint light_dir_attrib = 5;
+    vec3 light_dir = glm::normalize(vec3(0.4f, 1.0f, 0.3f));
+    glUniform3fv(light_dir_attrib, 1, value_ptr(light_dir));
+
+    GLint ambient_light_color_attrib = 6;
+    glUniform3fv(ambient_light_color_attrib, 1, value_ptr(vec3(0.05f)));
+
+    GLint diffuse_light_color_attrib = 7;
+    glUniform3fv(diffuse_light_color_attrib, 1, value_ptr(vec3(1.0f)));
+
+    GLint lamp_color_attrib = 8;
+    glUniform3fv(lamp_color_attrib, 1, value_ptr(vec3(0.6f)));
+}
+
+void Caverns::cleanup() {
+    terrain->cleanup();
+}
+
+void Caverns::update(double dt) {
+    // Some keys are not detected by the key event handler, so we poll
+    // for them manually
+    {
+        int space = glfwGetKey(this->window, GLFW_KEY_SPACE);
+        if (space == GLFW_PRESS) {
+            this->pressed_keys[GLFW_KEY_SPACE] = " ";
+        } else {
+            this->pressed_keys.erase(GLFW_KEY_SPACE);
+        }
+
+        int lshift = glfwGetKey(this->window, GLFW_KEY_LEFT_SHIFT);
+        if (lshift == GLFW_PRESS) {
+            this->pressed_keys[GLFW_KEY_LEFT_SHIFT] = "LSHIFT";
+        } else {
+            this->pressed_keys.erase(GLFW_KEY_LEFT_SHIFT);
+        }
+    }
+
+    float move_amt = MOVE_SPEED * (float)dt;
+
+    if (pressed_keys.find(GLFW_KEY_W) != pressed_keys.end()) {
+        camera.move(Camera::Direction::FORWARD, move_amt);
+    }
+    if (pressed_keys.find(GLFW_KEY_S) != pressed_keys.end()) {
+        camera.move(Camera::Direction::BACKWARD, move_amt);
+    }
+    if (pressed_keys.find(GLFW_KEY_A) != pressed_keys.end()) {
+        camera.move(Camera::Direction::LEFT, move_amt);
+    }
+    if (pressed_keys.find(GLFW_KEY_D) != pressed_keys.end()) {
+        camera.move(Camera::Direction::RIGHT, move_amt);
+    }
+    if (pressed_keys.find(GLFW_KEY_SPACE) != pressed_keys.end()) {
+        camera.move(Camera::Direction::UP, move_amt);
+    }
+    if (pressed_keys.find(GLFW_KEY_LEFT_SHIFT) != pressed_keys.end()) {
+        camera.move(Camera::Direction::DOWN, move_amt);
+    }
+
+    update_view_matrix();
+    update_eye_position();
+
+    terrain->update(camera.get_position());
+}
+
+void Caverns::draw() {
+    glUseProgram(program);
+
+    GLint model_attrib = 2;
+    terrain->draw(Frustum(perspective * view), model_attrib);
+}
+
+void Caverns::on_key_event(
+    GLFWwindow *win,
+    int key,
+    int scancode,
+    int action,
+    int mods) {
+    (void)win;
+
+    if (action == GLFW_PRESS) {
+        const char *key_name = glfwGetKeyName(key, scancode);
+        if (!key_name) {
+            return;
+        }
+
+        this->pressed_keys[key] = key_name;
+
+        if ((mods & GLFW_MOD_CONTROL) &&
+            (key_name[0] == 'w' || key_name[0] == 'W')) {
+            wireframe = !wireframe;
+            glPolygonMode(GL_FRONT_AND_BACK, wireframe ? GL_LINE : GL_FILL);
+        }
+
+    } else if (action == GLFW_RELEASE) {
+        this->pressed_keys.erase(key);
+    }
+}
+
+void Caverns::on_mouse_move(GLFWwindow *win, double xpos, double ypos) {
+    (void)win;
+
+    if (is_first_mouse_movement) {
+        is_first_mouse_movement = false;
+        mouse_pos = vec2(xpos, ypos);
+    }
+
+    const float sensitivity = 0.05f;
+
+    vec2 delta = vec2(xpos - mouse_pos.x, mouse_pos.y - ypos);
+    delta *= sensitivity;
+
+    camera.rotate2d(delta);
+    update_view_matrix();
+
+    mouse_pos = vec2(xpos, ypos);
+}
+
+void Caverns::on_window_resize(GLFWwindow *win, int width, int height) {
+    (void)win;
+
+    screen_size = vec2(width, height);
+    update_perspective_matrix();
+}
+
+void Caverns::update_view_matrix() {
+    view = camera.get_view_matrix();
+    GLint view_attrib = 3;
+    glUniformMatrix4fv(view_attrib, 1, GL_FALSE, value_ptr(view));
+}
+
+void Caverns::update_perspective_matrix() {
+    float aspect_ratio = (float)screen_size.x / (float)screen_size.y;
+    perspective = glm::perspective(
+        glm::radians(FIELD_OF_VIEW), aspect_ratio, 0.1f, VIEW_DISTANCE);
+
+    GLint persp_attrib = 4;
+    glUniformMatrix4fv(persp_attrib, 1, GL_FALSE, value_ptr(perspective));
+}
+
+void Caverns::update_eye_position() {
+    GLint eye_pos_attrib = 13;
+    glUniform3fv(eye_pos_attrib, 1, value_ptr(camera.get_position()));
+}
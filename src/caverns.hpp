@@ -0,0 +1,68 @@
+#pragma once
+
+#include "camera.hpp"
+#include "density_field.hpp"
+#include "generator.hpp"
+#include "stage.hpp"
+#include "thread_pool.hpp"
+#include "voxel_terrain.hpp"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+using glm::mat4;
+using glm::vec2;
+using glm::vec3;
+
+typedef struct GLFWwindow GLFWwindow;
+typedef unsigned int GLuint;
+
+/**
+ * Flying over (and through) volumetric terrain with caves and
+ * overhangs, meshed with marching cubes.
+ */
+class Caverns : public Stage {
+public:
+    void init(GLFWwindow *) override;
+
+    void cleanup() override;
+
+    void update(double dt) override;
+
+    void draw() override;
+
+    void on_key_event(GLFWwindow *, int, int, int, int) override;
+
+    void on_mouse_move(GLFWwindow *, double, double) override;
+
+    void on_window_resize(GLFWwindow *, int, int) override;
+
+private:
+    GLFWwindow *window;
+
+    GLuint program;
+
+    Camera camera;
+
+    ThreadPool pool;
+
+    std::unique_ptr<TerrainGenerator> generator;
+    std::unique_ptr<DensityField> field;
+    std::unique_ptr<VoxelTerrain> terrain;
+
+    vec2 screen_size;
+
+    bool wireframe = false;
+
+    bool is_first_mouse_movement = false;
+    vec2 mouse_pos;
+    std::unordered_map<int, std::string> pressed_keys;
+
+    mat4 view;
+    mat4 perspective;
+
+    void update_view_matrix();
+    void update_perspective_matrix();
+    void update_eye_position();
+};
@@ -0,0 +1,390 @@
+#include "cdlod.hpp"
+
+#include "frustum.hpp"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+// Index count of one quadrant of the patch mesh
+static const size_t QUADRANT_INDICES =
+    (CDLOD_PATCH_QUADS / 2) * (CDLOD_PATCH_QUADS / 2) * 6;
+
+// Min/max pyramid level holding the leaf nodes
+static const size_t LEAF_PYRAMID_LEVEL = 5;
+static_assert(
+    (1u << LEAF_PYRAMID_LEVEL) == CDLOD_PATCH_QUADS,
+    "leaf nodes must line up with a pyramid level");
+
+// Squared distance from a point to the closest point of a box
+static float box_distance_sq(vec3 p, vec3 min, vec3 max) {
+    vec3 d = glm::max(glm::max(min - p, p - max), vec3(0.0f));
+    return glm::dot(d, d);
+}
+
+CdlodTerrain::CdlodTerrain(
+    Heightfield hf,
+    vector<uint32_t> weights,
+    vec2 world_origin,
+    float sample_spacing,
+    Params p) :
+    heights(std::move(hf)),
+    splat(std::move(weights)),
+    origin(world_origin),
+    spacing(sample_spacing),
+    params(p) {
+    size_t samples = heights.get_width();
+    size_t root_samples = (size_t)CDLOD_PATCH_QUADS << (params.levels - 1);
+
+    if (params.levels == 0 || heights.get_height() != samples ||
+        samples < 2 || (samples - 1) % root_samples != 0) {
+        std::string err_msg = "CDLOD heightmap must be square with 1 + a ";
+        err_msg.append("multiple of ");
+        err_msg.append(std::to_string(root_samples));
+        err_msg.append(" samples per side, but got ");
+        err_msg.append(std::to_string(heights.get_width()));
+        err_msg.append("x");
+        err_msg.append(std::to_string(heights.get_height()));
+
+        throw std::invalid_argument(err_msg);
+    }
+    if (splat.size() != samples * samples) {
+        throw std::invalid_argument("CDLOD splat map doesn't match heights");
+    }
+
+    leaf_count = (samples - 1) / CDLOD_PATCH_QUADS;
+
+    bounds = MinMaxPyramid(heights);
+    compute_errors();
+}
+
+void CdlodTerrain::init() {
+    // One patch, with the indices grouped by quadrant so that any
+    // quadrant can be drawn on its own
+    const unsigned int n = CDLOD_PATCH_QUADS + 1;
+    const unsigned int half = CDLOD_PATCH_QUADS / 2;
+
+    vector<vec3> vertices;
+    for (unsigned int y = 0; y < n; ++y) {
+        for (unsigned int x = 0; x < n; ++x) {
+            vertices.push_back(vec3(x, y, 0.0f));
+        }
+    }
+
+    vector<unsigned int> indices;
+    for (unsigned int q = 0; q < 4; ++q) {
+        unsigned int x0 = (q & 1) * half;
+        unsigned int y0 = (q >> 1) * half;
+
+        for (unsigned int y = y0; y < y0 + half; ++y) {
+            for (unsigned int x = x0; x < x0 + half; ++x) {
+                // Same triangulation as Plane
+                indices.push_back((y * n) + x);
+                indices.push_back((y * n) + (x + 1));
+                indices.push_back(((y + 1) * n) + (x + 1));
+
+                indices.push_back((y * n) + x);
+                indices.push_back(((y + 1) * n) + x);
+                indices.push_back(((y + 1) * n) + (x + 1));
+            }
+        }
+    }
+
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+
+    glGenBuffers(1, &vertex_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+    glBufferData(
+        GL_ARRAY_BUFFER,
+        (GLsizeiptr)(vertices.size() * sizeof(vec3)),
+        vertices.data(),
+        GL_STATIC_DRAW);
+
+    GLuint pos_attrib = 0;
+    glEnableVertexAttribArray(pos_attrib);
+    glVertexAttribPointer(
+        pos_attrib, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), (char *)nullptr + 0);
+
+    glGenBuffers(1, &index_buffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+    glBufferData(
+        GL_ELEMENT_ARRAY_BUFFER,
+        (GLsizeiptr)(indices.size() * sizeof(unsigned int)),
+        indices.data(),
+        GL_STATIC_DRAW);
+
+    glBindVertexArray(0);
+
+    GLsizei samples = (GLsizei)heights.get_width();
+
+    // Linear filtering gives the morphing vertices, which sit between
+    // samples, a height on the line between their neighbours
+    glGenTextures(1, &height_texture);
+    glBindTexture(GL_TEXTURE_2D, height_texture);
+    glTexImage2D(
+        GL_TEXTURE_2D,
+        0,
+        GL_R32F,
+        samples,
+        samples,
+        0,
+        GL_RED,
+        GL_FLOAT,
+        heights.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glGenTextures(1, &splat_texture);
+    glBindTexture(GL_TEXTURE_2D, splat_texture);
+    glTexImage2D(
+        GL_TEXTURE_2D,
+        0,
+        GL_RGBA8,
+        samples,
+        samples,
+        0,
+        GL_RGBA,
+        GL_UNSIGNED_BYTE,
+        splat.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // Only the GPU needs the splat weights; the heights are kept for
+    // queries
+    splat = vector<uint32_t>();
+}
+
+void CdlodTerrain::cleanup() {
+    glDeleteTextures(1, &splat_texture);
+    glDeleteTextures(1, &height_texture);
+    glDeleteBuffers(1, &index_buffer);
+    glDeleteBuffers(1, &vertex_buffer);
+    glDeleteVertexArrays(1, &vao);
+}
+
+void CdlodTerrain::select(
+    vec3 camera_pos,
+    const mat4 &view,
+    const mat4 &perspective,
+    float viewport_height) {
+    compute_ranges(perspective, viewport_height);
+
+    Frustum frustum(perspective * view);
+    selected.clear();
+
+    size_t top = params.levels - 1;
+    size_t roots = leaf_count >> top;
+    for (size_t y = 0; y < roots; ++y) {
+        for (size_t x = 0; x < roots; ++x) {
+            select_node(x, y, top, camera_pos, frustum);
+        }
+    }
+}
+
+void CdlodTerrain::draw(
+    GLint node_loc,
+    GLint morph_loc,
+    GLint heightmap_info_loc) const {
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, height_texture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, splat_texture);
+    glActiveTexture(GL_TEXTURE0);
+
+    glUniform4f(
+        heightmap_info_loc,
+        origin.x,
+        origin.y,
+        1.0f / spacing,
+        1.0f / (float)heights.get_width());
+
+    glBindVertexArray(vao);
+
+    for (const Selection &s : selected) {
+        float size = get_node_size(s.level);
+        float quad_size = (float)(1u << s.level) * spacing;
+        glUniform4f(
+            node_loc,
+            origin.x + ((float)s.x * size),
+            origin.y + ((float)s.y * size),
+            quad_size,
+            0.0f);
+
+        // Vertices finish morphing at the end of the level's range
+        float end = ranges[s.level];
+        float prev = (s.level > 0) ? ranges[s.level - 1] : 0.0f;
+        float start = end - ((end - prev) * params.morph_fraction);
+        glUniform2f(morph_loc, start, end);
+
+        if (s.quadrant < 0) {
+            glDrawElements(
+                GL_TRIANGLES,
+                (GLsizei)(4 * QUADRANT_INDICES),
+                GL_UNSIGNED_INT,
+                (char *)nullptr + 0);
+        } else {
+            size_t offset =
+                (size_t)s.quadrant * QUADRANT_INDICES * sizeof(unsigned int);
+            glDrawElements(
+                GL_TRIANGLES,
+                (GLsizei)QUADRANT_INDICES,
+                GL_UNSIGNED_INT,
+                (char *)nullptr + offset);
+        }
+    }
+
+    glBindVertexArray(0);
+}
+
+size_t CdlodTerrain::get_triangle_count() const {
+    size_t quadrants = 0;
+    for (const Selection &s : selected) {
+        quadrants += (s.quadrant < 0) ? 4 : 1;
+    }
+
+    return quadrants * (QUADRANT_INDICES / 3);
+}
+
+void CdlodTerrain::compute_errors() {
+    size_t samples = heights.get_width();
+    level_error.assign(params.levels, 0.0f);
+
+    // Compare every sample against the triangles of each level's mesh
+    // over it, split along the same diagonal as the patch mesh
+    for (size_t level = 1; level < params.levels; ++level) {
+        size_t step = (size_t)1 << level;
+        float inv_step = 1.0f / (float)step;
+        float worst = 0.0f;
+
+        for (size_t y0 = 0; y0 + 1 < samples; y0 += step) {
+            for (size_t x0 = 0; x0 + 1 < samples; x0 += step) {
+                float a = heights.at(x0, y0);
+                float b = heights.at(x0 + step, y0);
+                float c = heights.at(x0, y0 + step);
+                float d = heights.at(x0 + step, y0 + step);
+
+                for (size_t v = 0; v <= step; ++v) {
+                    for (size_t u = 0; u <= step; ++u) {
+                        float fu = (float)u * inv_step;
+                        float fv = (float)v * inv_step;
+                        float mesh = (u >= v)
+                                         ? a + ((b - a) * fu) + ((d - b) * fv)
+                                         : a + ((c - a) * fv) + ((d - c) * fu);
+
+                        float h = heights.at(x0 + u, y0 + v);
+                        worst = std::max(worst, std::abs(h - mesh));
+                    }
+                }
+            }
+        }
+
+        level_error[level] = worst;
+    }
+}
+
+void CdlodTerrain::compute_ranges(
+    const mat4 &perspective,
+    float viewport_height) {
+    // An error of e world units at distance d covers e * k / d pixels
+    float k = viewport_height * 0.5f * perspective[1][1];
+
+    ranges.resize(params.levels);
+    for (size_t level = 0; level < params.levels; ++level) {
+        if (level + 1 == params.levels) {
+            // Nothing coarser to switch to
+            ranges[level] = FLT_MAX;
+            break;
+        }
+
+        // Use this level until the next one's error becomes small
+        // enough. Each range must at least double the previous one so
+        // that neighbouring nodes are never more than a level apart,
+        // and the leaves need to cover at least a node.
+        float range = level_error[level + 1] * k / params.max_pixel_error;
+        if (level == 0) {
+            range = std::max(range, get_node_size(0));
+        } else {
+            range = std::max(range, 2.0f * ranges[level - 1]);
+        }
+
+        ranges[level] = range;
+    }
+}
+
+void CdlodTerrain::get_node_box(
+    size_t x,
+    size_t y,
+    size_t level,
+    vec3 &min,
+    vec3 &max) const {
+    float size = get_node_size(level);
+    vec2 range = bounds.at(LEAF_PYRAMID_LEVEL + level, x, y);
+
+    min = vec3(
+        origin.x + ((float)x * size), range.x, origin.y + ((float)y * size));
+    max = vec3(min.x + size, range.y, min.z + size);
+}
+
+bool CdlodTerrain::select_node(
+    size_t x,
+    size_t y,
+    size_t level,
+    vec3 camera_pos,
+    const Frustum &frustum) {
+    vec3 min;
+    vec3 max;
+    get_node_box(x, y, level, min, max);
+
+    // Beyond this level's range, so the parent has to cover it
+    float range = ranges[level];
+    if (box_distance_sq(camera_pos, min, max) > range * range) {
+        return false;
+    }
+
+    // Handled, by not drawing anything
+    if (!frustum.intersects_box(min, max)) {
+        return true;
+    }
+
+    // Far enough that the finer level isn't needed anywhere in it
+    bool needs_finer = false;
+    if (level > 0) {
+        float finer = ranges[level - 1];
+        needs_finer = box_distance_sq(camera_pos, min, max) <= finer * finer;
+    }
+
+    if (!needs_finer) {
+        selected.push_back({x, y, level, -1});
+        return true;
+    }
+
+    for (int q = 0; q < 4; ++q) {
+        size_t cx = (2 * x) + (size_t)(q & 1);
+        size_t cy = (2 * y) + (size_t)(q >> 1);
+        if (select_node(cx, cy, level - 1, camera_pos, frustum)) {
+            continue;
+        }
+
+        // The child is out of its own level's range; draw that
+        // quadrant of this node instead, if it's visible
+        vec3 child_min;
+        vec3 child_max;
+        get_node_box(cx, cy, level - 1, child_min, child_max);
+        if (frustum.intersects_box(child_min, child_max)) {
+            selected.push_back({x, y, level, q});
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+#include "collision.hpp"
+#include "heightfield.hpp"
+#include "minmax_pyramid.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+using glm::mat4;
+using glm::vec2;
+using glm::vec3;
+
+using std::vector;
+
+typedef unsigned int GLuint;
+typedef int GLint;
+typedef int GLsizei;
+
+class Frustum;
+
+// Quads along each side of the grid mesh drawn for every node
+constexpr unsigned int CDLOD_PATCH_QUADS = 32;
+
+/**
+ * Continuous distance-dependent level of detail (CDLOD) terrain.
+ *
+ * The heightmap lives in a texture, and the terrain is drawn as a
+ * quadtree of nodes that all share one small grid mesh, scaled to
+ * each node's size and displaced in the vertex shader. Every level of
+ * the tree is used within a range of distances from the camera,
+ * picked each frame so that the level's geometric error never
+ * projects to more than a few pixels with the current projection.
+ * Over the far end of its range, a node's vertices morph into the
+ * next coarser level, so changing levels never pops.
+ *
+ * How many nodes get drawn depends on the view distance and the error
+ * threshold, not on the size of the heightmap.
+ */
+class CdlodTerrain {
+public:
+    struct Params {
+        // Levels in the quadtree, with the leaves at level 0
+        size_t levels = 8;
+
+        // Largest geometric error allowed on screen, in pixels. The
+        // error of a level is its worst case anywhere on the map.
+        float max_pixel_error = 4.0f;
+
+        // Fraction at the far end of each level's range over which
+        // vertices morph into the next level
+        float morph_fraction = 0.3f;
+    };
+
+    /**
+     * @param heights: the heightmap, in world units. Its sides must be
+     * 1 plus a multiple of CDLOD_PATCH_QUADS << (levels - 1) samples.
+     * @param splat: per-sample material weights, as in ChunkData
+     * @param origin: world XZ position of the first sample
+     * @param spacing: world units between neighbouring samples
+     */
+    CdlodTerrain(
+        Heightfield heights,
+        vector<uint32_t> splat,
+        vec2 origin,
+        float spacing,
+        Params p);
+
+    CdlodTerrain(const CdlodTerrain &) = delete;
+    CdlodTerrain &operator=(const CdlodTerrain &) = delete;
+
+    /**
+     * Upload the heightmap and create the patch mesh. Needs a GL
+     * context.
+     */
+    void init();
+
+    void cleanup();
+
+    /**
+     * Pick the nodes to draw this frame.
+     *
+     * @param view: the camera's view matrix, for frustum culling
+     * @param perspective: the projection the terrain is drawn with
+     * @param viewport_height: in pixels
+     */
+    void select(
+        vec3 camera_pos,
+        const mat4 &view,
+        const mat4 &perspective,
+        float viewport_height);
+
+    /**
+     * Draw the selected nodes with the currently bound program.
+     *
+     * @param node_loc: uniform location of the node's placement
+     * @param morph_loc: uniform location of its morph range
+     * @param heightmap_info_loc: uniform location of the heightmap's
+     * placement in the world
+     */
+    void draw(GLint node_loc, GLint morph_loc, GLint heightmap_info_loc)
+        const;
+
+    size_t get_selected_count() const {
+        return selected.size();
+    }
+
+    size_t get_triangle_count() const;
+
+    const Heightfield &get_heights() const {
+        return heights;
+    }
+
+    const MinMaxPyramid &get_bounds() const {
+        return bounds;
+    }
+
+    /**
+     * Collision queries against the heightmap. Only valid while this
+     * terrain is alive.
+     */
+    HeightfieldCollider get_collider() const {
+        return HeightfieldCollider(heights, bounds, origin, spacing);
+    }
+
+    vec2 get_origin() const {
+        return origin;
+    }
+
+    float get_spacing() const {
+        return spacing;
+    }
+
+    /**
+     * Length of the heightmap's sides in world units.
+     */
+    float get_extent() const {
+        return (float)(heights.get_width() - 1) * spacing;
+    }
+
+private:
+    // A node to draw: the whole of it, or one quadrant when the rest
+    // is covered by finer nodes
+    struct Selection {
+        size_t x;
+        size_t y;
+        size_t level;
+        int quadrant;
+    };
+
+    Heightfield heights;
+    vector<uint32_t> splat;
+    vec2 origin;
+    float spacing;
+    Params params;
+
+    // Nodes along each side of the heightmap at level 0
+    size_t leaf_count;
+
+    // Lowest and highest sample under every node: a node of level l
+    // is an entry of the pyramid's level l + log2(CDLOD_PATCH_QUADS)
+    MinMaxPyramid bounds;
+
+    // Per level, the largest vertical distance between its mesh and
+    // the full resolution heightmap
+    vector<float> level_error;
+
+    // Per level, the distance from the camera within which it's used.
+    // Recomputed by every select().
+    vector<float> ranges;
+
+    vector<Selection> selected;
+
+    GLuint vao = 0;
+    GLuint vertex_buffer = 0;
+    GLuint index_buffer = 0;
+    GLuint height_texture = 0;
+    GLuint splat_texture = 0;
+
+    void compute_errors();
+
+    void compute_ranges(const mat4 &perspective, float viewport_height);
+
+    float get_node_size(size_t level) const {
+        return (float)(CDLOD_PATCH_QUADS << level) * spacing;
+    }
+
+    void get_node_box(
+        size_t x,
+        size_t y,
+        size_t level,
+        vec3 &min,
+        vec3 &max) const;
+
+    bool select_node(
+        size_t x,
+        size_t y,
+        size_t level,
+        vec3 camera_pos,
+        const Frustum &frustum);
+};
@@ -0,0 +1,270 @@
+#include "chunk.hpp"
+
+#include "erosion.hpp"
+#include "heightfield_codec.hpp"
+#include "thermal_erosion.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+ChunkBuilder::ChunkBuilder(
+    ThreadPool &p,
+    const TerrainGenerator &gen,
+    Params prm) :
+    pool(p),
+    generator(gen),
+    params(prm) {
+    size_t stride = params.coarse_stride;
+    if (stride == 0 || (stride & (stride - 1)) != 0 ||
+        stride >= CHUNK_SAMPLES - 1) {
+        std::string err_msg = "Coarse stride must be a power of two below ";
+        err_msg.append(std::to_string(CHUNK_SAMPLES - 1));
+        err_msg.append(", but got ");
+        err_msg.append(std::to_string(stride));
+
+        throw std::invalid_argument(err_msg);
+    }
+
+    detail_seed = hash_combine(generator.get_params().seed, 0x64657461u);
+}
+
+ChunkData ChunkBuilder::build(ChunkCoord coord) const {
+    // With a coarse stride, everything up to finish() happens on the
+    // coarse grid
+    const size_t stride = params.coarse_stride;
+    const float step = params.spacing * (float)stride;
+    const size_t samples = ((CHUNK_SAMPLES - 1) / stride) + 1;
+
+    // Samples kept around the chunk: one for the normals on its
+    // border, or two for the curve through the coarse samples
+    const size_t ring = (stride > 1) ? 2 : 1;
+
+    size_t margin =
+        params.erode ? std::max(params.erosion_margin, ring) : ring;
+    size_t padded = samples + (2 * margin);
+
+    vec2 origin = get_origin(coord) - vec2((float)margin * step);
+    Heightfield hf = generator.generate(origin, padded, padded, step);
+
+    if (params.erode) {
+        Heightfield raw = hf;
+
+        // Erosion works in grid units
+        float *h = hf.data();
+        for (size_t i = 0; i < padded * padded; ++i) {
+            h[i] /= step;
+        }
+
+        HydraulicErosion::Params erosion_params;
+        erosion_params.seed =
+            hash_2d(coord.x, coord.z, generator.get_params().seed);
+        HydraulicErosion(pool, erosion_params).erode(hf);
+        ThermalErosion().erode(hf, 4);
+
+        // Fade from the raw heights on the border (and the ring just
+        // outside it, which the border normals depend on, and the
+        // neighbour's ring inside it) to fully eroded heights further
+        // in
+        const int last = (int)samples - 1;
+        for (size_t y = 0; y < padded; ++y) {
+            for (size_t x = 0; x < padded; ++x) {
+                int cx = (int)x - (int)margin;
+                int cy = (int)y - (int)margin;
+                int dist = std::min({cx, cy, last - cx, last - cy});
+
+                float w = (float)(dist - (int)ring) / (float)params.feather;
+                w = std::clamp(w, 0.0f, 1.0f);
+
+                float eroded = hf.at(x, y) * step;
+                hf.at(x, y) = raw.at(x, y) + ((eroded - raw.at(x, y)) * w);
+            }
+        }
+    }
+
+    size_t kept = samples + (2 * ring);
+    Heightfield rings(kept, kept);
+    for (size_t y = 0; y < kept; ++y) {
+        for (size_t x = 0; x < kept; ++x) {
+            float h = hf.at(x + margin - ring, y + margin - ring);
+            if (params.height_precision > 0.0f) {
+                h = HeightfieldCodec::quantize(h, params.height_precision);
+            }
+            rings.at(x, y) = h;
+        }
+    }
+
+    return finish(coord, std::move(rings));
+}
+
+ChunkData ChunkBuilder::finish(ChunkCoord coord, Heightfield padded) const {
+    const size_t padded_samples = CHUNK_SAMPLES + 2;
+    const size_t coarse_samples = get_coarse_samples();
+    bool is_coarse = params.coarse_stride > 1 &&
+                     padded.get_width() == coarse_samples &&
+                     padded.get_height() == coarse_samples;
+    if (!is_coarse && (padded.get_width() != padded_samples ||
+                       padded.get_height() != padded_samples)) {
+        throw std::invalid_argument("padded chunk heights have the wrong size");
+    }
+
+    // Full-resolution padded heights to work from
+    Heightfield refined;
+    if (is_coarse) {
+        refined = refine(coord, padded);
+    }
+    const Heightfield &full = is_coarse ? refined : padded;
+
+    const float spacing = params.spacing;
+
+    ChunkData data;
+    data.coord = coord;
+    data.heights = Heightfield(CHUNK_SAMPLES, CHUNK_SAMPLES);
+    data.normals.resize(CHUNK_VERTICES);
+    data.splat.resize(CHUNK_VERTICES);
+
+    for (size_t y = 0; y < CHUNK_SAMPLES; ++y) {
+        for (size_t x = 0; x < CHUNK_SAMPLES; ++x) {
+            data.heights.at(x, y) = full.at(x + 1, y + 1);
+
+            // Normals are in grid space (the model matrix scales X and
+            // Z by the spacing), and the heightfield's Z is our Y
+            vec3 n = full.normal_at(x + 1, y + 1);
+            size_t i = (y * CHUNK_SAMPLES) + x;
+            data.normals[i] = vec3(n.x, n.z, n.y);
+
+            vec3 world_normal = glm::normalize(
+                vec3(n.x / spacing, n.z, n.y / spacing));
+            data.splat[i] = generator.splat_weights(
+                data.heights.at(x, y), world_normal);
+        }
+    }
+
+    data.bounds = MinMaxPyramid(data.heights);
+    data.padded_heights = std::move(padded);
+    return data;
+}
+
+uint64_t ChunkBuilder::get_content_key() const {
+    auto float_bits = [](float f) {
+        uint32_t bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+        return bits;
+    };
+
+    const TerrainGenerator::Params &gen = generator.get_params();
+
+    uint32_t h = hash_combine(gen.seed, float_bits(gen.feature_size));
+    h = hash_combine(h, float_bits(gen.amplitude));
+    h = hash_combine(h, (uint32_t)gen.octaves);
+    h = hash_combine(h, float_bits(params.spacing));
+    h = hash_combine(h, params.erode ? 1u : 0u);
+    h = hash_combine(h, (uint32_t)params.erosion_margin);
+    h = hash_combine(h, (uint32_t)params.feather);
+    h = hash_combine(h, float_bits(params.height_precision));
+    if (params.coarse_stride > 1) {
+        h = hash_combine(h, (uint32_t)params.coarse_stride);
+        h = hash_combine(h, float_bits(params.detail_amplitude));
+    }
+
+    return ((uint64_t)CHUNK_SAMPLES << 32) | h;
+}
+
+Heightfield ChunkBuilder::refine(ChunkCoord coord, const Heightfield &coarse)
+    const {
+    const size_t stride = params.coarse_stride;
+    const size_t fine = CHUNK_SAMPLES + 2;
+    const size_t rows = coarse.get_height();
+
+    // Catmull-Rom weights, and the first of the four coarse samples
+    // they apply to, for every fine sample; the same along X and Y.
+    // Counting the rings, fine sample i sits stride * 2 + i - 1 fine
+    // steps past the first coarse sample. Where it falls right on a
+    // coarse sample, the weights are exactly 0, 1, 0, 0, so chunks
+    // agree along their borders.
+    vector<size_t> first(fine);
+    vector<glm::vec4> weights(fine);
+    for (size_t i = 0; i < fine; ++i) {
+        size_t pos = (stride * 2) + i - 1;
+        float t = (float)(pos % stride) / (float)stride;
+        float t2 = t * t;
+        float t3 = t2 * t;
+
+        first[i] = (pos / stride) - 1;
+        weights[i] = glm::vec4(
+            0.5f * ((2.0f * t2) - t3 - t),
+            0.5f * ((3.0f * t3) - (5.0f * t2) + 2.0f),
+            0.5f * ((4.0f * t2) - (3.0f * t3) + t),
+            0.5f * (t3 - t2));
+    }
+
+    auto blend = [](glm::vec4 w, float a, float b, float c, float d) {
+        return (w.x * a) + (w.y * b) + (w.z * c) + (w.w * d);
+    };
+
+    // Along X on every coarse row, then along Y
+    Heightfield across(fine, rows);
+    for (size_t y = 0; y < rows; ++y) {
+        for (size_t x = 0; x < fine; ++x) {
+            size_t f = first[x];
+            across.at(x, y) = blend(
+                weights[x],
+                coarse.at(f, y),
+                coarse.at(f + 1, y),
+                coarse.at(f + 2, y),
+                coarse.at(f + 3, y));
+        }
+    }
+
+    const float spacing = params.spacing;
+    vec2 origin = get_origin(coord) - vec2(spacing);
+
+    Heightfield out(fine, fine);
+    for (size_t y = 0; y < fine; ++y) {
+        size_t f = first[y];
+        float wz = origin.y + ((float)y * spacing);
+        for (size_t x = 0; x < fine; ++x) {
+            float wx = origin.x + ((float)x * spacing);
+            float smooth = blend(
+                weights[y],
+                across.at(x, f),
+                across.at(x, f + 1),
+                across.at(x, f + 2),
+                across.at(x, f + 3));
+            out.at(x, y) = smooth + detail_at(wx, wz);
+        }
+    }
+
+    return out;
+}
+
+float ChunkBuilder::detail_at(float x, float z) const {
+    // Lattice cells as big as the coarse grid's, and an octave for
+    // each halving from there down to the full resolution
+    size_t stride = params.coarse_stride;
+    int octaves = 0;
+    while ((stride >>= 1) > 0) {
+        ++octaves;
+    }
+
+    float inv_size = 1.0f / ((float)params.coarse_stride * params.spacing);
+    float n = fbm(x * inv_size, z * inv_size, detail_seed, octaves);
+    return n * params.detail_amplitude;
+}
+
+void ChunkData::write_blob(uint8_t *out) const {
+    std::memcpy(
+        out + CHUNK_HEIGHTS_OFFSET,
+        heights.data(),
+        CHUNK_VERTICES * sizeof(float));
+    std::memcpy(
+        out + CHUNK_NORMALS_OFFSET,
+        normals.data(),
+        CHUNK_VERTICES * sizeof(vec3));
+    std::memcpy(
+        out + CHUNK_SPLAT_OFFSET,
+        splat.data(),
+        CHUNK_VERTICES * sizeof(uint32_t));
+}
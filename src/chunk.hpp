@@ -0,0 +1,234 @@
+#pragma once
+
+#include "generator.hpp"
+#include "heightfield.hpp"
+#include "minmax_pyramid.hpp"
+#include "noise.hpp"
+#include "tree_instance.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+using glm::vec2;
+using glm::vec3;
+
+using std::vector;
+
+class ThreadPool;
+class TileCache;
+
+// Samples along each side of a terrain chunk. Neighbouring chunks
+// share the samples on their common edge.
+constexpr unsigned int CHUNK_SAMPLES = 65;
+
+constexpr size_t CHUNK_VERTICES = CHUNK_SAMPLES * CHUNK_SAMPLES;
+
+// A chunk's vertex data as one blob, laid out the same way in GPU
+// buffers and in the tile cache: all heights, then all normals, then
+// all splat weights
+constexpr size_t CHUNK_HEIGHTS_OFFSET = 0;
+constexpr size_t CHUNK_NORMALS_OFFSET =
+    CHUNK_HEIGHTS_OFFSET + (CHUNK_VERTICES * sizeof(float));
+constexpr size_t CHUNK_SPLAT_OFFSET =
+    CHUNK_NORMALS_OFFSET + (CHUNK_VERTICES * sizeof(vec3));
+constexpr size_t CHUNK_BLOB_BYTES =
+    CHUNK_SPLAT_OFFSET + (CHUNK_VERTICES * sizeof(uint32_t));
+
+struct ChunkCoord {
+    int32_t x;
+    int32_t z;
+
+    bool operator==(const ChunkCoord &other) const {
+        return x == other.x && z == other.z;
+    }
+
+    bool operator!=(const ChunkCoord &other) const {
+        return !(*this == other);
+    }
+};
+
+struct ChunkCoordHash {
+    size_t operator()(const ChunkCoord &c) const {
+        return hash_2d(c.x, c.z, 0);
+    }
+};
+
+/**
+ * Everything about a chunk that is built off the GL thread.
+ */
+struct ChunkData {
+    ChunkCoord coord;
+
+    // CHUNK_SAMPLES x CHUNK_SAMPLES heights in world units. Sample
+    // (x, y) lies at world (origin.x + x * spacing, origin.z + y *
+    // spacing).
+    Heightfield heights;
+
+    // One normal per sample in the chunk's grid space, Y up
+    vector<vec3> normals;
+
+    // Per-sample material weights, packed as RGBA8 in memory order:
+    // grass, rock, snow, sand
+    vector<uint32_t> splat;
+
+    // Lowest and highest heights over the chunk's cells
+    MinMaxPyramid bounds;
+
+    // Triangle list, over the same samples, for drawing the chunk from
+    // far away. Only filled in by the chunk manager.
+    vector<uint32_t> far_indices;
+
+    // Trees standing on the chunk, see TreeScatter. Only filled in by
+    // the chunk manager.
+    vector<TreeInstance> trees;
+
+    // The heights plus a one-sample ring around them, which the
+    // normals on the border depend on. Everything else can be rebuilt
+    // from these with ChunkBuilder::finish(). With a coarse stride,
+    // only the coarse samples plus two rings around them instead.
+    Heightfield padded_heights;
+
+    /**
+     * Copy everything into a CHUNK_BLOB_BYTES buffer.
+     */
+    void write_blob(uint8_t *out) const;
+};
+
+/**
+ * Turns a chunk coordinate into terrain: samples the generator,
+ * erodes, and computes normals and splat weights. Safe to call from
+ * several threads at once.
+ *
+ * Erosion runs on a margin around the chunk and is faded out towards
+ * the chunk's border, so the outermost samples (and their normals)
+ * are the plain generator output and line up with the neighbours no
+ * matter how each chunk eroded.
+ *
+ * With a coarse stride, chunks are generated, eroded and stored on a
+ * grid that many times coarser, so stored terrain costs a fraction of
+ * the memory, and only brought to full resolution by finish() when
+ * they're loaded around the camera. The detail added then depends only
+ * on the world position, so it's the same every time and lines up
+ * across chunks too.
+ */
+class ChunkBuilder {
+public:
+    struct Params {
+        // World units between neighbouring samples
+        float spacing = 1.0f;
+
+        bool erode = true;
+
+        // Extra samples generated on every side for erosion to run on
+        size_t erosion_margin = 8;
+
+        // Distance from the border, in samples, over which erosion
+        // fades in
+        size_t feather = 8;
+
+        // If not 0, heights are rounded to multiples of this with
+        // HeightfieldCodec::quantize(), so chunks stored compressed at
+        // the same precision decode to exactly what was built
+        float height_precision = 0.0f;
+
+        // If above 1, only every coarse_stride-th sample is generated
+        // and kept in padded_heights (and so in the tile cache), and
+        // finish() fills the rest back in: a smooth curve through the
+        // coarse samples, plus procedural detail. Must be a power of
+        // two, less than CHUNK_SAMPLES - 1.
+        size_t coarse_stride = 1;
+
+        // Largest height of the added detail, in world units
+        float detail_amplitude = 0.5f;
+    };
+
+    ChunkBuilder(ThreadPool &p, const TerrainGenerator &gen) :
+        ChunkBuilder(p, gen, Params()) {}
+
+    ChunkBuilder(ThreadPool &pool, const TerrainGenerator &generator, Params p);
+
+    ChunkData build(ChunkCoord coord) const;
+
+    /**
+     * Compute the normals and splat weights of a chunk from its
+     * padded heights, e.g. ones kept in compressed storage.
+     *
+     * @param padded: (CHUNK_SAMPLES + 2) squared heights, or
+     * get_coarse_samples() squared coarse ones, see
+     * ChunkData::padded_heights
+     */
+    ChunkData finish(ChunkCoord coord, Heightfield padded) const;
+
+    /**
+     * Samples along each side of the padded heights of a chunk built
+     * with a coarse stride.
+     */
+    size_t get_coarse_samples() const {
+        return ((CHUNK_SAMPLES - 1) / params.coarse_stride) + 5;
+    }
+
+    /**
+     * Samples along each side of ChunkData::padded_heights, as built
+     * by this builder.
+     */
+    size_t get_padded_samples() const {
+        return (params.coarse_stride > 1) ? get_coarse_samples()
+                                          : CHUNK_SAMPLES + 2;
+    }
+
+    const Params &get_params() const {
+        return params;
+    }
+
+    /**
+     * Hash of every setting that affects what build() returns, so
+     * persisted chunks can be matched to the settings they came from.
+     */
+    uint64_t get_content_key() const;
+
+    /**
+     * Length of a chunk's side in world units.
+     */
+    float get_chunk_size() const {
+        return (float)(CHUNK_SAMPLES - 1) * params.spacing;
+    }
+
+    /**
+     * World XZ position of a chunk's first sample.
+     */
+    vec2 get_origin(ChunkCoord coord) const {
+        return vec2((float)coord.x, (float)coord.z) * get_chunk_size();
+    }
+
+    /**
+     * The chunk containing a world position.
+     */
+    ChunkCoord coord_at(vec3 pos) const {
+        float size = get_chunk_size();
+        return {
+            (int32_t)std::floor(pos.x / size),
+            (int32_t)std::floor(pos.z / size)};
+    }
+
+private:
+    ThreadPool &pool;
+    const TerrainGenerator &generator;
+    Params params;
+
+    uint32_t detail_seed;
+
+    /**
+     * Fill a chunk's coarse padded heights back in to full resolution,
+     * detail included.
+     */
+    Heightfield refine(ChunkCoord coord, const Heightfield &coarse) const;
+
+    /**
+     * Height of the detail added at a world XZ position.
+     */
+    float detail_at(float x, float z) const;
+};
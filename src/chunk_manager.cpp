@@ -0,0 +1,775 @@
+#include "chunk_manager.hpp"
+
+#include "forest_simulator.hpp"
+#include "frustum.hpp"
+#include "plane.hpp"
+#include "thread_pool.hpp"
+#include "tile_cache.hpp"
+#include "wildfire.hpp"
+
+#include <glad/glad.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+
+ChunkManager::ChunkManager(
+    ThreadPool &p,
+    const ChunkBuilder &b,
+    TileCache *c,
+    Params prm) :
+    pool(p),
+    builder(b),
+    cache(c),
+    params(prm),
+    rtin(CHUNK_SAMPLES),
+    scatter(b, prm.trees),
+    tree_grid(b.get_chunk_size()) {
+    int r = params.view_radius;
+    for (int dz = -r; dz <= r; ++dz) {
+        for (int dx = -r; dx <= r; ++dx) {
+            ring.push_back({dx, dz});
+        }
+    }
+
+    std::stable_sort(
+        ring.begin(), ring.end(), [](ChunkCoord lhs, ChunkCoord rhs) {
+            return (lhs.x * lhs.x) + (lhs.z * lhs.z) <
+                   (rhs.x * rhs.x) + (rhs.z * rhs.z);
+        });
+}
+
+ChunkManager::~ChunkManager() {
+    // Builds hold a reference to the builder, which may go away with us
+    wait_for_builds();
+}
+
+void ChunkManager::init() {
+    // Every chunk has the same grid layout, so the grid positions and
+    // the triangles are shared. Only heights and normals differ.
+    auto plane = std::make_unique<Plane<CHUNK_SAMPLES>>();
+    num_elements = (GLsizei)plane->indices.size();
+
+    glGenBuffers(1, &grid_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, grid_buffer);
+    {
+        GLsizeiptr size =
+            (GLsizeiptr)(plane->vertices.size() * sizeof(Vertex));
+        const GLvoid *data = plane->vertices.data();
+        glBufferData(GL_ARRAY_BUFFER, size, data, GL_STATIC_DRAW);
+    }
+
+    glGenBuffers(1, &index_buffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+    {
+        GLsizeiptr size =
+            (GLsizeiptr)(plane->indices.size() * sizeof(unsigned int));
+        const GLvoid *data = plane->indices.data();
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, GL_STATIC_DRAW);
+    }
+}
+
+void ChunkManager::cleanup() {
+    wait_for_builds();
+    ready.clear();
+    cached.clear();
+
+    for (auto &entry : loaded) {
+        free_slots.push_back(entry.second.slot);
+    }
+    loaded.clear();
+    tree_grid.clear();
+    forest = nullptr;
+    fire = nullptr;
+
+    for (auto &slot : free_slots) {
+        glDeleteTextures(1, &slot.texture);
+        glDeleteBuffers(1, &slot.buffer);
+        glDeleteBuffers(1, &slot.far_buffer);
+        glDeleteVertexArrays(1, &slot.vao);
+    }
+    free_slots.clear();
+
+    glDeleteBuffers(1, &index_buffer);
+    glDeleteBuffers(1, &grid_buffer);
+}
+
+void ChunkManager::update(vec3 camera_pos) {
+    ChunkCoord center = builder.coord_at(camera_pos);
+    camera_chunk = center;
+    int keep_radius = params.view_radius + params.unload_margin;
+
+    // Release whatever is now too far away
+    for (auto it = loaded.begin(); it != loaded.end();) {
+        if (!in_range(it->first, center, keep_radius)) {
+            release_slot(it->second.slot);
+            tree_grid.remove(it->first);
+            it = loaded.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    ready.erase(
+        std::remove_if(
+            ready.begin(),
+            ready.end(),
+            [&](const ChunkData &data) {
+                return !in_range(data.coord, center, keep_radius);
+            }),
+        ready.end());
+
+    cached.erase(
+        std::remove_if(
+            cached.begin(),
+            cached.end(),
+            [&](const CachedChunk &chunk) {
+                return !in_range(chunk.coord, center, keep_radius);
+            }),
+        cached.end());
+
+    // Collect finished builds. Builds can't be cancelled, so ones
+    // we've moved away from in the meantime are simply dropped.
+    for (auto it = building.begin(); it != building.end();) {
+        auto status = it->second.wait_for(std::chrono::seconds(0));
+        if (status != std::future_status::ready) {
+            ++it;
+            continue;
+        }
+
+        ChunkData data = it->second.get();
+        if (in_range(data.coord, center, keep_radius)) {
+            ready.push_back(std::move(data));
+        }
+        it = building.erase(it);
+    }
+
+    // Chunks no longer found are simply requested again, and built
+    for (auto it = reading.begin(); it != reading.end();) {
+        auto status = it->second.wait_for(std::chrono::seconds(0));
+        if (status != std::future_status::ready) {
+            ++it;
+            continue;
+        }
+
+        CachedChunk chunk = it->second.get();
+        if (chunk.found && in_range(chunk.coord, center, keep_radius)) {
+            cached.push_back(std::move(chunk));
+        }
+        it = reading.erase(it);
+    }
+
+    // Upload the nearest finished or cached chunks, a few per frame
+    auto dist_sq = [&center](ChunkCoord c) {
+        int dx = c.x - center.x;
+        int dz = c.z - center.z;
+        return (dx * dx) + (dz * dz);
+    };
+
+    std::sort(
+        ready.begin(),
+        ready.end(),
+        [&dist_sq](const ChunkData &lhs, const ChunkData &rhs) {
+            return dist_sq(lhs.coord) < dist_sq(rhs.coord);
+        });
+    std::sort(
+        cached.begin(),
+        cached.end(),
+        [&dist_sq](const CachedChunk &lhs, const CachedChunk &rhs) {
+            return dist_sq(lhs.coord) < dist_sq(rhs.coord);
+        });
+
+    size_t next_ready = 0;
+    size_t next_cached = 0;
+    for (size_t i = 0; i < params.uploads_per_frame; ++i) {
+        bool have_ready = next_ready < ready.size();
+        bool have_cached = next_cached < cached.size();
+        if (!have_ready && !have_cached) {
+            break;
+        }
+
+        if (have_cached &&
+            (!have_ready || dist_sq(cached[next_cached].coord) <=
+                                dist_sq(ready[next_ready].coord))) {
+            upload_cached(std::move(cached[next_cached++]));
+        } else {
+            upload(std::move(ready[next_ready++]));
+        }
+    }
+    ready.erase(ready.begin(), ready.begin() + (ptrdiff_t)next_ready);
+    cached.erase(cached.begin(), cached.begin() + (ptrdiff_t)next_cached);
+
+    // Queue up missing chunks, nearest first, up to the limit on
+    // pending jobs. Raw cached ones are read from their tiles; the rest
+    // are decoded or built.
+    size_t max_pending = params.max_pending;
+    if (max_pending == 0) {
+        max_pending = 2 * pool.size();
+    }
+
+    const ChunkBuilder &b = builder;
+    TileCache *c = cache;
+    for (ChunkCoord offset : ring) {
+        ChunkCoord coord = {center.x + offset.x, center.z + offset.z};
+        if (is_requested(coord)) {
+            continue;
+        }
+
+        if (get_pending_count() >= max_pending) {
+            continue;
+        }
+
+        if (cache && cache->get_format() == TileCache::Format::RAW &&
+            cache->contains(coord)) {
+            cache->prefetch(coord);
+            reading.emplace(coord, pool.submit([this, coord]() {
+                return read_cached(coord);
+            }));
+            continue;
+        }
+
+        building.emplace(coord, pool.submit([this, &b, c, coord]() {
+            // Compressed tiles still need decoding and their normals
+            // rebuilt, which is far cheaper than building from scratch
+            ChunkData data;
+            bool decoded = false;
+            if (c) {
+                try {
+                    Heightfield padded;
+                    if (c->load_heights(
+                            coord, padded, b.get_padded_samples())) {
+                        data = b.finish(coord, std::move(padded));
+                        decoded = true;
+                    }
+                } catch (const std::exception &e) {
+                    // A corrupt tile is built again, and replaced
+                    std::cerr << e.what() << " in cached chunk ("
+                              << coord.x << ", " << coord.z << ")"
+                              << std::endl;
+                    c->forget(coord);
+                }
+            }
+
+            if (!decoded) {
+                data = b.build(coord);
+                if (c && !cache_failed) {
+                    try {
+                        c->store(data);
+                    } catch (const std::runtime_error &e) {
+                        // The cache is only a shortcut, so carry on
+                        // without it
+                        if (!cache_failed.exchange(true)) {
+                            std::cerr << e.what()
+                                      << ", no longer caching chunks"
+                                      << std::endl;
+                        }
+                    }
+                }
+            }
+
+            simplify(data.heights, data.far_indices);
+            scatter.place(coord, data.heights, data.trees);
+            return data;
+        }));
+    }
+}
+
+void ChunkManager::draw(
+    const Frustum &frustum,
+    GLint model_loc,
+    GLint model_inv_transp_loc) const {
+    for (const auto &entry : loaded) {
+        const LoadedChunk &chunk = entry.second;
+        if (!frustum.intersects_box(chunk.box_min, chunk.box_max)) {
+            continue;
+        }
+
+        glUniformMatrix4fv(model_loc, 1, GL_FALSE, value_ptr(chunk.model));
+        glUniformMatrix4fv(
+            model_inv_transp_loc,
+            1,
+            GL_FALSE,
+            value_ptr(chunk.model_inv_transp));
+
+        // The element buffer binding is part of the VAO, so it has to
+        // be set every time
+        ChunkCoord coord = entry.first;
+        bool far = !in_range(coord, camera_chunk, params.near_radius) &&
+                   chunk.far_elements > 0;
+        glBindVertexArray(chunk.slot.vao);
+        glBindBuffer(
+            GL_ELEMENT_ARRAY_BUFFER,
+            far ? chunk.slot.far_buffer : index_buffer);
+        glDrawElements(
+            GL_TRIANGLES,
+            far ? chunk.far_elements : num_elements,
+            GL_UNSIGNED_INT,
+            (char *)nullptr + 0);
+    }
+}
+
+bool ChunkManager::height_at(vec2 xz, float &height) const {
+    auto it = loaded.find(builder.coord_at(vec3(xz.x, 0.0f, xz.y)));
+    if (it == loaded.end()) {
+        return false;
+    }
+
+    height = get_collider(it->first, it->second).height_at(xz);
+    return true;
+}
+
+bool ChunkManager::get_vertex_texture(
+    ChunkCoord coord,
+    GLuint &texture,
+    vec3 &box_min,
+    vec3 &box_max) const {
+    auto it = loaded.find(coord);
+    if (it == loaded.end()) {
+        return false;
+    }
+
+    texture = it->second.slot.texture;
+    box_min = it->second.box_min;
+    box_max = it->second.box_max;
+    return true;
+}
+
+bool ChunkManager::sweep_sphere(
+    vec3 start,
+    vec3 end,
+    float radius,
+    SphereHit &hit) const {
+    ChunkCoord first = builder.coord_at(glm::min(start, end) - radius);
+    ChunkCoord last = builder.coord_at(glm::max(start, end) + radius);
+
+    bool found = false;
+    for (int32_t z = first.z; z <= last.z; ++z) {
+        for (int32_t x = first.x; x <= last.x; ++x) {
+            ChunkCoord coord = {x, z};
+            auto it = loaded.find(coord);
+            if (it == loaded.end()) {
+                continue;
+            }
+
+            SphereHit chunk_hit;
+            HeightfieldCollider collider = get_collider(coord, it->second);
+            if (collider.sweep_sphere(start, end, radius, chunk_hit) &&
+                (!found || chunk_hit.t < hit.t)) {
+                hit = chunk_hit;
+                found = true;
+            }
+        }
+    }
+
+    return found;
+}
+
+bool ChunkManager::raycast(
+    vec3 start,
+    vec3 dir,
+    float max_distance,
+    RayHit &hit) const {
+    float size = builder.get_chunk_size();
+    ChunkCoord coord = builder.coord_at(start);
+
+    // Walk the chunk grid along the ray: t_next is how far along the
+    // ray it crosses into the next column or row, t_delta how far it
+    // goes between two crossings
+    vec2 origin = builder.get_origin(coord);
+    int32_t step_x = 0;
+    float t_next_x = FLT_MAX;
+    float t_delta_x = FLT_MAX;
+    if (dir.x > 0.0f) {
+        step_x = 1;
+        t_next_x = (origin.x + size - start.x) / dir.x;
+        t_delta_x = size / dir.x;
+    } else if (dir.x < 0.0f) {
+        step_x = -1;
+        t_next_x = (origin.x - start.x) / dir.x;
+        t_delta_x = -size / dir.x;
+    }
+    int32_t step_z = 0;
+    float t_next_z = FLT_MAX;
+    float t_delta_z = FLT_MAX;
+    if (dir.z > 0.0f) {
+        step_z = 1;
+        t_next_z = (origin.y + size - start.z) / dir.z;
+        t_delta_z = size / dir.z;
+    } else if (dir.z < 0.0f) {
+        step_z = -1;
+        t_next_z = (origin.y - start.z) / dir.z;
+        t_delta_z = -size / dir.z;
+    }
+
+    float t = 0.0f;
+    while (t <= max_distance) {
+        auto it = loaded.find(coord);
+        if (it != loaded.end()) {
+            // Anything this chunk hits comes before the chunks the
+            // ray reaches later
+            HeightfieldCollider collider = get_collider(coord, it->second);
+            if (collider.raycast(start, dir, max_distance, hit)) {
+                return true;
+            }
+        }
+
+        if (t_next_x < t_next_z) {
+            t = t_next_x;
+            t_next_x += t_delta_x;
+            coord.x += step_x;
+        } else {
+            t = t_next_z;
+            t_next_z += t_delta_z;
+            coord.z += step_z;
+        }
+    }
+
+    return false;
+}
+
+HeightfieldCollider ChunkManager::get_collider(
+    ChunkCoord coord,
+    const LoadedChunk &chunk) const {
+    return HeightfieldCollider(
+        chunk.heights,
+        chunk.bounds,
+        builder.get_origin(coord),
+        builder.get_params().spacing);
+}
+
+bool ChunkManager::in_range(
+    ChunkCoord coord,
+    ChunkCoord center,
+    int radius) const {
+    return std::abs(coord.x - center.x) <= radius &&
+           std::abs(coord.z - center.z) <= radius;
+}
+
+bool ChunkManager::is_requested(ChunkCoord coord) const {
+    if (loaded.count(coord) || building.count(coord) || reading.count(coord)) {
+        return true;
+    }
+
+    bool is_ready = std::any_of(
+        ready.begin(), ready.end(), [&coord](const ChunkData &data) {
+            return data.coord == coord;
+        });
+    bool is_cached = std::any_of(
+        cached.begin(), cached.end(), [&coord](const CachedChunk &chunk) {
+            return chunk.coord == coord;
+        });
+    return is_ready || is_cached;
+}
+
+void ChunkManager::upload(ChunkData &&data) {
+    GpuSlot slot = acquire_slot();
+
+    glBindBuffer(GL_ARRAY_BUFFER, slot.buffer);
+    glBufferSubData(
+        GL_ARRAY_BUFFER,
+        (GLintptr)CHUNK_HEIGHTS_OFFSET,
+        (GLsizeiptr)(CHUNK_VERTICES * sizeof(float)),
+        data.heights.data());
+    glBufferSubData(
+        GL_ARRAY_BUFFER,
+        (GLintptr)CHUNK_NORMALS_OFFSET,
+        (GLsizeiptr)(CHUNK_VERTICES * sizeof(vec3)),
+        data.normals.data());
+    glBufferSubData(
+        GL_ARRAY_BUFFER,
+        (GLintptr)CHUNK_SPLAT_OFFSET,
+        (GLsizeiptr)(CHUNK_VERTICES * sizeof(uint32_t)),
+        data.splat.data());
+
+    add_loaded(
+        data.coord,
+        slot,
+        std::move(data.heights),
+        std::move(data.bounds),
+        data.far_indices,
+        std::move(data.trees));
+}
+
+void ChunkManager::upload_cached(CachedChunk &&chunk) {
+    GpuSlot slot = acquire_slot();
+
+    // The cached blob already has the buffer's layout, so it goes
+    // from the mapped file to GL in one call
+    glBindBuffer(GL_ARRAY_BUFFER, slot.buffer);
+    bool found = cache->with_tile(
+        chunk.coord, [](const uint8_t *blob, size_t size) {
+            glBufferSubData(GL_ARRAY_BUFFER, 0, (GLsizeiptr)size, blob);
+        });
+
+    if (!found) {
+        release_slot(slot);
+        return;
+    }
+
+    add_loaded(
+        chunk.coord,
+        slot,
+        std::move(chunk.heights),
+        std::move(chunk.bounds),
+        chunk.far_indices,
+        std::move(chunk.trees));
+}
+
+ChunkManager::CachedChunk ChunkManager::read_cached(ChunkCoord coord) const {
+    CachedChunk chunk;
+    chunk.coord = coord;
+    chunk.heights = Heightfield(CHUNK_SAMPLES, CHUNK_SAMPLES);
+
+    // Raw tiles don't store a pyramid; keep a copy of the heights to
+    // build one from
+    Heightfield &heights = chunk.heights;
+    chunk.found = cache->with_tile(
+        coord, [&heights](const uint8_t *blob, size_t) {
+            std::memcpy(
+                heights.data(),
+                blob + CHUNK_HEIGHTS_OFFSET,
+                CHUNK_VERTICES * sizeof(float));
+        });
+
+    // Nor a simplified mesh or trees
+    if (chunk.found) {
+        chunk.bounds = MinMaxPyramid(heights);
+        simplify(heights, chunk.far_indices);
+        scatter.place(coord, heights, chunk.trees);
+    }
+    return chunk;
+}
+
+void ChunkManager::add_loaded(
+    ChunkCoord coord,
+    GpuSlot slot,
+    Heightfield heights,
+    MinMaxPyramid bounds,
+    const vector<uint32_t> &far_indices,
+    vector<TreeInstance> trees) {
+    // Not through the element array target, which would change
+    // whatever VAO is bound
+    glBindBuffer(GL_COPY_WRITE_BUFFER, slot.far_buffer);
+    glBufferData(
+        GL_COPY_WRITE_BUFFER,
+        (GLsizeiptr)(far_indices.size() * sizeof(uint32_t)),
+        far_indices.data(),
+        GL_STATIC_DRAW);
+
+    // Grid positions are in samples; scale them out to world units and
+    // move the chunk into place
+    float spacing = builder.get_params().spacing;
+    vec2 origin = builder.get_origin(coord);
+
+    LoadedChunk chunk;
+    chunk.slot = slot;
+    chunk.model = glm::translate(mat4(1.0f), vec3(origin.x, 0.0f, origin.y));
+    chunk.model = glm::scale(chunk.model, vec3(spacing, 1.0f, spacing));
+    chunk.model_inv_transp = glm::transpose(glm::inverse(chunk.model));
+
+    float size = builder.get_chunk_size();
+    vec2 height_range = bounds.get_range();
+    chunk.box_min = vec3(origin.x, height_range.x, origin.y);
+    chunk.box_max = vec3(origin.x + size, height_range.y, origin.y + size);
+
+    chunk.far_elements = (GLsizei)far_indices.size();
+
+    chunk.heights = std::move(heights);
+    chunk.bounds = std::move(bounds);
+
+    take_forest_trees(coord, chunk.heights, trees);
+    remove_burnt_trees(trees);
+    loaded[coord] = std::move(chunk);
+    tree_grid.insert(coord, std::move(trees));
+}
+
+void ChunkManager::set_forest(const ForestSimulator *f) {
+    forest = f;
+
+    vector<std::pair<ChunkCoord, vector<TreeInstance>>> batch;
+    for (const auto &entry : loaded) {
+        vector<TreeInstance> trees;
+        scatter.place(entry.first, entry.second.heights, trees);
+        take_forest_trees(entry.first, entry.second.heights, trees);
+        remove_burnt_trees(trees);
+        batch.emplace_back(entry.first, std::move(trees));
+    }
+    tree_grid.insert_all(std::move(batch));
+}
+
+void ChunkManager::set_fire(const WildfireSimulator *f) {
+    fire = f;
+
+    // The fire may have burnt for a while already
+    remove_burnt_chunk_trees(false);
+}
+
+void ChunkManager::remove_burnt_chunk_trees(bool only_caught) {
+    if (!fire) {
+        return;
+    }
+
+    auto burnt = [this](const TreeInstance &tree) {
+        return fire->has_burnt(vec2(tree.position.x, tree.position.z));
+    };
+
+    vector<std::pair<ChunkCoord, vector<TreeInstance>>> batch;
+    for (const auto &entry : loaded) {
+        vec2 origin = builder.get_origin(entry.first);
+        vec2 end = origin + vec2(builder.get_chunk_size());
+        if (only_caught && !fire->caught_fire(origin, end)) {
+            continue;
+        }
+
+        const vector<TreeInstance> *standing = tree_grid.find(entry.first);
+        if (!standing ||
+            std::none_of(standing->begin(), standing->end(), burnt)) {
+            continue;
+        }
+
+        vector<TreeInstance> trees = *standing;
+        remove_burnt_trees(trees);
+        batch.emplace_back(entry.first, std::move(trees));
+    }
+
+    if (!batch.empty()) {
+        tree_grid.insert_all(std::move(batch));
+    }
+}
+
+void ChunkManager::take_forest_trees(
+    ChunkCoord coord,
+    const Heightfield &heights,
+    vector<TreeInstance> &trees) const {
+    vec2 origin = builder.get_origin(coord);
+    vec2 end = origin + vec2(builder.get_chunk_size());
+    if (!forest || !forest->covers(origin, end)) {
+        return;
+    }
+
+    // The forest only knows the ground roughly
+    forest->collect(origin, end, trees);
+    float inv_spacing = 1.0f / builder.get_params().spacing;
+    for (TreeInstance &tree : trees) {
+        tree.position.y = heights.sample(
+            (tree.position.x - origin.x) * inv_spacing,
+            (tree.position.z - origin.y) * inv_spacing);
+    }
+}
+
+bool ChunkManager::remove_burnt_trees(vector<TreeInstance> &trees) const {
+    if (!fire) {
+        return false;
+    }
+
+    size_t count = trees.size();
+    trees.erase(
+        std::remove_if(
+            trees.begin(),
+            trees.end(),
+            [this](const TreeInstance &tree) {
+                return fire->has_burnt(
+                    vec2(tree.position.x, tree.position.z));
+            }),
+        trees.end());
+    return trees.size() != count;
+}
+
+ChunkManager::GpuSlot ChunkManager::acquire_slot() {
+    if (!free_slots.empty()) {
+        GpuSlot slot = free_slots.back();
+        free_slots.pop_back();
+        return slot;
+    }
+
+    GpuSlot slot;
+    glGenVertexArrays(1, &slot.vao);
+    glBindVertexArray(slot.vao);
+
+    // Grid position (x, y, 0) of each sample, shared by all chunks
+    glBindBuffer(GL_ARRAY_BUFFER, grid_buffer);
+    GLuint pos_attrib = 0;
+    glEnableVertexAttribArray(pos_attrib);
+    glVertexAttribPointer(
+        pos_attrib, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (char *)nullptr + 0);
+
+    glGenBuffers(1, &slot.buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, slot.buffer);
+    glBufferData(
+        GL_ARRAY_BUFFER, (GLsizeiptr)CHUNK_BLOB_BYTES, nullptr, GL_STATIC_DRAW);
+
+    GLuint norm_attrib = 1;
+    glEnableVertexAttribArray(norm_attrib);
+    glVertexAttribPointer(
+        norm_attrib,
+        3,
+        GL_FLOAT,
+        GL_FALSE,
+        sizeof(vec3),
+        (char *)nullptr + CHUNK_NORMALS_OFFSET);
+
+    GLuint height_attrib = 2;
+    glEnableVertexAttribArray(height_attrib);
+    glVertexAttribPointer(
+        height_attrib,
+        1,
+        GL_FLOAT,
+        GL_FALSE,
+        sizeof(float),
+        (char *)nullptr + CHUNK_HEIGHTS_OFFSET);
+
+    GLuint splat_attrib = 3;
+    glEnableVertexAttribArray(splat_attrib);
+    glVertexAttribPointer(
+        splat_attrib,
+        4,
+        GL_UNSIGNED_BYTE,
+        GL_TRUE,
+        sizeof(uint32_t),
+        (char *)nullptr + CHUNK_SPLAT_OFFSET);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+    glBindVertexArray(0);
+
+    glGenTextures(1, &slot.texture);
+    glBindTexture(GL_TEXTURE_BUFFER, slot.texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, slot.buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+    glGenBuffers(1, &slot.far_buffer);
+
+    return slot;
+}
+
+void ChunkManager::simplify(
+    const Heightfield &heights,
+    vector<uint32_t> &indices) const {
+    vector<float> errors;
+    rtin.compute_errors(heights, errors);
+    rtin.extract(errors, params.far_error, indices);
+}
+
+void ChunkManager::release_slot(GpuSlot slot) {
+    // Never more slots than were loaded at once, so just keep them
+    free_slots.push_back(slot);
+}
+
+void ChunkManager::wait_for_builds() {
+    for (auto &entry : building) {
+        entry.second.wait();
+    }
+    building.clear();
+
+    for (auto &entry : reading) {
+        entry.second.wait();
+    }
+    reading.clear();
+}
@@ -0,0 +1,360 @@
+#pragma once
+
+#include "chunk.hpp"
+#include "collision.hpp"
+#include "instance_grid.hpp"
+#include "rtin.hpp"
+#include "tree_scatter.hpp"
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <future>
+#include <unordered_map>
+#include <vector>
+
+using glm::mat4;
+using glm::vec2;
+using glm::vec3;
+
+typedef unsigned int GLuint;
+typedef int GLint;
+typedef int GLsizei;
+
+class ForestSimulator;
+class Frustum;
+class ThreadPool;
+class TileCache;
+class WildfireSimulator;
+
+/**
+ * Keeps a square ring of terrain chunks loaded around the camera.
+ *
+ * Missing chunks are built on the thread pool, nearest first, and
+ * uploaded to the GPU a few per frame on the GL thread, so a quickly
+ * moving camera never causes a long frame. Chunks that fall outside
+ * the ring (plus some slack, so we don't thrash on a boundary) are
+ * released and their GPU buffers recycled. Memory use is bounded by
+ * the ring size plus the number of chunks allowed in flight.
+ *
+ * With a tile cache, chunks built once are stored in it, and later
+ * visits upload them straight from the cache (or, for a compressed
+ * cache, decode them on the thread pool) instead of rebuilding. What
+ * a raw tile doesn't hold is still made on the thread pool.
+ *
+ * Every chunk also gets an error-bounded RTIN mesh over its samples,
+ * drawn instead of the full grid once the chunk is a few chunks away
+ * from the camera. Both index the same vertex buffer, so switching
+ * between them is free.
+ *
+ * Trees are scattered over each chunk as it's built, on the thread
+ * pool too, and kept in an instance grid while it's loaded, for
+ * culling and neighbour lookups. Chunks a simulated forest covers
+ * take its trees instead, and trees a wildfire has burnt are left out.
+ */
+class ChunkManager {
+public:
+    struct Params {
+        // Chunks loaded in each direction from the camera's chunk
+        int view_radius = 8;
+
+        // Extra distance, in chunks, before a loaded chunk is released
+        int unload_margin = 1;
+
+        // Most chunks uploaded to the GPU in a single update()
+        size_t uploads_per_frame = 4;
+
+        // Most chunks being built or waiting for upload at once, or 0
+        // for twice the number of worker threads
+        size_t max_pending = 0;
+
+        // Chunks further than this from the camera's chunk are drawn
+        // with a simplified mesh
+        int near_radius = 2;
+
+        // Vertical error allowed in the simplified meshes, in world
+        // units
+        float far_error = 0.1f;
+
+        TreeScatter::Params trees;
+    };
+
+    ChunkManager(ThreadPool &p, const ChunkBuilder &b) :
+        ChunkManager(p, b, nullptr, Params()) {}
+
+    /**
+     * @param cache: where built chunks are persisted and looked up, or
+     * nullptr to always build
+     */
+    ChunkManager(
+        ThreadPool &pool,
+        const ChunkBuilder &builder,
+        TileCache *cache,
+        Params p);
+
+    ~ChunkManager();
+
+    ChunkManager(const ChunkManager &) = delete;
+    ChunkManager &operator=(const ChunkManager &) = delete;
+
+    /**
+     * Create the GPU state shared by all chunks. Needs a GL context.
+     */
+    void init();
+
+    /**
+     * Free all GPU state, after waiting for any chunks still being
+     * built.
+     */
+    void cleanup();
+
+    /**
+     * Release far chunks, upload finished ones, and start building
+     * missing ones around the camera position.
+     */
+    void update(vec3 camera_pos);
+
+    /**
+     * Draw every loaded chunk in the view frustum with the currently
+     * bound program.
+     *
+     * @param model_loc: uniform location of the model matrix
+     * @param model_inv_transp_loc: uniform location of its inverse
+     * transpose, for the normals
+     */
+    void draw(
+        const Frustum &frustum,
+        GLint model_loc,
+        GLint model_inv_transp_loc) const;
+
+    /**
+     * Height of the loaded terrain at a world XZ position.
+     *
+     * @return false if the chunk there isn't loaded
+     */
+    bool height_at(vec2 xz, float &height) const;
+
+    /**
+     * A loaded chunk's vertex data blob on the GPU, as a buffer texture
+     * of R32UI texels, for shaders to read the terrain without a copy
+     * of it: the heights' float bits from texel 0, and the splat
+     * weights from texel CHUNK_SPLAT_OFFSET / 4.
+     *
+     * @param box_min, box_max: set to the chunk's world space bounds
+     * @return false if the chunk isn't loaded
+     */
+    bool get_vertex_texture(
+        ChunkCoord coord,
+        GLuint &texture,
+        vec3 &box_min,
+        vec3 &box_max) const;
+
+    /**
+     * Sweep a sphere against the loaded chunks along its path, see
+     * HeightfieldCollider::sweep_sphere(). Chunks that aren't loaded
+     * are empty space.
+     */
+    bool sweep_sphere(vec3 start, vec3 end, float radius, SphereHit &hit)
+        const;
+
+    /**
+     * Cast a ray against the loaded chunks, see
+     * HeightfieldCollider::raycast(). Visits the chunks under the ray
+     * in order, so it stops at the first one that's hit.
+     */
+    bool raycast(vec3 start, vec3 dir, float max_distance, RayHit &hit)
+        const;
+
+    size_t get_loaded_count() const {
+        return loaded.size();
+    }
+
+    size_t get_pending_count() const {
+        return building.size() + reading.size() + ready.size() +
+               cached.size();
+    }
+
+    /**
+     * Take the trees of every chunk the forest wholly covers from it,
+     * stood on the chunk's own heights, rather than scattering them;
+     * loaded chunks change over at once. The forest must stay alive
+     * until it's replaced, or until cleanup(). nullptr goes back to
+     * scattering.
+     */
+    void set_forest(const ForestSimulator *f);
+
+    /**
+     * Leave out the trees standing where a fire has burnt, in the
+     * loaded chunks and in any loaded later. The fire must stay alive
+     * until it's replaced, or until cleanup(). nullptr keeps every
+     * tree.
+     */
+    void set_fire(const WildfireSimulator *f);
+
+    /**
+     * Take out the loaded trees where the fire caught during its last
+     * step(), or was ignited since. Call it after each.
+     */
+    void burn_trees() {
+        remove_burnt_chunk_trees(true);
+    }
+
+    size_t get_tree_count() const {
+        return tree_grid.size();
+    }
+
+    /**
+     * The trees of the loaded chunks.
+     */
+    const InstanceGrid &get_tree_grid() const {
+        return tree_grid;
+    }
+
+private:
+    // A VAO plus the buffer holding one chunk's vertex data blob, a
+    // buffer texture over it, and the indices of its simplified mesh
+    struct GpuSlot {
+        GLuint vao;
+        GLuint buffer;
+        GLuint texture;
+        GLuint far_buffer;
+    };
+
+    // A chunk found in a raw tile, with what the tile doesn't hold. Its
+    // vertex data goes from the tile to the GPU on upload.
+    struct CachedChunk {
+        ChunkCoord coord;
+
+        // False if the tile has gone from the cache in the meantime
+        bool found;
+
+        Heightfield heights;
+        MinMaxPyramid bounds;
+        vector<uint32_t> far_indices;
+        vector<TreeInstance> trees;
+    };
+
+    struct LoadedChunk {
+        GpuSlot slot;
+        mat4 model;
+        mat4 model_inv_transp;
+
+        // World space bounding box, for culling
+        vec3 box_min;
+        vec3 box_max;
+
+        GLsizei far_elements;
+
+        // Kept on the CPU for collision queries
+        Heightfield heights;
+        MinMaxPyramid bounds;
+    };
+
+    ThreadPool &pool;
+    const ChunkBuilder &builder;
+    TileCache *cache;
+    Params params;
+
+    // Set once storing to the cache has failed, e.g. on a full disk;
+    // chunks are still built, just no longer stored
+    std::atomic<bool> cache_failed{false};
+
+    // Simplifies chunks for drawing them from far away
+    Rtin rtin;
+
+    TreeScatter scatter;
+
+    InstanceGrid tree_grid;
+
+    const ForestSimulator *forest = nullptr;
+    const WildfireSimulator *fire = nullptr;
+
+    // Where the camera was at the last update()
+    ChunkCoord camera_chunk = {0, 0};
+
+    // Offsets from the camera's chunk that should be loaded, nearest
+    // first
+    vector<ChunkCoord> ring;
+
+    std::unordered_map<ChunkCoord, LoadedChunk, ChunkCoordHash> loaded;
+    std::unordered_map<ChunkCoord, std::future<ChunkData>, ChunkCoordHash>
+        building;
+    vector<ChunkData> ready;
+
+    // Chunks found in the cache, being read on the thread pool and then
+    // waiting for upload
+    std::unordered_map<ChunkCoord, std::future<CachedChunk>, ChunkCoordHash>
+        reading;
+    vector<CachedChunk> cached;
+
+    // Released slots, reused before creating new ones
+    vector<GpuSlot> free_slots;
+
+    GLuint grid_buffer = 0;
+    GLuint index_buffer = 0;
+    GLsizei num_elements = 0;
+
+    bool in_range(ChunkCoord coord, ChunkCoord center, int radius) const;
+
+    bool is_requested(ChunkCoord coord) const;
+
+    void upload(ChunkData &&data);
+
+    void upload_cached(CachedChunk &&chunk);
+
+    /**
+     * Read a chunk from its raw tile, and make what the tile doesn't
+     * hold. Safe to call from any thread.
+     */
+    CachedChunk read_cached(ChunkCoord coord) const;
+
+    /**
+     * Replace a chunk's trees with the forest's, if it covers the
+     * chunk.
+     */
+    void take_forest_trees(
+        ChunkCoord coord,
+        const Heightfield &heights,
+        vector<TreeInstance> &trees) const;
+
+    /**
+     * Drop the trees standing where the fire has burnt.
+     *
+     * @return whether any were dropped
+     */
+    bool remove_burnt_trees(vector<TreeInstance> &trees) const;
+
+    /**
+     * Drop the loaded trees standing where the fire has burnt, putting
+     * only the chunks that lost any back in the grid.
+     *
+     * @param only_caught: only look at chunks the fire has just
+     * reached, see WildfireSimulator::caught_fire()
+     */
+    void remove_burnt_chunk_trees(bool only_caught);
+
+    void add_loaded(
+        ChunkCoord coord,
+        GpuSlot slot,
+        Heightfield heights,
+        MinMaxPyramid bounds,
+        const vector<uint32_t> &far_indices,
+        vector<TreeInstance> trees);
+
+    /**
+     * Triangulate a chunk's heights for drawing it from far away, see
+     * Params::far_error. Safe to call from any thread.
+     */
+    void simplify(const Heightfield &heights, vector<uint32_t> &indices)
+        const;
+
+    HeightfieldCollider get_collider(
+        ChunkCoord coord,
+        const LoadedChunk &chunk) const;
+
+    GpuSlot acquire_slot();
+
+    void release_slot(GpuSlot slot);
+
+    void wait_for_builds();
+};
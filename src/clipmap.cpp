@@ -0,0 +1,382 @@
+#include "clipmap.hpp"
+
+#include "generator.hpp"
+#include "thread_pool.hpp"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+// Rounds towards negative infinity, unlike integer division
+static int floor_div(int a, int b) {
+    int q = a / b;
+    return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+static ivec2 floor_div(ivec2 a, int b) {
+    return ivec2(floor_div(a.x, b), floor_div(a.y, b));
+}
+
+static int wrap(int i, int size) {
+    return i - (floor_div(i, size) * size);
+}
+
+ClipmapTerrain::ClipmapTerrain(
+    ThreadPool &p,
+    const TerrainGenerator &gen,
+    float sample_spacing,
+    Params prm) :
+    pool(p),
+    generator(gen),
+    spacing(sample_spacing),
+    params(prm) {
+    unsigned int t = params.texture_size;
+    if (params.levels == 0 || params.levels > 16) {
+        throw std::invalid_argument("clipmaps need between 1 and 16 levels");
+    }
+    if (params.half_quads == 0 || params.half_quads % 4 != 0) {
+        throw std::invalid_argument(
+            "clipmap ring size must be a positive multiple of 4");
+    }
+    if (params.transition == 0 || params.transition >= params.half_quads / 2) {
+        throw std::invalid_argument("clipmap transition band is too wide");
+    }
+
+    // Rings, plus a sample either side for normals, must fit without
+    // wrapping onto themselves
+    if ((t & (t - 1)) != 0 || t < (2 * params.half_quads) + 4) {
+        throw std::invalid_argument(
+            "clipmap texture size must be a power of two larger than the "
+            "rings");
+    }
+
+    levels.resize(params.levels);
+}
+
+void ClipmapTerrain::init() {
+    // One grid for every level. Level 0 draws all of it; the others
+    // leave a hole for the level inside them, which sits either
+    // centred or one quad further along X and/or Z depending on how
+    // the two levels snapped to the camera.
+    const unsigned int quads = 2 * params.half_quads;
+    const unsigned int n = quads + 1;
+    const unsigned int hole = params.half_quads;
+
+    vector<vec3> vertices;
+    for (unsigned int y = 0; y < n; ++y) {
+        for (unsigned int x = 0; x < n; ++x) {
+            vertices.push_back(vec3(x, y, 0.0f));
+        }
+    }
+
+    vector<unsigned int> indices;
+    for (unsigned int mesh = 0; mesh < 5; ++mesh) {
+        mesh_first.push_back(indices.size());
+
+        unsigned int hole_x = (hole / 2) + ((mesh - 1) & 1);
+        unsigned int hole_y = (hole / 2) + ((mesh - 1) >> 1);
+
+        for (unsigned int y = 0; y < quads; ++y) {
+            for (unsigned int x = 0; x < quads; ++x) {
+                bool in_hole = mesh > 0 && x >= hole_x &&
+                               x < hole_x + hole && y >= hole_y &&
+                               y < hole_y + hole;
+                if (in_hole) {
+                    continue;
+                }
+
+                // Same triangulation as Plane
+                indices.push_back((y * n) + x);
+                indices.push_back((y * n) + (x + 1));
+                indices.push_back(((y + 1) * n) + (x + 1));
+
+                indices.push_back((y * n) + x);
+                indices.push_back(((y + 1) * n) + x);
+                indices.push_back(((y + 1) * n) + (x + 1));
+            }
+        }
+
+        mesh_count.push_back(indices.size() - mesh_first.back());
+    }
+
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+
+    glGenBuffers(1, &vertex_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+    glBufferData(
+        GL_ARRAY_BUFFER,
+        (GLsizeiptr)(vertices.size() * sizeof(vec3)),
+        vertices.data(),
+        GL_STATIC_DRAW);
+
+    GLuint pos_attrib = 0;
+    glEnableVertexAttribArray(pos_attrib);
+    glVertexAttribPointer(
+        pos_attrib, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), (char *)nullptr + 0);
+
+    glGenBuffers(1, &index_buffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+    glBufferData(
+        GL_ELEMENT_ARRAY_BUFFER,
+        (GLsizeiptr)(indices.size() * sizeof(unsigned int)),
+        indices.data(),
+        GL_STATIC_DRAW);
+
+    glBindVertexArray(0);
+
+    // Repeating textures make the toroidal addressing free, including
+    // for linear filtering across the seam
+    GLsizei size = (GLsizei)params.texture_size;
+    GLsizei layers = (GLsizei)params.levels;
+
+    glGenTextures(1, &height_texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, height_texture);
+    glTexImage3D(
+        GL_TEXTURE_2D_ARRAY,
+        0,
+        GL_R32F,
+        size,
+        size,
+        layers,
+        0,
+        GL_RED,
+        GL_FLOAT,
+        nullptr);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+    glGenTextures(1, &splat_texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, splat_texture);
+    glTexImage3D(
+        GL_TEXTURE_2D_ARRAY,
+        0,
+        GL_RGBA8,
+        size,
+        size,
+        layers,
+        0,
+        GL_RGBA,
+        GL_UNSIGNED_BYTE,
+        nullptr);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    for (Level &level : levels) {
+        level.valid = false;
+    }
+}
+
+void ClipmapTerrain::cleanup() {
+    glDeleteTextures(1, &splat_texture);
+    glDeleteTextures(1, &height_texture);
+    glDeleteBuffers(1, &index_buffer);
+    glDeleteBuffers(1, &vertex_buffer);
+    glDeleteVertexArrays(1, &vao);
+}
+
+void ClipmapTerrain::update(vec3 camera_pos) {
+    const int t = (int)params.texture_size;
+    const int half = (int)params.half_quads;
+
+    // The camera's sample at the finest level. Every level is snapped
+    // from this, so they always nest exactly.
+    ivec2 finest(
+        (int)std::floor(camera_pos.x / spacing),
+        (int)std::floor(camera_pos.z / spacing));
+
+    updated_samples = 0;
+
+    for (size_t l = 0; l < levels.size(); ++l) {
+        Level &level = levels[l];
+
+        // Rings are centred on an even sample of their own level,
+        // i.e. on a sample of the next coarser one
+        ivec2 camera = floor_div(finest, 1 << l);
+        ivec2 center = floor_div(finest, 2 << l) * 2;
+
+        level.ring_origin = center - half;
+        level.mesh = (l == 0) ? 0
+                              : (size_t)(1 + (camera.x - center.x) +
+                                         (2 * (camera.y - center.y)));
+
+        ivec2 origin = center - (t / 2);
+        ivec2 old = level.region_origin;
+        ivec2 moved = glm::abs(origin - old);
+
+        if (!level.valid || moved.x >= t || moved.y >= t) {
+            update_region(l, origin, ivec2(t, t));
+        } else if (moved.x != 0 || moved.y != 0) {
+            // Columns that came into view, down the whole new region
+            if (origin.x > old.x) {
+                update_region(l, ivec2(old.x + t, origin.y), ivec2(moved.x, t));
+            } else if (origin.x < old.x) {
+                update_region(l, origin, ivec2(moved.x, t));
+            }
+
+            // Rows that came into view, apart from those columns
+            int x0 = std::max(origin.x, old.x);
+            int x1 = std::min(origin.x, old.x) + t;
+            if (origin.y > old.y) {
+                update_region(
+                    l, ivec2(x0, old.y + t), ivec2(x1 - x0, moved.y));
+            } else if (origin.y < old.y) {
+                update_region(l, ivec2(x0, origin.y), ivec2(x1 - x0, moved.y));
+            }
+        }
+
+        level.region_origin = origin;
+        level.valid = true;
+    }
+}
+
+void ClipmapTerrain::draw(GLint node_loc, GLint clipmap_info_loc) const {
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, height_texture);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, splat_texture);
+    glActiveTexture(GL_TEXTURE0);
+
+    glUniform4f(
+        clipmap_info_loc,
+        1.0f / (float)params.texture_size,
+        (float)params.half_quads,
+        (float)params.transition,
+        (float)(levels.size() - 1));
+
+    glBindVertexArray(vao);
+
+    for (size_t l = 0; l < levels.size(); ++l) {
+        const Level &level = levels[l];
+        float s = get_level_spacing(l);
+
+        glUniform4f(
+            node_loc,
+            (float)level.ring_origin.x * s,
+            (float)level.ring_origin.y * s,
+            s,
+            (float)l);
+
+        glDrawElements(
+            GL_TRIANGLES,
+            (GLsizei)mesh_count[level.mesh],
+            GL_UNSIGNED_INT,
+            (char *)nullptr + (mesh_first[level.mesh] * sizeof(unsigned int)));
+    }
+
+    glBindVertexArray(0);
+}
+
+float ClipmapTerrain::get_extent() const {
+    return (float)params.half_quads * get_level_spacing(levels.size() - 1);
+}
+
+void ClipmapTerrain::update_region(size_t level, ivec2 first, ivec2 size) {
+    if (size.x <= 0 || size.y <= 0) {
+        return;
+    }
+
+    const float s = get_level_spacing(level);
+    const size_t w = (size_t)size.x;
+    const size_t h = (size_t)size.y;
+
+    // One extra sample all around, for the normals
+    const size_t pw = w + 2;
+    vector<float> padded(pw * (h + 2));
+    pool.parallel_for(0, h + 2, [&](size_t row) {
+        float z = (float)(first.y + (int)row - 1) * s;
+        for (size_t col = 0; col < pw; ++col) {
+            float x = (float)(first.x + (int)col - 1) * s;
+            padded[(row * pw) + col] = generator.height_at(x, z);
+        }
+    });
+
+    vector<float> heights(w * h);
+    vector<uint32_t> splat(w * h);
+    pool.parallel_for(0, h, [&](size_t y) {
+        const float *above = &padded[y * pw];
+        const float *row = above + pw;
+        const float *below = row + pw;
+
+        for (size_t x = 0; x < w; ++x) {
+            float height = row[x + 1];
+            vec3 normal = glm::normalize(vec3(
+                row[x] - row[x + 2], 2.0f * s, above[x + 1] - below[x + 1]));
+
+            heights[(y * w) + x] = height;
+            splat[(y * w) + x] = generator.splat_weights(height, normal);
+        }
+    });
+
+    // The rectangle wraps around the layer's edges, so it can land in
+    // up to four pieces
+    const int t = (int)params.texture_size;
+    int tx = wrap(first.x, t);
+    int ty = wrap(first.y, t);
+    int first_w = std::min(size.x, t - tx);
+    int first_h = std::min(size.y, t - ty);
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, size.x);
+    for (int py = 0; py < 2; ++py) {
+        int rows = (py == 0) ? first_h : size.y - first_h;
+        if (rows == 0) {
+            continue;
+        }
+
+        for (int px = 0; px < 2; ++px) {
+            int cols = (px == 0) ? first_w : size.x - first_w;
+            if (cols == 0) {
+                continue;
+            }
+
+            glPixelStorei(GL_UNPACK_SKIP_PIXELS, (px == 0) ? 0 : first_w);
+            glPixelStorei(GL_UNPACK_SKIP_ROWS, (py == 0) ? 0 : first_h);
+
+            GLint dst_x = (px == 0) ? tx : 0;
+            GLint dst_y = (py == 0) ? ty : 0;
+
+            glBindTexture(GL_TEXTURE_2D_ARRAY, height_texture);
+            glTexSubImage3D(
+                GL_TEXTURE_2D_ARRAY,
+                0,
+                dst_x,
+                dst_y,
+                (GLint)level,
+                cols,
+                rows,
+                1,
+                GL_RED,
+                GL_FLOAT,
+                heights.data());
+
+            glBindTexture(GL_TEXTURE_2D_ARRAY, splat_texture);
+            glTexSubImage3D(
+                GL_TEXTURE_2D_ARRAY,
+                0,
+                dst_x,
+                dst_y,
+                (GLint)level,
+                cols,
+                rows,
+                1,
+                GL_RGBA,
+                GL_UNSIGNED_BYTE,
+                splat.data());
+        }
+    }
+
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    updated_samples += w * h;
+}
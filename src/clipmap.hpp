@@ -0,0 +1,147 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+using glm::ivec2;
+using glm::vec2;
+using glm::vec3;
+
+using std::vector;
+
+typedef unsigned int GLuint;
+typedef int GLint;
+typedef int GLsizei;
+
+class TerrainGenerator;
+class ThreadPool;
+
+/**
+ * Geometry clipmap terrain: nested square rings of grid, centred on
+ * the camera, each with twice the sample spacing of the one inside
+ * it.
+ *
+ * Every level keeps its heights (and splat weights) in one layer of a
+ * texture array, addressed toroidally: world sample i of a level
+ * lives in texel i mod the texture size, and the texture repeats. As
+ * the camera moves, a level's window slides over the world, and only
+ * the L-shaped strip of samples it newly covers is generated and
+ * uploaded. What a frame costs depends on how far the camera moved,
+ * not on how far the terrain reaches.
+ *
+ * Near its outer edge, each level blends into the next coarser one in
+ * the vertex shader, so neighbouring levels meet without cracks.
+ */
+class ClipmapTerrain {
+public:
+    struct Params {
+        // Nested levels; level 0 is the finest
+        size_t levels = 8;
+
+        // Quads from the centre of each level's ring to its outer
+        // edge. Must be a multiple of 4.
+        unsigned int half_quads = 64;
+
+        // Width, in quads, of the band at the outside of every ring
+        // where it blends into the next level
+        unsigned int transition = 10;
+
+        // Texels along each side of every level's texture layer. A
+        // power of two larger than the ring.
+        unsigned int texture_size = 256;
+    };
+
+    /**
+     * @param spacing: world units between samples of the finest level
+     */
+    ClipmapTerrain(
+        ThreadPool &pool,
+        const TerrainGenerator &generator,
+        float spacing,
+        Params p);
+
+    ClipmapTerrain(const ClipmapTerrain &) = delete;
+    ClipmapTerrain &operator=(const ClipmapTerrain &) = delete;
+
+    /**
+     * Create the ring meshes and the texture arrays. Needs a GL
+     * context.
+     */
+    void init();
+
+    void cleanup();
+
+    /**
+     * Slide every level's window to follow the camera, uploading the
+     * samples that came into view.
+     */
+    void update(vec3 camera_pos);
+
+    /**
+     * Draw all levels with the currently bound program.
+     *
+     * @param node_loc: uniform location of a level's placement
+     * @param clipmap_info_loc: uniform location of the clipmap's
+     * shape
+     */
+    void draw(GLint node_loc, GLint clipmap_info_loc) const;
+
+    /**
+     * Distance from the camera to the outer edge of the coarsest
+     * level, in world units.
+     */
+    float get_extent() const;
+
+    /**
+     * Samples generated and uploaded by the last update().
+     */
+    size_t get_updated_samples() const {
+        return updated_samples;
+    }
+
+private:
+    struct Level {
+        // Sample index, in this level's spacing, of the first sample
+        // stored in its texture layer
+        ivec2 region_origin;
+        bool valid = false;
+
+        // Sample index of the ring's first vertex
+        ivec2 ring_origin;
+
+        // Which of the ring meshes to draw, see init()
+        size_t mesh;
+    };
+
+    ThreadPool &pool;
+    const TerrainGenerator &generator;
+    float spacing;
+    Params params;
+
+    vector<Level> levels;
+    size_t updated_samples = 0;
+
+    GLuint vao = 0;
+    GLuint vertex_buffer = 0;
+    GLuint index_buffer = 0;
+    GLuint height_texture = 0;
+    GLuint splat_texture = 0;
+
+    // First index and count of each ring mesh in the index buffer
+    vector<size_t> mesh_first;
+    vector<size_t> mesh_count;
+
+    float get_level_spacing(size_t level) const {
+        return spacing * (float)(1u << level);
+    }
+
+    /**
+     * Generate the samples of a rectangle of one level, in that
+     * level's sample indices, and upload them to where they wrap
+     * around to in its layer.
+     */
+    void update_region(size_t level, ivec2 first, ivec2 size);
+};
@@ -0,0 +1,606 @@
+#include "collision.hpp"
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+// Line of sight queries handed to a worker at a time
+static const size_t LINE_OF_SIGHT_BATCH = 256;
+
+// The cell containing a grid position, clamped into the heightfield,
+// and the position within it
+static inline size_t locate(float grid, size_t samples, float &fraction) {
+    grid = std::clamp(grid, 0.0f, (float)(samples - 1));
+    size_t cell = std::min((size_t)grid, samples - 2);
+    fraction = grid - (float)cell;
+    return cell;
+}
+
+// Earliest time in [0, max_t] where a quadratic a t^2 + b t + c
+// becomes 0 on its way down, i.e. where the sphere enters a shape
+// rather than leaves it
+static bool entering_root(float a, float b, float c, float max_t, float &t) {
+    if (std::abs(a) < 1e-12f) {
+        return false;
+    }
+
+    float det = (b * b) - (4.0f * a * c);
+    if (det < 0.0f) {
+        return false;
+    }
+
+    float s = std::sqrt(det);
+    float r1 = (-b - s) / (2.0f * a);
+    float r2 = (-b + s) / (2.0f * a);
+    if (r1 > r2) {
+        std::swap(r1, r2);
+    }
+
+    if (r1 < 0.0f || r1 > max_t) {
+        return false;
+    }
+
+    t = r1;
+    return true;
+}
+
+// Sphere of radius r moving from p by d against a single vertex
+static bool sweep_vertex(vec3 p, vec3 d, float r, vec3 v, float &t) {
+    vec3 rel = p - v;
+    float a = glm::dot(d, d);
+    float b = 2.0f * glm::dot(d, rel);
+    float c = glm::dot(rel, rel) - (r * r);
+    return entering_root(a, b, c, t, t);
+}
+
+// Same against the inside of an edge, as an infinite cylinder clipped
+// to the segment
+static bool sweep_edge(vec3 p, vec3 d, float r, vec3 e0, vec3 e1, float &t) {
+    vec3 edge = e1 - e0;
+    vec3 base = e0 - p;
+
+    float edge_sq = glm::dot(edge, edge);
+    float edge_dot_d = glm::dot(edge, d);
+    float edge_dot_base = glm::dot(edge, base);
+
+    float a = (edge_sq * -glm::dot(d, d)) + (edge_dot_d * edge_dot_d);
+    float b = (edge_sq * 2.0f * glm::dot(d, base)) -
+              (2.0f * edge_dot_d * edge_dot_base);
+    float c = (edge_sq * ((r * r) - glm::dot(base, base))) +
+              (edge_dot_base * edge_dot_base);
+
+    float root = t;
+    if (!entering_root(a, b, c, t, root)) {
+        return false;
+    }
+
+    float f = ((edge_dot_d * root) - edge_dot_base) / edge_sq;
+    if (f < 0.0f || f > 1.0f) {
+        return false;
+    }
+
+    t = root;
+    return true;
+}
+
+// Closest point to q on a segment
+static vec3 closest_on_segment(vec3 q, vec3 e0, vec3 e1) {
+    vec3 edge = e1 - e0;
+    float f = glm::dot(q - e0, edge) / glm::dot(edge, edge);
+    return e0 + (edge * std::clamp(f, 0.0f, 1.0f));
+}
+
+// Clip a ray's [t0, t1] to the slab lo <= o + d t <= hi on one axis
+static bool clip_slab(
+    float o,
+    float d,
+    float lo,
+    float hi,
+    float &t0,
+    float &t1) {
+    if (std::abs(d) < 1e-12f) {
+        return o >= lo && o <= hi;
+    }
+
+    float ta = (lo - o) / d;
+    float tb = (hi - o) / d;
+    if (ta > tb) {
+        std::swap(ta, tb);
+    }
+
+    t0 = std::max(t0, ta);
+    t1 = std::min(t1, tb);
+    return t0 <= t1;
+}
+
+// Distance along a ray to a triangle, if it hits it (Moller-Trumbore)
+static bool ray_triangle(vec3 o, vec3 d, vec3 a, vec3 b, vec3 c, float &t) {
+    vec3 e1 = b - a;
+    vec3 e2 = c - a;
+    vec3 pv = glm::cross(d, e2);
+
+    float det = glm::dot(e1, pv);
+    if (std::abs(det) < 1e-12f) {
+        return false;
+    }
+    float inv_det = 1.0f / det;
+
+    vec3 tv = o - a;
+    float u = glm::dot(tv, pv) * inv_det;
+    if (u < 0.0f || u > 1.0f) {
+        return false;
+    }
+
+    vec3 qv = glm::cross(tv, e1);
+    float v = glm::dot(d, qv) * inv_det;
+    if (v < 0.0f || u + v > 1.0f) {
+        return false;
+    }
+
+    t = glm::dot(e2, qv) * inv_det;
+    return true;
+}
+
+HeightfieldCollider::HeightfieldCollider(
+    const Heightfield &hf,
+    const MinMaxPyramid &pyramid,
+    vec2 world_origin,
+    float sample_spacing) :
+    heights(hf),
+    bounds(pyramid),
+    origin(world_origin),
+    spacing(sample_spacing),
+    inv_spacing(1.0f / sample_spacing) {}
+
+float HeightfieldCollider::height_at(vec2 xz) const {
+    vec2 grid = (xz - origin) * inv_spacing;
+
+    float fx;
+    float fy;
+    size_t x = locate(grid.x, heights.get_width(), fx);
+    size_t y = locate(grid.y, heights.get_height(), fy);
+
+    float h00 = heights.at(x, y);
+    float h11 = heights.at(x + 1, y + 1);
+    if (fx >= fy) {
+        float h10 = heights.at(x + 1, y);
+        return h00 + ((h10 - h00) * fx) + ((h11 - h10) * fy);
+    }
+
+    float h01 = heights.at(x, y + 1);
+    return h00 + ((h01 - h00) * fy) + ((h11 - h01) * fx);
+}
+
+vec3 HeightfieldCollider::normal_at(vec2 xz) const {
+    vec2 grid = (xz - origin) * inv_spacing;
+
+    float fx;
+    float fy;
+    size_t x = locate(grid.x, heights.get_width(), fx);
+    size_t y = locate(grid.y, heights.get_height(), fy);
+
+    float h00 = heights.at(x, y);
+    float h11 = heights.at(x + 1, y + 1);
+    float dx;
+    float dz;
+    if (fx >= fy) {
+        float h10 = heights.at(x + 1, y);
+        dx = h10 - h00;
+        dz = h11 - h10;
+    } else {
+        float h01 = heights.at(x, y + 1);
+        dx = h11 - h01;
+        dz = h01 - h00;
+    }
+
+    return glm::normalize(vec3(-dx, spacing, -dz));
+}
+
+bool HeightfieldCollider::sweep_sphere(
+    vec3 start,
+    vec3 end,
+    float radius,
+    SphereHit &hit) const {
+    Sweep sweep;
+    sweep.start = start;
+    sweep.delta = end - start;
+    sweep.radius = radius;
+    sweep.found = false;
+    sweep.t = 1.0f;
+
+    // Faces first: on terrain they're what a sphere usually lands on,
+    // and the contact found limits how far along the path the edges
+    // and corners can be, which makes the second pass over a smaller
+    // box
+    if (!clip_sweep(sweep)) {
+        return false;
+    }
+    sweep.edges = false;
+    sweep_blocks(sweep);
+
+    if (sweep.found) {
+        clip_sweep(sweep);
+    }
+    sweep.edges = true;
+    sweep_blocks(sweep);
+
+    if (!sweep.found) {
+        return false;
+    }
+
+    hit.t = sweep.t;
+    hit.position = start + (sweep.delta * sweep.t);
+    hit.normal = sweep.normal;
+    return true;
+}
+
+bool HeightfieldCollider::clip_sweep(Sweep &sweep) const {
+    vec3 end = sweep.start + (sweep.delta * sweep.t);
+    sweep.lo = glm::min(sweep.start, end) - sweep.radius;
+    sweep.hi = glm::max(sweep.start, end) + sweep.radius;
+
+    vec2 grid_lo = (vec2(sweep.lo.x, sweep.lo.z) - origin) * inv_spacing;
+    vec2 grid_hi = (vec2(sweep.hi.x, sweep.hi.z) - origin) * inv_spacing;
+
+    size_t cells_x = bounds.get_width(0);
+    size_t cells_y = bounds.get_height(0);
+    if (grid_hi.x < 0.0f || grid_hi.y < 0.0f ||
+        grid_lo.x >= (float)cells_x || grid_lo.y >= (float)cells_y) {
+        return false;
+    }
+
+    sweep.x0 = (size_t)std::max(grid_lo.x, 0.0f);
+    sweep.y0 = (size_t)std::max(grid_lo.y, 0.0f);
+    sweep.x1 = std::min((size_t)grid_hi.x, cells_x - 1);
+    sweep.y1 = std::min((size_t)grid_hi.y, cells_y - 1);
+    return true;
+}
+
+void HeightfieldCollider::sweep_blocks(Sweep &sweep) const {
+    // Start from the level where the sweep covers at most 2x2 blocks
+    size_t extent = std::max(sweep.x1 - sweep.x0, sweep.y1 - sweep.y0) + 1;
+    size_t level = 0;
+    while (((size_t)1 << level) < extent &&
+           level + 1 < bounds.get_level_count()) {
+        ++level;
+    }
+
+    for (size_t y = sweep.y0 >> level; y <= sweep.y1 >> level; ++y) {
+        for (size_t x = sweep.x0 >> level; x <= sweep.x1 >> level; ++x) {
+            sweep_block(level, x, y, sweep);
+        }
+    }
+}
+
+void HeightfieldCollider::sweep_block(
+    size_t level,
+    size_t x,
+    size_t y,
+    Sweep &sweep) const {
+    // Skip blocks whose surface lies wholly above or below the path
+    vec2 range = bounds.at(level, x, y);
+    if (range.y < sweep.lo.y || range.x > sweep.hi.y) {
+        return;
+    }
+
+    if (level == 0) {
+        if (sweep.edges) {
+            sweep_edges(x, y, sweep);
+        } else {
+            sweep_faces(x, y, sweep);
+        }
+        return;
+    }
+
+    size_t child = level - 1;
+    size_t cx0 = std::max(2 * x, sweep.x0 >> child);
+    size_t cy0 = std::max(2 * y, sweep.y0 >> child);
+    size_t cx1 = std::min(
+        {(2 * x) + 1, sweep.x1 >> child, bounds.get_width(child) - 1});
+    size_t cy1 = std::min(
+        {(2 * y) + 1, sweep.y1 >> child, bounds.get_height(child) - 1});
+
+    for (size_t cy = cy0; cy <= cy1; ++cy) {
+        for (size_t cx = cx0; cx <= cx1; ++cx) {
+            sweep_block(child, cx, cy, sweep);
+        }
+    }
+}
+
+void HeightfieldCollider::sweep_faces(size_t x, size_t y, Sweep &sweep)
+    const {
+    vec3 p = sweep.start;
+    vec3 d = sweep.delta;
+    float r = sweep.radius;
+
+    vec3 v00 = get_vertex(x, y);
+    float h10 = heights.at(x + 1, y);
+    float h01 = heights.at(x, y + 1);
+    float h11 = heights.at(x + 1, y + 1);
+
+    // Both triangles are graphs over XZ, so a point on one's plane is
+    // inside it exactly when its XZ position is inside the triangle's
+    // half of the cell
+    for (int lower = 0; lower < 2; ++lower) {
+        // Upward normal, scaled by 1 / spacing
+        vec3 n = lower ? vec3(h01 - h11, spacing, v00.y - h01)
+                       : vec3(v00.y - h10, spacing, h10 - h11);
+        // Speed towards the plane and signed distance, scaled by len
+        float towards = glm::dot(n, d);
+        if (towards >= 0.0f) {
+            continue;
+        }
+
+        float len = glm::length(n);
+        float dist = glm::dot(p - v00, n);
+        if (dist < -r * len) {
+            continue;
+        }
+
+        // A sphere that starts out sunk into the plane touches it at
+        // once. Compare before dividing, most faces stop here.
+        float gap = std::max(dist - (r * len), 0.0f);
+        if (gap > -towards * sweep.t) {
+            continue;
+        }
+        float t = gap / -towards;
+
+        vec3 q = p + (d * t) - (n * (std::min(dist, r * len) / (len * len)));
+        float u = (q.x - v00.x) * inv_spacing;
+        float v = (q.z - v00.z) * inv_spacing;
+        bool inside = lower ? (u >= 0.0f && u <= v && v <= 1.0f)
+                            : (v >= 0.0f && v <= u && u <= 1.0f);
+        if (inside) {
+            sweep.t = t;
+            sweep.normal = n / len;
+            sweep.found = true;
+        }
+    }
+}
+
+void HeightfieldCollider::sweep_edges(size_t x, size_t y, Sweep &sweep)
+    const {
+    vec3 p = sweep.start;
+    vec3 d = sweep.delta;
+    float r = sweep.radius;
+
+    vec3 v00 = get_vertex(x, y);
+    vec3 v10 = get_vertex(x + 1, y);
+    vec3 v01 = get_vertex(x, y + 1);
+    vec3 v11 = get_vertex(x + 1, y + 1);
+
+    // Every edge and corner is shared, so each cell only tests its
+    // own: the first corner, and the edges leaving it. The last cell
+    // of the sweep in each direction also takes the far side. A cell
+    // skipped by the pyramid has all its corners out of the sweep's
+    // height range, so the features it owns can't be touched either.
+    // Features outside the box the sphere sweeps through are skipped
+    // before solving anything.
+    auto edge = [&](vec3 e0, vec3 e1) {
+        vec3 e_lo = glm::min(e0, e1);
+        vec3 e_hi = glm::max(e0, e1);
+        if (e_hi.x < sweep.lo.x || e_hi.y < sweep.lo.y ||
+            e_hi.z < sweep.lo.z || e_lo.x > sweep.hi.x ||
+            e_lo.y > sweep.hi.y || e_lo.z > sweep.hi.z) {
+            return;
+        }
+
+        float t = sweep.t;
+        if (sweep_edge(p, d, r, e0, e1, t)) {
+            vec3 center = p + (d * t);
+            sweep.t = t;
+            sweep.normal =
+                glm::normalize(center - closest_on_segment(center, e0, e1));
+            sweep.found = true;
+        }
+    };
+    auto corner = [&](vec3 v) {
+        if (v.x < sweep.lo.x || v.y < sweep.lo.y || v.z < sweep.lo.z ||
+            v.x > sweep.hi.x || v.y > sweep.hi.y || v.z > sweep.hi.z) {
+            return;
+        }
+
+        float t = sweep.t;
+        if (sweep_vertex(p, d, r, v, t)) {
+            sweep.t = t;
+            sweep.normal = glm::normalize(p + (d * t) - v);
+            sweep.found = true;
+        }
+    };
+
+    corner(v00);
+    edge(v00, v10);
+    edge(v00, v01);
+    edge(v00, v11);
+
+    bool last_x = (x == sweep.x1);
+    bool last_y = (y == sweep.y1);
+    if (last_x) {
+        corner(v10);
+        edge(v10, v11);
+    }
+    if (last_y) {
+        corner(v01);
+        edge(v01, v11);
+    }
+    if (last_x && last_y) {
+        corner(v11);
+    }
+}
+
+bool HeightfieldCollider::raycast(
+    vec3 start,
+    vec3 dir,
+    float max_distance,
+    RayHit &hit) const {
+    // The ray in grid units across and world units up, so that t is
+    // still a distance in world units
+    vec3 o(
+        (start.x - origin.x) * inv_spacing,
+        start.y,
+        (start.z - origin.y) * inv_spacing);
+    vec3 d(dir.x * inv_spacing, dir.y, dir.z * inv_spacing);
+
+    size_t cells_x = bounds.get_width(0);
+    size_t cells_y = bounds.get_height(0);
+    vec2 range = bounds.get_range();
+
+    float t0 = 0.0f;
+    float t1 = max_distance;
+    if (!clip_slab(o.x, d.x, 0.0f, (float)cells_x, t0, t1) ||
+        !clip_slab(o.z, d.z, 0.0f, (float)cells_y, t0, t1) ||
+        !clip_slab(o.y, d.y, range.x, range.y, t0, t1)) {
+        return false;
+    }
+
+    const size_t top = bounds.get_level_count() - 1;
+    size_t level = top;
+    size_t cx = 0;
+    size_t cz = 0;
+    float t = t0;
+
+    while (true) {
+        // Where the ray leaves the current block
+        float x_lo = (float)(cx << level);
+        float z_lo = (float)(cz << level);
+        float x_hi = (float)std::min((cx + 1) << level, cells_x);
+        float z_hi = (float)std::min((cz + 1) << level, cells_y);
+
+        float exit_x = FLT_MAX;
+        if (d.x > 0.0f) {
+            exit_x = (x_hi - o.x) / d.x;
+        } else if (d.x < 0.0f) {
+            exit_x = (x_lo - o.x) / d.x;
+        }
+        float exit_z = FLT_MAX;
+        if (d.z > 0.0f) {
+            exit_z = (z_hi - o.z) / d.z;
+        } else if (d.z < 0.0f) {
+            exit_z = (z_lo - o.z) / d.z;
+        }
+        float t_exit = std::min({exit_x, exit_z, t1});
+
+        // Could the ray meet the surface within this block?
+        float y_enter = o.y + (d.y * t);
+        float y_exit = o.y + (d.y * t_exit);
+        range = bounds.at(level, cx, cz);
+        bool overlaps = std::max(y_enter, y_exit) >= range.x &&
+                        std::min(y_enter, y_exit) <= range.y;
+
+        if (overlaps && level > 0) {
+            // Into the child block the ray is in at t
+            --level;
+            float mid_x = (float)(((2 * cx) + 1) << level);
+            float mid_z = (float)(((2 * cz) + 1) << level);
+            float gx = o.x + (d.x * t);
+            float gz = o.z + (d.z * t);
+            bool upper_x = gx > mid_x || (gx >= mid_x && d.x > 0.0f);
+            bool upper_z = gz > mid_z || (gz >= mid_z && d.z > 0.0f);
+            cx = std::min(
+                (2 * cx) + (upper_x ? 1 : 0), bounds.get_width(level) - 1);
+            cz = std::min(
+                (2 * cz) + (upper_z ? 1 : 0), bounds.get_height(level) - 1);
+            continue;
+        }
+
+        if (overlaps) {
+            // The triangles only cover this cell, so whatever they hit
+            // is nearer than anything in the cells still ahead
+            vec3 v00 = get_vertex(cx, cz);
+            vec3 v11 = get_vertex(cx + 1, cz + 1);
+            const vec3 corners[2] = {
+                get_vertex(cx + 1, cz), get_vertex(cx, cz + 1)};
+
+            float best = FLT_MAX;
+            vec3 normal(0.0f);
+            for (const vec3 &corner : corners) {
+                float t_hit;
+                if (ray_triangle(start, dir, v00, corner, v11, t_hit) &&
+                    t_hit >= 0.0f && t_hit <= max_distance && t_hit < best) {
+                    best = t_hit;
+                    normal =
+                        glm::normalize(glm::cross(corner - v00, v11 - v00));
+                }
+            }
+
+            if (best < FLT_MAX) {
+                hit.distance = best;
+                hit.position = start + (dir * best);
+                hit.normal = (normal.y < 0.0f) ? -normal : normal;
+                return true;
+            }
+        }
+
+        // On to the neighbour the ray leaves into
+        if (t_exit >= t1) {
+            return false;
+        }
+        t = t_exit;
+
+        size_t width = bounds.get_width(level);
+        size_t height = bounds.get_height(level);
+        size_t old_x = cx;
+        size_t old_z = cz;
+        if (exit_x <= exit_z) {
+            if (d.x < 0.0f ? cx == 0 : cx + 1 >= width) {
+                return false;
+            }
+            cx = (d.x < 0.0f) ? cx - 1 : cx + 1;
+        }
+        if (exit_z <= exit_x) {
+            if (d.z < 0.0f ? cz == 0 : cz + 1 >= height) {
+                return false;
+            }
+            cz = (d.z < 0.0f) ? cz - 1 : cz + 1;
+        }
+
+        // Climb as long as the step left the parent block, so open
+        // stretches are crossed in big steps
+        while (level < top &&
+               ((cx >> 1) != (old_x >> 1) || (cz >> 1) != (old_z >> 1))) {
+            ++level;
+            cx >>= 1;
+            cz >>= 1;
+            old_x >>= 1;
+            old_z >>= 1;
+        }
+    }
+}
+
+bool HeightfieldCollider::line_of_sight(vec3 from, vec3 to) const {
+    vec3 delta = to - from;
+    float length = glm::length(delta);
+    if (length <= 0.0f) {
+        return true;
+    }
+
+    RayHit hit;
+    return !raycast(from, delta / length, length, hit);
+}
+
+void HeightfieldCollider::line_of_sight(
+    ThreadPool &pool,
+    const vector<vec3> &from,
+    const vector<vec3> &to,
+    vector<uint8_t> &visible) const {
+    if (from.size() != to.size()) {
+        throw std::invalid_argument(
+            "line of sight needs as many end points as start points");
+    }
+
+    size_t count = from.size();
+    visible.assign(count, 0);
+
+    size_t batches = (count + LINE_OF_SIGHT_BATCH - 1) / LINE_OF_SIGHT_BATCH;
+    pool.parallel_for(0, batches, [&](size_t batch) {
+        size_t begin = batch * LINE_OF_SIGHT_BATCH;
+        size_t end = std::min(begin + LINE_OF_SIGHT_BATCH, count);
+        for (size_t i = begin; i < end; ++i) {
+            visible[i] = line_of_sight(from[i], to[i]) ? 1 : 0;
+        }
+    });
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include "heightfield.hpp"
+#include "minmax_pyramid.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+using glm::vec2;
+using glm::vec3;
+
+using std::vector;
+
+class ThreadPool;
+
+/**
+ * Where a swept sphere first touched the terrain.
+ */
+struct SphereHit {
+    // Fraction of the way from the start to the end of the sweep
+    float t;
+
+    // Centre of the sphere at the moment of contact
+    vec3 position;
+
+    // Unit vector from the touched point to the sphere's centre
+    vec3 normal;
+};
+
+/**
+ * Where a ray first hit the terrain.
+ */
+struct RayHit {
+    // Along the ray, in world units
+    float distance;
+
+    vec3 position;
+
+    // Of the triangle that was hit, pointing up
+    vec3 normal;
+};
+
+/**
+ * Collision queries against a heightfield placed in the world, on the
+ * same triangles the terrain is drawn with: every cell split along the
+ * diagonal from sample (x, y) to (x + 1, y + 1).
+ *
+ * Only refers to the heightfield and its min/max pyramid, so it's
+ * cheap to create for a single query. Heights are a few flops on one
+ * cell. Sweeps only descend into the pyramid's blocks whose height
+ * range the sphere's path overlaps, so a sphere passing well above the
+ * ground tests no triangles at all.
+ *
+ * Rays walk the pyramid like a DDA: through the blocks of whatever
+ * level they're at, climbing a level whenever the ray passes over a
+ * block and leaves its parent, and descending only into blocks whose
+ * height range the ray's span over them overlaps. Only the cells the
+ * ray could actually hit get exact triangle tests.
+ */
+class HeightfieldCollider {
+public:
+    /**
+     * @param heights: in world units
+     * @param bounds: the pyramid of exactly these heights
+     * @param origin: world XZ position of the first sample
+     * @param spacing: world units between neighbouring samples
+     */
+    HeightfieldCollider(
+        const Heightfield &heights,
+        const MinMaxPyramid &bounds,
+        vec2 origin,
+        float spacing);
+
+    /**
+     * Whether a world XZ position lies over the heightfield.
+     */
+    bool contains(vec2 xz) const {
+        vec2 grid = (xz - origin) * inv_spacing;
+        return grid.x >= 0.0f && grid.y >= 0.0f &&
+               grid.x <= (float)(heights.get_width() - 1) &&
+               grid.y <= (float)(heights.get_height() - 1);
+    }
+
+    /**
+     * Height of the surface at a world XZ position. Positions outside
+     * of the heightfield are clamped to its edges.
+     */
+    float height_at(vec2 xz) const;
+
+    /**
+     * Upwards unit normal of the triangle under a world XZ position.
+     */
+    vec3 normal_at(vec2 xz) const;
+
+    /**
+     * Move a sphere in a straight line and find the first point where
+     * it touches the surface from above. Contacts that the sphere is
+     * moving away from are ignored, so a sphere that starts out
+     * touching the ground can always lift off.
+     *
+     * @return whether there was a contact before the end
+     */
+    bool sweep_sphere(vec3 start, vec3 end, float radius, SphereHit &hit)
+        const;
+
+    /**
+     * Find the first point where a ray hits the surface, from either
+     * side.
+     *
+     * @param dir: unit direction
+     * @param max_distance: how far along the ray to look
+     * @return whether anything was hit
+     */
+    bool raycast(vec3 start, vec3 dir, float max_distance, RayHit &hit)
+        const;
+
+    /**
+     * Whether the segment between two points clears the surface.
+     */
+    bool line_of_sight(vec3 from, vec3 to) const;
+
+    /**
+     * Line of sight between many pairs of points, spread over a
+     * thread pool.
+     *
+     * @param visible: resized to the number of pairs, 1 for each pair
+     * that can see each other and 0 otherwise
+     */
+    void line_of_sight(
+        ThreadPool &pool,
+        const vector<vec3> &from,
+        const vector<vec3> &to,
+        vector<uint8_t> &visible) const;
+
+private:
+    const Heightfield &heights;
+    const MinMaxPyramid &bounds;
+    vec2 origin;
+    float spacing;
+    float inv_spacing;
+
+    // One sweep, in the heightfield's cells
+    struct Sweep {
+        vec3 start;
+        vec3 delta;
+        float radius;
+
+        // Cells [x0, x1] x [y0, y1] the sweep can touch before t
+        size_t x0;
+        size_t y0;
+        size_t x1;
+        size_t y1;
+
+        // World space box the sphere passes through before t
+        vec3 lo;
+        vec3 hi;
+
+        // Whether this pass tests edges and corners rather than faces
+        bool edges;
+
+        // Earliest contact so far
+        bool found;
+        float t;
+        vec3 normal;
+    };
+
+    vec3 get_vertex(size_t x, size_t y) const {
+        return vec3(
+            origin.x + ((float)x * spacing),
+            heights.at(x, y),
+            origin.y + ((float)y * spacing));
+    }
+
+    /**
+     * Fit the sweep's box and cell range to its path up to t.
+     *
+     * @return false if the path misses the heightfield
+     */
+    bool clip_sweep(Sweep &sweep) const;
+
+    void sweep_blocks(Sweep &sweep) const;
+
+    void sweep_block(size_t level, size_t x, size_t y, Sweep &sweep) const;
+
+    void sweep_faces(size_t x, size_t y, Sweep &sweep) const;
+
+    void sweep_edges(size_t x, size_t y, Sweep &sweep) const;
+};
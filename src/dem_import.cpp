@@ -0,0 +1,288 @@
+#include "dem_import.hpp"
+
+#include "heightfield_codec.hpp"
+#include "noise.hpp"
+#include "thread_pool.hpp"
+#include "tile_cache.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+static std::runtime_error file_error(const std::string &what) {
+    std::string err_msg = "DEM: ";
+    err_msg.append(what);
+    err_msg.append(": ");
+    err_msg.append(std::strerror(errno));
+    return std::runtime_error(err_msg);
+}
+
+static std::runtime_error format_error(
+    const std::string &path,
+    const std::string &what) {
+    std::string err_msg = "DEM: '";
+    err_msg.append(path);
+    err_msg.append("': ");
+    err_msg.append(what);
+    return std::runtime_error(err_msg);
+}
+
+DemSource::DemSource(const std::string &path, Params p) :
+    params(p),
+    page_size((size_t)sysconf(_SC_PAGESIZE)),
+    big_endian(p.big_endian),
+    is_signed(p.is_signed),
+    width(p.width),
+    height(p.height) {
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw file_error("failed to open '" + path + "'");
+    }
+
+    try {
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            throw file_error("failed to stat '" + path + "'");
+        }
+        file_size = (uint64_t)st.st_size;
+        modified = (int64_t)st.st_mtime;
+
+        if (file_size == 0) {
+            throw format_error(path, "file is empty");
+        }
+
+        mapped_size = (size_t)file_size;
+        void *addr = mmap(nullptr, mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            throw file_error("failed to map '" + path + "'");
+        }
+        mapping = (const uint8_t *)addr;
+
+        // Rows are read top to bottom, so let the OS read ahead
+        madvise((void *)mapping, mapped_size, MADV_SEQUENTIAL);
+
+        if (params.format == Format::PGM) {
+            parse_pgm_header(path);
+        }
+
+        if (width < 2 || height < 2) {
+            throw format_error(path, "needs at least 2x2 samples");
+        }
+
+        size_t data_bytes = width * height * sample_bytes;
+        if (data_offset + data_bytes > mapped_size) {
+            std::string what = "truncated, expected ";
+            what.append(std::to_string(data_offset + data_bytes));
+            what.append(" bytes but got ");
+            what.append(std::to_string(mapped_size));
+            throw format_error(path, what);
+        }
+    } catch (...) {
+        if (mapping) {
+            munmap((void *)mapping, mapped_size);
+        }
+        close(fd);
+        throw;
+    }
+}
+
+DemSource::~DemSource() {
+    if (mapping) {
+        munmap((void *)mapping, mapped_size);
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+float DemSource::at(size_t x, size_t y) const {
+    return (raw_at(x, y) * params.height_scale) + params.height_offset;
+}
+
+Heightfield DemSource::read(int64_t x, int64_t y, size_t w, size_t h) const {
+    Heightfield hf(w, h);
+
+    int64_t last_x = (int64_t)width - 1;
+    int64_t last_y = (int64_t)height - 1;
+    for (size_t j = 0; j < h; ++j) {
+        size_t sy = (size_t)std::clamp(y + (int64_t)j, (int64_t)0, last_y);
+        for (size_t i = 0; i < w; ++i) {
+            size_t sx =
+                (size_t)std::clamp(x + (int64_t)i, (int64_t)0, last_x);
+            hf.at(i, j) = at(sx, sy);
+        }
+    }
+
+    return hf;
+}
+
+void DemSource::release_rows(size_t y0, size_t y1) const {
+    y1 = std::min(y1, height);
+    if (y0 >= y1) {
+        return;
+    }
+
+    // Only whole pages, and none that reach into row y1
+    size_t row_bytes = width * sample_bytes;
+    size_t start = data_offset + (y0 * row_bytes);
+    size_t end = data_offset + (y1 * row_bytes);
+    start = (start / page_size) * page_size;
+    end = (end / page_size) * page_size;
+    if (end > start) {
+        madvise((void *)(mapping + start), end - start, MADV_DONTNEED);
+    }
+}
+
+uint32_t DemSource::get_content_key() const {
+    auto float_bits = [](float f) {
+        uint32_t bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+        return bits;
+    };
+
+    uint32_t h = hash_combine((uint32_t)width, (uint32_t)height);
+    h = hash_combine(h, (uint32_t)file_size);
+    h = hash_combine(h, (uint32_t)(file_size >> 32));
+    h = hash_combine(h, (uint32_t)modified);
+    h = hash_combine(h, (uint32_t)((uint64_t)modified >> 32));
+    h = hash_combine(h, (uint32_t)params.format);
+    h = hash_combine(h, big_endian ? 1u : 0u);
+    h = hash_combine(h, is_signed ? 1u : 0u);
+    h = hash_combine(h, float_bits(params.height_scale));
+    h = hash_combine(h, float_bits(params.height_offset));
+    return h;
+}
+
+void DemSource::parse_pgm_header(const std::string &path) {
+    // "P5", width, height and the largest sample value, separated by
+    // whitespace and comments, then exactly one whitespace character
+    if (mapped_size < 2 || mapping[0] != 'P' || mapping[1] != '5') {
+        throw format_error(path, "not a binary PGM file");
+    }
+
+    size_t pos = 2;
+    auto next_number = [&]() {
+        while (pos < mapped_size) {
+            if (mapping[pos] == '#') {
+                while (pos < mapped_size && mapping[pos] != '\n') {
+                    ++pos;
+                }
+            } else if (std::isspace(mapping[pos])) {
+                ++pos;
+            } else {
+                break;
+            }
+        }
+
+        if (pos >= mapped_size || !std::isdigit(mapping[pos])) {
+            throw format_error(path, "malformed PGM header");
+        }
+
+        size_t value = 0;
+        while (pos < mapped_size && std::isdigit(mapping[pos])) {
+            value = (value * 10) + (size_t)(mapping[pos] - '0');
+            ++pos;
+        }
+        return value;
+    };
+
+    width = next_number();
+    height = next_number();
+    size_t max_value = next_number();
+    if (max_value == 0 || max_value > 65535) {
+        throw format_error(path, "PGM sample range out of bounds");
+    }
+
+    data_offset = pos + 1;
+    sample_bytes = (max_value > 255) ? 2 : 1;
+    big_endian = true;
+    is_signed = false;
+}
+
+float DemSource::raw_at(size_t x, size_t y) const {
+    const uint8_t *p =
+        mapping + data_offset + (((y * width) + x) * sample_bytes);
+    if (sample_bytes == 1) {
+        return (float)p[0];
+    }
+
+    uint16_t bits = big_endian ? (uint16_t)((p[0] << 8) | p[1])
+                               : (uint16_t)((p[1] << 8) | p[0]);
+    return is_signed ? (float)(int16_t)bits : (float)bits;
+}
+
+DemImporter::DemImporter(ThreadPool &p, const ChunkBuilder &b) :
+    pool(p),
+    builder(b) {}
+
+ChunkCoord DemImporter::get_chunk_count(const DemSource &dem) {
+    size_t quads = CHUNK_SAMPLES - 1;
+    return {
+        (int32_t)((dem.get_width() - 1 + quads - 1) / quads),
+        (int32_t)((dem.get_height() - 1 + quads - 1) / quads)};
+}
+
+uint64_t DemImporter::get_content_key(const DemSource &dem) const {
+    uint64_t key = builder.get_content_key();
+    uint32_t h = hash_combine((uint32_t)key, dem.get_content_key());
+    return (key & 0xffffffff00000000ULL) | h;
+}
+
+void DemImporter::import(
+    const DemSource &dem,
+    TileCache &cache,
+    bool verbose) const {
+    ChunkCoord count = get_chunk_count(dem);
+    size_t quads = CHUNK_SAMPLES - 1;
+
+    for (int32_t z = 0; z < count.z; ++z) {
+        pool.parallel_for(0, (size_t)count.x, [&](size_t x) {
+            ChunkCoord coord = {(int32_t)x, z};
+            if (!cache.contains(coord)) {
+                cache.store(build(dem, coord));
+            }
+        });
+
+        // The next row of chunks starts one sample above its first
+        // row, for the normals; everything before that is done with
+        size_t next_row = ((size_t)(z + 1) * quads) - 1;
+        dem.release_rows(0, next_row);
+        cache.flush();
+
+        if (verbose && ((z + 1) % 16 == 0 || z + 1 == count.z)) {
+            std::cerr << "Importing DEM: " << (z + 1) << " of " << count.z
+                      << " rows of chunks" << std::endl;
+        }
+    }
+}
+
+ChunkData DemImporter::build(const DemSource &dem, ChunkCoord coord) const {
+    size_t quads = CHUNK_SAMPLES - 1;
+    Heightfield padded = dem.read(
+        ((int64_t)coord.x * (int64_t)quads) - 1,
+        ((int64_t)coord.z * (int64_t)quads) - 1,
+        CHUNK_SAMPLES + 2,
+        CHUNK_SAMPLES + 2);
+
+    // Match what the builder would have made, so the chunks survive
+    // a round trip through compressed tiles unchanged
+    float precision = builder.get_params().height_precision;
+    if (precision > 0.0f) {
+        float *h = padded.data();
+        size_t n = padded.get_width() * padded.get_height();
+        for (size_t i = 0; i < n; ++i) {
+            h[i] = HeightfieldCodec::quantize(h[i], precision);
+        }
+    }
+
+    return builder.finish(coord, std::move(padded));
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include "chunk.hpp"
+#include "heightfield.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+class ThreadPool;
+class TileCache;
+
+/**
+ * A digital elevation model on disk: a grid of 16-bit (or 8-bit)
+ * samples, either a binary PGM ("P5") file or headerless raw data.
+ *
+ * The file is memory-mapped rather than read, so it can be far bigger
+ * than RAM. Only the pages that are actually sampled get read in, and
+ * release_rows() hands pages back once they're no longer needed.
+ * Uses POSIX file mapping.
+ */
+class DemSource {
+public:
+    enum class Format { PGM, RAW };
+
+    struct Params {
+        Format format = Format::PGM;
+
+        // Size of RAW files in samples, which they don't record
+        // themselves. PGM files ignore these.
+        size_t width = 0;
+        size_t height = 0;
+
+        // Byte order and signedness of RAW 16-bit samples. PGM
+        // samples are always unsigned and big-endian.
+        bool big_endian = false;
+        bool is_signed = false;
+
+        // Height in world units = sample * height_scale + height_offset
+        float height_scale = 1.0f;
+        float height_offset = 0.0f;
+    };
+
+    explicit DemSource(const std::string &path) : DemSource(path, Params()) {}
+
+    /**
+     * Map a DEM file. Throws a std::runtime_error if it can't be
+     * opened or is malformed or truncated.
+     */
+    DemSource(const std::string &path, Params p);
+
+    ~DemSource();
+
+    DemSource(const DemSource &) = delete;
+    DemSource &operator=(const DemSource &) = delete;
+
+    size_t get_width() const {
+        return width;
+    }
+
+    size_t get_height() const {
+        return height;
+    }
+
+    /**
+     * Height of one sample, in world units.
+     */
+    float at(size_t x, size_t y) const;
+
+    /**
+     * Copy a rectangle of samples into a heightfield, in world units.
+     * Parts of the rectangle outside of the DEM repeat its nearest
+     * edge.
+     *
+     * @param x, y: first sample, may be negative
+     */
+    Heightfield read(int64_t x, int64_t y, size_t w, size_t h) const;
+
+    /**
+     * Let the OS drop the pages holding rows [y0, y1) from memory.
+     * They're read back in if they're sampled again.
+     */
+    void release_rows(size_t y0, size_t y1) const;
+
+    /**
+     * Hash of the file's identity and the settings it's read with, so
+     * terrain imported from it can be matched to it later.
+     */
+    uint32_t get_content_key() const;
+
+private:
+    Params params;
+
+    int fd = -1;
+    const uint8_t *mapping = nullptr;
+    size_t mapped_size = 0;
+    size_t page_size;
+
+    // Where the samples start, and their size in bytes
+    size_t data_offset = 0;
+    size_t sample_bytes = 2;
+    bool big_endian;
+    bool is_signed;
+
+    size_t width;
+    size_t height;
+
+    // Identity of the file for get_content_key()
+    uint64_t file_size;
+    int64_t modified;
+
+    void parse_pgm_header(const std::string &path);
+
+    float raw_at(size_t x, size_t y) const;
+};
+
+/**
+ * Cuts a DEM into terrain chunks and stores them in a tile cache, so
+ * the chunk manager streams them in as if it had built them itself.
+ *
+ * DEM sample (x, y) becomes the chunk sample at world (x * spacing,
+ * y * spacing). Chunks are processed one row at a time, spread over a
+ * thread pool, each computing its normals, splat weights and min/max
+ * pyramid with ChunkBuilder::finish(). Once a row of chunks is stored,
+ * the DEM's pages above it are released and the cache's written tiles
+ * flushed to disk, so memory use depends on the DEM's width but not
+ * its height. Chunks that are already cached are skipped, so an
+ * interrupted import picks up where it left off.
+ */
+class DemImporter {
+public:
+    DemImporter(ThreadPool &pool, const ChunkBuilder &builder);
+
+    /**
+     * Chunks needed along X and Z to cover a DEM. Chunks on the far
+     * edges may stick out past it.
+     */
+    static ChunkCoord get_chunk_count(const DemSource &dem);
+
+    /**
+     * Content key for a tile cache holding this DEM's chunks, which
+     * also covers the builder's settings.
+     */
+    uint64_t get_content_key(const DemSource &dem) const;
+
+    /**
+     * Store every chunk of the DEM that the cache doesn't have yet.
+     *
+     * @param verbose: whether to report progress on stderr
+     */
+    void import(const DemSource &dem, TileCache &cache, bool verbose) const;
+
+private:
+    ThreadPool &pool;
+    const ChunkBuilder &builder;
+
+    ChunkData build(const DemSource &dem, ChunkCoord coord) const;
+};
@@ -0,0 +1,212 @@
+#include "density_field.hpp"
+
+#include "noise.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+// SSE2 has no 32-bit multiply that keeps the low halves, so do the
+// even and odd lanes separately and put them back together
+static inline __m128i mul_u32(__m128i a, __m128i b) {
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(
+        _mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+        _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+// The same steps as hash_u32() and hash_combine(), four at a time
+static inline __m128i hash_u32_x4(__m128i x) {
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+    x = mul_u32(x, _mm_set1_epi32((int)0x7feb352dU));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 15));
+    x = mul_u32(x, _mm_set1_epi32((int)0x846ca68bU));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+    return x;
+}
+
+static inline __m128i hash_combine_x4(__m128i seed, __m128i value) {
+    __m128i mixed = _mm_add_epi32(value, _mm_set1_epi32((int)0x9e3779b9U));
+    mixed = _mm_add_epi32(mixed, _mm_slli_epi32(seed, 6));
+    mixed = _mm_add_epi32(mixed, _mm_srli_epi32(seed, 2));
+    return hash_u32_x4(_mm_xor_si128(seed, mixed));
+}
+
+static inline __m128 hash_to_unit_x4(__m128i h) {
+    return _mm_mul_ps(
+        _mm_cvtepi32_ps(_mm_srli_epi32(h, 8)),
+        _mm_set1_ps(1.0f / 16777216.0f));
+}
+
+static inline __m128 floor_x4(__m128 x) {
+    __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+    __m128 too_high = _mm_and_ps(_mm_cmpgt_ps(truncated, x), _mm_set1_ps(1.0f));
+    return _mm_sub_ps(truncated, too_high);
+}
+
+static inline __m128 fade_x4(__m128 t) {
+    __m128 inner =
+        _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f));
+    inner = _mm_add_ps(_mm_mul_ps(t, inner), _mm_set1_ps(10.0f));
+    return _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(t, t), t), inner);
+}
+
+static inline __m128 lerp_x4(__m128 a, __m128 b, __m128 t) {
+    return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+}
+
+/**
+ * value_noise_3d() at four points.
+ */
+static __m128 value_noise_3d_x4(__m128 x, __m128 y, __m128 z, uint32_t seed) {
+    __m128 fx = floor_x4(x);
+    __m128 fy = floor_x4(y);
+    __m128 fz = floor_x4(z);
+    __m128i ix = _mm_cvttps_epi32(fx);
+    __m128i iy = _mm_cvttps_epi32(fy);
+    __m128i iz = _mm_cvttps_epi32(fz);
+    __m128 ux = fade_x4(_mm_sub_ps(x, fx));
+    __m128 uy = fade_x4(_mm_sub_ps(y, fy));
+    __m128 uz = fade_x4(_mm_sub_ps(z, fz));
+
+    __m128i one = _mm_set1_epi32(1);
+    __m128i s = _mm_set1_epi32((int)seed);
+    __m128i hx[2] = {
+        hash_combine_x4(s, ix), hash_combine_x4(s, _mm_add_epi32(ix, one))};
+
+    __m128 v[2][2][2];
+    for (int dx = 0; dx < 2; ++dx) {
+        for (int dy = 0; dy < 2; ++dy) {
+            __m128i hy = hash_combine_x4(
+                hx[dx], (dy == 0) ? iy : _mm_add_epi32(iy, one));
+            for (int dz = 0; dz < 2; ++dz) {
+                __m128i h = hash_combine_x4(
+                    hy, (dz == 0) ? iz : _mm_add_epi32(iz, one));
+                v[dx][dy][dz] = hash_to_unit_x4(h);
+            }
+        }
+    }
+
+    __m128 x00 = lerp_x4(v[0][0][0], v[1][0][0], ux);
+    __m128 x10 = lerp_x4(v[0][1][0], v[1][1][0], ux);
+    __m128 x01 = lerp_x4(v[0][0][1], v[1][0][1], ux);
+    __m128 x11 = lerp_x4(v[0][1][1], v[1][1][1], ux);
+    __m128 y0 = lerp_x4(x00, x10, uy);
+    __m128 y1 = lerp_x4(x01, x11, uy);
+    __m128 n = lerp_x4(y0, y1, uz);
+    return _mm_sub_ps(_mm_mul_ps(n, _mm_set1_ps(2.0f)), _mm_set1_ps(1.0f));
+}
+
+static inline __m128 abs_x4(__m128 x) {
+    return _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+}
+#endif
+
+DensityField::DensityField(const TerrainGenerator &gen, Params p) :
+    generator(gen),
+    params(p) {
+    uint32_t seed = generator.get_params().seed;
+    overhang_seed = hash_combine(seed, 0x6f76u);
+    cave_seeds[0] = hash_combine(seed, 0x6361u);
+    cave_seeds[1] = hash_combine(seed, 0x6362u);
+
+    inv_overhang_size = 1.0f / params.overhang_size;
+    inv_cave_size = 1.0f / params.cave_size;
+}
+
+float DensityField::density_at(vec3 pos) const {
+    return density(pos, generator.height_at(pos.x, pos.z));
+}
+
+void DensityField::sample(
+    vec3 origin,
+    size_t w,
+    size_t h,
+    size_t d,
+    float spacing,
+    vector<float> &out) const {
+    out.resize(w * h * d);
+
+    // The surface only depends on X and Z, so it's worked out once
+    // per column
+    vector<float> ground(w * d);
+    for (size_t z = 0; z < d; ++z) {
+        float wz = origin.z + ((float)z * spacing);
+        for (size_t x = 0; x < w; ++x) {
+            float wx = origin.x + ((float)x * spacing);
+            ground[(z * w) + x] = generator.height_at(wx, wz);
+        }
+    }
+
+    for (size_t z = 0; z < d; ++z) {
+        float wz = origin.z + ((float)z * spacing);
+        for (size_t y = 0; y < h; ++y) {
+            float wy = origin.y + ((float)y * spacing);
+            float *row = &out[((z * h) + y) * w];
+            const float *row_ground = &ground[z * w];
+
+            size_t x = 0;
+#ifdef __SSE2__
+            __m128 py = _mm_set1_ps(wy);
+            __m128 oy = _mm_set1_ps(wy * inv_overhang_size);
+            __m128 oz = _mm_set1_ps(wz * inv_overhang_size);
+            __m128 cy =
+                _mm_set1_ps((wy * inv_cave_size) * params.cave_squash);
+            __m128 cz = _mm_set1_ps(wz * inv_cave_size);
+
+            for (; x + 4 <= w; x += 4) {
+                __m128i lanes = _mm_setr_epi32(
+                    (int)x, (int)(x + 1), (int)(x + 2), (int)(x + 3));
+                __m128 px = _mm_add_ps(
+                    _mm_set1_ps(origin.x),
+                    _mm_mul_ps(_mm_cvtepi32_ps(lanes), _mm_set1_ps(spacing)));
+
+                __m128 warp = value_noise_3d_x4(
+                    _mm_mul_ps(px, _mm_set1_ps(inv_overhang_size)),
+                    oy,
+                    oz,
+                    overhang_seed);
+                warp = _mm_mul_ps(warp, _mm_set1_ps(params.overhang_amplitude));
+                __m128 ground_x4 = _mm_loadu_ps(row_ground + x);
+                __m128 solid = _mm_sub_ps(_mm_add_ps(ground_x4, warp), py);
+
+                __m128 cx = _mm_mul_ps(px, _mm_set1_ps(inv_cave_size));
+                __m128 a = abs_x4(value_noise_3d_x4(cx, cy, cz, cave_seeds[0]));
+                __m128 b = abs_x4(value_noise_3d_x4(cx, cy, cz, cave_seeds[1]));
+                __m128 width = _mm_set1_ps(params.cave_width);
+                __m128 cave = _mm_mul_ps(
+                    _mm_sub_ps(_mm_add_ps(a, b), width),
+                    _mm_set1_ps(params.cave_size));
+
+                _mm_storeu_ps(row + x, _mm_min_ps(solid, cave));
+            }
+#endif
+            for (; x < w; ++x) {
+                float wx = origin.x + ((float)x * spacing);
+                row[x] = density(vec3(wx, wy, wz), row_ground[x]);
+            }
+        }
+    }
+}
+
+float DensityField::density(vec3 pos, float ground) const {
+    float warp = value_noise_3d(
+        pos.x * inv_overhang_size,
+        pos.y * inv_overhang_size,
+        pos.z * inv_overhang_size,
+        overhang_seed);
+    float solid = (ground + (warp * params.overhang_amplitude)) - pos.y;
+
+    // Tunnels follow the curves where both noise fields are 0
+    float cx = pos.x * inv_cave_size;
+    float cy = (pos.y * inv_cave_size) * params.cave_squash;
+    float cz = pos.z * inv_cave_size;
+    float a = std::abs(value_noise_3d(cx, cy, cz, cave_seeds[0]));
+    float b = std::abs(value_noise_3d(cx, cy, cz, cave_seeds[1]));
+    float cave = ((a + b) - params.cave_width) * params.cave_size;
+
+    return std::min(solid, cave);
+}
@@ -0,0 +1,202 @@
+#include "erosion.hpp"
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+
+HydraulicErosion::HydraulicErosion(ThreadPool &p, Params prm) :
+    pool(p),
+    params(prm) {
+    if (params.max_lifetime <= 0 || params.brush_radius < 0) {
+        throw std::invalid_argument(
+            "erosion needs a positive droplet lifetime and brush radius");
+    }
+
+    // A droplet moves at most one sample per step, erodes up to
+    // brush_radius around where it was, and deposits/reads up to one
+    // sample past where it is
+    halo = (size_t)params.max_lifetime + (size_t)params.brush_radius + 2;
+
+    // Two tiles of the same checkerboard color are one tile apart,
+    // so their halos can't overlap as long as a tile is wider than
+    // two halos
+    tile_size = std::max(params.tile_size, (2 * halo) + 1);
+
+    int r = params.brush_radius;
+    float weight_sum = 0.0f;
+    for (int dy = -r; dy <= r; ++dy) {
+        for (int dx = -r; dx <= r; ++dx) {
+            float dist = std::sqrt((float)((dx * dx) + (dy * dy)));
+            if (dist <= (float)r) {
+                float weight = 1.0f - (dist / (float)(r + 1));
+                brush.push_back({dx, dy, weight});
+                weight_sum += weight;
+            }
+        }
+    }
+
+    for (auto &b : brush) {
+        b.weight /= weight_sum;
+    }
+}
+
+ErosionStats HydraulicErosion::erode(Heightfield &hf) const {
+    size_t width = hf.get_width();
+    size_t height = hf.get_height();
+    if (width < 2 || height < 2) {
+        return ErosionStats();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    size_t tiles_x = (width + tile_size - 1) / tile_size;
+    size_t tiles_y = (height + tile_size - 1) / tile_size;
+
+    // One list of tiles per checkerboard color
+    vector<Tile> phases[4];
+    size_t total_droplets = 0;
+
+    for (size_t ty = 0; ty < tiles_y; ++ty) {
+        for (size_t tx = 0; tx < tiles_x; ++tx) {
+            Tile tile;
+            tile.x0 = tx * tile_size;
+            tile.y0 = ty * tile_size;
+            tile.x1 = std::min(tile.x0 + tile_size, width);
+            tile.y1 = std::min(tile.y0 + tile_size, height);
+            tile.index = (ty * tiles_x) + tx;
+
+            float area = (float)((tile.x1 - tile.x0) * (tile.y1 - tile.y0));
+            tile.num_droplets =
+                (size_t)std::lround(area * params.droplets_per_sample);
+            total_droplets += tile.num_droplets;
+
+            phases[((ty % 2) * 2) + (tx % 2)].push_back(tile);
+        }
+    }
+
+    for (const auto &phase : phases) {
+        pool.parallel_for(0, phase.size(), [&](size_t i) {
+            erode_tile(hf, phase[i]);
+        });
+    }
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    ErosionStats stats;
+    stats.droplets = total_droplets;
+    stats.seconds = elapsed.count();
+    return stats;
+}
+
+void HydraulicErosion::erode_tile(Heightfield &hf, const Tile &tile) const {
+    uint32_t tile_seed = hash_combine(params.seed, (uint32_t)tile.index);
+
+    for (size_t i = 0; i < tile.num_droplets; ++i) {
+        Rng rng(((uint64_t)tile_seed << 32) | (uint64_t)i);
+        run_droplet(hf, rng, tile);
+    }
+}
+
+void HydraulicErosion::run_droplet(
+    Heightfield &hf,
+    Rng &rng,
+    const Tile &tile) const {
+    const int width = (int)hf.get_width();
+    const int height = (int)hf.get_height();
+    float *map = hf.data();
+
+    float px = rng.next_range((float)tile.x0, (float)tile.x1 - 1.0f);
+    float py = rng.next_range((float)tile.y0, (float)tile.y1 - 1.0f);
+    px = std::min(px, (float)(width - 2));
+    py = std::min(py, (float)(height - 2));
+
+    float dir_x = 0.0f;
+    float dir_y = 0.0f;
+    float speed = params.initial_speed;
+    float water = params.initial_water;
+    float sediment = 0.0f;
+
+    for (int step = 0; step < params.max_lifetime; ++step) {
+        int nx = (int)px;
+        int ny = (int)py;
+        float fx = px - (float)nx;
+        float fy = py - (float)ny;
+        int cell = (ny * width) + nx;
+
+        // Height and gradient from the four corners of the cell
+        float h00 = map[cell];
+        float h10 = map[cell + 1];
+        float h01 = map[cell + width];
+        float h11 = map[cell + width + 1];
+
+        float grad_x = ((h10 - h00) * (1.0f - fy)) + ((h11 - h01) * fy);
+        float grad_y = ((h01 - h00) * (1.0f - fx)) + ((h11 - h10) * fx);
+        float h = (h00 * (1.0f - fx) * (1.0f - fy)) +
+                  (h10 * fx * (1.0f - fy)) + (h01 * (1.0f - fx) * fy) +
+                  (h11 * fx * fy);
+
+        dir_x = (dir_x * params.inertia) - (grad_x * (1.0f - params.inertia));
+        dir_y = (dir_y * params.inertia) - (grad_y * (1.0f - params.inertia));
+
+        float len = std::sqrt((dir_x * dir_x) + (dir_y * dir_y));
+        if (len < 1e-6f) {
+            // Flat ground, nowhere to flow
+            break;
+        }
+        dir_x /= len;
+        dir_y /= len;
+
+        px += dir_x;
+        py += dir_y;
+
+        if (px < 0.0f || py < 0.0f || px >= (float)(width - 1) ||
+            py >= (float)(height - 1)) {
+            break;
+        }
+
+        float new_h = hf.sample(px, py);
+        float dh = new_h - h;
+
+        float capacity = std::max(
+            -dh * speed * water * params.sediment_capacity_factor,
+            params.min_sediment_capacity);
+
+        if (sediment > capacity || dh > 0.0f) {
+            // Going uphill: fill the pit behind us, at most up to the
+            // height we came from. Otherwise drop the excess.
+            float amount = (dh > 0.0f)
+                               ? std::min(dh, sediment)
+                               : (sediment - capacity) * params.deposit_speed;
+            sediment -= amount;
+
+            map[cell] += amount * (1.0f - fx) * (1.0f - fy);
+            map[cell + 1] += amount * fx * (1.0f - fy);
+            map[cell + width] += amount * (1.0f - fx) * fy;
+            map[cell + width + 1] += amount * fx * fy;
+        } else {
+            // Never dig deeper than the height difference, so we don't
+            // carve holes that water then can't get out of
+            float amount =
+                std::min((capacity - sediment) * params.erode_speed, -dh);
+
+            for (const auto &b : brush) {
+                int bx = nx + b.dx;
+                int by = ny + b.dy;
+                if (bx < 0 || by < 0 || bx >= width || by >= height) {
+                    continue;
+                }
+
+                map[(by * width) + bx] -= amount * b.weight;
+            }
+            sediment += amount;
+        }
+
+        float speed_sq = (speed * speed) - (dh * params.gravity);
+        speed = std::sqrt(std::max(0.0f, speed_sq));
+        water *= (1.0f - params.evaporate_speed);
+    }
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "heightfield.hpp"
+#include "noise.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+class ThreadPool;
+
+struct ErosionStats {
+    size_t droplets = 0;
+    double seconds = 0.0;
+
+    double droplets_per_second() const {
+        return (seconds > 0.0) ? (double)droplets / seconds : 0.0;
+    }
+};
+
+/**
+ * Particle-based hydraulic erosion: water droplets run downhill over
+ * the heightfield, picking up sediment when they speed up and
+ * dropping it when they slow down or evaporate.
+ *
+ * The grid is split into square tiles, each with its own droplets
+ * seeded from (seed, tile, droplet index). A droplet can only travel
+ * a bounded distance from the tile it started in (the halo), and
+ * tiles are made at least twice as wide as the halo, so tiles that
+ * are not adjacent never touch the same samples. Tiles are run in
+ * four passes of a 2x2 checkerboard, each pass in parallel. Nothing
+ * depends on thread count or scheduling, so a given seed always
+ * produces the same terrain.
+ */
+class HydraulicErosion {
+public:
+    struct Params {
+        uint32_t seed = 1;
+
+        // Number of droplets per heightfield sample
+        float droplets_per_sample = 0.25f;
+
+        // Steps before a droplet evaporates completely. Each step
+        // moves exactly one grid unit, so this also bounds how far a
+        // droplet can travel.
+        int max_lifetime = 30;
+
+        // Samples within this distance share the material eroded at
+        // the droplet's position
+        int brush_radius = 3;
+
+        // Requested tile width; rounded up if too small for the halo
+        size_t tile_size = 128;
+
+        float inertia = 0.05f;
+        float sediment_capacity_factor = 4.0f;
+        float min_sediment_capacity = 0.01f;
+        float erode_speed = 0.3f;
+        float deposit_speed = 0.3f;
+        float evaporate_speed = 0.01f;
+        float gravity = 4.0f;
+        float initial_water = 1.0f;
+        float initial_speed = 1.0f;
+    };
+
+    explicit HydraulicErosion(ThreadPool &p) : HydraulicErosion(p, Params()) {}
+
+    HydraulicErosion(ThreadPool &pool, Params p);
+
+    /**
+     * Erode a heightfield in place. Heights are taken to be in grid
+     * units, i.e. the same units as the distance between samples.
+     */
+    ErosionStats erode(Heightfield &hf) const;
+
+    /**
+     * Distance, in samples, that a droplet can modify around the tile
+     * it was spawned in.
+     */
+    size_t get_halo() const {
+        return halo;
+    }
+
+    size_t get_tile_size() const {
+        return tile_size;
+    }
+
+private:
+    struct BrushSample {
+        int dx;
+        int dy;
+        float weight;
+    };
+
+    struct Tile {
+        size_t x0, y0, x1, y1;
+        size_t index;
+        size_t num_droplets;
+    };
+
+    ThreadPool &pool;
+    Params params;
+
+    size_t halo;
+    size_t tile_size;
+
+    vector<BrushSample> brush;
+
+    void erode_tile(Heightfield &hf, const Tile &tile) const;
+
+    void run_droplet(Heightfield &hf, Rng &rng, const Tile &tile) const;
+};
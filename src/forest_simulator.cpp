@@ -0,0 +1,355 @@
+#include "forest_simulator.hpp"
+
+#include "noise.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+static const float TWO_PI = 6.28318531f;
+
+/**
+ * A number for a tree, from where it stands, for hashing. Trees never
+ * move, so it's the same every year.
+ */
+static uint32_t tree_id(const TreeInstance &tree) {
+    uint32_t x;
+    uint32_t z;
+    std::memcpy(&x, &tree.position.x, sizeof(x));
+    std::memcpy(&z, &tree.position.z, sizeof(z));
+    return hash_combine(hash_u32(x), z);
+}
+
+/**
+ * Whether seed a takes the spot before seed b: by their ids, and
+ * where they are if those are the same.
+ */
+static bool outranks(const TreeInstance &a, const TreeInstance &b) {
+    uint32_t id_a = tree_id(a);
+    uint32_t id_b = tree_id(b);
+    if (id_a != id_b) {
+        return id_a > id_b;
+    }
+    if (a.position.x < b.position.x || a.position.x > b.position.x) {
+        return a.position.x < b.position.x;
+    }
+    return a.position.z < b.position.z;
+}
+
+ForestSimulator::ForestSimulator(
+    ThreadPool &p,
+    const GroundFunction &ground,
+    vec2 o,
+    float s,
+    Params prm) :
+    pool(p),
+    params(prm),
+    origin(o),
+    extent(s),
+    trees(prm.tile_size) {
+    if (!(extent > 0.0f) || !(params.tile_size > 0.0f) ||
+        !(params.ground_spacing > 0.0f) || params.variants == 0) {
+        std::string err_msg = "Bad forest: ";
+        err_msg.append(std::to_string(extent));
+        err_msg.append(" across, in tiles of ");
+        err_msg.append(std::to_string(params.tile_size));
+        err_msg.append(", ground sampled every ");
+        err_msg.append(std::to_string(params.ground_spacing));
+        throw std::invalid_argument(err_msg);
+    }
+
+    if (!(params.seedling_scale > 0.0f) ||
+        params.seedling_scale > params.max_scale ||
+        !(params.crown_radius > 0.0f) || !(params.min_distance > 0.0f)) {
+        throw std::invalid_argument("Trees need a size to start at, a "
+                                    "crown and room to grow");
+    }
+
+    size_t samples = (size_t)std::ceil(extent / params.ground_spacing) + 1;
+    heights = Heightfield(samples, samples);
+    fertility = Heightfield(samples, samples);
+    pool.parallel_for(0, samples, [&](size_t y) {
+        for (size_t x = 0; x < samples; ++x) {
+            vec2 xz =
+                origin + (vec2((float)x, (float)y) * params.ground_spacing);
+            float fertile;
+            ground(xz, heights.at(x, y), fertile);
+            fertility.at(x, y) = std::clamp(fertile, 0.0f, 1.0f);
+        }
+    });
+
+    float tile_size = params.tile_size;
+    first_tile = {
+        (int32_t)std::floor(origin.x / tile_size),
+        (int32_t)std::floor(origin.y / tile_size)};
+    last_tile = {
+        (int32_t)std::ceil((origin.x + extent) / tile_size) - 1,
+        (int32_t)std::ceil((origin.y + extent) / tile_size) - 1};
+}
+
+void ForestSimulator::run(uint32_t years) {
+    for (uint32_t i = 0; i < years; ++i) {
+        step();
+    }
+}
+
+void ForestSimulator::step() {
+    size_t wide = (size_t)(last_tile.x - first_tile.x + 1);
+    size_t deep = (size_t)(last_tile.z - first_tile.z + 1);
+
+    vector<vector<TreeInstance>> grown(wide * deep);
+    pool.parallel_for(0, grown.size(), [&](size_t i) {
+        ChunkCoord tile = {
+            first_tile.x + (int32_t)(i % wide),
+            first_tile.z + (int32_t)(i / wide)};
+        grow_tile(tile, grown[i]);
+    });
+
+    // Tiles go in in the same order every time, so the grid does too,
+    // and all at once, so its top tree is only built the once
+    vector<std::pair<ChunkCoord, vector<TreeInstance>>> batch;
+    batch.reserve(grown.size());
+    for (size_t i = 0; i < grown.size(); ++i) {
+        ChunkCoord tile = {
+            first_tile.x + (int32_t)(i % wide),
+            first_tile.z + (int32_t)(i / wide)};
+        batch.emplace_back(tile, std::move(grown[i]));
+    }
+    InstanceGrid next(params.tile_size);
+    next.insert_all(std::move(batch));
+
+    trees = std::move(next);
+    ++year;
+}
+
+bool ForestSimulator::covers(vec2 lo, vec2 hi) const {
+    vec2 end = origin + vec2(extent);
+    return lo.x >= origin.x && lo.y >= origin.y && hi.x <= end.x &&
+           hi.y <= end.y;
+}
+
+void ForestSimulator::collect(vec2 lo, vec2 hi, vector<TreeInstance> &out)
+    const {
+    vector<const TreeInstance *> found;
+    trees.query_box(
+        vec3(lo.x, -FLT_MAX, lo.y), vec3(hi.x, FLT_MAX, hi.y), found);
+
+    // Trees right on the far edges belong to the next box over
+    out.clear();
+    for (const TreeInstance *tree : found) {
+        if (tree->position.x < hi.x && tree->position.z < hi.y) {
+            out.push_back(*tree);
+        }
+    }
+}
+
+void ForestSimulator::ground_at(vec2 xz, float &height, float &fertile)
+    const {
+    vec2 p = (xz - origin) / params.ground_spacing;
+    height = heights.sample(p.x, p.y);
+
+    bool inside = xz.x >= origin.x && xz.y >= origin.y &&
+                  xz.x <= origin.x + extent && xz.y <= origin.y + extent;
+    fertile = inside ? fertility.sample(p.x, p.y) : 0.0f;
+}
+
+void ForestSimulator::grow_tile(ChunkCoord tile, vector<TreeInstance> &out)
+    const {
+    out.clear();
+
+    uint32_t year_seed = hash_combine(params.seed, year);
+    float widest = params.crown_radius * params.max_scale;
+    vector<const TreeInstance *> near;
+
+    const vector<TreeInstance> *current = trees.find(tile);
+    if (current) {
+        for (const TreeInstance &tree : *current) {
+            vec2 xz(tree.position.x, tree.position.z);
+            float crown = params.crown_radius * tree.scale;
+
+            // Light left over by the crowns overlapping this one
+            trees.query_radius(xz, crown + widest, near);
+            float shade = 0.0f;
+            for (const TreeInstance *other : near) {
+                if (other == &tree) {
+                    continue;
+                }
+
+                vec2 d = vec2(other->position.x, other->position.z) - xz;
+                float reach = crown + (params.crown_radius * other->scale);
+                float overlap = 1.0f - (glm::length(d) / reach);
+                if (overlap <= 0.0f) {
+                    continue;
+                }
+
+                float weight = (other->scale >= tree.scale)
+                                   ? 1.0f
+                                   : 0.25f * other->scale / tree.scale;
+                shade += overlap * weight;
+            }
+            float light = std::max(0.0f, 1.0f - shade);
+
+            float height;
+            float fertile;
+            ground_at(xz, height, fertile);
+
+            float grown = tree.scale / params.max_scale;
+            float mortality = params.base_mortality +
+                              (params.shade_mortality * (1.0f - light) *
+                               (1.0f - light)) +
+                              (params.old_mortality *
+                               glm::smoothstep(0.85f, 1.0f, grown));
+            uint32_t h = hash_combine(year_seed, tree_id(tree));
+            if (!(fertile > 0.0f) || hash_to_unit(h) < mortality) {
+                continue;
+            }
+
+            TreeInstance next = tree;
+            next.scale += params.growth_rate * fertile * light * (1.0f - grown);
+            next.scale = std::min(next.scale, params.max_scale);
+            out.push_back(next);
+        }
+    }
+
+    // A seed loses its spot to any seed near it that outranks it and
+    // could take root, even one that loses its own spot, so the outcome
+    // only depends on the seeds nearby and the tiles either side of an
+    // edge agree on it. Seeds are sorted by X to find their neighbours.
+    float gap = params.min_distance;
+    vec2 lo = vec2((float)tile.x, (float)tile.z) * params.tile_size;
+    vec2 hi = lo + vec2(params.tile_size);
+
+    vector<TreeInstance> seeds;
+    find_seeds(lo - vec2(gap), hi + vec2(gap), seeds);
+    std::sort(
+        seeds.begin(),
+        seeds.end(),
+        [](const TreeInstance &a, const TreeInstance &b) {
+            return a.position.x < b.position.x;
+        });
+
+    for (size_t i = 0; i < seeds.size(); ++i) {
+        const TreeInstance &seed = seeds[i];
+        vec2 xz(seed.position.x, seed.position.z);
+        if (xz.x < lo.x || xz.y < lo.y || xz.x >= hi.x || xz.y >= hi.y) {
+            continue;
+        }
+
+        auto beats = [&](size_t j) {
+            vec2 d = vec2(seeds[j].position.x, seeds[j].position.z) - xz;
+            return glm::dot(d, d) < gap * gap && outranks(seeds[j], seed);
+        };
+
+        bool beaten = false;
+        for (size_t j = i; j-- > 0 && !beaten;) {
+            if (seeds[j].position.x < xz.x - gap) {
+                break;
+            }
+            beaten = beats(j);
+        }
+        for (size_t j = i + 1; j < seeds.size() && !beaten; ++j) {
+            if (seeds[j].position.x > xz.x + gap) {
+                break;
+            }
+            beaten = beats(j);
+        }
+
+        if (!beaten) {
+            out.push_back(seed);
+        }
+    }
+}
+
+void ForestSimulator::find_seeds(
+    vec2 lo,
+    vec2 hi,
+    vector<TreeInstance> &out) const {
+    out.clear();
+
+    uint32_t year_seed = hash_combine(params.seed, year);
+    float widest = params.crown_radius * params.max_scale;
+    vector<const TreeInstance *> near;
+
+    auto consider = [&](vec2 xz, uint32_t h, uint32_t variant) {
+        if (xz.x < lo.x || xz.y < lo.y || xz.x >= hi.x || xz.y >= hi.y) {
+            return;
+        }
+
+        float height;
+        float fertile;
+        ground_at(xz, height, fertile);
+        if (hash_to_unit(hash_u32(h)) >= fertile * params.germination) {
+            return;
+        }
+
+        // Not under another tree's crown, nor right next to it
+        trees.query_radius(xz, std::max(widest, params.min_distance), near);
+        for (const TreeInstance *other : near) {
+            vec2 d = vec2(other->position.x, other->position.z) - xz;
+            float room = std::max(
+                params.min_distance, params.crown_radius * other->scale);
+            if (glm::dot(d, d) < room * room) {
+                return;
+            }
+        }
+
+        Rng rng(h);
+        TreeInstance seedling;
+        seedling.position = vec3(xz.x, height, xz.y);
+        seedling.scale = params.seedling_scale;
+        seedling.rotation = rng.next_range(0.0f, TWO_PI);
+        seedling.variant = variant;
+        out.push_back(seedling);
+    };
+
+    // Dropped around grown trees
+    vector<const TreeInstance *> parents;
+    float reach = params.dispersal;
+    trees.query_box(
+        vec3(lo.x - reach, -FLT_MAX, lo.y - reach),
+        vec3(hi.x + reach, FLT_MAX, hi.y + reach),
+        parents);
+
+    for (const TreeInstance *parent : parents) {
+        if (parent->scale < params.mature_scale) {
+            continue;
+        }
+
+        uint32_t parent_seed = hash_combine(year_seed, tree_id(*parent));
+        for (uint32_t k = 0; k < params.seeds_per_year; ++k) {
+            uint32_t h = hash_combine(parent_seed, k);
+            Rng rng(h);
+            float angle = rng.next_range(0.0f, TWO_PI);
+            float distance = params.dispersal * std::sqrt(rng.next_float());
+            vec2 xz = vec2(parent->position.x, parent->position.z) +
+                      (vec2(std::cos(angle), std::sin(angle)) * distance);
+            consider(xz, h, parent->variant);
+        }
+    }
+
+    // Blown in, anywhere on the tiles under the box
+    float tile_size = params.tile_size;
+    int32_t x0 = std::max((int32_t)std::floor(lo.x / tile_size), first_tile.x);
+    int32_t z0 = std::max((int32_t)std::floor(lo.y / tile_size), first_tile.z);
+    int32_t x1 = std::min((int32_t)std::floor(hi.x / tile_size), last_tile.x);
+    int32_t z1 = std::min((int32_t)std::floor(hi.y / tile_size), last_tile.z);
+    uint32_t rain = (year == 0) ? params.first_seed_rain : params.seed_rain;
+
+    for (int32_t tz = z0; tz <= z1; ++tz) {
+        for (int32_t tx = x0; tx <= x1; ++tx) {
+            uint32_t tile_seed = hash_2d(tx, tz, year_seed);
+            vec2 corner = vec2((float)tx, (float)tz) * tile_size;
+            for (uint32_t k = 0; k < rain; ++k) {
+                uint32_t h = hash_combine(tile_seed, k);
+                Rng rng(h);
+                vec2 xz = corner + (vec2(rng.next_float(), rng.next_float()) *
+                                    tile_size);
+                consider(xz, h, rng.next_u32() % params.variants);
+            }
+        }
+    }
+}
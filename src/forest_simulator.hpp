@@ -0,0 +1,194 @@
+#pragma once
+
+#include "heightfield.hpp"
+#include "instance_grid.hpp"
+#include "tree_instance.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+using glm::vec2;
+
+using std::vector;
+
+class ThreadPool;
+
+/**
+ * Grows a forest over a square of the world, a simulated year at a
+ * time.
+ *
+ * Every year, each tree grows by how much light reaches it and how
+ * fertile its ground is, and slows down as it nears its full size.
+ * Light is shared out by the crowns overlapping its own, the taller
+ * ones taking most of it. Trees die at random, more often when they're
+ * shaded and when they're old. Grown trees drop seeds around them, and
+ * a few more blow in from elsewhere; a seed takes root only on fertile
+ * ground, out from under other trees' crowns, and not too close to
+ * another tree or to a seed that beat it to the spot.
+ *
+ * Trees are TreeInstances, their scale being how big they've grown, so
+ * the forest can go straight to the renderer. They're kept in an
+ * InstanceGrid with a tile per chunk, and each year reads the last
+ * one's grid and builds a new one, the tiles in parallel. Everything
+ * random is a hash of the seed, the year and a tree's position, and a
+ * tile only ever reads last year's trees, so a forest comes out the
+ * same however many threads grow it.
+ */
+class ForestSimulator {
+public:
+    /**
+     * The ground at a world XZ position: its height, and how well trees
+     * grow there, from 0 (not at all) to 1. Called from several threads
+     * at once.
+     */
+    typedef std::function<void(vec2 xz, float &height, float &fertility)>
+        GroundFunction;
+
+    struct Params {
+        uint32_t seed = 1;
+
+        // Side of the tiles years are simulated in parallel over
+        float tile_size = 128.0f;
+
+        // Distance between the samples the ground is read at
+        float ground_spacing = 4.0f;
+
+        // Tree models to pick from, as TreeInstance::variant
+        uint32_t variants = 1;
+
+        // Seeds blowing in from outside, per tile per year, and in the
+        // first year
+        uint32_t seed_rain = 4;
+        uint32_t first_seed_rain = 60;
+
+        // Chance of a seed taking root on the most fertile ground
+        float germination = 0.6f;
+
+        // Closest a seed takes root to another tree or seed
+        float min_distance = 2.0f;
+
+        // Crown radius of a tree of scale 1, in world units
+        float crown_radius = 3.0f;
+
+        // Scale of a new seedling, of a tree old enough to drop seeds,
+        // and of a fully grown tree
+        float seedling_scale = 0.1f;
+        float mature_scale = 0.6f;
+        float max_scale = 1.25f;
+
+        // Scale gained a year in full light on the most fertile ground,
+        // while still small
+        float growth_rate = 0.06f;
+
+        // Seeds dropped by a grown tree a year, and how far from it
+        // they can land
+        uint32_t seeds_per_year = 2;
+        float dispersal = 12.0f;
+
+        // Chance of dying each year: for any tree, added in full for a
+        // tree in deep shade, and for one at its full size
+        float base_mortality = 0.005f;
+        float shade_mortality = 0.15f;
+        float old_mortality = 0.04f;
+    };
+
+    /**
+     * Sample the ground over a square of the world, on the pool. The
+     * forest starts empty.
+     *
+     * @param origin: the square's corner with the least X and Z
+     * @param size: length of its sides, in world units
+     */
+    ForestSimulator(
+        ThreadPool &pool,
+        const GroundFunction &ground,
+        vec2 origin,
+        float size,
+        Params p);
+
+    ForestSimulator(const ForestSimulator &) = delete;
+    ForestSimulator &operator=(const ForestSimulator &) = delete;
+
+    /**
+     * Simulate a number of years, one after the other.
+     */
+    void run(uint32_t years);
+
+    /**
+     * Simulate one year, its tiles in parallel.
+     */
+    void step();
+
+    /**
+     * Years simulated so far.
+     */
+    uint32_t get_year() const {
+        return year;
+    }
+
+    /**
+     * Number of living trees.
+     */
+    size_t size() const {
+        return trees.size();
+    }
+
+    /**
+     * The living trees, a tile per chunk.
+     */
+    const InstanceGrid &get_trees() const {
+        return trees;
+    }
+
+    /**
+     * Whether the forest covers the whole of an XZ box.
+     */
+    bool covers(vec2 lo, vec2 hi) const;
+
+    /**
+     * Copy out the trees standing in an XZ box, e.g. a chunk's.
+     *
+     * @param out: replaced with the trees
+     */
+    void collect(vec2 lo, vec2 hi, vector<TreeInstance> &out) const;
+
+private:
+    ThreadPool &pool;
+    Params params;
+
+    // The square the forest grows on
+    vec2 origin;
+    float extent;
+
+    // Heights and fertility at ground_spacing over the square
+    Heightfield heights;
+    Heightfield fertility;
+
+    // Tiles the square is split into, as chunk coordinates of the grid
+    ChunkCoord first_tile;
+    ChunkCoord last_tile;
+
+    InstanceGrid trees;
+    uint32_t year = 0;
+
+    /**
+     * Height and fertility at a world XZ position, interpolated.
+     * Fertility is 0 outside the square.
+     */
+    void ground_at(vec2 xz, float &height, float &fertile) const;
+
+    /**
+     * Next year's trees on one tile, from this year's.
+     */
+    void grow_tile(ChunkCoord tile, vector<TreeInstance> &out) const;
+
+    /**
+     * Seeds that land in a box this year, and could take root there
+     * as far as the ground and this year's trees go.
+     */
+    void find_seeds(vec2 lo, vec2 hi, vector<TreeInstance> &out) const;
+};
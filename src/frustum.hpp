@@ -0,0 +1,120 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <array>
+
+using glm::mat4;
+using glm::vec3;
+using glm::vec4;
+
+/**
+ * The six planes of a view frustum, for culling bounding volumes
+ * against what the camera can see.
+ */
+class Frustum {
+public:
+    /**
+     * Extract the planes from a combined projection * view matrix.
+     * Each plane's normal (xyz) points into the frustum.
+     */
+    explicit Frustum(const mat4 &view_proj) {
+        // GLM matrices are column-major, so build the rows first
+        vec4 rows[4];
+        for (int r = 0; r < 4; ++r) {
+            rows[r] = vec4(
+                view_proj[0][r],
+                view_proj[1][r],
+                view_proj[2][r],
+                view_proj[3][r]);
+        }
+
+        planes[0] = rows[3] + rows[0]; // Left
+        planes[1] = rows[3] - rows[0]; // Right
+        planes[2] = rows[3] + rows[1]; // Bottom
+        planes[3] = rows[3] - rows[1]; // Top
+        planes[4] = rows[3] + rows[2]; // Near
+        planes[5] = rows[3] - rows[2]; // Far
+
+        for (vec4 &p : planes) {
+            p /= glm::length(vec3(p.x, p.y, p.z));
+        }
+    }
+
+    /**
+     * Whether an axis-aligned box is at least partly inside. May
+     * return true for some boxes just outside a corner of the
+     * frustum, which is fine for culling.
+     */
+    bool intersects_box(vec3 min, vec3 max) const {
+        for (const vec4 &p : planes) {
+            // The corner furthest along the plane's normal
+            vec3 corner(
+                (p.x >= 0.0f) ? max.x : min.x,
+                (p.y >= 0.0f) ? max.y : min.y,
+                (p.z >= 0.0f) ? max.z : min.z);
+
+            if (glm::dot(vec3(p.x, p.y, p.z), corner) + p.w < 0.0f) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * Test a box against some of the planes, for walking down a
+     * hierarchy of boxes inside each other. Planes the box is wholly
+     * inside of are cleared from the mask, since everything in the box
+     * is inside them too, and needn't be tested against them again.
+     *
+     * @param mask: a bit per plane to test, updated
+     * @return false if the box is wholly outside
+     */
+    bool cull_box(vec3 min, vec3 max, unsigned &mask) const {
+        for (size_t i = 0; i < planes.size(); ++i) {
+            unsigned bit = 1u << i;
+            if (!(mask & bit)) {
+                continue;
+            }
+
+            // The corners furthest along and against the plane's normal
+            const vec4 &p = planes[i];
+            vec3 far_corner(
+                (p.x >= 0.0f) ? max.x : min.x,
+                (p.y >= 0.0f) ? max.y : min.y,
+                (p.z >= 0.0f) ? max.z : min.z);
+            vec3 near_corner(
+                (p.x >= 0.0f) ? min.x : max.x,
+                (p.y >= 0.0f) ? min.y : max.y,
+                (p.z >= 0.0f) ? min.z : max.z);
+
+            vec3 n(p.x, p.y, p.z);
+            if (glm::dot(n, far_corner) + p.w < 0.0f) {
+                return false;
+            }
+            if (glm::dot(n, near_corner) + p.w >= 0.0f) {
+                mask &= ~bit;
+            }
+        }
+
+        return true;
+    }
+
+    bool intersects_sphere(vec3 center, float radius) const {
+        for (const vec4 &p : planes) {
+            if (glm::dot(vec3(p.x, p.y, p.z), center) + p.w < -radius) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    const vec4 &get_plane(size_t i) const {
+        return planes[i];
+    }
+
+private:
+    std::array<vec4, 6> planes;
+};
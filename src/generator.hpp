@@ -0,0 +1,131 @@
+#pragma once
+
+#include "heightfield.hpp"
+#include "noise.hpp"
+#include "thread_pool.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+/**
+ * Procedural terrain. Heights are a pure function of the seed and
+ * the world position, so any region can be generated independently
+ * of any other and neighbouring regions always line up.
+ */
+class TerrainGenerator {
+public:
+    struct Params {
+        uint32_t seed = 1;
+
+        // World units per noise lattice cell of the first octave
+        float feature_size = 96.0f;
+
+        // Highest possible peak above (and deepest valley below) zero
+        float amplitude = 24.0f;
+
+        int octaves = 6;
+    };
+
+    TerrainGenerator() : TerrainGenerator(Params()) {}
+
+    explicit TerrainGenerator(Params p) : params(p) {}
+
+    const Params &get_params() const {
+        return params;
+    }
+
+    /**
+     * Height at a position on the world's XZ plane.
+     */
+    float height_at(float x, float z) const {
+        float inv_size = 1.0f / params.feature_size;
+        float n = fbm(x * inv_size, z * inv_size, params.seed, params.octaves);
+
+        // Square the positive half to get flatter valleys and sharper
+        // peaks than raw noise
+        if (n > 0.0f) {
+            n *= n * 1.5f;
+        }
+
+        return n * params.amplitude;
+    }
+
+    /**
+     * Sample a rectangular region into a heightfield. Sample (x, y)
+     * of the result lies at world (origin.x + x * spacing, origin.y +
+     * y * spacing). Heights are in world units.
+     */
+    Heightfield generate(
+        vec2 origin,
+        size_t width,
+        size_t height,
+        float spacing = 1.0f) const {
+        Heightfield hf(width, height);
+
+        for (size_t y = 0; y < height; ++y) {
+            float wz = origin.y + ((float)y * spacing);
+            for (size_t x = 0; x < width; ++x) {
+                float wx = origin.x + ((float)x * spacing);
+                hf.at(x, y) = height_at(wx, wz);
+            }
+        }
+
+        return hf;
+    }
+
+    /**
+     * Same as generate(), with rows spread over a thread pool.
+     */
+    Heightfield generate(
+        ThreadPool &pool,
+        vec2 origin,
+        size_t width,
+        size_t height,
+        float spacing = 1.0f) const {
+        Heightfield hf(width, height);
+
+        pool.parallel_for(0, height, [&](size_t y) {
+            float wz = origin.y + ((float)y * spacing);
+            for (size_t x = 0; x < width; ++x) {
+                float wx = origin.x + ((float)x * spacing);
+                hf.at(x, y) = height_at(wx, wz);
+            }
+        });
+
+        return hf;
+    }
+
+    /**
+     * Material weights for a point on the terrain, packed as RGBA8 in
+     * memory order: grass, rock, snow, sand.
+     *
+     * @param normal: unit surface normal in world space
+     */
+    uint32_t splat_weights(float height, vec3 normal) const {
+        float steepness = 1.0f - normal.y;
+        float amplitude = params.amplitude;
+
+        float rock = glm::smoothstep(0.2f, 0.4f, steepness);
+        float snow =
+            glm::smoothstep(0.6f * amplitude, 0.8f * amplitude, height) *
+            (1.0f - rock);
+        float lowland =
+            glm::smoothstep(-0.6f * amplitude, -0.45f * amplitude, height);
+        float sand = (1.0f - lowland) * (1.0f - rock);
+        float grass = std::max(0.0f, 1.0f - rock - snow - sand);
+
+        auto to_byte = [](float w) {
+            return (uint32_t)std::lround(std::clamp(w, 0.0f, 1.0f) * 255.0f);
+        };
+
+        // Little-endian, so grass ends up in the first byte
+        return to_byte(grass) | (to_byte(rock) << 8) | (to_byte(snow) << 16) |
+               (to_byte(sand) << 24);
+    }
+
+private:
+    Params params;
+};
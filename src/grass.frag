@@ -0,0 +1,19 @@
+#version 420 core
+#extension GL_ARB_explicit_uniform_location : enable
+
+// Interpolated from the vertex shader
+in vec3 normal;
+in vec3 color;
+
+out vec4 fragColor;
+
+// The same sun as tree.frag's
+const vec3 lightDir = vec3(0.24, 0.94, 0.24);
+const vec3 ambientLightColor = vec3(0.25);
+const vec3 diffuseLightColor = vec3(0.9);
+
+void main() {
+    float sunWeight = max(0.0, dot(normalize(normal), lightDir));
+    vec3 light = ambientLightColor + (diffuseLightColor * sunWeight);
+    fragColor = vec4(color * light, 1.0);
+}
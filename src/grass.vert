@@ -0,0 +1,143 @@
+#version 420 core
+#extension GL_ARB_explicit_uniform_location : enable
+
+// No vertex attributes: each instance is a cell of ground, and
+// gl_VertexID picks a blade in it and a corner of that blade
+
+layout(location = 3) uniform mat4 uView;
+layout(location = 4) uniform mat4 uPersp;
+
+layout(location = 5) uniform vec3 uEyePos;
+
+// Cell size, how far the grass reaches, and the tallest blades' height
+// and width
+layout(location = 6) uniform vec4 uGrass;
+
+// Blades in a cell with nothing but grass
+layout(location = 7) uniform int uBlades;
+
+layout(location = 8) uniform uint uSeed;
+
+// The chunk being drawn: the world XZ of its first sample, and the
+// world distance between samples
+layout(location = 9) uniform vec2 uChunkOrigin;
+layout(location = 10) uniform float uSpacing;
+
+// World coordinates of the first cell drawn, and how many cells each
+// row of them has
+layout(location = 11) uniform ivec2 uFirstCell;
+layout(location = 12) uniform int uCellsWide;
+
+// Samples along a chunk's side, and the texel its splat weights start
+// at
+layout(location = 13) uniform int uSamples;
+layout(location = 14) uniform int uSplatTexel;
+
+// The chunk's vertex data, see ChunkManager::get_vertex_texture()
+layout(binding = 7) uniform usamplerBuffer uGround;
+
+out vec3 normal;
+out vec3 color;
+
+const int BLADE_VERTICES = 15;
+
+const vec3 baseColor = vec3(0.08, 0.2, 0.05);
+const vec3 tipColor = vec3(0.35, 0.55, 0.18);
+
+// These match hash_u32(), hash_combine() and hash_to_unit() in noise.hpp
+
+uint hashU32(uint x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+uint hashCombine(uint seed, uint value) {
+    return hashU32(seed ^ (value + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+float hashToUnit(uint h) {
+    return float(h >> 8) * (1.0 / 16777216.0);
+}
+
+int groundTexel(ivec2 index) {
+    ivec2 s = clamp(index, ivec2(0), ivec2(uSamples - 1));
+    return (s.y * uSamples) + s.x;
+}
+
+// Height and grass weight of the ground under a world XZ position,
+// interpolated between the chunk's samples
+vec2 ground(vec2 xz) {
+    vec2 p = (xz - uChunkOrigin) / uSpacing;
+    ivec2 s = ivec2(floor(p));
+    vec2 f = p - vec2(s);
+
+    vec2 corners[4];
+    for (int i = 0; i < 4; ++i) {
+        int texel = groundTexel(s + ivec2(i & 1, i >> 1));
+        float height = uintBitsToFloat(texelFetch(uGround, texel).r);
+        uint splat = texelFetch(uGround, uSplatTexel + texel).r;
+        corners[i] = vec2(height, unpackUnorm4x8(splat).r);
+    }
+
+    vec2 row0 = mix(corners[0], corners[1], f.x);
+    vec2 row1 = mix(corners[2], corners[3], f.x);
+    return mix(row0, row1, f.y);
+}
+
+void main() {
+    ivec2 cell = uFirstCell +
+                 ivec2(gl_InstanceID % uCellsWide, gl_InstanceID / uCellsWide);
+    int blade = gl_VertexID / BLADE_VERTICES;
+
+    uint h = hashCombine(hashCombine(uSeed, uint(cell.x)), uint(cell.y));
+    h = hashCombine(h, uint(blade));
+    uint h1 = hashU32(h);
+    uint h2 = hashU32(h1);
+    uint h3 = hashU32(h2);
+    uint h4 = hashU32(h3);
+    uint h5 = hashU32(h4);
+
+    float cellSize = uGrass.x;
+    vec2 xz = (vec2(cell) + vec2(hashToUnit(h1), hashToUnit(h2))) * cellSize;
+    vec2 g = ground(xz);
+
+    // Fewer blades on less grassy ground, and towards the edge
+    float dist = distance(vec3(xz.x, g.x, xz.y), uEyePos);
+    float thinning = 1.0 - smoothstep(0.6 * uGrass.y, uGrass.y, dist);
+    if (hashToUnit(h) >= g.y * thinning) {
+        // A point outside the clip volume, so the blade has no area
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        normal = vec3(0.0, 1.0, 0.0);
+        color = vec3(0.0);
+        return;
+    }
+
+    // The blade is a strip of seven vertices, two a level and then the
+    // tip, cut into five triangles
+    int corner = gl_VertexID % BLADE_VERTICES;
+    int strip = (corner / 3) + (corner % 3);
+    float t = float(strip / 2) / 3.0;
+    float side = ((strip & 1) == 0) ? -0.5 : 0.5;
+
+    float angle = hashToUnit(h3) * 6.28318531;
+    vec3 facing = vec3(cos(angle), 0.0, sin(angle));
+    vec3 across = vec3(-facing.z, 0.0, facing.x);
+
+    float height = uGrass.z * mix(0.5, 1.0, hashToUnit(h4));
+    float width = uGrass.w * (1.0 - t);
+    float bend = hashToUnit(h5) * 0.5;
+
+    vec3 world = vec3(xz.x, g.x, xz.y) + (across * (side * width)) +
+                 (facing * (bend * height * t * t)) +
+                 vec3(0.0, height * t, 0.0);
+
+    // Lit mostly as the ground is, so blades don't flicker as they turn
+    normal = normalize(vec3(0.0, 1.5, 0.0) + facing);
+    color = mix(baseColor, tipColor, t) * mix(0.8, 1.2, hashToUnit(h2));
+
+    gl_Position = uPersp * uView * vec4(world, 1.0);
+}
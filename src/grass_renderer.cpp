@@ -0,0 +1,171 @@
+#include "grass_renderer.hpp"
+
+#include "chunk_manager.hpp"
+#include "frustum.hpp"
+#include "util.hpp"
+
+#include <glad/glad.h>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+// Texture unit the chunks' vertex data is read through
+static const GLuint GROUND_UNIT = 7;
+
+// Each blade is five triangles: two quads and a tip. Must match
+// grass.vert.
+static const GLsizei BLADE_VERTICES = 15;
+
+GrassRenderer::GrassRenderer(Params p) : params(p) {
+    if (!(params.radius > 0.0f) || !(params.cell_size > 0.0f) ||
+        params.blades == 0) {
+        std::string err_msg = "Bad grass: radius ";
+        err_msg.append(std::to_string(params.radius));
+        err_msg.append(", cells of ");
+        err_msg.append(std::to_string(params.cell_size));
+        err_msg.append(", ");
+        err_msg.append(std::to_string(params.blades));
+        err_msg.append(" blades each");
+        throw std::invalid_argument(err_msg);
+    }
+}
+
+void GrassRenderer::init() {
+    auto vert = compile_shader("../src/grass.vert", GL_VERTEX_SHADER);
+    auto frag = compile_shader("../src/grass.frag", GL_FRAGMENT_SHADER);
+    program = link_program({vert, frag});
+    glDeleteShader(vert);
+    glDeleteShader(frag);
+
+    glGenVertexArrays(1, &vao);
+}
+
+void GrassRenderer::cleanup() {
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(program);
+}
+
+void GrassRenderer::draw(
+    const ChunkManager &chunks,
+    const ChunkBuilder &builder,
+    const Frustum &frustum,
+    const mat4 &view,
+    const mat4 &perspective,
+    vec3 eye) {
+    blade_count = 0;
+    if (program == 0) {
+        return;
+    }
+
+    glUseProgram(program);
+
+    GLint view_attrib = 3;
+    glUniformMatrix4fv(view_attrib, 1, GL_FALSE, value_ptr(view));
+
+    GLint persp_attrib = 4;
+    glUniformMatrix4fv(persp_attrib, 1, GL_FALSE, value_ptr(perspective));
+
+    GLint eye_pos_attrib = 5;
+    glUniform3fv(eye_pos_attrib, 1, value_ptr(eye));
+
+    float chunk_size = builder.get_chunk_size();
+    int cells = std::max(1, (int)std::lround(chunk_size / params.cell_size));
+    float cell_size = chunk_size / (float)cells;
+
+    GLint grass_attrib = 6;
+    glUniform4f(
+        grass_attrib,
+        cell_size,
+        params.radius,
+        params.blade_height,
+        params.blade_width);
+
+    GLint blades_attrib = 7;
+    glUniform1i(blades_attrib, (GLint)params.blades);
+
+    GLint seed_attrib = 8;
+    glUniform1ui(seed_attrib, params.seed);
+
+    GLint spacing_attrib = 10;
+    glUniform1f(spacing_attrib, builder.get_params().spacing);
+
+    GLint samples_attrib = 13;
+    glUniform1i(samples_attrib, (GLint)CHUNK_SAMPLES);
+
+    GLint splat_texel_attrib = 14;
+    glUniform1i(
+        splat_texel_attrib, (GLint)(CHUNK_SPLAT_OFFSET / sizeof(uint32_t)));
+
+    GLint chunk_origin_attrib = 9;
+    GLint first_cell_attrib = 11;
+    GLint cells_wide_attrib = 12;
+
+    glBindVertexArray(vao);
+    glActiveTexture(GL_TEXTURE0 + GROUND_UNIT);
+
+    // Only the chunks under the square around the eye can have grass
+    ChunkCoord first = builder.coord_at(eye - vec3(params.radius));
+    ChunkCoord last = builder.coord_at(eye + vec3(params.radius));
+    for (int32_t z = first.z; z <= last.z; ++z) {
+        for (int32_t x = first.x; x <= last.x; ++x) {
+            ChunkCoord coord = {x, z};
+            GLuint texture;
+            vec3 box_min;
+            vec3 box_max;
+            if (!chunks.get_vertex_texture(coord, texture, box_min, box_max)) {
+                continue;
+            }
+
+            // The chunk's cells under that square
+            vec2 origin = builder.get_origin(coord);
+            int x0 = (int)std::floor(
+                (eye.x - params.radius - origin.x) / cell_size);
+            int x1 = (int)std::floor(
+                (eye.x + params.radius - origin.x) / cell_size);
+            int z0 = (int)std::floor(
+                (eye.z - params.radius - origin.y) / cell_size);
+            int z1 = (int)std::floor(
+                (eye.z + params.radius - origin.y) / cell_size);
+            x0 = std::max(x0, 0);
+            z0 = std::max(z0, 0);
+            x1 = std::min(x1, cells - 1);
+            z1 = std::min(z1, cells - 1);
+            if (x0 > x1 || z0 > z1) {
+                continue;
+            }
+
+            vec3 lo(
+                origin.x + ((float)x0 * cell_size),
+                box_min.y,
+                origin.y + ((float)z0 * cell_size));
+            vec3 hi(
+                origin.x + ((float)(x1 + 1) * cell_size),
+                box_max.y + params.blade_height,
+                origin.y + ((float)(z1 + 1) * cell_size));
+            if (!frustum.intersects_box(lo, hi)) {
+                continue;
+            }
+
+            int wide = x1 - x0 + 1;
+            int deep = z1 - z0 + 1;
+            glUniform2f(chunk_origin_attrib, origin.x, origin.y);
+            glUniform2i(
+                first_cell_attrib, (x * cells) + x0, (z * cells) + z0);
+            glUniform1i(cells_wide_attrib, wide);
+
+            glBindTexture(GL_TEXTURE_BUFFER, texture);
+            glDrawArraysInstanced(
+                GL_TRIANGLES,
+                0,
+                BLADE_VERTICES * (GLsizei)params.blades,
+                wide * deep);
+            blade_count += (size_t)(wide * deep) * params.blades;
+        }
+    }
+
+    glActiveTexture(GL_TEXTURE0);
+}
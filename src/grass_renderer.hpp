@@ -0,0 +1,99 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstdlib>
+
+using glm::mat4;
+using glm::vec3;
+
+typedef unsigned int GLuint;
+
+class ChunkBuilder;
+class ChunkManager;
+class Frustum;
+
+/**
+ * Grass around the camera, stored nowhere.
+ *
+ * The ground near the camera is split into square cells, a whole
+ * number to a chunk, and every cell grows up to a fixed number of
+ * blades. Everything about a blade (where in its cell it stands, which
+ * way it faces, how tall it is, how it bends, its color) comes from a
+ * hash of its cell's world coordinates and its number in the cell, so
+ * it's the same every frame without being kept anywhere. The vertex
+ * shader makes the blades out of nothing but gl_VertexID and
+ * gl_InstanceID, and stands them on the terrain by reading the chunk's
+ * own heights and splat weights straight from its vertex buffer, see
+ * ChunkManager::get_vertex_texture(). A blade only grows where a hash
+ * falls under the ground's grass weight, thinning out towards the edge
+ * of the grass.
+ *
+ * All the CPU does each frame is one instanced draw per nearby chunk,
+ * over the rectangle of its cells near the camera, so the grass costs
+ * the same memory however big the world gets: none.
+ */
+class GrassRenderer {
+public:
+    struct Params {
+        // Grass grows up to this far from the camera, in world units
+        float radius = 40.0f;
+
+        // Side of a cell, rounded so a whole number fit in a chunk
+        float cell_size = 1.0f;
+
+        // Blades grown by a cell with nothing but grass
+        uint32_t blades = 12;
+
+        // Of the tallest blades, in world units
+        float blade_height = 0.7f;
+        float blade_width = 0.06f;
+
+        uint32_t seed = 0;
+    };
+
+    GrassRenderer() : GrassRenderer(Params()) {}
+
+    explicit GrassRenderer(Params p);
+
+    GrassRenderer(const GrassRenderer &) = delete;
+    GrassRenderer &operator=(const GrassRenderer &) = delete;
+
+    /**
+     * Build the shader program. Needs a GL context.
+     */
+    void init();
+
+    void cleanup();
+
+    /**
+     * Draw the grass on the loaded chunks near the eye. Leaves the
+     * grass program bound.
+     */
+    void draw(
+        const ChunkManager &chunks,
+        const ChunkBuilder &builder,
+        const Frustum &frustum,
+        const mat4 &view,
+        const mat4 &perspective,
+        vec3 eye);
+
+    /**
+     * Blades the last draw() could have grown, before the ground and
+     * the distance thinned them out.
+     */
+    size_t get_blade_count() const {
+        return blade_count;
+    }
+
+private:
+    Params params;
+
+    GLuint program = 0;
+
+    // No vertex data, but drawing still needs a VAO bound
+    GLuint vao = 0;
+
+    size_t blade_count = 0;
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+using glm::vec2;
+using glm::vec3;
+
+using std::vector;
+
+/**
+ * A regular grid of height samples, stored row-major.
+ *
+ * Samples are addressed as (x, y) in grid units; what a grid unit
+ * means in world space is up to whoever owns the heightfield.
+ */
+class Heightfield {
+public:
+    Heightfield() : Heightfield(0, 0) {}
+
+    Heightfield(size_t w, size_t h, float value = 0.0f) :
+        width(w),
+        height(h),
+        heights(w * h, value) {}
+
+    size_t get_width() const {
+        return width;
+    }
+
+    size_t get_height() const {
+        return height;
+    }
+
+    float &at(size_t x, size_t y) {
+        return heights[(y * width) + x];
+    }
+
+    float at(size_t x, size_t y) const {
+        return heights[(y * width) + x];
+    }
+
+    float *data() {
+        return heights.data();
+    }
+
+    const float *data() const {
+        return heights.data();
+    }
+
+    /**
+     * Bilinearly interpolate the height at a fractional grid
+     * position. Positions outside of the grid are clamped to its
+     * edges.
+     */
+    float sample(float x, float y) const {
+        x = std::clamp(x, 0.0f, (float)(width - 1));
+        y = std::clamp(y, 0.0f, (float)(height - 1));
+
+        size_t x0 = std::min((size_t)x, width - 2);
+        size_t y0 = std::min((size_t)y, height - 2);
+        float fx = x - (float)x0;
+        float fy = y - (float)y0;
+
+        const float *row0 = &heights[(y0 * width) + x0];
+        const float *row1 = row0 + width;
+
+        float top = row0[0] + ((row0[1] - row0[0]) * fx);
+        float bottom = row1[0] + ((row1[1] - row1[0]) * fx);
+        return top + ((bottom - top) * fy);
+    }
+
+    /**
+     * Surface normal at a sample, from central differences.
+     *
+     * @param spacing: distance between adjacent samples, in the same
+     * units as the heights
+     */
+    vec3 normal_at(size_t x, size_t y, float spacing = 1.0f) const {
+        size_t xl = (x > 0) ? x - 1 : x;
+        size_t xr = (x + 1 < width) ? x + 1 : x;
+        size_t yd = (y > 0) ? y - 1 : y;
+        size_t yu = (y + 1 < height) ? y + 1 : y;
+
+        float dx = (at(xr, y) - at(xl, y)) / ((float)(xr - xl) * spacing);
+        float dy = (at(x, yu) - at(x, yd)) / ((float)(yu - yd) * spacing);
+
+        return glm::normalize(vec3(-dx, -dy, 1.0f));
+    }
+
+    /**
+     * Lowest and highest sample in the whole grid.
+     */
+    vec2 get_range() const {
+        if (heights.empty()) {
+            throw std::logic_error("range of an empty heightfield");
+        }
+
+        auto minmax = std::minmax_element(heights.begin(), heights.end());
+        return vec2(*minmax.first, *minmax.second);
+    }
+
+private:
+    size_t width;
+    size_t height;
+
+    vector<float> heights;
+};
@@ -0,0 +1,294 @@
+#include "heightfield_codec.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const char MAGIC[4] = {'T', 'F', 'H', 'C'};
+
+// Residuals are bit-packed this many at a time, each block starting
+// with a byte holding its bit width
+static const size_t BLOCK = 16;
+
+struct EncodedHeader {
+    char magic[4];
+    uint16_t width;
+    uint16_t height;
+
+    // Height of a sample is (base + stored value) * step
+    int32_t base;
+    float step;
+};
+
+// Maps small negative and positive residuals to small unsigned values:
+// 0, -1, 1, -2, 2... become 0, 1, 2, 3, 4...
+static inline uint16_t zigzag(uint16_t r) {
+    return (uint16_t)((r << 1) ^ (uint16_t)((int16_t)r >> 15));
+}
+
+static inline uint16_t unzigzag(uint16_t z) {
+    return (uint16_t)((z >> 1) ^ (uint16_t)(0 - (z & 1)));
+}
+
+static void pack_block(const uint16_t *values, vector<uint8_t> &out) {
+    unsigned int all = 0;
+    for (size_t i = 0; i < BLOCK; ++i) {
+        all |= values[i];
+    }
+
+    uint8_t bits = 0;
+    while (all >> bits) {
+        ++bits;
+    }
+    out.push_back(bits);
+
+    // BLOCK * bits is always a whole number of bytes
+    uint64_t acc = 0;
+    unsigned int filled = 0;
+    for (size_t i = 0; i < BLOCK; ++i) {
+        acc |= (uint64_t)values[i] << filled;
+        filled += bits;
+        while (filled >= 8) {
+            out.push_back((uint8_t)acc);
+            acc >>= 8;
+            filled -= 8;
+        }
+    }
+}
+
+static const uint8_t *unpack_block(
+    const uint8_t *in,
+    const uint8_t *end,
+    uint16_t *values) {
+    if (in == end || *in > 16) {
+        throw std::runtime_error("heightfield codec: corrupt block");
+    }
+
+    unsigned int bits = *in++;
+    size_t bytes = (BLOCK * bits) / 8;
+    if ((size_t)(end - in) < bytes) {
+        throw std::runtime_error("heightfield codec: truncated data");
+    }
+
+    if (bits == 0) {
+        std::fill(values, values + BLOCK, (uint16_t)0);
+        return in;
+    }
+
+    uint64_t mask = (1u << bits) - 1;
+    uint64_t acc = 0;
+    unsigned int filled = 0;
+    for (size_t i = 0; i < BLOCK; ++i) {
+        while (filled < bits) {
+            acc |= (uint64_t)*in++ << filled;
+            filled += 8;
+        }
+        values[i] = (uint16_t)(acc & mask);
+        acc >>= bits;
+        filled -= bits;
+    }
+
+    return in;
+}
+
+// Turns one row of zigzagged residuals back into stored values, given
+// the row above (all zeros for the first row). Every value was
+// predicted as left + up - upleft, so
+//     q[x] = q[x - 1] + r[x] + up[x] - up[x - 1]
+// which is a prefix sum of r[x] + up[x] - up[x - 1]. All arithmetic
+// wraps at 16 bits, same as the encoder's.
+static void reconstruct_row(
+    const uint16_t *zigzagged,
+    const uint16_t *up,
+    uint16_t *q,
+    size_t width) {
+    q[0] = (uint16_t)(unzigzag(zigzagged[0]) + up[0]);
+    size_t x = 1;
+
+#ifdef __SSE2__
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i carry = _mm_set1_epi16((short)q[0]);
+
+    for (; x + 8 <= width; x += 8) {
+        __m128i z = _mm_loadu_si128((const __m128i *)(zigzagged + x));
+        __m128i r = _mm_xor_si128(
+            _mm_srli_epi16(z, 1), _mm_sub_epi16(zero, _mm_and_si128(z, one)));
+
+        __m128i u = _mm_loadu_si128((const __m128i *)(up + x));
+        __m128i ul = _mm_loadu_si128((const __m128i *)(up + x - 1));
+        __m128i d = _mm_add_epi16(r, _mm_sub_epi16(u, ul));
+
+        // Log-step prefix sum across the 8 lanes
+        d = _mm_add_epi16(d, _mm_slli_si128(d, 2));
+        d = _mm_add_epi16(d, _mm_slli_si128(d, 4));
+        d = _mm_add_epi16(d, _mm_slli_si128(d, 8));
+        __m128i v = _mm_add_epi16(d, carry);
+        _mm_storeu_si128((__m128i *)(q + x), v);
+
+        // Broadcast the last lane as the next carry
+        carry = _mm_unpackhi_epi64(v, v);
+        carry = _mm_shufflehi_epi16(carry, 0xFF);
+        carry = _mm_shufflelo_epi16(carry, 0xFF);
+    }
+#endif
+
+    for (; x < width; ++x) {
+        uint16_t d = (uint16_t)(unzigzag(zigzagged[x]) + up[x] - up[x - 1]);
+        q[x] = (uint16_t)(q[x - 1] + d);
+    }
+}
+
+static void dequantize_row(
+    const uint16_t *q,
+    float *out,
+    size_t width,
+    int32_t base,
+    float step) {
+    size_t x = 0;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i vbase = _mm_set1_epi32(base);
+    const __m128 vstep = _mm_set1_ps(step);
+
+    for (; x + 8 <= width; x += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(q + x));
+        __m128i lo = _mm_add_epi32(_mm_unpacklo_epi16(v, zero), vbase);
+        __m128i hi = _mm_add_epi32(_mm_unpackhi_epi16(v, zero), vbase);
+        _mm_storeu_ps(out + x, _mm_mul_ps(_mm_cvtepi32_ps(lo), vstep));
+        _mm_storeu_ps(out + x + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), vstep));
+    }
+#endif
+
+    for (; x < width; ++x) {
+        out[x] = (float)(base + (int32_t)q[x]) * step;
+    }
+}
+
+HeightfieldCodec::HeightfieldCodec(Params p) : params(p) {
+    if (!(params.precision > 0.0f)) {
+        throw std::invalid_argument(
+            "heightfield codec precision must be positive");
+    }
+}
+
+void HeightfieldCodec::encode(
+    const Heightfield &hf,
+    vector<uint8_t> &out) const {
+    size_t width = hf.get_width();
+    size_t height = hf.get_height();
+    size_t count = width * height;
+
+    if (width == 0 || height == 0 || width > UINT16_MAX ||
+        height > UINT16_MAX) {
+        throw std::invalid_argument(
+            "heightfield codec: unsupported size " + std::to_string(width) +
+            "x" + std::to_string(height));
+    }
+
+    vec2 range = hf.get_range();
+    if (!std::isfinite(range.x) || !std::isfinite(range.y)) {
+        throw std::invalid_argument("heightfield codec: non-finite height");
+    }
+
+    // Coarsen the step until the range fits in 16 bits (with some room
+    // for rounding), and the rounded heights easily fit in an int32
+    float step = params.precision;
+    float extent = std::max(std::abs(range.x), std::abs(range.y));
+    while ((range.y - range.x) / step > 65000.0f || extent / step > 1e9f) {
+        step *= 2.0f;
+    }
+
+    vector<int32_t> rounded(count);
+    const float *h = hf.data();
+    for (size_t i = 0; i < count; ++i) {
+        rounded[i] = (int32_t)std::lround(h[i] / step);
+    }
+    int32_t base = *std::min_element(rounded.begin(), rounded.end());
+
+    EncodedHeader header;
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.width = (uint16_t)width;
+    header.height = (uint16_t)height;
+    header.base = base;
+    header.step = step;
+
+    const uint8_t *header_bytes = (const uint8_t *)&header;
+    out.insert(out.end(), header_bytes, header_bytes + sizeof(header));
+
+    // Residuals for the whole grid, padded to a whole number of blocks
+    vector<uint16_t> residuals(((count + BLOCK - 1) / BLOCK) * BLOCK, 0);
+    auto q = [&](size_t x, size_t y) {
+        return (uint16_t)(rounded[(y * width) + x] - base);
+    };
+
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t x = 0; x < width; ++x) {
+            uint16_t left = (x > 0) ? q(x - 1, y) : 0;
+            uint16_t up = (y > 0) ? q(x, y - 1) : 0;
+            uint16_t upleft = (x > 0 && y > 0) ? q(x - 1, y - 1) : 0;
+
+            uint16_t predicted = (uint16_t)(left + up - upleft);
+            uint16_t r = (uint16_t)(q(x, y) - predicted);
+            residuals[(y * width) + x] = zigzag(r);
+        }
+    }
+
+    for (size_t i = 0; i < residuals.size(); i += BLOCK) {
+        pack_block(&residuals[i], out);
+    }
+}
+
+void HeightfieldCodec::decode(
+    const uint8_t *data,
+    size_t size,
+    Heightfield &out) {
+    EncodedHeader header;
+    if (size < sizeof(header)) {
+        throw std::runtime_error("heightfield codec: truncated header");
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        throw std::runtime_error("heightfield codec: bad magic");
+    }
+
+    size_t width = header.width;
+    size_t height = header.height;
+    size_t count = width * height;
+    if (count == 0) {
+        throw std::runtime_error("heightfield codec: empty heightfield");
+    }
+
+    // Every block takes at least its bit width byte
+    size_t blocks = (count + BLOCK - 1) / BLOCK;
+    if (size - sizeof(header) < blocks) {
+        throw std::runtime_error("heightfield codec: truncated data");
+    }
+
+    if (out.get_width() != width || out.get_height() != height) {
+        out = Heightfield(width, height);
+    }
+
+    vector<uint16_t> residuals(((count + BLOCK - 1) / BLOCK) * BLOCK);
+    const uint8_t *in = data + sizeof(header);
+    const uint8_t *end = data + size;
+    for (size_t i = 0; i < residuals.size(); i += BLOCK) {
+        in = unpack_block(in, end, &residuals[i]);
+    }
+
+    // The first row is predicted from a row of zeros
+    vector<uint16_t> up(width, 0);
+    vector<uint16_t> row(width);
+    for (size_t y = 0; y < height; ++y) {
+        reconstruct_row(&residuals[y * width], up.data(), row.data(), width);
+        dequantize_row(
+            row.data(), &out.at(0, y), width, header.base, header.step);
+        std::swap(up, row);
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "heightfield.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+using std::vector;
+
+/**
+ * Compact, lossy encoding of heightfields, for storing terrain tiles.
+ *
+ * Heights are rounded to multiples of a fixed precision and stored as
+ * 16-bit offsets from the lowest sample. Each sample is predicted from
+ * its left, upper and upper-left neighbours (exact on any plane), and
+ * the small residuals that remain are bit-packed in blocks of 16, each
+ * block using as many bits as its largest residual needs. Smooth
+ * terrain comes out at a handful of bits per sample.
+ *
+ * Decoding undoes the prediction a row at a time with SIMD prefix
+ * sums when SSE2 is available; the scalar fallback gives identical
+ * results.
+ */
+class HeightfieldCodec {
+public:
+    struct Params {
+        // Heights are rounded to multiples of this. A heightfield that
+        // spans too many multiples for 16 bits is stored with the
+        // smallest power-of-two multiple of it that fits.
+        float precision = 0.01f;
+    };
+
+    HeightfieldCodec() : HeightfieldCodec(Params()) {}
+
+    explicit HeightfieldCodec(Params p);
+
+    /**
+     * Append an encoded heightfield to out.
+     */
+    void encode(const Heightfield &hf, vector<uint8_t> &out) const;
+
+    /**
+     * Decode a heightfield written by encode(). Throws a
+     * std::runtime_error if the data is malformed.
+     *
+     * @param out: resized to fit, so its storage can be reused
+     */
+    static void decode(const uint8_t *data, size_t size, Heightfield &out);
+
+    /**
+     * Round a height exactly the way encode() and decode() do (as
+     * long as the heightfield fits in 16 bits), so that heights used
+     * directly agree bit for bit with ones that went through the
+     * codec.
+     */
+    static float quantize(float height, float precision) {
+        return (float)std::lround(height / precision) * precision;
+    }
+
+private:
+    Params params;
+};
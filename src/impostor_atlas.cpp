@@ -0,0 +1,175 @@
+#include "impostor_atlas.hpp"
+
+#include <glad/glad.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+// Widest atlas we'll ask for, in texels
+static const size_t MAX_ATLAS_SIZE = 8192;
+
+ImpostorAtlas::ImpostorAtlas(Params p) : params(p) {
+    size_t size = params.frames * params.frame_size;
+    if (params.frames == 0 || params.frame_size == 0 ||
+        size > MAX_ATLAS_SIZE) {
+        std::string err_msg = "Bad impostor atlas: ";
+        err_msg.append(std::to_string(params.frames));
+        err_msg.append(" frames of ");
+        err_msg.append(std::to_string(params.frame_size));
+        err_msg.append(" texels");
+        throw std::invalid_argument(err_msg);
+    }
+}
+
+void ImpostorAtlas::bake(const DrawFunction &draw, vec3 center, float radius) {
+    GLsizei size = (GLsizei)(params.frames * params.frame_size);
+
+    // Color and coverage, then normals. Both are cleared to zero, so
+    // they end up premultiplied by coverage and their mipmaps don't
+    // bleed the background into the edges.
+    auto make_texture = [size](GLuint &texture) {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(
+            GL_TEXTURE_2D,
+            0,
+            GL_RGBA8,
+            size,
+            size,
+            0,
+            GL_RGBA,
+            GL_UNSIGNED_BYTE,
+            nullptr);
+        glTexParameteri(
+            GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    };
+    make_texture(color_texture);
+    make_texture(normal_texture);
+
+    glGenRenderbuffers(1, &depth_buffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth_buffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size, size);
+
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(
+        GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color_texture, 0);
+    glFramebufferTexture2D(
+        GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normal_texture, 0);
+    glFramebufferRenderbuffer(
+        GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_buffer);
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        std::string err_msg = "Impostor framebuffer incomplete: ";
+        err_msg.append(std::to_string(status));
+        throw std::runtime_error(err_msg);
+    }
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    GLenum buffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, buffers);
+
+    const GLfloat clear_color[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    const GLfloat clear_depth = 1.0f;
+    glClearBufferfv(GL_COLOR, 0, clear_color);
+    glClearBufferfv(GL_COLOR, 1, clear_color);
+    glClearBufferfv(GL_DEPTH, 0, &clear_depth);
+
+    // The whole bounding sphere fits in every frame
+    mat4 projection =
+        glm::ortho(-radius, radius, -radius, radius, radius, 3.0f * radius);
+
+    GLsizei frame_size = (GLsizei)params.frame_size;
+    for (size_t y = 0; y < params.frames; ++y) {
+        for (size_t x = 0; x < params.frames; ++x) {
+            vec3 dir = get_frame_direction(x, y);
+            vec3 right;
+            vec3 up;
+            get_basis(dir, right, up);
+
+            // Looking back along dir from outside the sphere, with the
+            // picture's axes lined up with right and up
+            vec3 eye = center + (dir * (2.0f * radius));
+            mat4 view(1.0f);
+            for (int i = 0; i < 3; ++i) {
+                view[i][0] = right[i];
+                view[i][1] = up[i];
+                view[i][2] = dir[i];
+            }
+            view[3][0] = -glm::dot(right, eye);
+            view[3][1] = -glm::dot(up, eye);
+            view[3][2] = -glm::dot(dir, eye);
+
+            glViewport(
+                (GLint)x * frame_size,
+                (GLint)y * frame_size,
+                frame_size,
+                frame_size);
+            draw(view, projection);
+        }
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+    glBindTexture(GL_TEXTURE_2D, color_texture);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, normal_texture);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void ImpostorAtlas::cleanup() {
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &depth_buffer);
+    glDeleteTextures(1, &normal_texture);
+    glDeleteTextures(1, &color_texture);
+
+    framebuffer = 0;
+    depth_buffer = 0;
+    normal_texture = 0;
+    color_texture = 0;
+}
+
+vec2 ImpostorAtlas::encode(vec3 dir) {
+    dir.y = std::max(dir.y, 0.0f);
+    dir /= std::abs(dir.x) + dir.y + std::abs(dir.z);
+
+    // The diamond |x| + |z| <= 1, turned 45 degrees to fill the square
+    vec2 p(dir.x + dir.z, dir.x - dir.z);
+    return (p * 0.5f) + 0.5f;
+}
+
+vec3 ImpostorAtlas::decode(vec2 uv) {
+    vec2 p = (uv * 2.0f) - 1.0f;
+    float x = (p.x + p.y) * 0.5f;
+    float z = (p.x - p.y) * 0.5f;
+    float y = 1.0f - std::abs(x) - std::abs(z);
+    return glm::normalize(vec3(x, y, z));
+}
+
+vec3 ImpostorAtlas::get_frame_direction(size_t x, size_t y) const {
+    float n = (float)params.frames;
+    return decode(vec2(((float)x + 0.5f) / n, ((float)y + 0.5f) / n));
+}
+
+void ImpostorAtlas::get_basis(vec3 dir, vec3 &right, vec3 &up) {
+    // Straight down the Y axis any horizontal direction will do, as
+    // long as it's always the same one
+    vec3 reference = (std::abs(dir.y) > 0.999f) ? vec3(0.0f, 0.0f, -1.0f)
+                                                : vec3(0.0f, 1.0f, 0.0f);
+    right = glm::normalize(glm::cross(reference, dir));
+    up = glm::cross(dir, right);
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdlib>
+#include <functional>
+
+using glm::mat4;
+using glm::vec2;
+using glm::vec3;
+
+typedef unsigned int GLuint;
+
+/**
+ * Pictures of a model from many directions over the upper hemisphere,
+ * packed into a texture atlas, for drawing it far away as a single
+ * quad (an impostor).
+ *
+ * Directions are laid out with a hemi-octahedral mapping: the upper
+ * hemisphere is folded onto a square, which is cut into frames x
+ * frames equal frames. Each frame is an orthographic view of the model
+ * from the direction through its center, so neighbouring frames are
+ * neighbouring views, and the frame for a direction is a quick lookup
+ * rather than a search. tree_impostor.vert does the same mapping on
+ * the GPU, and has to match the functions here.
+ *
+ * Two atlases are made: the model's color with coverage in alpha,
+ * and its normals in model space, so impostors can be lit like the
+ * real thing.
+ */
+class ImpostorAtlas {
+public:
+    struct Params {
+        // Frames along each side of the atlas
+        size_t frames = 8;
+
+        // Width and height of each frame, in texels
+        size_t frame_size = 128;
+    };
+
+    /**
+     * Draws the model with the given view and projection, writing its
+     * color to the first draw buffer and its normal, packed into
+     * [0, 1], to the second.
+     */
+    typedef std::function<void(const mat4 &view, const mat4 &projection)>
+        DrawFunction;
+
+    ImpostorAtlas() : ImpostorAtlas(Params()) {}
+
+    explicit ImpostorAtlas(Params p);
+
+    ImpostorAtlas(const ImpostorAtlas &) = delete;
+    ImpostorAtlas &operator=(const ImpostorAtlas &) = delete;
+
+    /**
+     * Render every frame. Needs a GL context; leaves the default
+     * framebuffer bound, with its viewport as it was.
+     *
+     * @param center: center of the model's bounding sphere
+     * @param radius: radius of the model's bounding sphere
+     */
+    void bake(const DrawFunction &draw, vec3 center, float radius);
+
+    void cleanup();
+
+    const Params &get_params() const {
+        return params;
+    }
+
+    GLuint get_color_texture() const {
+        return color_texture;
+    }
+
+    GLuint get_normal_texture() const {
+        return normal_texture;
+    }
+
+    /**
+     * Map a direction with y >= 0 onto [0, 1]^2.
+     */
+    static vec2 encode(vec3 dir);
+
+    /**
+     * Map a point of [0, 1]^2 back to a unit direction, y >= 0.
+     */
+    static vec3 decode(vec2 uv);
+
+    /**
+     * The direction a frame was rendered from, pointing from the model
+     * towards the camera.
+     */
+    vec3 get_frame_direction(size_t x, size_t y) const;
+
+    /**
+     * The right and up axes of the picture seen from a direction.
+     */
+    static void get_basis(vec3 dir, vec3 &right, vec3 &up);
+
+private:
+    Params params;
+
+    GLuint framebuffer = 0;
+    GLuint color_texture = 0;
+    GLuint normal_texture = 0;
+    GLuint depth_buffer = 0;
+};
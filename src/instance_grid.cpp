@@ -0,0 +1,452 @@
+#include "instance_grid.hpp"
+
+#include "frustum.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstddef>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+// A bit for each of a frustum's six planes
+static const unsigned ALL_PLANES = 0x3f;
+
+/**
+ * Interleave the bits of x and z, x in the even ones.
+ */
+static uint32_t morton(uint32_t x, uint32_t z) {
+    uint32_t m = 0;
+    for (uint32_t bit = 0; bit < 16; ++bit) {
+        m |= ((x >> bit) & 1u) << (2 * bit);
+        m |= ((z >> bit) & 1u) << ((2 * bit) + 1);
+    }
+    return m;
+}
+
+static void unmorton(uint32_t m, uint32_t &x, uint32_t &z) {
+    x = 0;
+    z = 0;
+    for (uint32_t bit = 0; bit < 16; ++bit) {
+        x |= ((m >> (2 * bit)) & 1u) << bit;
+        z |= ((m >> ((2 * bit) + 1)) & 1u) << bit;
+    }
+}
+
+/**
+ * Where a level of a quadtree starts, stored a level at a time.
+ */
+static size_t level_offset(size_t level) {
+    return (((size_t)1 << (2 * level)) - 1) / 3;
+}
+
+/**
+ * Add instances to a query_frustum() result, lengthening the last span
+ * if they carry on from it.
+ */
+static void add_span(
+    vector<InstanceSpan> &out,
+    const TreeInstance *first,
+    size_t count,
+    bool inside) {
+    if (!out.empty()) {
+        InstanceSpan &last = out.back();
+        if (last.inside == inside && last.first + last.count == first) {
+            last.count += count;
+            return;
+        }
+    }
+    out.push_back({first, count, inside});
+}
+
+InstanceGrid::InstanceGrid(float size, size_t c) :
+    chunk_size(size),
+    cells(c),
+    cell_size(size / (float)c) {
+    bool power_of_two = c > 0 && (c & (c - 1)) == 0;
+    if (!(size > 0.0f) || !power_of_two || c > 256) {
+        std::string err_msg = "Bad instance grid: chunk size ";
+        err_msg.append(std::to_string(size));
+        err_msg.append(", ");
+        err_msg.append(std::to_string(c));
+        err_msg.append(" cells");
+        throw std::invalid_argument(err_msg);
+    }
+
+    levels = 1;
+    while (((size_t)1 << (levels - 1)) < cells) {
+        ++levels;
+    }
+    first_cell = level_offset(levels - 1);
+}
+
+template <typename Fn>
+void InstanceGrid::for_each_cell(vec2 lo, vec2 hi, Fn fn) const {
+    float inv_chunk = 1.0f / chunk_size;
+    int32_t first_x = (int32_t)std::floor(lo.x * inv_chunk);
+    int32_t first_z = (int32_t)std::floor(lo.y * inv_chunk);
+    int32_t last_x = (int32_t)std::floor(hi.x * inv_chunk);
+    int32_t last_z = (int32_t)std::floor(hi.y * inv_chunk);
+
+    float inv_cell = 1.0f / cell_size;
+    int last = (int)cells - 1;
+
+    // Returns false once fn has asked to stop
+    auto visit = [&](const Chunk &chunk) {
+        int x0 = (int)std::floor((lo.x - chunk.origin.x) * inv_cell);
+        int z0 = (int)std::floor((lo.y - chunk.origin.y) * inv_cell);
+        int x1 = (int)std::floor((hi.x - chunk.origin.x) * inv_cell);
+        int z1 = (int)std::floor((hi.y - chunk.origin.y) * inv_cell);
+        x0 = std::max(x0, 0);
+        z0 = std::max(z0, 0);
+        x1 = std::min(x1, last);
+        z1 = std::min(z1, last);
+
+        for (int cz = z0; cz <= z1; ++cz) {
+            for (int cx = x0; cx <= x1; ++cx) {
+                uint32_t c = morton((uint32_t)cx, (uint32_t)cz);
+                const Node &cell = chunk.nodes[first_cell + c];
+                if (cell.count > 0 && !fn(chunk, cell)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    };
+
+    // Big rectangles can cover far more chunks than are loaded; look
+    // at the loaded ones instead then
+    size_t span_x = (size_t)((int64_t)last_x - first_x + 1);
+    size_t span_z = (size_t)((int64_t)last_z - first_z + 1);
+    if (span_x * span_z > chunks.size()) {
+        for (const auto &entry : chunks) {
+            ChunkCoord c = entry.first;
+            if (c.x < first_x || c.x > last_x || c.z < first_z ||
+                c.z > last_z) {
+                continue;
+            }
+            if (!visit(entry.second)) {
+                return;
+            }
+        }
+        return;
+    }
+
+    for (int32_t z = first_z; z <= last_z; ++z) {
+        for (int32_t x = first_x; x <= last_x; ++x) {
+            auto it = chunks.find({x, z});
+            if (it != chunks.end() && !visit(it->second)) {
+                return;
+            }
+        }
+    }
+}
+
+void InstanceGrid::insert(ChunkCoord coord, vector<TreeInstance> instances) {
+    add_chunk(coord, std::move(instances));
+    build_top();
+}
+
+void InstanceGrid::insert_all(
+    vector<std::pair<ChunkCoord, vector<TreeInstance>>> batch) {
+    for (auto &entry : batch) {
+        add_chunk(entry.first, std::move(entry.second));
+    }
+    build_top();
+}
+
+void InstanceGrid::add_chunk(
+    ChunkCoord coord,
+    vector<TreeInstance> instances) {
+    auto it = chunks.find(coord);
+    if (it != chunks.end()) {
+        count -= it->second.instances.size();
+        chunks.erase(it);
+    }
+    if (instances.empty()) {
+        return;
+    }
+
+    Chunk chunk;
+    chunk.origin = vec2((float)coord.x, (float)coord.z) * chunk_size;
+    chunk.nodes.assign(level_offset(levels), {0, 0, FLT_MAX, -FLT_MAX});
+    Node *leaves = &chunk.nodes[first_cell];
+
+    // Counting sort by cell: count, turn the counts into offsets, then
+    // drop every instance into its place
+    float inv_cell = 1.0f / cell_size;
+    int last = (int)cells - 1;
+    vector<uint32_t> cell_of(instances.size());
+    for (size_t i = 0; i < instances.size(); ++i) {
+        vec3 p = instances[i].position;
+        int cx = (int)std::floor((p.x - chunk.origin.x) * inv_cell);
+        int cz = (int)std::floor((p.z - chunk.origin.y) * inv_cell);
+        cx = std::min(std::max(cx, 0), last);
+        cz = std::min(std::max(cz, 0), last);
+
+        uint32_t c = morton((uint32_t)cx, (uint32_t)cz);
+        cell_of[i] = c;
+
+        Node &cell = leaves[c];
+        cell.count += 1;
+        cell.min_y = std::min(cell.min_y, p.y);
+        cell.max_y = std::max(cell.max_y, p.y);
+    }
+
+    size_t cell_count = cells * cells;
+    uint32_t offset = 0;
+    for (size_t c = 0; c < cell_count; ++c) {
+        leaves[c].first = offset;
+        offset += leaves[c].count;
+    }
+
+    chunk.instances.resize(instances.size());
+    vector<uint32_t> next(cell_count);
+    for (size_t c = 0; c < cell_count; ++c) {
+        next[c] = leaves[c].first;
+    }
+    for (size_t i = 0; i < instances.size(); ++i) {
+        chunk.instances[next[cell_of[i]]++] = instances[i];
+    }
+
+    // Each node above the cells covers its four children, which come
+    // one after the other in memory
+    for (size_t level = levels - 1; level-- > 0;) {
+        Node *nodes = &chunk.nodes[level_offset(level)];
+        const Node *children = &chunk.nodes[level_offset(level + 1)];
+        size_t width = (size_t)1 << (2 * level);
+        for (size_t n = 0; n < width; ++n) {
+            Node &node = nodes[n];
+            node.first = children[4 * n].first;
+            for (size_t k = 0; k < 4; ++k) {
+                const Node &child = children[(4 * n) + k];
+                node.count += child.count;
+                node.min_y = std::min(node.min_y, child.min_y);
+                node.max_y = std::max(node.max_y, child.max_y);
+            }
+        }
+    }
+
+    count += chunk.instances.size();
+    chunks.emplace(coord, std::move(chunk));
+}
+
+void InstanceGrid::remove(ChunkCoord coord) {
+    auto it = chunks.find(coord);
+    if (it != chunks.end()) {
+        count -= it->second.instances.size();
+        chunks.erase(it);
+        build_top();
+    }
+}
+
+void InstanceGrid::clear() {
+    chunks.clear();
+    top_nodes.clear();
+    top_chunks.clear();
+    count = 0;
+}
+
+const vector<TreeInstance> *InstanceGrid::find(ChunkCoord coord) const {
+    auto it = chunks.find(coord);
+    return (it != chunks.end()) ? &it->second.instances : nullptr;
+}
+
+void InstanceGrid::query_radius(
+    vec2 xz,
+    float radius,
+    vector<const TreeInstance *> &out) const {
+    out.clear();
+
+    float radius_sq = radius * radius;
+    for_each_cell(
+        xz - radius, xz + radius, [&](const Chunk &chunk, const Node &cell) {
+            const TreeInstance *first = &chunk.instances[cell.first];
+            for (uint32_t i = 0; i < cell.count; ++i) {
+                vec3 p = first[i].position;
+                vec2 d = vec2(p.x, p.z) - xz;
+                if (glm::dot(d, d) <= radius_sq) {
+                    out.push_back(&first[i]);
+                }
+            }
+            return true;
+        });
+}
+
+void InstanceGrid::query_box(
+    vec3 min,
+    vec3 max,
+    vector<const TreeInstance *> &out) const {
+    out.clear();
+
+    vec2 lo(min.x, min.z);
+    vec2 hi(max.x, max.z);
+    for_each_cell(lo, hi, [&](const Chunk &chunk, const Node &cell) {
+        if (cell.max_y < min.y || cell.min_y > max.y) {
+            return true;
+        }
+
+        const TreeInstance *first = &chunk.instances[cell.first];
+        for (uint32_t i = 0; i < cell.count; ++i) {
+            vec3 p = first[i].position;
+            if (p.x >= min.x && p.y >= min.y && p.z >= min.z &&
+                p.x <= max.x && p.y <= max.y && p.z <= max.z) {
+                out.push_back(&first[i]);
+            }
+        }
+        return true;
+    });
+}
+
+bool InstanceGrid::any_within(vec2 xz, float radius) const {
+    float radius_sq = radius * radius;
+    bool found = false;
+    for_each_cell(
+        xz - radius, xz + radius, [&](const Chunk &chunk, const Node &cell) {
+            const TreeInstance *first = &chunk.instances[cell.first];
+            for (uint32_t i = 0; i < cell.count; ++i) {
+                vec3 p = first[i].position;
+                vec2 d = vec2(p.x, p.z) - xz;
+                if (glm::dot(d, d) <= radius_sq) {
+                    found = true;
+                    return false;
+                }
+            }
+            return true;
+        });
+    return found;
+}
+
+void InstanceGrid::query_frustum(
+    const Frustum &frustum,
+    float reach,
+    vector<InstanceSpan> &out) const {
+    out.clear();
+    if (top_nodes.empty()) {
+        return;
+    }
+
+    // Nodes to visit, with the planes they still straddle
+    vector<std::pair<uint32_t, unsigned>> stack = {{0, ALL_PLANES}};
+    vec3 margin(reach);
+    while (!stack.empty()) {
+        uint32_t index = stack.back().first;
+        unsigned mask = stack.back().second;
+        stack.pop_back();
+
+        const TopNode &node = top_nodes[index];
+        if (!frustum.cull_box(node.min - margin, node.max + margin, mask)) {
+            continue;
+        }
+
+        if (mask == 0) {
+            for (uint32_t i = 0; i < node.count; ++i) {
+                const Chunk &chunk = *top_chunks[node.first + i];
+                add_span(
+                    out,
+                    chunk.instances.data(),
+                    chunk.instances.size(),
+                    true);
+            }
+        } else if (node.count == 1) {
+            query_node(
+                frustum, margin, *top_chunks[node.first], 0, 0, mask, out);
+        } else {
+            stack.push_back({node.children[1], mask});
+            stack.push_back({node.children[0], mask});
+        }
+    }
+}
+
+void InstanceGrid::build_top() {
+    top_nodes.clear();
+    top_chunks.clear();
+    for (const auto &entry : chunks) {
+        top_chunks.push_back(&entry.second);
+    }
+
+    if (!top_chunks.empty()) {
+        build_top_node(0, top_chunks.size());
+    }
+}
+
+uint32_t InstanceGrid::build_top_node(size_t first, size_t n) {
+    uint32_t index = (uint32_t)top_nodes.size();
+    top_nodes.push_back({});
+
+    vec3 lo(FLT_MAX);
+    vec3 hi(-FLT_MAX);
+    for (size_t i = first; i < first + n; ++i) {
+        const Chunk &chunk = *top_chunks[i];
+        const Node &root = chunk.nodes[0];
+        lo = glm::min(lo, vec3(chunk.origin.x, root.min_y, chunk.origin.y));
+        hi = glm::max(
+            hi,
+            vec3(
+                chunk.origin.x + chunk_size,
+                root.max_y,
+                chunk.origin.y + chunk_size));
+    }
+
+    TopNode node = {lo, hi, (uint32_t)first, (uint32_t)n, {0, 0}};
+    if (n > 1) {
+        // Halve along whichever of X and Z is longer
+        int axis = (hi.x - lo.x >= hi.z - lo.z) ? 0 : 2;
+        auto begin = top_chunks.begin() + (ptrdiff_t)first;
+        auto middle = begin + (ptrdiff_t)(n / 2);
+        std::nth_element(
+            begin,
+            middle,
+            begin + (ptrdiff_t)n,
+            [axis](const Chunk *lhs, const Chunk *rhs) {
+                return (axis == 0) ? lhs->origin.x < rhs->origin.x
+                                   : lhs->origin.y < rhs->origin.y;
+            });
+
+        node.children[0] = build_top_node(first, n / 2);
+        node.children[1] = build_top_node(first + (n / 2), n - (n / 2));
+    }
+
+    top_nodes[index] = node;
+    return index;
+}
+
+void InstanceGrid::query_node(
+    const Frustum &frustum,
+    vec3 margin,
+    const Chunk &chunk,
+    size_t level,
+    uint32_t code,
+    unsigned mask,
+    vector<InstanceSpan> &out) const {
+    const Node &node = chunk.nodes[level_offset(level) + code];
+    if (node.count == 0) {
+        return;
+    }
+
+    uint32_t x;
+    uint32_t z;
+    unmorton(code, x, z);
+    float side = cell_size * (float)(cells >> level);
+
+    vec3 lo(
+        chunk.origin.x + ((float)x * side),
+        node.min_y,
+        chunk.origin.y + ((float)z * side));
+    vec3 hi = lo + vec3(side, 0.0f, side);
+    hi.y = node.max_y;
+    if (!frustum.cull_box(lo - margin, hi + margin, mask)) {
+        return;
+    }
+
+    if (mask == 0 || level + 1 == levels) {
+        add_span(out, &chunk.instances[node.first], node.count, mask == 0);
+        return;
+    }
+
+    for (uint32_t k = 0; k < 4; ++k) {
+        query_node(
+            frustum, margin, chunk, level + 1, (code * 4) + k, mask, out);
+    }
+}
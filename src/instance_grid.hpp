@@ -0,0 +1,219 @@
+#pragma once
+
+#include "chunk.hpp"
+#include "tree_instance.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstdlib>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using glm::vec2;
+using glm::vec3;
+
+using std::vector;
+
+class Frustum;
+
+/**
+ * A run of instances next to each other in memory.
+ */
+struct InstanceSpan {
+    const TreeInstance *first;
+    size_t count;
+
+    // Whether they're all known to be in view, so don't need testing
+    bool inside;
+};
+
+/**
+ * A uniform grid over the instances placed on the loaded chunks, for
+ * finding the ones near a point, in a box or in view without looking
+ * at all of them.
+ *
+ * Instances are added and removed a whole chunk at a time, as chunks
+ * load and unload. Each chunk is split into a fixed number of cells a
+ * side, and its instances are sorted by cell with a counting sort, so
+ * a cell is just a range of the chunk's array: no per-instance
+ * allocations, and a query only touches the chunks and cells it
+ * overlaps.
+ *
+ * For frustum queries the grid doubles as a bounding volume hierarchy.
+ * Cells are numbered in Morton order, so each block of 2x2, 4x4, ...
+ * cells is also one range of instances, and a chunk's cells form a
+ * quadtree of boxes fitted to their instances' heights. Above the
+ * chunks is a binary tree of chunk boxes, rebuilt whenever a chunk is
+ * inserted or removed; it only has a node per chunk, so that's cheap,
+ * and the chunks' own trees are built once, on insertion. Queries walk
+ * down from the top, dropping boxes outside the frustum and taking
+ * boxes inside it whole, without looking further down, so their cost
+ * grows with what's on screen rather than with the whole forest.
+ *
+ * Instances must lie inside the chunk they're added with (in XZ);
+ * ones that don't are put in its nearest cell and may be missed by
+ * queries.
+ */
+class InstanceGrid {
+public:
+    explicit InstanceGrid(float size) : InstanceGrid(size, 8) {}
+
+    /**
+     * @param chunk_size: width of a chunk, in world units
+     * @param cells: cells along each side of a chunk, a power of two
+     */
+    InstanceGrid(float chunk_size, size_t cells);
+
+    /**
+     * Add a chunk's instances, replacing any it already had. They're
+     * reordered by cell.
+     */
+    void insert(ChunkCoord coord, vector<TreeInstance> instances);
+
+    /**
+     * Add several chunks' instances as insert() would, but only
+     * rebuilding the tree over the chunks once.
+     */
+    void insert_all(vector<std::pair<ChunkCoord, vector<TreeInstance>>> batch);
+
+    void remove(ChunkCoord coord);
+
+    void clear();
+
+    /**
+     * The instances of a chunk, in cell order, or nullptr if it has
+     * none.
+     */
+    const vector<TreeInstance> *find(ChunkCoord coord) const;
+
+    /**
+     * Number of instances in all chunks.
+     */
+    size_t size() const {
+        return count;
+    }
+
+    /**
+     * Find the instances within a distance of a point, measured in XZ.
+     *
+     * @param out: replaced with the instances found
+     */
+    void query_radius(
+        vec2 xz,
+        float radius,
+        vector<const TreeInstance *> &out) const;
+
+    /**
+     * Find the instances whose positions are in a box.
+     *
+     * @param out: replaced with the instances found
+     */
+    void query_box(
+        vec3 min,
+        vec3 max,
+        vector<const TreeInstance *> &out) const;
+
+    /**
+     * Whether any instance is within a distance of a point, measured in
+     * XZ. Stops at the first one, for spacing checks.
+     */
+    bool any_within(vec2 xz, float radius) const;
+
+    /**
+     * Find the instances that might be in the view frustum. Not exact:
+     * spans that aren't inside it still have to be tested instance by
+     * instance, see TreeRenderer::cull().
+     *
+     * @param reach: how far an instance can stick out from its
+     * position, in any direction
+     * @param out: replaced with the instances found, merging
+     * neighbouring spans where possible
+     */
+    void query_frustum(
+        const Frustum &frustum,
+        float reach,
+        vector<InstanceSpan> &out) const;
+
+private:
+    // A range of a chunk's instances, and their height range
+    struct Node {
+        uint32_t first;
+        uint32_t count;
+        float min_y;
+        float max_y;
+    };
+
+    struct Chunk {
+        vec2 origin;
+        vector<TreeInstance> instances;
+
+        // The chunk's quadtree, a level at a time from the root, each
+        // level in Morton order. The last level is the cells.
+        vector<Node> nodes;
+    };
+
+    // A node of the tree over the chunks, covering a range of
+    // top_chunks. Leaves have no children.
+    struct TopNode {
+        vec3 min;
+        vec3 max;
+        uint32_t first;
+        uint32_t count;
+        uint32_t children[2];
+    };
+
+    float chunk_size;
+    size_t cells;
+    float cell_size;
+
+    // Levels of each chunk's quadtree, and where its cells start
+    size_t levels;
+    size_t first_cell;
+
+    size_t count = 0;
+
+    std::unordered_map<ChunkCoord, Chunk, ChunkCoordHash> chunks;
+
+    vector<TopNode> top_nodes;
+    vector<const Chunk *> top_chunks;
+
+    /**
+     * Add or replace a chunk's instances and build its quadtree, but
+     * leave the tree over the chunks alone.
+     */
+    void add_chunk(ChunkCoord coord, vector<TreeInstance> instances);
+
+    /**
+     * Rebuild the tree over the chunks, after one came or went.
+     */
+    void build_top();
+
+    /**
+     * Split top_chunks[first, first + n) into a subtree.
+     *
+     * @return the index of its root
+     */
+    uint32_t build_top_node(size_t first, size_t n);
+
+    /**
+     * Add a chunk's quadtree node, and its children while they're not
+     * inside the frustum, to a query_frustum() result.
+     */
+    void query_node(
+        const Frustum &frustum,
+        vec3 margin,
+        const Chunk &chunk,
+        size_t level,
+        uint32_t code,
+        unsigned mask,
+        vector<InstanceSpan> &out) const;
+
+    /**
+     * Call fn(chunk, cell) on every non-empty cell overlapping a
+     * rectangle in XZ.
+     */
+    template <typename Fn>
+    void for_each_cell(vec2 lo, vec2 hi, Fn fn) const;
+};
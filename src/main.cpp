@@ -1,10 +1,22 @@
 #include "application.hpp"
+#include "caverns.hpp"
+#include "ocean.hpp"
 
+#include <cstring>
 #include <iostream>
+#include <memory>
+
+int main(int argc, char **argv) {
+    // The heightfield terrain, unless asked for the voxel one
+    std::unique_ptr<Stage> stage;
+    if (argc > 1 && std::strcmp(argv[1], "--caves") == 0) {
+        stage = std::make_unique<Caverns>();
+    } else {
+        stage = std::make_unique<Ocean>();
+    }
 
-int main() {
     try {
-        Application::run();
+        Application::run(std::move(stage));
     } catch (const std::exception &e) {
         std::cerr << e.what() << std::endl;
         return EXIT_FAILURE;
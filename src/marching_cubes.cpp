@@ -0,0 +1,262 @@
+#include "marching_cubes.hpp"
+
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+
+using std::array;
+
+// Cube corner i is at (i & 1, (i >> 1) & 1, (i >> 2) & 1). Edge e runs
+// along axis e / 4, from the corner with that axis' bit clear and the
+// other two bits taken from e % 4.
+
+/**
+ * The corner edge e starts from.
+ */
+static int edge_start(int e) {
+    int axis = e / 4;
+    int k = e % 4;
+    int low = k & ((1 << axis) - 1);
+    int high = (k >> axis) << (axis + 1);
+    return low | high;
+}
+
+/**
+ * The edge between two corners that differ along one axis.
+ */
+static int edge_between(int a, int b) {
+    int diff = a ^ b;
+    int axis = (diff == 1) ? 0 : (diff == 2) ? 1 : 2;
+    int start = a & b;
+    int low = start & ((1 << axis) - 1);
+    int high = (start >> (axis + 1)) << axis;
+    return (axis * 4) + (low | high);
+}
+
+/**
+ * Which of the cube's faces edge e lies on, as bits axis * 2 + side.
+ */
+static int edge_faces(int e) {
+    int axis = e / 4;
+    int start = edge_start(e);
+    int faces = 0;
+    for (int other = 0; other < 3; ++other) {
+        if (other != axis) {
+            faces |= 1 << ((other * 2) + ((start >> other) & 1));
+        }
+    }
+    return faces;
+}
+
+namespace {
+
+struct CaseTable {
+    // Up to 4 separate pieces of surface of up to 12 edges each, fan
+    // triangulated, though no case needs more than 5 triangles
+    static constexpr size_t MAX_INDICES = 15;
+
+    array<uint8_t, 256> counts;
+    array<array<uint8_t, MAX_INDICES>, 256> edges;
+
+    CaseTable() {
+        for (int c = 0; c < 256; ++c) {
+            build(c);
+        }
+    }
+
+    void build(int c) {
+        auto inside = [c](int corner) { return ((c >> corner) & 1) != 0; };
+
+        // On every face, in counter-clockwise order seen from outside
+        // the cube, join the edge where the corners go from outside to
+        // inside to the next edge where they go back out. Going round
+        // every face like that, each crossed edge is entered from one
+        // face and left through the other.
+        array<int, 12> next;
+        next.fill(-1);
+        for (int axis = 0; axis < 3; ++axis) {
+            int u = (axis + 1) % 3;
+            int v = (axis + 2) % 3;
+            for (int side = 0; side < 2; ++side) {
+                array<int, 4> face;
+                int order[4][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+                for (int i = 0; i < 4; ++i) {
+                    // Counter-clockwise seen from +axis; flipped for
+                    // the face on the negative side
+                    int j = (side == 1) ? i : 3 - i;
+                    face[(size_t)i] = (side << axis) | (order[j][0] << u) |
+                                      (order[j][1] << v);
+                }
+
+                for (int i = 0; i < 4; ++i) {
+                    int a = face[(size_t)i];
+                    int b = face[(size_t)((i + 1) % 4)];
+                    if (inside(a) || !inside(b)) {
+                        continue;
+                    }
+
+                    int j = (i + 1) % 4;
+                    while (inside(face[(size_t)((j + 1) % 4)])) {
+                        j = (j + 1) % 4;
+                    }
+                    int exit = edge_between(
+                        face[(size_t)j], face[(size_t)((j + 1) % 4)]);
+                    next[(size_t)edge_between(a, b)] = exit;
+                }
+            }
+        }
+
+        // Follow each loop of edges and fan it into triangles
+        size_t count = 0;
+        array<bool, 12> visited;
+        visited.fill(false);
+        for (int first = 0; first < 12; ++first) {
+            if (next[(size_t)first] < 0 || visited[(size_t)first]) {
+                continue;
+            }
+
+            array<int, 12> loop;
+            size_t length = 0;
+            for (int e = first; !visited[(size_t)e]; e = next[(size_t)e]) {
+                visited[(size_t)e] = true;
+                loop[length++] = e;
+            }
+
+            // Fan out from a vertex none of whose diagonals lie on one
+            // of the cube's faces, or the cube next door could put an
+            // edge in the same place
+            size_t start = 0;
+            for (size_t k = 0; k < length; ++k) {
+                int faces = edge_faces(loop[k]);
+                bool flat = false;
+                for (size_t i = 2; i + 1 < length; ++i) {
+                    flat = flat ||
+                           (faces & edge_faces(loop[(k + i) % length])) != 0;
+                }
+                if (!flat) {
+                    start = k;
+                    break;
+                }
+            }
+
+            for (size_t i = 1; i + 1 < length; ++i) {
+                if (count + 3 > MAX_INDICES) {
+                    throw std::logic_error("marching cubes case too big");
+                }
+                edges[(size_t)c][count++] = (uint8_t)loop[start];
+                edges[(size_t)c][count++] =
+                    (uint8_t)loop[(start + i) % length];
+                edges[(size_t)c][count++] =
+                    (uint8_t)loop[(start + i + 1) % length];
+            }
+        }
+        counts[(size_t)c] = (uint8_t)count;
+    }
+};
+
+} // namespace
+
+static const CaseTable &case_table() {
+    static const CaseTable table;
+    return table;
+}
+
+MarchingCubes::MarchingCubes(size_t c) : cells(c) {
+    if (cells == 0) {
+        throw std::invalid_argument("marching cubes needs at least 1 cell");
+    }
+
+    // Build it now rather than on some worker's first chunk
+    case_table();
+}
+
+void MarchingCubes::extract(const vector<float> &density, VoxelMesh &mesh)
+    const {
+    const CaseTable &table = case_table();
+    const size_t samples = get_samples();
+    const size_t corners = cells + 1;
+    if (density.size() != samples * samples * samples) {
+        throw std::invalid_argument("density grid has the wrong size");
+    }
+
+    mesh.positions.clear();
+    mesh.normals.clear();
+    mesh.indices.clear();
+
+    // Corner (x, y, z) of the chunk is sample (x + 1, y + 1, z + 1)
+    auto at = [&](size_t x, size_t y, size_t z) {
+        return density[(((z + 1) * samples) + (y + 1)) * samples + (x + 1)];
+    };
+    auto gradient = [&](size_t x, size_t y, size_t z) {
+        const float *d =
+            &density[(((z + 1) * samples) + (y + 1)) * samples + (x + 1)];
+        size_t row = samples;
+        size_t slice = samples * samples;
+        return vec3(
+            d[1] - d[-1], d[row] - d[-(ptrdiff_t)row],
+            d[slice] - d[-(ptrdiff_t)slice]);
+    };
+
+    // The vertex on each grid edge, found through the corner it
+    // starts from and its axis
+    const uint32_t NONE = UINT32_MAX;
+    size_t corner_count = corners * corners * corners;
+    vector<uint32_t> edge_vertices(3 * corner_count, NONE);
+
+    auto edge_vertex = [&](size_t x, size_t y, size_t z, int axis) {
+        size_t key = ((size_t)axis * corner_count) +
+                     (((z * corners) + y) * corners) + x;
+        uint32_t &vertex = edge_vertices[key];
+        if (vertex != NONE) {
+            return vertex;
+        }
+
+        size_t x1 = x + ((axis == 0) ? 1 : 0);
+        size_t y1 = y + ((axis == 1) ? 1 : 0);
+        size_t z1 = z + ((axis == 2) ? 1 : 0);
+        float d0 = at(x, y, z);
+        float d1 = at(x1, y1, z1);
+        float t = d0 / (d0 - d1);
+
+        vec3 position((float)x, (float)y, (float)z);
+        position[axis] += t;
+
+        // Density grows into the ground, so out is down the gradient
+        vec3 g = glm::mix(gradient(x, y, z), gradient(x1, y1, z1), t);
+        float length = glm::length(g);
+        vec3 normal = (length > 0.0f) ? -g / length : vec3(0.0f, 1.0f, 0.0f);
+
+        vertex = (uint32_t)mesh.positions.size();
+        mesh.positions.push_back(position);
+        mesh.normals.push_back(normal);
+        return vertex;
+    };
+
+    for (size_t z = 0; z < cells; ++z) {
+        for (size_t y = 0; y < cells; ++y) {
+            for (size_t x = 0; x < cells; ++x) {
+                int c = 0;
+                for (int i = 0; i < 8; ++i) {
+                    size_t cx = x + (size_t)(i & 1);
+                    size_t cy = y + (size_t)((i >> 1) & 1);
+                    size_t cz = z + (size_t)((i >> 2) & 1);
+                    if (at(cx, cy, cz) > 0.0f) {
+                        c |= 1 << i;
+                    }
+                }
+
+                size_t count = table.counts[(size_t)c];
+                const auto &edges = table.edges[(size_t)c];
+                for (size_t i = 0; i < count; ++i) {
+                    int e = edges[i];
+                    int start = edge_start(e);
+                    mesh.indices.push_back(edge_vertex(
+                        x + (size_t)(start & 1),
+                        y + (size_t)((start >> 1) & 1),
+                        z + (size_t)((start >> 2) & 1),
+                        e / 4));
+                }
+            }
+        }
+    }
+}
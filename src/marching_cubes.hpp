@@ -0,0 +1,74 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+using glm::vec3;
+
+using std::vector;
+
+/**
+ * An indexed triangle mesh in a voxel chunk's grid units.
+ */
+struct VoxelMesh {
+    vector<vec3> positions;
+
+    // Unit normals pointing out of the ground
+    vector<vec3> normals;
+
+    // Triangle list, counter-clockwise seen from outside the ground
+    vector<uint32_t> indices;
+};
+
+/**
+ * Extracts the surface where a sampled density field crosses zero,
+ * one cube of eight samples at a time.
+ *
+ * Which of a cube's corners are inside the ground picks one of 256
+ * cases; the triangles for each case come from a table built once, by
+ * tracing the contour around the inside corners on each of the cube's
+ * faces. Faces with two diagonally opposite inside corners always keep
+ * those corners apart, and since that only depends on the face, the
+ * cubes on either side of it agree and the surface has no holes.
+ *
+ * Each vertex sits on a grid edge, where the density crosses zero,
+ * and is shared by every triangle in the chunk that uses that edge, so
+ * the output is an indexed mesh. Normals come from the density's
+ * gradient.
+ */
+class MarchingCubes {
+public:
+    /**
+     * @param cells: cubes along each side of a chunk
+     */
+    explicit MarchingCubes(size_t cells);
+
+    size_t get_cells() const {
+        return cells;
+    }
+
+    /**
+     * Samples along each side of the grid extract() wants: one per
+     * cube corner, plus one on every side for the gradients.
+     */
+    size_t get_samples() const {
+        return cells + 3;
+    }
+
+    /**
+     * Mesh the surface in a chunk. Safe to call from several threads
+     * at once.
+     *
+     * @param density: get_samples() cubed, x fastest, then y, then z;
+     * positive inside the ground. Sample (1, 1, 1) is the chunk's
+     * first corner, at the origin of the mesh.
+     * @param mesh: cleared, then filled in
+     */
+    void extract(const vector<float> &density, VoxelMesh &mesh) const;
+
+private:
+    size_t cells;
+};
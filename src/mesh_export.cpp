@@ -0,0 +1,293 @@
+#include "mesh_export.hpp"
+
+#include "thread_pool.hpp"
+#include "tile_cache.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+static const char MAGIC[8] = {'T', 'F', 'M', 'E', 'S', 'H', '\0', '\0'};
+static const uint32_t VERSION = 1;
+
+template<typename T>
+static void append(vector<uint8_t> &out, const T *values, size_t count) {
+    size_t start = out.size();
+    out.resize(start + (count * sizeof(T)));
+    std::memcpy(out.data() + start, values, count * sizeof(T));
+}
+
+/**
+ * Triangles of a grid with some quads along each side, in vertical
+ * strips a few quads wide. Going down a strip, each row of quads
+ * reuses the row of vertices the previous one just loaded, which
+ * still fit in the cache.
+ *
+ * Every quad is split along the diagonal from sample (x, y) to
+ * (x + 1, y + 1), like the chunks are drawn, and both triangles wind
+ * counter-clockwise seen from above.
+ *
+ * @param indices: triangle list, indexing vertices in first-use order
+ * @param vertices: the grid sample, y * (quads + 1) + x, behind each
+ * vertex
+ */
+static void strip_order(
+    size_t quads,
+    size_t strip_quads,
+    vector<uint16_t> &indices,
+    vector<uint16_t> &vertices) {
+    size_t side = quads + 1;
+    vector<int32_t> remap(side * side, -1);
+
+    auto emit = [&](size_t x, size_t y) {
+        size_t sample = (y * side) + x;
+        if (remap[sample] < 0) {
+            remap[sample] = (int32_t)vertices.size();
+            vertices.push_back((uint16_t)sample);
+        }
+        indices.push_back((uint16_t)remap[sample]);
+    };
+
+    for (size_t x0 = 0; x0 < quads; x0 += strip_quads) {
+        size_t x1 = std::min(x0 + strip_quads, quads);
+        for (size_t y = 0; y < quads; ++y) {
+            for (size_t x = x0; x < x1; ++x) {
+                emit(x, y);
+                emit(x + 1, y + 1);
+                emit(x + 1, y);
+
+                emit(x, y);
+                emit(x, y + 1);
+                emit(x + 1, y + 1);
+            }
+        }
+    }
+}
+
+/**
+ * Fold a unit vector onto an octahedron around +Y, flatten it onto
+ * XZ, and store it as two signed bytes.
+ */
+static void encode_normal(vec3 n, int8_t out[2]) {
+    n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+
+    float u = n.x;
+    float v = n.z;
+    if (n.y < 0.0f) {
+        float fu = (1.0f - std::abs(v)) * ((u < 0.0f) ? -1.0f : 1.0f);
+        float fv = (1.0f - std::abs(u)) * ((v < 0.0f) ? -1.0f : 1.0f);
+        u = fu;
+        v = fv;
+    }
+
+    out[0] = (int8_t)std::lround(std::clamp(u, -1.0f, 1.0f) * 127.0f);
+    out[1] = (int8_t)std::lround(std::clamp(v, -1.0f, 1.0f) * 127.0f);
+}
+
+/**
+ * Largest vertical distance between a chunk's samples and the surface
+ * through every stride-th of them.
+ */
+static float lod_error(const Heightfield &heights, size_t stride) {
+    size_t quads = heights.get_width() - 1;
+    size_t cells = quads / stride;
+    float inv_stride = 1.0f / (float)stride;
+
+    float error = 0.0f;
+    for (size_t y = 0; y <= quads; ++y) {
+        size_t cy = std::min(y / stride, cells - 1);
+        float fy = (float)(y - (cy * stride)) * inv_stride;
+
+        for (size_t x = 0; x <= quads; ++x) {
+            size_t cx = std::min(x / stride, cells - 1);
+            float fx = (float)(x - (cx * stride)) * inv_stride;
+
+            float h00 = heights.at(cx * stride, cy * stride);
+            float h10 = heights.at((cx + 1) * stride, cy * stride);
+            float h01 = heights.at(cx * stride, (cy + 1) * stride);
+            float h11 = heights.at((cx + 1) * stride, (cy + 1) * stride);
+
+            // Same split as the triangles
+            float h = (fx >= fy)
+                          ? h00 + ((h10 - h00) * fx) + ((h11 - h10) * fy)
+                          : h00 + ((h01 - h00) * fy) + ((h11 - h01) * fx);
+            error = std::max(error, std::abs(h - heights.at(x, y)));
+        }
+    }
+
+    return error;
+}
+
+MeshExporter::MeshExporter(
+    ThreadPool &p,
+    const ChunkBuilder &b,
+    TileCache *c,
+    Params prm) :
+    pool(p),
+    builder(b),
+    cache(c),
+    params(prm) {
+    size_t quads = CHUNK_SAMPLES - 1;
+    if (params.lod_count == 0 || params.lod_count > 16 ||
+        (quads >> (params.lod_count - 1)) == 0) {
+        std::string err_msg = "Mesh export needs between 1 and ";
+        err_msg.append(std::to_string((size_t)std::log2(quads) + 1));
+        err_msg.append(" LODs, but got ");
+        err_msg.append(std::to_string(params.lod_count));
+
+        throw std::invalid_argument(err_msg);
+    }
+
+    // Two rows of a strip's vertices have to fit in the cache
+    size_t strip_quads = std::max(params.cache_size / 2, (size_t)2) - 1;
+
+    lod_indices.resize(params.lod_count);
+    lod_vertices.resize(params.lod_count);
+    for (size_t lod = 0; lod < params.lod_count; ++lod) {
+        strip_order(
+            quads >> lod, strip_quads, lod_indices[lod], lod_vertices[lod]);
+    }
+}
+
+void MeshExporter::write(
+    const std::string &path,
+    ChunkCoord first,
+    ChunkCoord last) const {
+    vector<ChunkCoord> coords;
+    for (int32_t z = first.z; z <= last.z; ++z) {
+        for (int32_t x = first.x; x <= last.x; ++x) {
+            coords.push_back({x, z});
+        }
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        throw std::runtime_error("Failed to open '" + path + "' for export");
+    }
+
+    // Written again at the end, once the index's offset is known
+    Header header = {};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.tile_samples = CHUNK_SAMPLES;
+    header.spacing = builder.get_params().spacing;
+    header.lod_count = (uint32_t)params.lod_count;
+    header.tile_count = coords.size();
+    file.write((const char *)&header, sizeof(header));
+
+    vector<TileEntry> index;
+    index.reserve(coords.size());
+    uint64_t offset = sizeof(header);
+
+    size_t batch_size = std::max(params.batch_size, (size_t)1);
+    vector<vector<uint8_t>> encoded(batch_size);
+    for (size_t start = 0; start < coords.size(); start += batch_size) {
+        size_t count = std::min(batch_size, coords.size() - start);
+
+        pool.parallel_for(0, count, [&](size_t i) {
+            encoded[i].clear();
+            encode_tile(get_chunk(coords[start + i]), encoded[i]);
+        });
+
+        for (size_t i = 0; i < count; ++i) {
+            const vector<uint8_t> &tile = encoded[i];
+            file.write((const char *)tile.data(), (std::streamsize)tile.size());
+
+            ChunkCoord coord = coords[start + i];
+            index.push_back({coord.x, coord.z, offset, tile.size()});
+            offset += tile.size();
+        }
+    }
+
+    header.index_offset = offset;
+    file.write(
+        (const char *)index.data(),
+        (std::streamsize)(index.size() * sizeof(TileEntry)));
+    file.seekp(0);
+    file.write((const char *)&header, sizeof(header));
+
+    if (!file) {
+        throw std::runtime_error("Failed to write '" + path + "'");
+    }
+}
+
+void MeshExporter::encode_tile(const ChunkData &data, vector<uint8_t> &out)
+    const {
+    const Heightfield &heights = data.heights;
+    const float spacing = builder.get_params().spacing;
+    const size_t quads = CHUNK_SAMPLES - 1;
+
+    vec2 range = data.bounds.get_range();
+    float step = (range.y - range.x) / 65535.0f;
+    float inv_step = (step > 0.0f) ? 1.0f / step : 0.0f;
+
+    vec2 origin = builder.get_origin(data.coord);
+    TileHeader tile = {
+        data.coord.x, data.coord.z, origin.x, origin.y, range.x, step};
+    append(out, &tile, 1);
+
+    vector<PackedVertex> vertices;
+    for (size_t lod = 0; lod < params.lod_count; ++lod) {
+        size_t stride = (size_t)1 << lod;
+        size_t side = (quads >> lod) + 1;
+        const vector<uint16_t> &samples = lod_vertices[lod];
+        const vector<uint16_t> &indices = lod_indices[lod];
+
+        LodHeader lod_header = {
+            (uint32_t)samples.size(),
+            (uint32_t)indices.size(),
+            (lod > 0) ? lod_error(heights, stride) : 0.0f,
+            0};
+        append(out, &lod_header, 1);
+
+        vertices.resize(samples.size());
+        for (size_t i = 0; i < samples.size(); ++i) {
+            size_t x = (samples[i] % side) * stride;
+            size_t y = (samples[i] / side) * stride;
+
+            PackedVertex &v = vertices[i];
+            v.x = (uint16_t)x;
+            v.z = (uint16_t)y;
+            float q = (heights.at(x, y) - range.x) * inv_step;
+            v.height = (uint16_t)std::lround(std::clamp(q, 0.0f, 65535.0f));
+
+            // Chunk normals are in grid space; the file's are in world
+            // space
+            vec3 n = data.normals[(y * CHUNK_SAMPLES) + x];
+            encode_normal(
+                glm::normalize(vec3(n.x / spacing, n.y, n.z / spacing)),
+                v.normal);
+        }
+        append(out, vertices.data(), vertices.size());
+
+        append(out, indices.data(), indices.size());
+        if (indices.size() % 2 != 0) {
+            uint16_t padding = 0;
+            append(out, &padding, 1);
+        }
+    }
+}
+
+ChunkData MeshExporter::get_chunk(ChunkCoord coord) const {
+    if (cache) {
+        try {
+            Heightfield padded;
+            if (cache->load_heights(
+                    coord, padded, builder.get_padded_samples())) {
+                return builder.finish(coord, std::move(padded));
+            }
+        } catch (const std::exception &e) {
+            // A corrupt tile is built again instead
+            std::cerr << e.what() << " in cached chunk (" << coord.x
+                      << ", " << coord.z << ")" << std::endl;
+            cache->forget(coord);
+        }
+    }
+
+    return builder.build(coord);
+}
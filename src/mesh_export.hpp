@@ -0,0 +1,142 @@
+#pragma once
+
+#include "chunk.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using std::vector;
+
+class ThreadPool;
+class TileCache;
+
+/**
+ * Writes terrain chunks to a compact binary mesh file for offline
+ * tools. All values are little-endian.
+ *
+ * The file starts with a Header, followed by the tiles one after
+ * another, and ends with an index of TileEntry records at
+ * Header::index_offset. Each tile is a TileHeader followed by its LOD
+ * chain, finest first. Every LOD is a LodHeader, its vertices, then
+ * its triangle list as 16-bit indices, padded to 4 bytes.
+ *
+ * LOD l keeps every 2^l-th sample of the chunk. A vertex is 8 bytes:
+ * its grid position in samples (x, then z), its height quantized
+ * between the tile's lowest and highest sample, and its normal
+ * octahedron-encoded into two signed bytes. Within each LOD the
+ * triangles are ordered in narrow vertical strips so neighbouring
+ * rows share vertices in a small post-transform cache, and the
+ * vertices are stored in the order the triangles first use them.
+ *
+ * Tiles are built and encoded on a thread pool a batch at a time and
+ * streamed to the file as each batch finishes, so memory use doesn't
+ * grow with the size of the export.
+ */
+class MeshExporter {
+public:
+    struct Params {
+        // Levels per tile, including the full-resolution one
+        size_t lod_count = 4;
+
+        // Vertex cache size to order triangles for. Strips are made
+        // narrow enough for two rows of vertices to fit.
+        size_t cache_size = 16;
+
+        // Tiles encoded at once before they're written out
+        size_t batch_size = 64;
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+
+        // Samples along each side of a tile at LOD 0
+        uint32_t tile_samples;
+
+        // World units between neighbouring samples at LOD 0
+        float spacing;
+
+        uint32_t lod_count;
+        uint64_t tile_count;
+        uint64_t index_offset;
+    };
+
+    struct TileEntry {
+        int32_t x;
+        int32_t z;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    struct TileHeader {
+        int32_t x;
+        int32_t z;
+
+        // World XZ of the tile's first sample
+        float origin_x;
+        float origin_z;
+
+        // Height = min_height + quantized height * height_step
+        float min_height;
+        float height_step;
+    };
+
+    struct LodHeader {
+        uint32_t vertex_count;
+        uint32_t index_count;
+
+        // Largest vertical distance between the full-resolution
+        // samples and this LOD's surface, in world units
+        float max_error;
+
+        uint32_t reserved;
+    };
+
+    struct PackedVertex {
+        uint16_t x;
+        uint16_t z;
+        uint16_t height;
+        int8_t normal[2];
+    };
+
+    MeshExporter(ThreadPool &p, const ChunkBuilder &b) :
+        MeshExporter(p, b, nullptr, Params()) {}
+
+    /**
+     * @param cache: if not null, chunks are taken from it where
+     * possible rather than built from scratch
+     */
+    MeshExporter(
+        ThreadPool &pool,
+        const ChunkBuilder &builder,
+        TileCache *cache,
+        Params p);
+
+    /**
+     * Export the chunks [first, last] on each axis, edges included.
+     * Throws a std::runtime_error if the file can't be written.
+     */
+    void write(const std::string &path, ChunkCoord first, ChunkCoord last)
+        const;
+
+    /**
+     * Append one chunk's TileHeader and LOD chain to out.
+     */
+    void encode_tile(const ChunkData &data, vector<uint8_t> &out) const;
+
+private:
+    ThreadPool &pool;
+    const ChunkBuilder &builder;
+    TileCache *cache;
+    Params params;
+
+    // Triangle lists of the LODs, in cache order, indexing vertices in
+    // first-use order; and for each LOD the sample (in LOD grid
+    // units) behind every vertex
+    vector<vector<uint16_t>> lod_indices;
+    vector<vector<uint16_t>> lod_vertices;
+
+    ChunkData get_chunk(ChunkCoord coord) const;
+};
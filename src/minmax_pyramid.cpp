@@ -0,0 +1,186 @@
+#include "minmax_pyramid.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <stdexcept>
+#include <string>
+
+static inline vec2 merge_bounds(vec2 a, vec2 b) {
+    return vec2(std::min(a.x, b.x), std::max(a.y, b.y));
+}
+
+MinMaxPyramid::MinMaxPyramid(const Heightfield &heights) {
+    if (heights.get_width() < 2 || heights.get_height() < 2) {
+        std::string err_msg = "Min/max pyramid needs at least 2x2 samples, ";
+        err_msg.append("but got ");
+        err_msg.append(std::to_string(heights.get_width()));
+        err_msg.append("x");
+        err_msg.append(std::to_string(heights.get_height()));
+
+        throw std::invalid_argument(err_msg);
+    }
+
+    size_t width = heights.get_width() - 1;
+    size_t height = heights.get_height() - 1;
+    while (true) {
+        levels.push_back({width, height, vector<vec2>(width * height)});
+        if (width == 1 && height == 1) {
+            break;
+        }
+
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+    }
+
+    compute_cells(heights, 0, 0, levels[0].width, levels[0].height);
+    for (size_t level = 1; level < levels.size(); ++level) {
+        merge(level, 0, 0, levels[level].width, levels[level].height);
+    }
+}
+
+void MinMaxPyramid::update(
+    const Heightfield &heights,
+    size_t x0,
+    size_t y0,
+    size_t x1,
+    size_t y1) {
+    if (x0 > x1 || y0 > y1) {
+        return;
+    }
+
+    // Every cell with one of the changed samples as a corner; the cells
+    // [cx0, cx1) x [cy0, cy1)
+    size_t cx0 = (x0 > 0) ? x0 - 1 : 0;
+    size_t cy0 = (y0 > 0) ? y0 - 1 : 0;
+    size_t cx1 = std::min(x1 + 1, levels[0].width);
+    size_t cy1 = std::min(y1 + 1, levels[0].height);
+    if (cx0 >= cx1 || cy0 >= cy1) {
+        return;
+    }
+
+    compute_cells(heights, cx0, cy0, cx1, cy1);
+
+    // Then their parents, level by level
+    for (size_t level = 1; level < levels.size(); ++level) {
+        cx0 /= 2;
+        cy0 /= 2;
+        cx1 = (cx1 + 1) / 2;
+        cy1 = (cy1 + 1) / 2;
+        merge(level, cx0, cy0, cx1, cy1);
+    }
+}
+
+vec2 MinMaxPyramid::get_range(size_t x0, size_t y0, size_t x1, size_t y1)
+    const {
+    // Samples to cells: [x0, x1] covers cells [x0, x1)
+    size_t cx0 = std::min(x0, levels[0].width - 1);
+    size_t cy0 = std::min(y0, levels[0].height - 1);
+    size_t cx1 = std::clamp(x1, cx0 + 1, levels[0].width);
+    size_t cy1 = std::clamp(y1, cy0 + 1, levels[0].height);
+
+    vec2 range(FLT_MAX, -FLT_MAX);
+
+    // Peel off the rows and columns that only part of their parent
+    // covers, then move up a level, until nothing is left
+    for (size_t level = 0; level < levels.size(); ++level) {
+        const Level &l = levels[level];
+        if (cx0 >= cx1 || cy0 >= cy1) {
+            break;
+        }
+
+        if (level + 1 == levels.size()) {
+            range = merge_bounds(range, l.bounds[0]);
+            break;
+        }
+
+        if (cx0 & 1) {
+            for (size_t y = cy0; y < cy1; ++y) {
+                range = merge_bounds(range, l.bounds[(y * l.width) + cx0]);
+            }
+            ++cx0;
+        }
+        if ((cx1 & 1) && cx1 < l.width && cx0 < cx1) {
+            for (size_t y = cy0; y < cy1; ++y) {
+                range = merge_bounds(range, l.bounds[(y * l.width) + cx1 - 1]);
+            }
+            --cx1;
+        }
+        if (cy0 & 1) {
+            for (size_t x = cx0; x < cx1; ++x) {
+                range = merge_bounds(range, l.bounds[(cy0 * l.width) + x]);
+            }
+            ++cy0;
+        }
+        if ((cy1 & 1) && cy1 < l.height && cy0 < cy1) {
+            for (size_t x = cx0; x < cx1; ++x) {
+                range =
+                    merge_bounds(range, l.bounds[((cy1 - 1) * l.width) + x]);
+            }
+            --cy1;
+        }
+
+        cx0 /= 2;
+        cy0 /= 2;
+        cx1 = (cx1 + 1) / 2;
+        cy1 = (cy1 + 1) / 2;
+    }
+
+    return range;
+}
+
+void MinMaxPyramid::compute_cells(
+    const Heightfield &heights,
+    size_t x0,
+    size_t y0,
+    size_t x1,
+    size_t y1) {
+    Level &l = levels[0];
+    size_t samples = heights.get_width();
+
+    for (size_t y = y0; y < y1; ++y) {
+        const float *row0 = heights.data() + (y * samples);
+        const float *row1 = row0 + samples;
+        vec2 *out = &l.bounds[y * l.width];
+
+        // Each sample column's range over the two rows, then pairs of
+        // columns; simple enough for the compiler to vectorize
+        float lo = std::min(row0[x0], row1[x0]);
+        float hi = std::max(row0[x0], row1[x0]);
+        for (size_t x = x0; x < x1; ++x) {
+            float next_lo = std::min(row0[x + 1], row1[x + 1]);
+            float next_hi = std::max(row0[x + 1], row1[x + 1]);
+            out[x] = vec2(std::min(lo, next_lo), std::max(hi, next_hi));
+            lo = next_lo;
+            hi = next_hi;
+        }
+    }
+}
+
+void MinMaxPyramid::merge(
+    size_t level,
+    size_t x0,
+    size_t y0,
+    size_t x1,
+    size_t y1) {
+    const Level &below = levels[level - 1];
+    Level &l = levels[level];
+
+    for (size_t y = y0; y < y1; ++y) {
+        size_t cy0 = 2 * y;
+        size_t cy1 = std::min(cy0 + 1, below.height - 1);
+
+        for (size_t x = x0; x < x1; ++x) {
+            size_t cx0 = 2 * x;
+            size_t cx1 = std::min(cx0 + 1, below.width - 1);
+
+            vec2 bounds = merge_bounds(
+                merge_bounds(
+                    below.bounds[(cy0 * below.width) + cx0],
+                    below.bounds[(cy0 * below.width) + cx1]),
+                merge_bounds(
+                    below.bounds[(cy1 * below.width) + cx0],
+                    below.bounds[(cy1 * below.width) + cx1]));
+            l.bounds[(y * l.width) + x] = bounds;
+        }
+    }
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "heightfield.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdlib>
+#include <vector>
+
+using glm::vec2;
+
+using std::vector;
+
+/**
+ * Lowest and highest height over every power-of-two block of a
+ * heightfield's cells, as a mip pyramid.
+ *
+ * A cell is the quad between four neighbouring samples. Level 0 has
+ * one entry per cell; each level above merges 2x2 entries of the one
+ * below, rounding up where a side is odd, until a single entry covers
+ * the whole grid. Entry (x, y) of level l covers samples x << l
+ * through (x + 1) << l on each axis, edges included, so it bounds the
+ * surface over that block exactly.
+ *
+ * Bounds of any node aligned to the pyramid are one lookup, of any
+ * other rectangle a walk along its border, and a ray can skip every
+ * block whose range it passes above or below.
+ */
+class MinMaxPyramid {
+public:
+    MinMaxPyramid() = default;
+
+    /**
+     * @param heights: at least 2 samples along each side
+     */
+    explicit MinMaxPyramid(const Heightfield &heights);
+
+    /**
+     * Recompute the entries over the sample rectangle [x0, x1] x
+     * [y0, y1] after its heights changed, and the entries above them,
+     * leaving the rest of the pyramid alone.
+     *
+     * @param heights: the heightfield the pyramid was built from,
+     * after the change
+     */
+    void update(
+        const Heightfield &heights,
+        size_t x0,
+        size_t y0,
+        size_t x1,
+        size_t y1);
+
+    size_t get_level_count() const {
+        return levels.size();
+    }
+
+    size_t get_width(size_t level) const {
+        return levels[level].width;
+    }
+
+    size_t get_height(size_t level) const {
+        return levels[level].height;
+    }
+
+    /**
+     * Lowest height in .x and highest in .y over one entry of a
+     * level.
+     */
+    vec2 at(size_t level, size_t x, size_t y) const {
+        const Level &l = levels[level];
+        return l.bounds[(y * l.width) + x];
+    }
+
+    /**
+     * Lowest and highest height anywhere in the heightfield.
+     */
+    vec2 get_range() const {
+        return levels.back().bounds[0];
+    }
+
+    /**
+     * Lowest and highest height over the cells of the sample
+     * rectangle [x0, x1] x [y0, y1]. Where the rectangle has no width
+     * or height, the bounds include the cells on one side of it.
+     */
+    vec2 get_range(size_t x0, size_t y0, size_t x1, size_t y1) const;
+
+private:
+    struct Level {
+        size_t width;
+        size_t height;
+        vector<vec2> bounds;
+    };
+
+    vector<Level> levels;
+
+    /**
+     * Recompute the cells [x0, x1) x [y0, y1) of level 0.
+     */
+    void compute_cells(
+        const Heightfield &heights,
+        size_t x0,
+        size_t y0,
+        size_t x1,
+        size_t y1);
+
+    /**
+     * Recompute the entries [x0, x1) x [y0, y1) of a level above 0
+     * from the level below.
+     */
+    void merge(size_t level, size_t x0, size_t y0, size_t x1, size_t y1);
+};
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+/**
+ * Avalanching integer hash (the "lowbias32" finalizer). Every input
+ * bit affects every output bit, so consecutive inputs give unrelated
+ * outputs.
+ */
+inline uint32_t hash_u32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+inline uint32_t hash_combine(uint32_t seed, uint32_t value) {
+    return hash_u32(seed ^ (value + 0x9e3779b9U + (seed << 6) + (seed >> 2)));
+}
+
+inline uint32_t hash_2d(int32_t x, int32_t y, uint32_t seed) {
+    return hash_combine(hash_combine(seed, (uint32_t)x), (uint32_t)y);
+}
+
+inline uint32_t hash_3d(int32_t x, int32_t y, int32_t z, uint32_t seed) {
+    return hash_combine(hash_2d(x, y, seed), (uint32_t)z);
+}
+
+/**
+ * Map a hash to a float in [0, 1).
+ */
+inline float hash_to_unit(uint32_t h) {
+    return (float)(h >> 8) * (1.0f / 16777216.0f);
+}
+
+/**
+ * Small, fast PRNG (PCG32). Seed it from a hash of whatever
+ * identifies the work item, so results don't depend on which thread
+ * or in which order the items are processed.
+ */
+class Rng {
+public:
+    explicit Rng(uint64_t seed) : state(0) {
+        next_u32();
+        state += seed;
+        next_u32();
+    }
+
+    uint32_t next_u32() {
+        uint64_t old = state;
+        state = (old * 6364136223846793005ULL) + 1442695040888963407ULL;
+        uint32_t xorshifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+        uint32_t rot = (uint32_t)(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+    }
+
+    /**
+     * Uniform float in [0, 1).
+     */
+    float next_float() {
+        return hash_to_unit(next_u32());
+    }
+
+    float next_range(float lo, float hi) {
+        return lo + ((hi - lo) * next_float());
+    }
+
+private:
+    uint64_t state;
+};
+
+/**
+ * 2D value noise in [-1, 1] with quintic interpolation between
+ * hashed lattice values.
+ */
+inline float value_noise(float x, float y, uint32_t seed) {
+    float fx = std::floor(x);
+    float fy = std::floor(y);
+    int32_t ix = (int32_t)fx;
+    int32_t iy = (int32_t)fy;
+    float tx = x - fx;
+    float ty = y - fy;
+
+    // Quintic fade curve, so the derivative is continuous
+    float ux = tx * tx * tx * (tx * (tx * 6.0f - 15.0f) + 10.0f);
+    float uy = ty * ty * ty * (ty * (ty * 6.0f - 15.0f) + 10.0f);
+
+    float v00 = hash_to_unit(hash_2d(ix, iy, seed));
+    float v10 = hash_to_unit(hash_2d(ix + 1, iy, seed));
+    float v01 = hash_to_unit(hash_2d(ix, iy + 1, seed));
+    float v11 = hash_to_unit(hash_2d(ix + 1, iy + 1, seed));
+
+    float bottom = v00 + ((v10 - v00) * ux);
+    float top = v01 + ((v11 - v01) * ux);
+    return ((bottom + ((top - bottom) * uy)) * 2.0f) - 1.0f;
+}
+
+/**
+ * 3D value noise in [-1, 1], like value_noise().
+ */
+inline float value_noise_3d(float x, float y, float z, uint32_t seed) {
+    float fx = std::floor(x);
+    float fy = std::floor(y);
+    float fz = std::floor(z);
+    int32_t ix = (int32_t)fx;
+    int32_t iy = (int32_t)fy;
+    int32_t iz = (int32_t)fz;
+    float tx = x - fx;
+    float ty = y - fy;
+    float tz = z - fz;
+
+    float ux = tx * tx * tx * (tx * (tx * 6.0f - 15.0f) + 10.0f);
+    float uy = ty * ty * ty * (ty * (ty * 6.0f - 15.0f) + 10.0f);
+    float uz = tz * tz * tz * (tz * (tz * 6.0f - 15.0f) + 10.0f);
+
+    float v000 = hash_to_unit(hash_3d(ix, iy, iz, seed));
+    float v100 = hash_to_unit(hash_3d(ix + 1, iy, iz, seed));
+    float v010 = hash_to_unit(hash_3d(ix, iy + 1, iz, seed));
+    float v110 = hash_to_unit(hash_3d(ix + 1, iy + 1, iz, seed));
+    float v001 = hash_to_unit(hash_3d(ix, iy, iz + 1, seed));
+    float v101 = hash_to_unit(hash_3d(ix + 1, iy, iz + 1, seed));
+    float v011 = hash_to_unit(hash_3d(ix, iy + 1, iz + 1, seed));
+    float v111 = hash_to_unit(hash_3d(ix + 1, iy + 1, iz + 1, seed));
+
+    float x00 = v000 + ((v100 - v000) * ux);
+    float x10 = v010 + ((v110 - v010) * ux);
+    float x01 = v001 + ((v101 - v001) * ux);
+    float x11 = v011 + ((v111 - v011) * ux);
+    float y0 = x00 + ((x10 - x00) * uy);
+    float y1 = x01 + ((x11 - x01) * uy);
+    return ((y0 + ((y1 - y0) * uz)) * 2.0f) - 1.0f;
+}
+
+/**
+ * Fractal sum of value noise octaves, normalized to [-1, 1].
+ */
+inline float fbm(
+    float x,
+    float y,
+    uint32_t seed,
+    int octaves,
+    float lacunarity = 2.0f,
+    float gain = 0.5f) {
+    float sum = 0.0f;
+    float norm = 0.0f;
+    float amplitude = 1.0f;
+
+    for (int i = 0; i < octaves; ++i) {
+        sum += value_noise(x, y, hash_combine(seed, (uint32_t)i)) * amplitude;
+        norm += amplitude;
+        amplitude *= gain;
+        x *= lacunarity;
+        y *= lacunarity;
+    }
+
+    return sum / norm;
+}
@@ -1,6 +1,8 @@
 #include "ocean.hpp"
 
-#include "plane.hpp"
+#include "dem_import.hpp"
+#include "frustum.hpp"
+#include "mesh_export.hpp"
 #include "util.hpp"
 
 #include <glad/glad.h>
@@ -9,12 +11,56 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <fstream>
 #include <iostream>
 
-const size_t N = 128;
+// How far the camera can see, in world units
+const float VIEW_DISTANCE = 512.0f;
 
-// World goes from [-width, width] in all axis
-const size_t WORLD_WIDTH = 256;
+// Vertical field of view, in degrees
+const float FIELD_OF_VIEW = 45.0f;
+
+// Heights are kept to this precision, which lets the tile cache store
+// them compressed without changing them
+const float HEIGHT_PRECISION = 0.01f;
+
+// Chunks are generated and cached with only every this many samples;
+// the rest is filled in with procedural detail as they're loaded
+const size_t COARSE_STRIDE = 4;
+
+// Samples along each side of the world drawn in CDLOD mode, centred on
+// the origin
+const size_t CDLOD_SAMPLES = 4097;
+
+// Elevation data to use instead of generated terrain, if it exists,
+// and where its chunks are cached
+const char *DEM_PATH = "heightmap.pgm";
+const char *DEM_CACHE_PATH = "dem_cache.bin";
+
+// Where Ctrl+E writes the terrain around the camera as meshes
+const char *EXPORT_PATH = "terrain_export.tfm";
+
+// The camera collides with the terrain as a sphere this big
+const float CAMERA_RADIUS = 0.5f;
+
+// Height of the camera above the ground in walk mode
+const float EYE_HEIGHT = 1.7f;
+
+// Side of the square of forest grown around the origin, and the years
+// it's grown for
+const float FOREST_SIZE = 1024.0f;
+const uint32_t FOREST_YEARS = 150;
+
+// Side of the cells fire spreads over, how many steps it spreads a
+// frame, and how strong the wind is
+const float FIRE_CELL_SIZE = 2.0f;
+const uint32_t FIRE_STEPS_PER_FRAME = 2;
+const float WIND_STRENGTH = 1.5f;
+
+// Ctrl+F sets fire to the forest this far around the crosshair
+const float FIRE_START_RADIUS = 6.0f;
 
 void Ocean::init(GLFWwindow *win) {
     try {
@@ -44,53 +90,124 @@ void Ocean::init(GLFWwindow *win) {
     mouse_pos = vec2(screen_center.x, screen_center.y);
     glfwSetCursorPos(win, mouse_pos.x, mouse_pos.y);
 
-    Plane<N> plane;
-    auto vertices = plane.vertices;
-    auto indices = plane.indices;
-    num_elements = indices.size();
+    // Trees grow on the thread pool while the terrain is set up
+    tree_meshes = std::make_unique<TreeMeshCache>(pool);
+    tree_renderer.request_meshes(*tree_meshes);
+
+    // Terrain is streamed in around the camera as it moves
+    generator = std::make_unique<TerrainGenerator>();
+    ChunkBuilder::Params builder_params;
+    builder_params.height_precision = HEIGHT_PRECISION;
+    builder_params.coarse_stride = COARSE_STRIDE;
+    builder =
+        std::make_unique<ChunkBuilder>(pool, *generator, builder_params);
+
+    // A DEM next to the executable replaces the generated terrain
+    // wherever it covers. It's cut into chunks in a cache of its own,
+    // once; later runs stream straight from the cache.
+    std::unique_ptr<DemSource> dem;
+    if (std::ifstream(DEM_PATH).good()) {
+        try {
+            dem = std::make_unique<DemSource>(DEM_PATH);
+        } catch (const std::runtime_error &e) {
+            std::cerr << e.what() << std::endl;
+        }
+    }
 
-    vao = 0;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+    // Chunks built in earlier runs are kept on disk. Without the cache
+    // everything still works, it's just slower.
+    try {
+        TileCache::Params cache_params;
+        cache_params.format = TileCache::Format::COMPRESSED;
+        cache_params.precision = HEIGHT_PRECISION;
+
+        if (dem) {
+            DemImporter importer(pool, *builder);
+            ChunkCoord count = DemImporter::get_chunk_count(*dem);
+            cache_params.max_tiles += (size_t)count.x * (size_t)count.z;
+            tile_cache = std::make_unique<TileCache>(
+                DEM_CACHE_PATH, importer.get_content_key(*dem), cache_params);
+            importer.import(*dem, *tile_cache, true);
+        } else {
+            tile_cache = std::make_unique<TileCache>(
+                "terrain_cache.bin", builder->get_content_key(), cache_params);
+        }
+    } catch (const std::runtime_error &e) {
+        std::cerr << e.what() << std::endl;
+    }
 
-    vertex_buffer = 0;
-    glGenBuffers(1, &vertex_buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
-    {
-        GLsizeiptr size = vertices.size() * sizeof(Vertex);
-        const GLvoid *data = &(vertices[0]);
-        glBufferData(GL_ARRAY_BUFFER, size, data, GL_STATIC_DRAW);
-    }
-
-    GLuint pos_attrib = 0;
-    glEnableVertexAttribArray(pos_attrib);
-    glVertexAttribPointer(
-        pos_attrib, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (char *)nullptr + 0);
-
-    GLuint norm_attrib = 1;
-    glEnableVertexAttribArray(norm_attrib);
-    glVertexAttribPointer(
-        norm_attrib,
-        3,
-        GL_FLOAT,
-        GL_FALSE,
-        sizeof(Vertex),
-        (char *)0 + sizeof(vec3));
-
-    // Put the plane into world coordinates
-    model = plane.get_model_matrix(WORLD_WIDTH);
-    GLint model_attrib = 2;
-    glUniformMatrix4fv(model_attrib, 1, GL_FALSE, value_ptr(model));
-
-    // Fix the normal vectors with the inverse transpose
-    mat4 model_inv_transp = glm::transpose(glm::inverse(model));
-    GLint model_inv_transp_attrib = 14;
-    glUniformMatrix4fv(
-        model_inv_transp_attrib, 1, GL_FALSE, value_ptr(model_inv_transp));
+    ChunkManager::Params chunk_params;
+    chunk_params.trees.variants = tree_renderer.get_variant_count();
+    chunk_params.view_radius =
+        (int)std::ceil(VIEW_DISTANCE / builder->get_chunk_size());
+    chunks = std::make_unique<ChunkManager>(
+        pool, *builder, tile_cache.get(), chunk_params);
+    chunks->init();
+
+    // Forests are grown over generated ground, so not over a DEM
+    if (!dem) {
+        ForestSimulator::Params forest_params;
+        forest_params.variants = chunk_params.trees.variants;
+        forest_params.max_scale = chunk_params.trees.max_scale;
+
+        // Trees grow best where they'd be scattered: on flat ground in
+        // the range of heights they like
+        const TerrainGenerator &gen = *generator;
+        TreeScatter::Params scatter = chunk_params.trees;
+        auto ground = [&gen, scatter](vec2 xz, float &h, float &fertility) {
+            h = gen.height_at(xz.x, xz.y);
+            float dx = gen.height_at(xz.x + 1.0f, xz.y) - h;
+            float dz = gen.height_at(xz.x, xz.y + 1.0f) - h;
+            float normal_y = 1.0f / std::sqrt(1.0f + (dx * dx) + (dz * dz));
+            float steepness = 1.0f - normal_y;
+
+            float low = glm::smoothstep(
+                scatter.min_height, scatter.min_height + 4.0f, h);
+            float high = 1.0f - glm::smoothstep(
+                                    scatter.max_height - 4.0f,
+                                    scatter.max_height,
+                                    h);
+            float flat = 1.0f - glm::smoothstep(
+                                    0.5f * scatter.max_steepness,
+                                    scatter.max_steepness,
+                                    steepness);
+            fertility = low * high * flat;
+        };
+
+        try {
+            forest = std::make_unique<ForestSimulator>(
+                pool,
+                ground,
+                vec2(-FOREST_SIZE / 2.0f),
+                FOREST_SIZE,
+                forest_params);
+            forest_growth = pool.submit([this]() {
+                forest->run(FOREST_YEARS);
+                build_fire();
+            });
+        } catch (const std::runtime_error &e) {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+
+    try {
+        tree_renderer.init(*tree_meshes);
+        tree_reach = tree_renderer.get_height() * chunk_params.trees.max_scale;
+    } catch (const std::runtime_error &e) {
+        std::cerr << e.what() << std::endl;
+    }
+
+    try {
+        grass_renderer.init();
+    } catch (const std::runtime_error &e) {
+        std::cerr << e.what() << std::endl;
+    }
 
     // Put the world into camera/view coordinates
+    float start_height = (dem && tile_cache) ? dem->at(0, 0)
+                                             : generator->height_at(0.0f, 0.0f);
     camera = Camera(
-        vec3(0.0f, 8.0f, 0.0f),
+        vec3(0.0f, start_height + 8.0f, 0.0f),
         vec3(0.0f, 0.0f, -1.0f),
         vec3(0.0f, 1.0f, 0.0f));
     update_view_matrix();
@@ -102,7 +219,7 @@ void Ocean::init(GLFWwindow *win) {
     // LIGHTING
     GLint light_pos_attrib = 5;
     glUniform3fv(
-        light_pos_attrib, 1, value_ptr(vec3(0.0f, (float)WORLD_WIDTH, 0.0f)));
+        light_pos_attrib, 1, value_ptr(vec3(0.0f, VIEW_DISTANCE / 2, 0.0f)));
 
     GLint ambient_light_color_attrib = 6;
     glUniform3fv(ambient_light_color_attrib, 1, value_ptr(vec3(0.05f)));
@@ -113,8 +230,9 @@ void Ocean::init(GLFWwindow *win) {
     GLint specular_light_color_attrib = 8;
     glUniform3fv(specular_light_color_attrib, 1, value_ptr(vec3(1.0f)));
 
+    // The terrain's own color comes from its splat weights
     GLint ambient_material_color_attrib = 9;
-    vec3 material_color = vec3(155.0 / 255.0, 84.0 / 255.0, 21.0 / 255.0);
+    vec3 material_color = vec3(1.0f);
     glUniform3fv(ambient_material_color_attrib, 1, value_ptr(material_color));
 
     GLint diffuse_material_color_attrib = 10;
@@ -125,21 +243,21 @@ void Ocean::init(GLFWwindow *win) {
 
     GLint material_shininess_attrib = 12;
     glUniform1f(material_shininess_attrib, 32.0f);
-
-    index_buffer = 0;
-    glGenBuffers(1, &index_buffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
-    {
-        GLsizeiptr size = indices.size() * sizeof(unsigned int);
-        const GLvoid *data = &(indices[0]);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, GL_STATIC_DRAW);
-    }
 }
 
 void Ocean::cleanup() {
-    glDeleteBuffers(1, &index_buffer);
-    glDeleteBuffers(1, &vertex_buffer);
-    glDeleteVertexArrays(1, &vao);
+    if (forest_growth.valid()) {
+        forest_growth.wait();
+    }
+    chunks->cleanup();
+    tree_renderer.cleanup();
+    grass_renderer.cleanup();
+    if (cdlod) {
+        cdlod->cleanup();
+    }
+    if (clipmap) {
+        clipmap->cleanup();
+    }
 }
 
 void Ocean::update(double dt) {
@@ -161,12 +279,14 @@ void Ocean::update(double dt) {
         }
     }
 
-    static const float move_speed = (float)WORLD_WIDTH / 10.0f;
+    static const float move_speed = VIEW_DISTANCE / 20.0f;
     float move_amt = move_speed * (float)dt;
 
     // TODO: It would be nice if pressing multiple keys didn't change
     // the speed you move at
 
+    vec3 old_position = camera.get_position();
+
     if (pressed_keys.find(GLFW_KEY_W) != pressed_keys.end()) {
         camera.move(Camera::Direction::FORWARD, move_amt);
     }
@@ -186,15 +306,91 @@ void Ocean::update(double dt) {
         camera.move(Camera::Direction::DOWN, move_amt);
     }
 
+    move_camera(old_position, camera.get_position());
+
     update_view_matrix();
     update_eye_position();
+
+    // The forest takes over from the scattered trees once it's grown
+    if (forest_growth.valid() &&
+        forest_growth.wait_for(std::chrono::seconds(0)) ==
+            std::future_status::ready) {
+        try {
+            forest_growth.get();
+            chunks->set_forest(forest.get());
+            chunks->set_fire(fire.get());
+            std::cerr << "Grew " << forest->size() << " trees over "
+                      << forest->get_year() << " years" << std::endl;
+        } catch (const std::runtime_error &e) {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+
+    if (fire_burning) {
+        fire->step(FIRE_STEPS_PER_FRAME);
+        chunks->burn_trees();
+
+        if (fire->get_burning_count() == 0) {
+            fire_burning = false;
+            float area = (float)fire->get_burnt_count() * FIRE_CELL_SIZE *
+                         FIRE_CELL_SIZE;
+            std::cerr << "Fire burnt out after " << fire->get_step()
+                      << " steps, over " << area << " square units"
+                      << std::endl;
+        }
+    }
+
+    switch (terrain_mode) {
+    case TerrainMode::CHUNKS:
+        chunks->update(camera.get_position());
+        break;
+    case TerrainMode::CDLOD:
+        cdlod->select(camera.get_position(), view, perspective, screen_size.y);
+        break;
+    case TerrainMode::CLIPMAP:
+        clipmap->update(camera.get_position());
+        break;
+    }
 }
 
 void Ocean::draw() {
     glUseProgram(program);
-    glBindVertexArray(vao);
-    glDrawElements(
-        GL_TRIANGLES, num_elements, GL_UNSIGNED_INT, (char *)nullptr + 0);
+
+    GLint terrain_mode_attrib = 15;
+    glUniform1i(terrain_mode_attrib, (GLint)terrain_mode);
+
+    GLint node_attrib = 16;
+    switch (terrain_mode) {
+    case TerrainMode::CHUNKS: {
+        GLint model_attrib = 2;
+        GLint model_inv_transp_attrib = 14;
+        Frustum frustum(perspective * view);
+        chunks->draw(frustum, model_attrib, model_inv_transp_attrib);
+
+        chunks->get_tree_grid().query_frustum(
+            frustum, tree_reach, tree_spans);
+        vec3 eye = camera.get_position();
+        tree_renderer.cull(frustum, eye, tree_spans);
+        tree_renderer.draw(view, perspective, eye);
+        grass_renderer.draw(
+            *chunks, *builder, frustum, view, perspective, eye);
+
+        // Everything else sets uniforms on the terrain's program
+        glUseProgram(program);
+        break;
+    }
+    case TerrainMode::CDLOD: {
+        GLint morph_range_attrib = 17;
+        GLint heightmap_info_attrib = 18;
+        cdlod->draw(node_attrib, morph_range_attrib, heightmap_info_attrib);
+        break;
+    }
+    case TerrainMode::CLIPMAP: {
+        GLint clipmap_info_attrib = 19;
+        clipmap->draw(node_attrib, clipmap_info_attrib);
+        break;
+    }
+    }
 }
 
 void Ocean::on_key_event(
@@ -227,6 +423,47 @@ void Ocean::on_key_event(
                     wireframe = false;
                 }
                 break;
+            case 'l':
+            case 'L':
+                // Cycle through the terrain renderers
+                switch (terrain_mode) {
+                case TerrainMode::CHUNKS:
+                    set_terrain_mode(TerrainMode::CDLOD);
+                    break;
+                case TerrainMode::CDLOD:
+                    set_terrain_mode(TerrainMode::CLIPMAP);
+                    break;
+                case TerrainMode::CLIPMAP:
+                    set_terrain_mode(TerrainMode::CHUNKS);
+                    break;
+                }
+                break;
+            case 'g':
+            case 'G':
+                // Walk on the ground instead of flying
+                walking = !walking;
+                break;
+            case 'p':
+            case 'P':
+                // The cursor is captured, so pick under the crosshair
+                pick(vec2(0.0f, 0.0f));
+                break;
+            case 'e':
+            case 'E':
+                export_terrain();
+                break;
+            case 'f':
+            case 'F':
+                start_fire();
+                break;
+            case 'r':
+            case 'R':
+                put_out_fire();
+                break;
+            case 't':
+            case 'T':
+                turn_wind();
+                break;
             }
         }
 
@@ -273,7 +510,7 @@ void Ocean::update_view_matrix() {
 void Ocean::update_perspective_matrix() {
     float aspect_ratio = (float)screen_size.x / (float)screen_size.y;
     perspective = glm::perspective(
-        glm::radians(45.0f), aspect_ratio, 0.1f, (float)WORLD_WIDTH * 2);
+        glm::radians(FIELD_OF_VIEW), aspect_ratio, 0.1f, get_view_distance());
 
     GLint persp_attrib = 4;
     glUniformMatrix4fv(persp_attrib, 1, GL_FALSE, value_ptr(perspective));
@@ -281,6 +518,272 @@ void Ocean::update_perspective_matrix() {
 
 void Ocean::update_eye_position() {
     GLint eye_pos_attrib = 13;
-    glUniformMatrix3fv(
-        eye_pos_attrib, 1, GL_FALSE, value_ptr(camera.get_position()));
+    glUniform3fv(eye_pos_attrib, 1, value_ptr(camera.get_position()));
+}
+
+void Ocean::set_terrain_mode(TerrainMode mode) {
+    try {
+        if (mode == TerrainMode::CDLOD && !cdlod) {
+            build_cdlod();
+        }
+
+        if (mode == TerrainMode::CLIPMAP && !clipmap) {
+            clipmap = std::make_unique<ClipmapTerrain>(
+                pool,
+                *generator,
+                builder->get_params().spacing,
+                ClipmapTerrain::Params());
+            clipmap->init();
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return;
+    }
+
+    terrain_mode = mode;
+    update_perspective_matrix();
+}
+
+void Ocean::build_cdlod() {
+    float spacing = builder->get_params().spacing;
+    vec2 origin = vec2(-0.5f * (float)(CDLOD_SAMPLES - 1) * spacing);
+
+    Heightfield heights = generator->generate(
+        pool, origin, CDLOD_SAMPLES, CDLOD_SAMPLES, spacing);
+
+    vector<uint32_t> splat(CDLOD_SAMPLES * CDLOD_SAMPLES);
+    pool.parallel_for(0, CDLOD_SAMPLES, [&](size_t y) {
+        for (size_t x = 0; x < CDLOD_SAMPLES; ++x) {
+            // The heightfield's Z is our Y
+            vec3 n = heights.normal_at(x, y, spacing);
+            splat[(y * CDLOD_SAMPLES) + x] = generator->splat_weights(
+                heights.at(x, y), vec3(n.x, n.z, n.y));
+        }
+    });
+
+    cdlod = std::make_unique<CdlodTerrain>(
+        std::move(heights),
+        std::move(splat),
+        origin,
+        spacing,
+        CdlodTerrain::Params());
+    cdlod->init();
+}
+
+void Ocean::move_camera(vec3 from, vec3 to) {
+    float ground;
+
+    if (walking) {
+        if (terrain_height_at(vec2(to.x, to.z), ground)) {
+            to.y = ground + EYE_HEIGHT;
+        }
+
+        camera.set_position(to);
+        return;
+    }
+
+    // Flying, slide along the ground instead of passing through it: on
+    // contact, drop the part of the remaining motion that points into
+    // the surface and try again from just off it
+    for (int i = 0; i < 3 && from != to; ++i) {
+        SphereHit hit;
+        if (!sweep_terrain(from, to, CAMERA_RADIUS, hit)) {
+            from = to;
+            break;
+        }
+
+        vec3 rest = to - hit.position;
+        rest -= hit.normal * glm::dot(rest, hit.normal);
+        from = hit.position + (hit.normal * 1e-3f);
+        to = from + rest;
+    }
+
+    // Whatever happened before (like switching to a terrain that's
+    // higher here), never end up under the ground
+    if (terrain_height_at(vec2(from.x, from.z), ground)) {
+        from.y = std::max(from.y, ground + CAMERA_RADIUS);
+    }
+
+    camera.set_position(from);
+}
+
+bool Ocean::terrain_height_at(vec2 xz, float &height) const {
+    switch (terrain_mode) {
+    case TerrainMode::CHUNKS:
+        return chunks->height_at(xz, height);
+    case TerrainMode::CDLOD:
+        height = cdlod->get_collider().height_at(xz);
+        return true;
+    default:
+        // The clipmap only keeps its heights on the GPU
+        return false;
+    }
+}
+
+bool Ocean::sweep_terrain(
+    vec3 start,
+    vec3 end,
+    float radius,
+    SphereHit &hit) const {
+    switch (terrain_mode) {
+    case TerrainMode::CHUNKS:
+        return chunks->sweep_sphere(start, end, radius, hit);
+    case TerrainMode::CDLOD:
+        return cdlod->get_collider().sweep_sphere(start, end, radius, hit);
+    default:
+        return false;
+    }
+}
+
+bool Ocean::raycast_terrain(
+    vec3 start,
+    vec3 dir,
+    float max_distance,
+    RayHit &hit) const {
+    switch (terrain_mode) {
+    case TerrainMode::CHUNKS:
+        return chunks->raycast(start, dir, max_distance, hit);
+    case TerrainMode::CDLOD:
+        return cdlod->get_collider().raycast(start, dir, max_distance, hit);
+    default:
+        return false;
+    }
+}
+
+void Ocean::pick(vec2 ndc) {
+    float aspect_ratio = (float)screen_size.x / (float)screen_size.y;
+    vec3 start = camera.get_position();
+    vec3 dir = camera.get_ray(ndc, FIELD_OF_VIEW, aspect_ratio);
+
+    RayHit hit;
+    if (!raycast_terrain(start, dir, get_view_distance(), hit)) {
+        std::cerr << "Pick: no terrain in range" << std::endl;
+        return;
+    }
+
+    std::cerr << "Pick: (" << hit.position.x << ", " << hit.position.y
+              << ", " << hit.position.z << "), " << hit.distance
+              << " units away" << std::endl;
+}
+
+void Ocean::export_terrain() {
+    // Everything the chunk renderer would stream in around the camera
+    ChunkCoord center = builder->coord_at(camera.get_position());
+    int radius = (int)std::ceil(VIEW_DISTANCE / builder->get_chunk_size());
+    ChunkCoord first = {center.x - radius, center.z - radius};
+    ChunkCoord last = {center.x + radius, center.z + radius};
+
+    try {
+        MeshExporter exporter(
+            pool, *builder, tile_cache.get(), MeshExporter::Params());
+        exporter.write(EXPORT_PATH, first, last);
+        std::cerr << "Exported terrain to " << EXPORT_PATH << std::endl;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+    }
+}
+
+void Ocean::build_fire() {
+    vec2 origin(-FOREST_SIZE / 2.0f);
+    size_t cells = (size_t)(FOREST_SIZE / FIRE_CELL_SIZE);
+
+    vector<TreeInstance> trees;
+    forest->collect(origin, origin + vec2(FOREST_SIZE), trees);
+    Heightfield fuel = WildfireSimulator::fuel_from_trees(
+        trees, origin, FIRE_CELL_SIZE, cells, cells);
+
+    Heightfield heights(cells, cells);
+    pool.parallel_for(0, cells, [&](size_t y) {
+        float z = origin.y + (((float)y + 0.5f) * FIRE_CELL_SIZE);
+        for (size_t x = 0; x < cells; ++x) {
+            heights.at(x, y) = generator->height_at(
+                origin.x + (((float)x + 0.5f) * FIRE_CELL_SIZE), z);
+        }
+    });
+
+    WildfireSimulator::Params fire_params;
+    fire_params.wind = vec2(std::cos(wind_angle), std::sin(wind_angle));
+    fire_params.wind_strength = WIND_STRENGTH;
+    fire = std::make_unique<WildfireSimulator>(
+        pool, fuel, heights, origin, FIRE_CELL_SIZE, fire_params);
+}
+
+void Ocean::start_fire() {
+    // The fire is only there once the forest has grown
+    if (forest_growth.valid() || !fire) {
+        std::cerr << "Fire: no forest to burn" << std::endl;
+        return;
+    }
+
+    float aspect_ratio = (float)screen_size.x / (float)screen_size.y;
+    vec3 start = camera.get_position();
+    vec3 dir = camera.get_ray(vec2(0.0f, 0.0f), FIELD_OF_VIEW, aspect_ratio);
+
+    RayHit hit;
+    if (!raycast_terrain(start, dir, get_view_distance(), hit)) {
+        std::cerr << "Fire: no terrain in range" << std::endl;
+        return;
+    }
+
+    bool lit = false;
+    vec2 center(hit.position.x, hit.position.z);
+    float radius_sq = FIRE_START_RADIUS * FIRE_START_RADIUS;
+    for (float dz = -FIRE_START_RADIUS; dz <= FIRE_START_RADIUS;
+         dz += FIRE_CELL_SIZE) {
+        for (float dx = -FIRE_START_RADIUS; dx <= FIRE_START_RADIUS;
+             dx += FIRE_CELL_SIZE) {
+            if ((dx * dx) + (dz * dz) <= radius_sq) {
+                lit |= fire->ignite(center + vec2(dx, dz));
+            }
+        }
+    }
+
+    if (!lit) {
+        std::cerr << "Fire: nothing to burn there" << std::endl;
+        return;
+    }
+    fire_burning = true;
+    chunks->burn_trees();
+}
+
+void Ocean::put_out_fire() {
+    if (forest_growth.valid() || !fire) {
+        return;
+    }
+
+    fire->reset();
+    fire_burning = false;
+
+    // Put the forest's trees back
+    chunks->set_forest(forest.get());
+}
+
+void Ocean::turn_wind() {
+    // The fire is built on the pool with the wind as it is, so leave
+    // it alone until the fire's there to take the change
+    if (forest_growth.valid() || !fire) {
+        std::cerr << "Wind: no fire to blow on" << std::endl;
+        return;
+    }
+
+    wind_angle =
+        std::fmod(wind_angle + glm::radians(45.0f), glm::radians(360.0f));
+
+    fire->set_wind(
+        vec2(std::cos(wind_angle), std::sin(wind_angle)), WIND_STRENGTH);
+    std::cerr << "Wind blowing towards " << glm::degrees(wind_angle)
+              << " degrees from +X" << std::endl;
+}
+
+float Ocean::get_view_distance() const {
+    switch (terrain_mode) {
+    case TerrainMode::CDLOD:
+        // CDLOD keeps the triangle count down however far we look, so
+        // the whole heightmap can be in view
+        return cdlod->get_extent();
+    case TerrainMode::CLIPMAP:
+        return clipmap->get_extent();
+    default:
+        return VIEW_DISTANCE;
+    }
 }
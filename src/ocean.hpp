@@ -1,8 +1,22 @@
 #pragma once
 
 #include "camera.hpp"
+#include "cdlod.hpp"
+#include "chunk.hpp"
+#include "chunk_manager.hpp"
+#include "clipmap.hpp"
+#include "forest_simulator.hpp"
+#include "generator.hpp"
+#include "grass_renderer.hpp"
 #include "stage.hpp"
-
+#include "thread_pool.hpp"
+#include "tile_cache.hpp"
+#include "tree_mesh_cache.hpp"
+#include "tree_renderer.hpp"
+#include "wildfire.hpp"
+
+#include <future>
+#include <memory>
 #include <unordered_map>
 
 using glm::mat4;
@@ -31,31 +45,122 @@ public:
     void on_window_resize(GLFWwindow *, int, int) override;
 
 private:
+    // Which renderer draws the terrain. The values are what the
+    // vertex shader's uTerrainMode expects.
+    enum class TerrainMode { CHUNKS = 0, CDLOD = 1, CLIPMAP = 2 };
+
     GLFWwindow *window;
 
     GLuint program;
-    GLuint vao;
-
-    GLuint vertex_buffer;
-    GLuint index_buffer;
-    GLsizei num_elements;
 
     Camera camera;
 
+    ThreadPool pool;
+
+    std::unique_ptr<TerrainGenerator> generator;
+    std::unique_ptr<ChunkBuilder> builder;
+    std::unique_ptr<TileCache> tile_cache;
+    std::unique_ptr<ChunkManager> chunks;
+
+    // Built the first time their mode is switched on
+    std::unique_ptr<CdlodTerrain> cdlod;
+    std::unique_ptr<ClipmapTerrain> clipmap;
+
+    TerrainMode terrain_mode = TerrainMode::CHUNKS;
+
+    // Drawn over the chunks, with the chunks' trees
+    std::unique_ptr<TreeMeshCache> tree_meshes;
+    TreeRenderer tree_renderer;
+    vector<InstanceSpan> tree_spans;
+
+    // How far a tree can reach from its base, at its largest scale
+    float tree_reach = 0.0f;
+
+    // Grown on the thread pool from the start, then given to the
+    // chunks in place of their scattered trees
+    std::unique_ptr<ForestSimulator> forest;
+    std::future<void> forest_growth;
+
+    // Set up over the forest as soon as it's grown. Once started, a
+    // fire spreads a few steps every frame and burns down the trees it
+    // reaches.
+    std::unique_ptr<WildfireSimulator> fire;
+    bool fire_burning = false;
+
+    // Direction the wind blows towards, in radians from +X towards +Z
+    float wind_angle = 0.0f;
+
+    // Drawn over the chunks near the camera
+    GrassRenderer grass_renderer;
+
     vec2 screen_size;
     vec2 screen_center;
 
     bool wireframe = false;
 
+    // Whether the camera keeps to the ground rather than flying
+    bool walking = false;
+
     bool is_first_mouse_movement = false;
     vec2 mouse_pos;
     std::unordered_map<int, std::string> pressed_keys;
 
-    mat4 model;
     mat4 view;
     mat4 perspective;
 
     void update_view_matrix();
     void update_perspective_matrix();
     void update_eye_position();
+
+    /**
+     * Move the camera from where it was to where the controls want it,
+     * keeping it above the terrain.
+     */
+    void move_camera(vec3 from, vec3 to);
+
+    bool terrain_height_at(vec2 xz, float &height) const;
+
+    bool sweep_terrain(vec3 start, vec3 end, float radius, SphereHit &hit)
+        const;
+
+    bool raycast_terrain(vec3 start, vec3 dir, float max_distance, RayHit &hit)
+        const;
+
+    /**
+     * Report the terrain under a point on the screen, in normalized
+     * device coordinates.
+     */
+    void pick(vec2 ndc);
+
+    /**
+     * Write the chunks around the camera to a mesh file, see
+     * MeshExporter.
+     */
+    void export_terrain();
+
+    /**
+     * Set up a wildfire over the grown forest. Runs on the pool.
+     */
+    void build_fire();
+
+    /**
+     * Set the forest burning around the terrain under the crosshair.
+     */
+    void start_fire();
+
+    /**
+     * Put out the fire, and grow back everything it burnt.
+     */
+    void put_out_fire();
+
+    /**
+     * Turn the wind an eighth of the way round, once the fire's been
+     * set up.
+     */
+    void turn_wind();
+
+    void set_terrain_mode(TerrainMode mode);
+    void build_cdlod();
+
+    float get_view_distance() const;
 };
@@ -1,11 +1,14 @@
 #pragma once
 
+#include "heightfield.hpp"
+
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <array>
 #include <cstdlib>
 #include <iostream>
+#include <stdexcept>
 
 using std::array;
 
@@ -51,6 +54,27 @@ public:
     array<Vertex, N * N> vertices;
     array<unsigned int, (N - 1) * (N - 1) * 6> indices;
 
+    /**
+     * Displace every vertex along the plane's normal by the matching
+     * sample of a heightfield, and recompute the normals to match.
+     *
+     * @param hf: an N by N heightfield, in the plane's own units
+     */
+    void set_heights(const Heightfield &hf) {
+        if (hf.get_width() != N || hf.get_height() != N) {
+            throw std::invalid_argument(
+                "heightfield size must match the plane's resolution");
+        }
+
+        for (unsigned int y = 0; y < N; ++y) {
+            for (unsigned int x = 0; x < N; ++x) {
+                Vertex *v = &(vertices[(y * N) + x]);
+                v->coords.z = hf.at(x, y);
+                v->normal = hf.normal_at(x, y);
+            }
+        }
+    }
+
     /**
      * Makes a matrix that puts the plane into world coordinates.
      *
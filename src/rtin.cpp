@@ -0,0 +1,156 @@
+#include "rtin.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+Rtin::Rtin(size_t size) : grid_size(size) {
+    size_t tile_size = grid_size - 1;
+    if (grid_size < 3 || grid_size > 65535 ||
+        (tile_size & (tile_size - 1)) != 0) {
+        std::string err_msg = "RTIN grid size must be 2^k + 1, but got ";
+        err_msg.append(std::to_string(grid_size));
+
+        throw std::invalid_argument(err_msg);
+    }
+
+    size_t triangle_count = (tile_size * tile_size * 2) - 2;
+    parent_count = triangle_count - (tile_size * tile_size);
+    coords.resize(triangle_count * 4);
+
+    // Triangle i is node i + 2 of a binary tree whose two roots split
+    // the grid along its diagonal; each bit of the id below the
+    // leading one picks the left or right half of the triangle above
+    for (size_t i = 0; i < triangle_count; ++i) {
+        size_t id = i + 2;
+        size_t ax = 0;
+        size_t ay = 0;
+        size_t bx = 0;
+        size_t by = 0;
+        size_t cx = 0;
+        size_t cy = 0;
+
+        if (id & 1) {
+            bx = tile_size;
+            by = tile_size;
+            cx = tile_size;
+        } else {
+            ax = tile_size;
+            ay = tile_size;
+            cy = tile_size;
+        }
+
+        while ((id >>= 1) > 1) {
+            size_t mx = (ax + bx) >> 1;
+            size_t my = (ay + by) >> 1;
+
+            if (id & 1) {
+                bx = ax;
+                by = ay;
+                ax = cx;
+                ay = cy;
+            } else {
+                ax = bx;
+                ay = by;
+                bx = cx;
+                by = cy;
+            }
+            cx = mx;
+            cy = my;
+        }
+
+        coords[(i * 4) + 0] = (uint16_t)ax;
+        coords[(i * 4) + 1] = (uint16_t)ay;
+        coords[(i * 4) + 2] = (uint16_t)bx;
+        coords[(i * 4) + 3] = (uint16_t)by;
+    }
+}
+
+void Rtin::compute_errors(const Heightfield &heights, vector<float> &errors)
+    const {
+    if (heights.get_width() != grid_size ||
+        heights.get_height() != grid_size) {
+        throw std::invalid_argument(
+            "heightfield size must match the RTIN grid size");
+    }
+
+    const size_t tile_size = grid_size - 1;
+    const float *h = heights.data();
+    errors.assign(grid_size * grid_size, 0.0f);
+
+    // Smallest triangles first, so each one can take on the errors of
+    // the two below it
+    size_t triangle_count = coords.size() / 4;
+    for (size_t i = triangle_count; i-- > 0;) {
+        size_t ax = coords[(i * 4) + 0];
+        size_t ay = coords[(i * 4) + 1];
+        size_t bx = coords[(i * 4) + 2];
+        size_t by = coords[(i * 4) + 3];
+        size_t mx = (ax + bx) >> 1;
+        size_t my = (ay + by) >> 1;
+        size_t middle = (my * grid_size) + mx;
+
+        float error;
+        if (mx == 0 || my == 0 || mx == tile_size || my == tile_size) {
+            error = FLT_MAX;
+        } else {
+            float interpolated =
+                (h[(ay * grid_size) + ax] + h[(by * grid_size) + bx]) * 0.5f;
+            error = std::abs(interpolated - h[middle]);
+        }
+        errors[middle] = std::max(errors[middle], error);
+
+        if (i < parent_count) {
+            // The right-angled corner, and the middles of the two legs,
+            // which are the children's hypotenuses
+            size_t cx = mx + my - ay;
+            size_t cy = my + ax - mx;
+            size_t left = (((ay + cy) >> 1) * grid_size) + ((ax + cx) >> 1);
+            size_t right = (((by + cy) >> 1) * grid_size) + ((bx + cx) >> 1);
+            errors[middle] =
+                std::max({errors[middle], errors[left], errors[right]});
+        }
+    }
+}
+
+void Rtin::extract(
+    const vector<float> &errors,
+    float max_error,
+    vector<uint32_t> &indices) const {
+    uint32_t max = (uint32_t)(grid_size - 1);
+
+    indices.clear();
+    extract_triangle(errors, max_error, 0, 0, max, max, max, 0, indices);
+    extract_triangle(errors, max_error, max, max, 0, 0, 0, max, indices);
+}
+
+void Rtin::extract_triangle(
+    const vector<float> &errors,
+    float max_error,
+    uint32_t ax,
+    uint32_t ay,
+    uint32_t bx,
+    uint32_t by,
+    uint32_t cx,
+    uint32_t cy,
+    vector<uint32_t> &indices) const {
+    uint32_t mx = (ax + bx) >> 1;
+    uint32_t my = (ay + by) >> 1;
+
+    // Split unless this is a single cell's half or it's close enough
+    bool is_cell = (std::max(ax, cx) - std::min(ax, cx)) +
+                       (std::max(ay, cy) - std::min(ay, cy)) ==
+                   1;
+    if (!is_cell && errors[(my * grid_size) + mx] > max_error) {
+        extract_triangle(errors, max_error, cx, cy, ax, ay, mx, my, indices);
+        extract_triangle(errors, max_error, bx, by, cx, cy, mx, my, indices);
+        return;
+    }
+
+    uint32_t size = (uint32_t)grid_size;
+    indices.push_back((ay * size) + ax);
+    indices.push_back((by * size) + bx);
+    indices.push_back((cy * size) + cx);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "heightfield.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+using std::vector;
+
+/**
+ * Right-triangulated irregular network over a square grid of 2^k + 1
+ * samples per side: adaptive meshes made only of the right triangles
+ * you get by splitting the grid's two halves along their hypotenuses,
+ * again and again.
+ *
+ * A tile's heights are turned into an error map once: for every
+ * sample, the largest vertical error that leaving out the sample, and
+ * so everything split below it, would make. A mesh for any error
+ * threshold then takes a single walk down the triangles that need
+ * splitting, linear in the size of the result, and never has cracks
+ * inside the tile.
+ *
+ * Samples on the tile's border always count as too far off, so every
+ * tile keeps its full-resolution edges and meets its neighbours (and
+ * full-resolution tiles) without cracks whatever their thresholds.
+ * Only the inside of the tile is simplified.
+ */
+class Rtin {
+public:
+    /**
+     * @param grid_size: samples per side, one more than a power of two
+     */
+    explicit Rtin(size_t grid_size);
+
+    size_t get_grid_size() const {
+        return grid_size;
+    }
+
+    /**
+     * Compute the error map of a tile.
+     *
+     * @param heights: grid_size by grid_size samples
+     * @param errors: resized to one entry per sample
+     */
+    void compute_errors(const Heightfield &heights, vector<float> &errors)
+        const;
+
+    /**
+     * Triangulate a tile, splitting every triangle that would
+     * otherwise pass more than max_error above or below the sample in
+     * the middle of its hypotenuse. Samples elsewhere in a triangle
+     * aren't checked, so they can be off by a little more.
+     *
+     * @param errors: the tile's error map
+     * @param indices: replaced with a triangle list of sample indices,
+     * y * grid_size + x
+     */
+    void extract(
+        const vector<float> &errors,
+        float max_error,
+        vector<uint32_t> &indices) const;
+
+private:
+    size_t grid_size;
+
+    // Every triangle down to single cells, in the order they're found
+    // by splitting, as the two ends of their hypotenuses: ax, ay, bx,
+    // by. The right-angled corner follows from those.
+    vector<uint16_t> coords;
+
+    // How many of them are split further
+    size_t parent_count;
+
+    void extract_triangle(
+        const vector<float> &errors,
+        float max_error,
+        uint32_t ax,
+        uint32_t ay,
+        uint32_t bx,
+        uint32_t by,
+        uint32_t cx,
+        uint32_t cy,
+        vector<uint32_t> &indices) const;
+};
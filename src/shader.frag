@@ -5,6 +5,7 @@
 in vec3 worldPosition;
 in vec4 viewPosition;
 in vec3 normal;
+in vec4 splat;
 
 layout(location = 3) uniform mat4 uView;
 layout(location = 13) uniform vec3 eyePos;
@@ -21,6 +22,11 @@ layout(location = 12) uniform float materialShininess;
 
 out vec4 fragColor;
 
+const vec3 grassColor = vec3(0.20, 0.42, 0.12);
+const vec3 rockColor = vec3(0.42, 0.38, 0.33);
+const vec3 snowColor = vec3(0.92, 0.94, 0.96);
+const vec3 sandColor = vec3(0.76, 0.68, 0.46);
+
 void main() {
     if (abs(worldPosition.x) < 0.1 && abs(worldPosition.y) < 0.1) {
         if (worldPosition.z > 0.0) {
@@ -45,7 +51,8 @@ void main() {
 
     } else {
         // Set color according to lighting
-        fragColor = vec4(diffuseMaterialColor, 1.0f);
+        vec3 albedo = (splat.r * grassColor) + (splat.g * rockColor) +
+                      (splat.b * snowColor) + (splat.a * sandColor);
 
         vec3 fragmentToLight = normalize(lightPos - worldPosition);
         vec3 reflection = normalize(reflect(-fragmentToLight, normal));
@@ -56,8 +63,8 @@ void main() {
         float specularWeight = pow(NDotH, materialShininess);
         float diffuseWeight = max(0.0, dot(normal, fragmentToLight));
 
-        vec3 ambient = ambientLightColor * ambientMaterialColor;
-        vec3 diffuse = (diffuseLightColor * diffuseMaterialColor) * diffuseWeight;
+        vec3 ambient = ambientLightColor * ambientMaterialColor * albedo;
+        vec3 diffuse = (diffuseLightColor * diffuseMaterialColor * albedo) * diffuseWeight;
         vec3 specular = (specularLightColor * specularMaterialColor) * specularWeight;
 
         fragColor = vec4(ambient + diffuse + specular, 1.0);
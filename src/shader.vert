@@ -1,24 +1,174 @@
 #version 420 core
 #extension GL_ARB_explicit_uniform_location : enable
 
+// Position on the chunk's (or CDLOD patch's) grid in .xy, in samples
 layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 aNorm;
+layout(location = 2) in float aHeight;
+
+// Material weights: grass, rock, snow, sand
+layout(location = 3) in vec4 aSplat;
 
 layout(location = 2) uniform mat4 uModel;
 layout(location = 3) uniform mat4 uView;
 layout(location = 4) uniform mat4 uPersp;
 
+layout(location = 13) uniform vec3 eyePos;
 layout(location = 14) uniform mat4 uModelInvTransp;
 
+// 0 for streamed chunks, which bring their own heights, normals and
+// splat weights; 1 for CDLOD patches displaced by the heightmap; 2 for
+// clipmap rings displaced by their level's texture layer
+layout(location = 15) uniform int uTerrainMode;
+
+// CDLOD node or clipmap ring: world XZ of its first vertex in .xy,
+// world size of one quad in .z, and for rings the level in .w
+layout(location = 16) uniform vec4 uNode;
+
+// Distances from the eye over which the node morphs into the next
+// coarser level
+layout(location = 17) uniform vec2 uMorphRange;
+
+// World XZ of the heightmap's first sample in .xy, 1 / sample spacing
+// in .z, 1 / samples per side in .w
+layout(location = 18) uniform vec4 uHeightmapInfo;
+
+// Clipmaps: 1 / texture size in .x, quads from a ring's centre to its
+// edge in .y, width of the band where it blends into the next level
+// in .z, coarsest level in .w
+layout(location = 19) uniform vec4 uClipmapInfo;
+
+layout(binding = 0) uniform sampler2D uHeightmap;
+layout(binding = 1) uniform sampler2D uSplatmap;
+
+// One layer per clipmap level, addressed toroidally
+layout(binding = 2) uniform sampler2DArray uClipHeights;
+layout(binding = 3) uniform sampler2DArray uClipSplat;
+
 out vec3 worldPosition;
 out vec4 viewPosition;
 
 out vec3 normal;
+out vec4 splat;
+
+vec2 heightmapCoords(vec2 xz) {
+    return ((xz - uHeightmapInfo.xy) * uHeightmapInfo.z + 0.5) *
+           uHeightmapInfo.w;
+}
+
+float heightAt(vec2 xz) {
+    return textureLod(uHeightmap, heightmapCoords(xz), 0.0).r;
+}
+
+void cdlodVertex() {
+    vec2 grid = aPos.xy;
+    vec2 xz = uNode.xy + (grid * uNode.z);
+
+    float dist = distance(eyePos, vec3(xz.x, heightAt(xz), xz.y));
+    float morph = clamp(
+        (dist - uMorphRange.x) / max(uMorphRange.y - uMorphRange.x, 1e-3),
+        0.0,
+        1.0);
+
+    // Slide odd vertices onto their even neighbours; fully morphed,
+    // the patch is exactly the next coarser level's mesh
+    grid -= fract(grid * 0.5) * 2.0 * morph;
+    xz = uNode.xy + (grid * uNode.z);
+
+    worldPosition = vec3(xz.x, heightAt(xz), xz.y);
+
+    // Differences at this level's own spacing, so that distant
+    // normals don't shimmer
+    float d = uNode.z;
+    float left = heightAt(xz - vec2(d, 0.0));
+    float right = heightAt(xz + vec2(d, 0.0));
+    float down = heightAt(xz - vec2(0.0, d));
+    float up = heightAt(xz + vec2(0.0, d));
+    normal = normalize(vec3(left - right, 2.0 * d, down - up));
+
+    splat = textureLod(uSplatmap, heightmapCoords(xz), 0.0);
+}
+
+vec3 clipmapCoords(vec2 xz, float spacing, float level) {
+    return vec3((xz / spacing + 0.5) * uClipmapInfo.x, level);
+}
+
+float clipmapHeightAt(vec2 xz, float spacing, float level) {
+    return textureLod(uClipHeights, clipmapCoords(xz, spacing, level), 0.0).r;
+}
+
+void clipmapSample(
+    vec2 xz,
+    float spacing,
+    float level,
+    out float height,
+    out vec3 n,
+    out vec4 weights) {
+    height = clipmapHeightAt(xz, spacing, level);
+
+    float left = clipmapHeightAt(xz - vec2(spacing, 0.0), spacing, level);
+    float right = clipmapHeightAt(xz + vec2(spacing, 0.0), spacing, level);
+    float down = clipmapHeightAt(xz - vec2(0.0, spacing), spacing, level);
+    float up = clipmapHeightAt(xz + vec2(0.0, spacing), spacing, level);
+    n = normalize(vec3(left - right, 2.0 * spacing, down - up));
+
+    weights = textureLod(uClipSplat, clipmapCoords(xz, spacing, level), 0.0);
+}
+
+void clipmapVertex() {
+    float spacing = uNode.z;
+    float level = uNode.w;
+    vec2 grid = aPos.xy;
+    vec2 xz = uNode.xy + (grid * spacing);
+
+    float height;
+    vec3 n;
+    vec4 weights;
+    clipmapSample(xz, spacing, level, height, n, weights);
+
+    if (level < uClipmapInfo.w) {
+        // Blend into the next level towards the outside of the ring.
+        // On the very edge the odd vertices then sit on the coarser
+        // ring's edges, so there are no cracks.
+        vec2 fromCenter = abs(grid - uClipmapInfo.y);
+        float edge = max(fromCenter.x, fromCenter.y);
+        float start = uClipmapInfo.y - uClipmapInfo.z - 1.0;
+        float alpha = clamp((edge - start) / uClipmapInfo.z, 0.0, 1.0);
+
+        float coarseHeight;
+        vec3 coarseNormal;
+        vec4 coarseWeights;
+        clipmapSample(
+            xz,
+            2.0 * spacing,
+            level + 1.0,
+            coarseHeight,
+            coarseNormal,
+            coarseWeights);
+
+        height = mix(height, coarseHeight, alpha);
+        n = normalize(mix(n, coarseNormal, alpha));
+        weights = mix(weights, coarseWeights, alpha);
+    }
+
+    worldPosition = vec3(xz.x, height, xz.y);
+    normal = n;
+    splat = weights;
+}
 
 void main() {
-    worldPosition = (uModel * vec4(aPos, 1.0)).xyz;
-    viewPosition = uView * vec4(worldPosition, 1.0);
-    normal = normalize(uModelInvTransp * vec4(aNorm, 1.0)).xyz;
+    if (uTerrainMode == 1) {
+        cdlodVertex();
+    } else if (uTerrainMode == 2) {
+        clipmapVertex();
+    } else {
+        vec3 localPosition = vec3(aPos.x, aHeight, aPos.y);
 
+        worldPosition = (uModel * vec4(localPosition, 1.0)).xyz;
+        normal = normalize((uModelInvTransp * vec4(aNorm, 0.0)).xyz);
+        splat = aSplat;
+    }
+
+    viewPosition = uView * vec4(worldPosition, 1.0);
     gl_Position = uPersp * viewPosition;
 }
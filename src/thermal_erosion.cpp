@@ -0,0 +1,189 @@
+#include "thermal_erosion.hpp"
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const float SQRT_2 = 1.41421356f;
+
+// Net amount flowing into a sample of height c from a neighbour of
+// height n, before scaling by the rate
+static inline float talus_flow(float c, float n, float t) {
+    float d = n - c;
+    return std::max(d - t, 0.0f) - std::max(-d - t, 0.0f);
+}
+
+ThermalErosion::ThermalErosion(Params p) : params(p) {
+    if (params.rate <= 0.0f || params.rate > 1.0f) {
+        throw std::invalid_argument("thermal erosion rate must be in (0, 1]");
+    }
+    if (params.strip_width == 0 || params.band_height == 0) {
+        throw std::invalid_argument("thermal erosion tiles can't be empty");
+    }
+}
+
+void ThermalErosion::erode(Heightfield &hf, int passes, ThreadPool *pool) {
+    size_t width = hf.get_width();
+    size_t height = hf.get_height();
+    if (passes <= 0 || width == 0 || height == 0) {
+        return;
+    }
+
+    // Every pass writes every sample, so the scratch buffer needs no
+    // copy of the heights to start from
+    scratch.resize(width * height);
+
+    float *front = hf.data();
+    float *back = scratch.data();
+    for (int pass = 0; pass < passes; ++pass) {
+        run_pass(front, back, width, height, pool);
+        std::swap(front, back);
+    }
+
+    // After an odd number of passes the result is in the scratch
+    if (front != hf.data()) {
+        std::memcpy(hf.data(), front, width * height * sizeof(float));
+    }
+}
+
+void ThermalErosion::run_pass(
+    const float *src,
+    float *dst,
+    size_t width,
+    size_t height,
+    ThreadPool *pool) const {
+    size_t num_bands = (height + params.band_height - 1) / params.band_height;
+
+    auto run_band = [&](size_t band) {
+        size_t row_begin = band * params.band_height;
+        size_t row_end = std::min(row_begin + params.band_height, height);
+        run_rows(src, dst, width, height, row_begin, row_end);
+    };
+
+    if (pool && num_bands > 1) {
+        pool->parallel_for(0, num_bands, run_band);
+    } else {
+        for (size_t band = 0; band < num_bands; ++band) {
+            run_band(band);
+        }
+    }
+}
+
+void ThermalErosion::run_rows(
+    const float *src,
+    float *dst,
+    size_t width,
+    size_t height,
+    size_t row_begin,
+    size_t row_end) const {
+    // Spread over 8 neighbours, so a full rate can at most level a
+    // sample with its neighbours in one pass
+    const float k = params.rate / 8.0f;
+    const float t = params.talus;
+    const float t_diag = params.talus * SQRT_2;
+    const ptrdiff_t w = (ptrdiff_t)width;
+
+    // Edge samples treat missing neighbours as being at their own
+    // height, i.e. no flow through the border of the map
+    auto edge_sample = [&](size_t x, size_t y) {
+        size_t xl = (x > 0) ? x - 1 : x;
+        size_t xr = (x + 1 < width) ? x + 1 : x;
+        size_t yu = (y > 0) ? y - 1 : y;
+        size_t yd = (y + 1 < height) ? y + 1 : y;
+
+        float c = src[(y * width) + x];
+        float acc = 0.0f;
+        acc += talus_flow(c, src[(y * width) + xl], t);
+        acc += talus_flow(c, src[(y * width) + xr], t);
+        acc += talus_flow(c, src[(yu * width) + x], t);
+        acc += talus_flow(c, src[(yd * width) + x], t);
+        acc += talus_flow(c, src[(yu * width) + xl], t_diag);
+        acc += talus_flow(c, src[(yu * width) + xr], t_diag);
+        acc += talus_flow(c, src[(yd * width) + xl], t_diag);
+        acc += talus_flow(c, src[(yd * width) + xr], t_diag);
+        dst[(y * width) + x] = c + (k * acc);
+    };
+
+#ifdef __SSE2__
+    const __m128 k4 = _mm_set1_ps(k);
+    const __m128 t4 = _mm_set1_ps(t);
+    const __m128 t_diag4 = _mm_set1_ps(t_diag);
+    const __m128 zero = _mm_setzero_ps();
+
+    auto flow4 = [&](__m128 c, const float *n, __m128 threshold) {
+        __m128 d = _mm_sub_ps(_mm_loadu_ps(n), c);
+        __m128 in = _mm_max_ps(_mm_sub_ps(d, threshold), zero);
+        __m128 neg_d = _mm_sub_ps(zero, d);
+        __m128 out = _mm_max_ps(_mm_sub_ps(neg_d, threshold), zero);
+        return _mm_sub_ps(in, out);
+    };
+#endif
+
+    for (size_t sx = 0; sx < width; sx += params.strip_width) {
+        size_t sx_end = std::min(sx + params.strip_width, width);
+
+        // Interior columns of this strip, where all 8 neighbours exist
+        size_t ix0 = std::max(sx, (size_t)1);
+        size_t ix1 = std::min(sx_end, width - 1);
+
+        for (size_t y = row_begin; y < row_end; ++y) {
+            if (y == 0 || y + 1 >= height || ix0 >= ix1) {
+                for (size_t x = sx; x < sx_end; ++x) {
+                    edge_sample(x, y);
+                }
+                continue;
+            }
+
+            for (size_t x = sx; x < ix0; ++x) {
+                edge_sample(x, y);
+            }
+
+            const float *row = src + (y * width);
+            float *out_row = dst + (y * width);
+            size_t x = ix0;
+
+#ifdef __SSE2__
+            for (; x + 4 <= ix1; x += 4) {
+                const float *p = row + x;
+                __m128 c = _mm_loadu_ps(p);
+                __m128 acc = zero;
+                acc = _mm_add_ps(acc, flow4(c, p - 1, t4));
+                acc = _mm_add_ps(acc, flow4(c, p + 1, t4));
+                acc = _mm_add_ps(acc, flow4(c, p - w, t4));
+                acc = _mm_add_ps(acc, flow4(c, p + w, t4));
+                acc = _mm_add_ps(acc, flow4(c, p - w - 1, t_diag4));
+                acc = _mm_add_ps(acc, flow4(c, p - w + 1, t_diag4));
+                acc = _mm_add_ps(acc, flow4(c, p + w - 1, t_diag4));
+                acc = _mm_add_ps(acc, flow4(c, p + w + 1, t_diag4));
+                _mm_storeu_ps(out_row + x, _mm_add_ps(c, _mm_mul_ps(k4, acc)));
+            }
+#endif
+
+            // Same arithmetic in the same order as the vector loop
+            for (; x < ix1; ++x) {
+                const float *p = row + x;
+                float c = *p;
+                float acc = 0.0f;
+                acc += talus_flow(c, p[-1], t);
+                acc += talus_flow(c, p[1], t);
+                acc += talus_flow(c, p[-w], t);
+                acc += talus_flow(c, p[w], t);
+                acc += talus_flow(c, p[-w - 1], t_diag);
+                acc += talus_flow(c, p[-w + 1], t_diag);
+                acc += talus_flow(c, p[w - 1], t_diag);
+                acc += talus_flow(c, p[w + 1], t_diag);
+                out_row[x] = c + (k * acc);
+            }
+
+            for (x = std::max(ix1, sx); x < sx_end; ++x) {
+                edge_sample(x, y);
+            }
+        }
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "heightfield.hpp"
+
+#include <cstdlib>
+#include <vector>
+
+class ThreadPool;
+
+/**
+ * Thermal (talus) erosion: wherever the slope to one of the 8
+ * neighbours of a sample is steeper than the talus angle, material
+ * slides down to that neighbour.
+ *
+ * Each pass is a pure stencil from one buffer into another, so every
+ * sample can be updated independently. The interior is vectorized
+ * with SSE2 when the compiler targets it, and the grid is walked in
+ * bands of rows and strips of columns so the three source rows a
+ * strip reads stay in cache.
+ */
+class ThermalErosion {
+public:
+    struct Params {
+        // Largest height difference between direct neighbours, per
+        // grid unit, that is left alone
+        float talus = 0.7f;
+
+        // Fraction of the excess slope moved in one pass, in (0, 1]
+        float rate = 0.5f;
+
+        // Columns handled at a time by each row band
+        size_t strip_width = 1024;
+
+        // Rows handed to a worker at a time when running on a pool
+        size_t band_height = 64;
+    };
+
+    ThermalErosion() : ThermalErosion(Params()) {}
+
+    explicit ThermalErosion(Params p);
+
+    /**
+     * Run some passes over the whole heightfield, in grid units.
+     *
+     * @param pool: if given, row bands are spread over its workers
+     */
+    void erode(Heightfield &hf, int passes, ThreadPool *pool = nullptr);
+
+private:
+    Params params;
+
+    // Second half of the ping-pong pair, kept around between calls so
+    // repeated runs don't allocate
+    vector<float> scratch;
+
+    void run_pass(
+        const float *src,
+        float *dst,
+        size_t width,
+        size_t height,
+        ThreadPool *pool) const;
+
+    void run_rows(
+        const float *src,
+        float *dst,
+        size_t width,
+        size_t height,
+        size_t row_begin,
+        size_t row_end) const;
+};
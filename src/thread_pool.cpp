@@ -0,0 +1,123 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+ThreadPool::ThreadPool(size_t num_threads) {
+    if (num_threads == 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    workers.reserve(num_threads);
+    for (size_t i = 0; i < num_threads; ++i) {
+        workers.emplace_back([this]() { worker_loop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        stopping = true;
+    }
+    jobs_available.notify_all();
+
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::enqueue(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        jobs.push_back(std::move(job));
+    }
+    jobs_available.notify_one();
+}
+
+void ThreadPool::worker_loop() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(jobs_mutex);
+            jobs_available.wait(
+                lock, [this]() { return stopping || !jobs.empty(); });
+
+            // Drain whatever is left before shutting down, so no
+            // future is left without a value
+            if (jobs.empty()) {
+                return;
+            }
+
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+
+        job();
+    }
+}
+
+void ThreadPool::parallel_for(
+    size_t begin,
+    size_t end,
+    const std::function<void(size_t)> &fn) {
+    if (begin >= end) {
+        return;
+    }
+
+    // Helpers may only get to run after everything is already done,
+    // so the state they touch has to outlive this call
+    struct State {
+        std::atomic<size_t> next;
+        std::atomic<size_t> remaining;
+        std::function<void(size_t)> fn;
+        size_t end;
+
+        std::mutex mutex;
+        std::condition_variable finished;
+        std::exception_ptr error;
+    };
+
+    auto state = std::make_shared<State>();
+    state->next = begin;
+    state->remaining = end - begin;
+    state->fn = fn;
+    state->end = end;
+
+    auto work = [state]() {
+        while (true) {
+            size_t i = state->next.fetch_add(1);
+            if (i >= state->end) {
+                return;
+            }
+
+            try {
+                state->fn(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if (!state->error) {
+                    state->error = std::current_exception();
+                }
+            }
+
+            if (state->remaining.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->finished.notify_all();
+            }
+        }
+    };
+
+    size_t helpers = std::min(workers.size(), end - begin - 1);
+    for (size_t i = 0; i < helpers; ++i) {
+        enqueue(work);
+    }
+
+    work();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&state]() { return state->remaining == 0; });
+
+    if (state->error) {
+        std::rethrow_exception(state->error);
+    }
+}
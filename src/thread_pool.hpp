@@ -0,0 +1,71 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed set of worker threads pulling jobs off a shared FIFO queue.
+ */
+class ThreadPool {
+public:
+    /**
+     * @param num_threads: worker count, or 0 to use one per hardware
+     * thread
+     */
+    explicit ThreadPool(size_t num_threads = 0);
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    size_t size() const {
+        return workers.size();
+    }
+
+    /**
+     * Queue a job and get a future for its result. Exceptions thrown
+     * by the job are rethrown from the future's get().
+     */
+    template<typename F>
+    auto submit(F &&job) -> std::future<decltype(job())> {
+        using Result = decltype(job());
+
+        auto task = std::make_shared<std::packaged_task<Result()>>(
+            std::forward<F>(job));
+        std::future<Result> result = task->get_future();
+
+        enqueue([task]() { (*task)(); });
+        return result;
+    }
+
+    /**
+     * Call fn(i) for every i in [begin, end), spread over the workers,
+     * and return once every call has finished. The calling thread
+     * works through indices too, so this is safe to use from inside a
+     * job running on this same pool.
+     */
+    void parallel_for(
+        size_t begin,
+        size_t end,
+        const std::function<void(size_t)> &fn);
+
+private:
+    std::vector<std::thread> workers;
+
+    std::deque<std::function<void()>> jobs;
+    std::mutex jobs_mutex;
+    std::condition_variable jobs_available;
+    bool stopping = false;
+
+    void enqueue(std::function<void()> job);
+
+    void worker_loop();
+};
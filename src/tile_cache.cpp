@@ -0,0 +1,289 @@
+#include "tile_cache.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+static const char MAGIC[8] = {'T', 'F', 'T', 'C', 'A', 'C', 'H', 'E'};
+static const uint32_t VERSION = 2;
+
+// Alignment of COMPRESSED tiles: one cache line
+static const size_t COMPRESSED_ALIGNMENT = 64;
+
+// The file grows at least this much at a time, to keep remapping rare
+static const size_t GROW_BYTES = 64 * 1024 * 1024;
+
+static size_t round_up(size_t n, size_t multiple) {
+    return ((n + multiple - 1) / multiple) * multiple;
+}
+
+static std::runtime_error file_error(const std::string &what) {
+    std::string err_msg = "tile cache: ";
+    err_msg.append(what);
+    err_msg.append(": ");
+    err_msg.append(std::strerror(errno));
+    return std::runtime_error(err_msg);
+}
+
+/**
+ * Make the file at least size bytes long, with its blocks actually
+ * allocated: writing through a mapping into a hole the disk has no room
+ * for kills the process with SIGBUS, where this fails cleanly instead.
+ *
+ * @return whether it worked, with errno set if not
+ */
+static bool allocate(int fd, size_t size) {
+    int err = posix_fallocate(fd, 0, (off_t)size);
+    if (err != 0) {
+        errno = err;
+        return false;
+    }
+    return true;
+}
+
+TileCache::TileCache(
+    const std::string &path,
+    uint64_t content_key,
+    Params p) :
+    params(p),
+    codec(HeightfieldCodec::Params{p.precision}),
+    page_size((size_t)sysconf(_SC_PAGESIZE)) {
+    index_end = round_up(
+        sizeof(Header) + (params.max_tiles * sizeof(Entry)), page_size);
+    tile_alignment = (params.format == Format::RAW) ? page_size
+                                                    : COMPRESSED_ALIGNMENT;
+
+    fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        throw file_error("failed to open '" + path + "'");
+    }
+
+    try {
+        load(path, content_key);
+    } catch (...) {
+        unmap_file();
+        close(fd);
+        throw;
+    }
+}
+
+TileCache::~TileCache() {
+    if (mapping) {
+        // Drop the unused space reserved by the last growth
+        size_t data_end = header()->data_end;
+        unmap_file();
+        if (ftruncate(fd, (off_t)data_end) != 0) {
+            // Nothing sensible to do about it; the file is still valid
+        }
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+void TileCache::load(const std::string &path, uint64_t content_key) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        throw file_error("failed to stat '" + path + "'");
+    }
+
+    size_t file_size = (size_t)st.st_size;
+    if (file_size < index_end) {
+        reset(content_key);
+        return;
+    }
+
+    map_file(file_size);
+
+    const Header *h = header();
+    float precision = params.precision;
+    bool valid = std::memcmp(h->magic, MAGIC, sizeof(MAGIC)) == 0 &&
+                 h->version == VERSION && h->tile_bytes == CHUNK_BLOB_BYTES &&
+                 h->format == (uint32_t)params.format &&
+                 std::memcmp(&h->precision, &precision, sizeof(float)) == 0 &&
+                 h->content_key == content_key &&
+                 h->max_tiles == params.max_tiles &&
+                 h->tile_count <= params.max_tiles &&
+                 h->data_end >= index_end && h->data_end <= file_size;
+    if (!valid) {
+        reset(content_key);
+        return;
+    }
+
+    // Tiles are read straight from the mapping, so a corrupt or half
+    // written entry mustn't point outside of the data
+    for (size_t i = 0; i < h->tile_count; ++i) {
+        const Entry &e = entries()[i];
+        bool in_data = e.offset >= index_end && e.size <= h->data_end &&
+                       e.offset <= h->data_end - e.size;
+        bool whole = params.format != Format::RAW ||
+                     e.size == CHUNK_BLOB_BYTES;
+        if (!in_data || !whole) {
+            reset(content_key);
+            return;
+        }
+
+        // A chunk stored again after forget() has a later entry,
+        // which wins
+        index[{e.x, e.z}] = i;
+    }
+}
+
+bool TileCache::contains(ChunkCoord coord) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return index.count(coord) != 0;
+}
+
+void TileCache::store(const ChunkData &data) {
+    // Compress before taking the lock, it's the slow part
+    vector<uint8_t> encoded;
+    if (params.format == Format::COMPRESSED) {
+        codec.encode(data.padded_heights, encoded);
+    }
+    size_t size = (params.format == Format::RAW) ? CHUNK_BLOB_BYTES
+                                                 : encoded.size();
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+
+    if (index.count(data.coord) || header()->tile_count >= params.max_tiles) {
+        return;
+    }
+
+    size_t offset = round_up(header()->data_end, tile_alignment);
+    size_t end = offset + size;
+    if (end > mapped_size) {
+        size_t new_size =
+            round_up(std::max(end, mapped_size + GROW_BYTES), page_size);
+        // Nothing is published until the new mapping is in place, so if
+        // either step fails the cache carries on as it was
+        if (!allocate(fd, new_size)) {
+            throw file_error("failed to grow the file");
+        }
+        map_file(new_size);
+    }
+
+    if (params.format == Format::RAW) {
+        data.write_blob(mapping + offset);
+    } else {
+        std::memcpy(mapping + offset, encoded.data(), size);
+    }
+
+    // Only publish the entry once its data is in place
+    size_t i = header()->tile_count;
+    entries()[i] = {data.coord.x, data.coord.z, offset, size};
+    header()->data_end = end;
+    header()->tile_count = i + 1;
+
+    index[data.coord] = i;
+}
+
+bool TileCache::load_heights(
+    ChunkCoord coord,
+    Heightfield &out,
+    size_t samples) const {
+    if (params.format != Format::COMPRESSED) {
+        return false;
+    }
+
+    bool found = with_tile(coord, [&out](const uint8_t *tile, size_t size) {
+        HeightfieldCodec::decode(tile, size, out);
+    });
+    if (found && (out.get_width() != samples || out.get_height() != samples)) {
+        std::string err_msg = "tile cache: expected ";
+        err_msg.append(std::to_string(samples));
+        err_msg.append("x");
+        err_msg.append(std::to_string(samples));
+        err_msg.append(" heights, got ");
+        err_msg.append(std::to_string(out.get_width()));
+        err_msg.append("x");
+        err_msg.append(std::to_string(out.get_height()));
+        throw std::runtime_error(err_msg);
+    }
+
+    return found;
+}
+
+void TileCache::forget(ChunkCoord coord) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    index.erase(coord);
+}
+
+void TileCache::prefetch(ChunkCoord coord) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+
+    auto it = index.find(coord);
+    if (it != index.end()) {
+        // madvise() wants a page-aligned start
+        const Entry &e = entries()[it->second];
+        size_t start = (e.offset / page_size) * page_size;
+        madvise(mapping + start, (e.offset - start) + e.size, MADV_WILLNEED);
+    }
+}
+
+size_t TileCache::get_tile_count() const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return index.size();
+}
+
+void TileCache::flush() {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+
+    if (msync(mapping, mapped_size, MS_SYNC) != 0) {
+        throw file_error("failed to write tiles to disk");
+    }
+
+    // The index stays, it's small and looked up all the time
+    madvise(mapping + index_end, mapped_size - index_end, MADV_DONTNEED);
+}
+
+void TileCache::reset(uint64_t content_key) {
+    unmap_file();
+    index.clear();
+
+    if (ftruncate(fd, 0) != 0 || !allocate(fd, index_end)) {
+        throw file_error("failed to reset the file");
+    }
+    map_file(index_end);
+
+    Header *h = header();
+    std::memcpy(h->magic, MAGIC, sizeof(MAGIC));
+    h->version = VERSION;
+    h->tile_bytes = CHUNK_BLOB_BYTES;
+    h->format = (uint32_t)params.format;
+    h->precision = params.precision;
+    h->content_key = content_key;
+    h->max_tiles = params.max_tiles;
+    h->tile_count = 0;
+    h->data_end = index_end;
+}
+
+void TileCache::map_file(size_t size) {
+    // Map the new size before letting go of the old mapping, so a
+    // failure leaves the old one usable
+    void *addr =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        throw file_error("failed to map the file");
+    }
+
+    unmap_file();
+    mapping = (uint8_t *)addr;
+    mapped_size = size;
+}
+
+void TileCache::unmap_file() {
+    if (mapping) {
+        munmap(mapping, mapped_size);
+        mapping = nullptr;
+        mapped_size = 0;
+    }
+}
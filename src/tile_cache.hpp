@@ -0,0 +1,180 @@
+#pragma once
+
+#include "chunk.hpp"
+#include "heightfield_codec.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * Persistent on-disk cache of built terrain chunks.
+ *
+ * The file starts with a header and a fixed-size index, followed by
+ * one tile per chunk, and is memory-mapped as a whole. Tiles come in
+ * one of two formats, chosen when the file is created:
+ *
+ * - RAW tiles are page-aligned blobs in the same layout as a chunk's
+ *   GPU buffer (see CHUNK_BLOB_BYTES), handed straight from the page
+ *   cache to glBufferSubData without being read or copied by us.
+ * - COMPRESSED tiles hold only the chunk's padded heights, encoded
+ *   with HeightfieldCodec. They are a few percent of the size of raw
+ *   ones; the normals and splat weights are rebuilt when loading.
+ *
+ * The header records a content key describing how the chunks were
+ * generated. If it doesn't match on open, or the format differs, the
+ * old contents are thrown away. Uses POSIX file mapping.
+ */
+class TileCache {
+public:
+    enum class Format : uint32_t { RAW = 0, COMPRESSED = 1 };
+
+    struct Params {
+        Format format = Format::RAW;
+
+        // Height precision of COMPRESSED tiles. Should match the
+        // builder's height_precision, so loaded chunks are identical
+        // to freshly built ones.
+        float precision = 0.01f;
+
+        // Capacity of the index; stores past it are ignored
+        size_t max_tiles = 16384;
+    };
+
+    TileCache(const std::string &path, uint64_t key) :
+        TileCache(path, key, Params()) {}
+
+    /**
+     * Open or create a cache file.
+     *
+     * @param content_key: identifies the generator settings; chunks
+     * cached under a different key are discarded
+     */
+    TileCache(const std::string &path, uint64_t content_key, Params p);
+
+    ~TileCache();
+
+    TileCache(const TileCache &) = delete;
+    TileCache &operator=(const TileCache &) = delete;
+
+    bool contains(ChunkCoord coord) const;
+
+    /**
+     * Add a chunk, unless it's already cached or the cache is full.
+     * Safe to call from any thread.
+     */
+    void store(const ChunkData &data);
+
+    Format get_format() const {
+        return params.format;
+    }
+
+    /**
+     * Call fn(tile, size) with a pointer to a cached chunk's tile, in
+     * the cache's format, valid only during the call. A RAW tile is
+     * always CHUNK_BLOB_BYTES long.
+     *
+     * @return false, without calling fn, if the chunk isn't cached
+     */
+    template<typename F>
+    bool with_tile(ChunkCoord coord, F &&fn) const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+
+        auto it = index.find(coord);
+        if (it == index.end()) {
+            return false;
+        }
+
+        const Entry &e = entries()[it->second];
+        fn((const uint8_t *)(mapping + e.offset), (size_t)e.size);
+        return true;
+    }
+
+    /**
+     * Decode a COMPRESSED tile's padded heights, ready for
+     * ChunkBuilder::finish(). Throws a std::runtime_error if the tile
+     * is corrupt or holds heights of another size.
+     *
+     * @param samples: along each side of the padded heights, see
+     * ChunkBuilder::get_padded_samples()
+     * @return false if the chunk isn't cached or the cache is RAW
+     */
+    bool load_heights(ChunkCoord coord, Heightfield &out, size_t samples)
+        const;
+
+    /**
+     * Stop using a chunk's tile, e.g. one that turned out to be
+     * corrupt. Storing the chunk again replaces it, in the file too.
+     */
+    void forget(ChunkCoord coord);
+
+    /**
+     * Ask the OS to start reading a cached chunk in the background,
+     * so the later upload doesn't stall on disk.
+     */
+    void prefetch(ChunkCoord coord) const;
+
+    size_t get_tile_count() const;
+
+    /**
+     * Write the tiles stored so far out to disk and drop them from
+     * memory; they're read back in when next used. Keeps long runs of
+     * store() from piling up dirty pages.
+     */
+    void flush();
+
+private:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t tile_bytes;
+        uint32_t format;
+        float precision;
+        uint64_t content_key;
+        uint64_t max_tiles;
+        uint64_t tile_count;
+        uint64_t data_end;
+    };
+
+    struct Entry {
+        int32_t x;
+        int32_t z;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    int fd = -1;
+    uint8_t *mapping = nullptr;
+    size_t mapped_size = 0;
+
+    Params params;
+    HeightfieldCodec codec;
+
+    size_t page_size;
+    size_t index_end;
+
+    // Tiles start at multiples of this: whole pages for RAW tiles, so
+    // they can be paged in and uploaded on their own
+    size_t tile_alignment;
+
+    std::unordered_map<ChunkCoord, size_t, ChunkCoordHash> index;
+    mutable std::shared_mutex mutex;
+
+    Header *header() const {
+        return (Header *)mapping;
+    }
+
+    Entry *entries() const {
+        return (Entry *)(mapping + sizeof(Header));
+    }
+
+    void load(const std::string &path, uint64_t content_key);
+
+    void reset(uint64_t content_key);
+
+    void map_file(size_t size);
+
+    void unmap_file();
+};
@@ -0,0 +1,32 @@
+#version 420 core
+#extension GL_ARB_explicit_uniform_location : enable
+
+// Interpolated from the vertex shader
+in vec3 normal;
+in vec3 color;
+in float fade;
+
+out vec4 fragColor;
+
+// Direction towards the sun, which is roughly overhead like the
+// terrain's light
+const vec3 lightDir = vec3(0.24, 0.94, 0.24);
+const vec3 ambientLightColor = vec3(0.25);
+const vec3 diffuseLightColor = vec3(0.9);
+
+// Noise in [0, 1) per pixel, the same as tree_impostor.frag's, so a
+// tree fading into its impostor leaves no holes and no overlap
+float dither() {
+    return fract(
+        52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+}
+
+void main() {
+    if (dither() >= fade) {
+        discard;
+    }
+
+    float sunWeight = max(0.0, dot(normalize(normal), lightDir));
+    vec3 light = ambientLightColor + (diffuseLightColor * sunWeight);
+    fragColor = vec4(color * light, 1.0);
+}
@@ -0,0 +1,60 @@
+#version 420 core
+#extension GL_ARB_explicit_uniform_location : enable
+
+// A tree mesh, with its base at the origin
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNorm;
+layout(location = 2) in vec3 aColor;
+
+layout(location = 3) uniform mat4 uView;
+layout(location = 4) uniform mat4 uPersp;
+
+// Where this batch of trees starts in the instance buffer
+layout(location = 8) uniform int uFirstInstance;
+
+// One texel per tree, packed by TreeQuantizer: X and Z, then Y and its
+// rotation about +Y, then its scale, variant, and how much of it is
+// drawn as a mesh rather than an impostor
+layout(binding = 4) uniform usamplerBuffer uInstances;
+
+// Where the quantizer's steps start, and their size
+layout(location = 9) uniform vec3 uOrigin;
+layout(location = 10) uniform vec3 uStep;
+
+out vec3 normal;
+out vec3 color;
+out float fade;
+
+const float TWO_PI = 6.28318531;
+
+// Matches TreeQuantizer::unpack()
+void unpack(int instance, out vec3 position, out float scale, out mat3 turn,
+            out float meshFade) {
+    uvec3 texel = texelFetch(uInstances, instance).xyz;
+
+    uvec3 steps = uvec3(texel.x, texel.y, texel.x >> 16) & 0xffffu;
+    position = uOrigin + (vec3(steps) * uStep);
+    scale = float(texel.z & 0xffffu) / 4096.0;
+    meshFade = float(texel.z >> 24) / 255.0;
+
+    float angle = float(texel.y >> 16) * (TWO_PI / 65536.0);
+    float c = cos(angle);
+    float s = sin(angle);
+    turn = mat3(
+        c, 0.0, -s,
+        0.0, 1.0, 0.0,
+        s, 0.0, c);
+}
+
+void main() {
+    vec3 position;
+    float scale;
+    mat3 rotation;
+    unpack(uFirstInstance + gl_InstanceID, position, scale, rotation, fade);
+
+    vec3 world = (rotation * aPos) * scale + position;
+    normal = rotation * aNorm;
+    color = aColor;
+
+    gl_Position = uPersp * uView * vec4(world, 1.0);
+}
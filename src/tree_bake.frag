@@ -0,0 +1,16 @@
+#version 420 core
+#extension GL_ARB_explicit_uniform_location : enable
+
+// Interpolated from tree.vert, drawing one unrotated, unscaled tree
+in vec3 normal;
+in vec3 color;
+in float fade;
+
+// The impostor atlases, see ImpostorAtlas
+layout(location = 0) out vec4 colorOut;
+layout(location = 1) out vec4 normalOut;
+
+void main() {
+    colorOut = vec4(color, 1.0);
+    normalOut = vec4((normalize(normal) * 0.5) + 0.5, 1.0);
+}
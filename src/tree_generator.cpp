@@ -0,0 +1,337 @@
+#include "tree_generator.hpp"
+
+#include "noise.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+static const float DEGREES = 0.01745329f;
+
+// Per level of detail: sides around each branch, the thinnest branch
+// drawn as a fraction of the trunk's radius, and how many leaf clumps
+// are merged into one, and how much bigger it is
+static const int BRANCH_SIDES[TREE_LODS] = {6, 4, 3};
+static const float MIN_RADIUS[TREE_LODS] = {0.0f, 0.1f, 0.3f};
+static const size_t LEAF_STRIDE[TREE_LODS] = {1, 2, 4};
+static const float LEAF_GROWTH[TREE_LODS] = {1.0f, 1.35f, 1.8f};
+
+/**
+ * Add a flat-shaded triangle, wound counter-clockwise seen from the side
+ * `outward` points to.
+ */
+static void add_triangle(
+    vector<TreeVertex> &vertices,
+    vec3 a,
+    vec3 b,
+    vec3 c,
+    vec3 outward,
+    vec3 color) {
+    vec3 n = glm::normalize(glm::cross(b - a, c - a));
+    if (glm::dot(n, outward) < 0.0f) {
+        std::swap(b, c);
+        n = -n;
+    }
+
+    vertices.push_back({a, n, color});
+    vertices.push_back({b, n, color});
+    vertices.push_back({c, n, color});
+}
+
+/**
+ * Two unit vectors perpendicular to a direction and to each other.
+ */
+static void perpendiculars(vec3 dir, vec3 &a, vec3 &b) {
+    vec3 reference = (std::abs(dir.y) < 0.9f) ? vec3(0.0f, 1.0f, 0.0f)
+                                               : vec3(1.0f, 0.0f, 0.0f);
+    a = glm::normalize(glm::cross(dir, reference));
+    b = glm::cross(dir, a);
+}
+
+/**
+ * Rotate v about a unit axis, by Rodrigues' formula.
+ */
+static vec3 rotate(vec3 v, vec3 axis, float angle) {
+    float c = std::cos(angle);
+    float s = std::sin(angle);
+    return (v * c) + (glm::cross(axis, v) * s) +
+           (axis * (glm::dot(axis, v) * (1.0f - c)));
+}
+
+/**
+ * Add the sides of a tapered cylinder from p0 to p1. Its ends are left
+ * open; they're hidden inside the branches around them.
+ */
+static void add_branch(
+    vector<TreeVertex> &vertices,
+    vec3 p0,
+    vec3 p1,
+    float r0,
+    float r1,
+    int sides,
+    vec3 color) {
+    vec3 a;
+    vec3 b;
+    perpendiculars(glm::normalize(p1 - p0), a, b);
+
+    const float two_pi = 6.28318531f;
+    for (int i = 0; i < sides; ++i) {
+        float a0 = two_pi * (float)i / (float)sides;
+        float a1 = two_pi * (float)(i + 1) / (float)sides;
+        vec3 d0 = (a * std::cos(a0)) + (b * std::sin(a0));
+        vec3 d1 = (a * std::cos(a1)) + (b * std::sin(a1));
+        vec3 outward = d0 + d1;
+
+        vec3 q00 = p0 + (d0 * r0);
+        vec3 q01 = p0 + (d1 * r0);
+        vec3 q10 = p1 + (d0 * r1);
+        vec3 q11 = p1 + (d1 * r1);
+        add_triangle(vertices, q00, q01, q11, outward, color);
+        add_triangle(vertices, q00, q11, q10, outward, color);
+    }
+}
+
+/**
+ * Add a clump of leaves: an octahedron stretched along the branch.
+ */
+static void add_leaves(
+    vector<TreeVertex> &vertices,
+    vec3 center,
+    vec3 heading,
+    float size,
+    vec3 color) {
+    vec3 a;
+    vec3 b;
+    perpendiculars(heading, a, b);
+
+    vec3 tips[2] = {center + (heading * size), center - (heading * size)};
+    vec3 ring[4] = {
+        center + (a * (0.8f * size)),
+        center + (b * (0.8f * size)),
+        center - (a * (0.8f * size)),
+        center - (b * (0.8f * size))};
+
+    for (vec3 tip : tips) {
+        for (int i = 0; i < 4; ++i) {
+            vec3 p0 = ring[i];
+            vec3 p1 = ring[(i + 1) % 4];
+            vec3 outward = ((tip + p0 + p1) / 3.0f) - center;
+            add_triangle(vertices, tip, p0, p1, outward, color);
+        }
+    }
+}
+
+/**
+ * Seed for everything random about a tree.
+ */
+static uint32_t tree_seed(const TreeSpecies &species, uint32_t seed) {
+    uint32_t h = hash_u32(seed);
+    for (char c : species.name) {
+        h = hash_combine(h, (uint32_t)(unsigned char)c);
+    }
+    return h;
+}
+
+TreeMesh TreeGenerator::generate(
+    const TreeSpecies &species,
+    uint32_t seed,
+    size_t lod) const {
+    if (lod >= TREE_LODS) {
+        std::string err_msg = "Tree level of detail out of range: ";
+        err_msg.append(std::to_string(lod));
+        throw std::invalid_argument(err_msg);
+    }
+
+    std::string symbols = rewrite(species, seed);
+
+    struct Turtle {
+        vec3 position;
+        vec3 heading;
+        vec3 left;
+        vec3 up;
+        float length;
+        float radius;
+    };
+
+    Turtle turtle = {
+        vec3(0.0f),
+        vec3(0.0f, 1.0f, 0.0f),
+        vec3(-1.0f, 0.0f, 0.0f),
+        vec3(0.0f, 0.0f, 1.0f),
+        species.length,
+        species.radius};
+    vector<Turtle> stack;
+
+    // The jitter is drawn for every turn at every level of detail, so
+    // they all grow the same tree
+    Rng rng(hash_combine(tree_seed(species, seed), 2));
+    auto turn_angle = [&](float sign) {
+        float jitter =
+            rng.next_range(-species.angle_jitter, species.angle_jitter);
+        return sign * (species.angle + jitter) * DEGREES;
+    };
+
+    float min_radius = MIN_RADIUS[lod] * species.radius;
+    size_t leaf_count = 0;
+
+    TreeMesh mesh;
+    for (char c : symbols) {
+        switch (c) {
+        case 'F': {
+            vec3 end = turtle.position + (turtle.heading * turtle.length);
+            float end_radius = turtle.radius * species.taper;
+            if (turtle.radius >= min_radius) {
+                add_branch(
+                    mesh.vertices,
+                    turtle.position,
+                    end,
+                    turtle.radius,
+                    end_radius,
+                    BRANCH_SIDES[lod],
+                    species.bark_color);
+            }
+            turtle.position = end;
+            turtle.radius = end_radius;
+            break;
+        }
+        case '+':
+        case '-': {
+            float angle = turn_angle((c == '+') ? 1.0f : -1.0f);
+            turtle.heading = rotate(turtle.heading, turtle.up, angle);
+            turtle.left = rotate(turtle.left, turtle.up, angle);
+            break;
+        }
+        case '&':
+        case '^': {
+            float angle = turn_angle((c == '&') ? 1.0f : -1.0f);
+            turtle.heading = rotate(turtle.heading, turtle.left, angle);
+            turtle.up = rotate(turtle.up, turtle.left, angle);
+            break;
+        }
+        case '/':
+        case '\\': {
+            float angle = turn_angle((c == '/') ? 1.0f : -1.0f);
+            turtle.left = rotate(turtle.left, turtle.heading, angle);
+            turtle.up = rotate(turtle.up, turtle.heading, angle);
+            break;
+        }
+        case '[':
+            stack.push_back(turtle);
+            turtle.length *= species.length_scale;
+            turtle.radius *= species.radius_scale;
+            break;
+        case ']':
+            if (!stack.empty()) {
+                turtle = stack.back();
+                stack.pop_back();
+            }
+            break;
+        case '!':
+            turtle.radius *= species.radius_scale;
+            break;
+        case 'L':
+            if (leaf_count % LEAF_STRIDE[lod] == 0) {
+                add_leaves(
+                    mesh.vertices,
+                    turtle.position,
+                    turtle.heading,
+                    species.leaf_size * LEAF_GROWTH[lod],
+                    species.leaf_color);
+            }
+            ++leaf_count;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return mesh;
+}
+
+std::string TreeGenerator::rewrite(const TreeSpecies &species, uint32_t seed)
+    const {
+    Rng rng(hash_combine(tree_seed(species, seed), 1));
+
+    std::string symbols = species.axiom;
+    for (int i = 0; i < species.iterations; ++i) {
+        std::string next;
+        for (char c : symbols) {
+            auto it = species.rules.find(c);
+            if (it == species.rules.end() || it->second.empty()) {
+                next.push_back(c);
+                continue;
+            }
+
+            // Pick a rule by weight
+            const vector<TreeRule> &rules = it->second;
+            float total = 0.0f;
+            for (const TreeRule &rule : rules) {
+                total += rule.weight;
+            }
+
+            float pick = rng.next_float() * total;
+            size_t chosen = rules.size() - 1;
+            for (size_t r = 0; r < rules.size(); ++r) {
+                if (pick < rules[r].weight) {
+                    chosen = r;
+                    break;
+                }
+                pick -= rules[r].weight;
+            }
+            next.append(rules[chosen].replacement);
+        }
+
+        if (next.size() > params.max_symbols) {
+            std::string err_msg = "L-system for '";
+            err_msg.append(species.name);
+            err_msg.append("' grew past ");
+            err_msg.append(std::to_string(params.max_symbols));
+            err_msg.append(" symbols");
+            throw std::runtime_error(err_msg);
+        }
+        symbols = std::move(next);
+    }
+
+    return symbols;
+}
+
+vector<TreeSpecies> TreeGenerator::get_default_species() {
+    // Whorls of four branches up a straight trunk, the lower ones
+    // having grown the longest
+    TreeSpecies conifer;
+    conifer.name = "conifer";
+    conifer.axiom = "FFA";
+    conifer.rules['A'] = {{"F[&&&B]///[&&&B]///[&&&B]///[&&&B]/A", 1.0f}};
+    conifer.rules['B'] = {
+        {"F[-L][+L]B", 1.0f},
+        {"F[+L]B", 0.5f},
+        {"F[-L]B", 0.5f}};
+    conifer.iterations = 7;
+    conifer.angle = 25.0f;
+    conifer.length = 0.7f;
+    conifer.radius = 0.25f;
+    conifer.length_scale = 0.6f;
+    conifer.radius_scale = 0.35f;
+    conifer.taper = 0.9f;
+    conifer.leaf_size = 0.6f;
+    conifer.leaf_color = vec3(0.12f, 0.3f, 0.14f);
+
+    // A trunk forking into three, over and over
+    TreeSpecies broadleaf;
+    broadleaf.name = "broadleaf";
+    broadleaf.axiom = "FFFA";
+    broadleaf.rules['A'] = {
+        {"!F[&FLA]/////[&FLA]///////[&FLA]", 1.0f},
+        {"!F[&FLA]///////[&FLA]", 0.5f}};
+    broadleaf.iterations = 4;
+    broadleaf.angle = 22.5f;
+    broadleaf.length = 0.8f;
+    broadleaf.radius = 0.22f;
+    broadleaf.length_scale = 0.85f;
+    broadleaf.radius_scale = 0.72f;
+    broadleaf.taper = 0.95f;
+    broadleaf.leaf_size = 0.55f;
+    broadleaf.leaf_color = vec3(0.25f, 0.45f, 0.15f);
+
+    return {conifer, broadleaf};
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using glm::vec3;
+
+using std::vector;
+
+// Levels of detail every tree is generated at, 0 being the finest
+constexpr size_t TREE_LODS = 3;
+
+struct TreeVertex {
+    vec3 position;
+    vec3 normal;
+    vec3 color;
+};
+
+/**
+ * A flat-shaded tree, as triangles of three vertices each, with its
+ * base at the origin and growing up +Y.
+ */
+struct TreeMesh {
+    vector<TreeVertex> vertices;
+};
+
+/**
+ * One replacement for a symbol of an L-system.
+ */
+struct TreeRule {
+    std::string replacement;
+
+    // Chance of being picked, relative to the symbol's other rules
+    float weight;
+};
+
+/**
+ * What a kind of tree looks like: an L-system and how to draw it.
+ *
+ * The axiom is rewritten with the rules a number of times, then read
+ * by a turtle, starting at the origin and heading up:
+ *
+ *   F     grow a branch segment forward
+ *   + -   turn left or right
+ *   & ^   pitch down or up
+ *   / \   roll clockwise or anticlockwise
+ *   [ ]   start or end a side branch, which is shorter and thinner
+ *   !     thin the branch
+ *   L     grow a clump of leaves
+ *
+ * Anything else is only there to be rewritten.
+ */
+struct TreeSpecies {
+    std::string name;
+
+    std::string axiom;
+    std::unordered_map<char, vector<TreeRule>> rules;
+    int iterations = 4;
+
+    // Turning angle, and how much it varies at random, in degrees
+    float angle = 25.0f;
+    float angle_jitter = 5.0f;
+
+    // Length and radius of the trunk's segments, in world units
+    float length = 1.0f;
+    float radius = 0.2f;
+
+    // Factors applied to the length and the radius by '[', to the
+    // radius by '!', and to the radius along each segment
+    float length_scale = 0.8f;
+    float radius_scale = 0.7f;
+    float taper = 0.95f;
+
+    float leaf_size = 0.5f;
+
+    vec3 bark_color = vec3(0.36f, 0.25f, 0.16f);
+    vec3 leaf_color = vec3(0.2f, 0.4f, 0.15f);
+};
+
+/**
+ * Grows tree meshes from L-systems.
+ *
+ * Everything random comes from the species' name and a seed, so a
+ * (species, seed) pair always gives the same tree, and its levels of
+ * detail are the same tree too: coarser ones use fewer sides per
+ * branch, leave out the thinnest branches, and merge leaf clumps into
+ * fewer, bigger ones.
+ *
+ * Safe to call from several threads at once.
+ */
+class TreeGenerator {
+public:
+    struct Params {
+        // Longest the rewritten string may get, to keep a runaway
+        // L-system from eating all memory
+        size_t max_symbols = 200000;
+    };
+
+    TreeGenerator() : TreeGenerator(Params()) {}
+
+    explicit TreeGenerator(Params p) : params(p) {}
+
+    /**
+     * @param lod: level of detail, less than TREE_LODS
+     */
+    TreeMesh generate(const TreeSpecies &species, uint32_t seed, size_t lod)
+        const;
+
+    /**
+     * A conifer and a broadleaf tree, to start with.
+     */
+    static vector<TreeSpecies> get_default_species();
+
+private:
+    Params params;
+
+    /**
+     * Apply the species' rules to its axiom.
+     */
+    std::string rewrite(const TreeSpecies &species, uint32_t seed) const;
+};
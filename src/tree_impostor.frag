@@ -0,0 +1,42 @@
+#version 420 core
+#extension GL_ARB_explicit_uniform_location : enable
+
+// Interpolated from the vertex shader
+in vec2 atlasCoord;
+in float fade;
+flat in mat3 rotation;
+
+// Premultiplied by coverage, see ImpostorAtlas
+layout(binding = 5) uniform sampler2D uColorAtlas;
+layout(binding = 6) uniform sampler2D uNormalAtlas;
+
+out vec4 fragColor;
+
+// As in tree.frag
+const vec3 lightDir = vec3(0.24, 0.94, 0.24);
+const vec3 ambientLightColor = vec3(0.25);
+const vec3 diffuseLightColor = vec3(0.9);
+
+float dither() {
+    return fract(
+        52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+}
+
+void main() {
+    // The mesh covers the rest of the fade
+    if (dither() < fade) {
+        discard;
+    }
+
+    vec4 color = texture(uColorAtlas, atlasCoord);
+    if (color.a < 0.5) {
+        discard;
+    }
+
+    vec4 normalTexel = texture(uNormalAtlas, atlasCoord);
+    vec3 n = rotation * ((normalTexel.xyz / normalTexel.a) * 2.0 - 1.0);
+
+    float sunWeight = max(0.0, dot(normalize(n), lightDir));
+    vec3 light = ambientLightColor + (diffuseLightColor * sunWeight);
+    fragColor = vec4((color.rgb / color.a) * light, 1.0);
+}
@@ -0,0 +1,98 @@
+#version 420 core
+#extension GL_ARB_explicit_uniform_location : enable
+
+layout(location = 3) uniform mat4 uView;
+layout(location = 4) uniform mat4 uPersp;
+
+layout(location = 5) uniform vec3 uEyePos;
+
+// Frames along each side of the atlas
+layout(location = 6) uniform int uFrames;
+
+// Bounding sphere of an unscaled tree: its center's height above the
+// base, and its radius
+layout(location = 7) uniform vec2 uBounds;
+
+// Where this batch of impostors starts in the instance buffer
+layout(location = 8) uniform int uFirstInstance;
+
+// Laid out and unpacked as for tree.vert
+layout(binding = 4) uniform usamplerBuffer uInstances;
+layout(location = 9) uniform vec3 uOrigin;
+layout(location = 10) uniform vec3 uStep;
+
+out vec2 atlasCoord;
+out float fade;
+flat out mat3 rotation;
+
+const float TWO_PI = 6.28318531;
+
+// Matches TreeQuantizer::unpack()
+void unpack(int instance, out vec3 position, out float scale, out mat3 turn,
+            out float meshFade) {
+    uvec3 texel = texelFetch(uInstances, instance).xyz;
+
+    uvec3 steps = uvec3(texel.x, texel.y, texel.x >> 16) & 0xffffu;
+    position = uOrigin + (vec3(steps) * uStep);
+    scale = float(texel.z & 0xffffu) / 4096.0;
+    meshFade = float(texel.z >> 24) / 255.0;
+
+    float angle = float(texel.y >> 16) * (TWO_PI / 65536.0);
+    float c = cos(angle);
+    float s = sin(angle);
+    turn = mat3(
+        c, 0.0, -s,
+        0.0, 1.0, 0.0,
+        s, 0.0, c);
+}
+
+// These three match ImpostorAtlas::encode(), decode() and get_basis()
+
+vec2 encode(vec3 dir) {
+    dir.y = max(dir.y, 0.0);
+    dir /= abs(dir.x) + dir.y + abs(dir.z);
+    return (vec2(dir.x + dir.z, dir.x - dir.z) * 0.5) + 0.5;
+}
+
+vec3 decode(vec2 uv) {
+    vec2 p = (uv * 2.0) - 1.0;
+    float x = (p.x + p.y) * 0.5;
+    float z = (p.x - p.y) * 0.5;
+    return normalize(vec3(x, 1.0 - abs(x) - abs(z), z));
+}
+
+void basis(vec3 dir, out vec3 right, out vec3 up) {
+    vec3 reference =
+        (abs(dir.y) > 0.999) ? vec3(0.0, 0.0, -1.0) : vec3(0.0, 1.0, 0.0);
+    right = normalize(cross(reference, dir));
+    up = cross(dir, right);
+}
+
+void main() {
+    vec3 position;
+    float scale;
+    unpack(uFirstInstance + gl_InstanceID, position, scale, rotation, fade);
+
+    vec3 center = position + vec3(0.0, uBounds.x * scale, 0.0);
+
+    // Pick the frame baked nearest to where we're looking from, in the
+    // tree's own space
+    vec3 toEye = transpose(rotation) * normalize(uEyePos - center);
+    float frames = float(uFrames);
+    vec2 frame = clamp(floor(encode(toEye) * frames), 0.0, frames - 1.0);
+    vec3 dir = decode((frame + 0.5) / frames);
+
+    vec3 right;
+    vec3 up;
+    basis(dir, right, up);
+
+    // A quad facing the frame's direction, as a triangle strip
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    atlasCoord = (frame + corner) / frames;
+
+    corner = (corner * 2.0) - 1.0;
+    vec3 offset = ((right * corner.x) + (up * corner.y)) * uBounds.y;
+    vec3 world = center + (rotation * offset) * scale;
+
+    gl_Position = uPersp * uView * vec4(world, 1.0);
+}
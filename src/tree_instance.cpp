@@ -0,0 +1,63 @@
+#include "tree_instance.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+static const float TWO_PI = 6.28318531f;
+
+// Largest value of the 16 and 8 bit fields
+static const float MAX_SHORT = 65535.0f;
+static const float MAX_BYTE = 255.0f;
+
+static const float SCALE_STEPS = 4096.0f;
+
+/**
+ * Round a value to the nearest of steps from 0 to max.
+ */
+static uint32_t quantize(float value, float max) {
+    return (uint32_t)std::min(std::max(std::round(value), 0.0f), max);
+}
+
+TreeQuantizer::TreeQuantizer(vec3 lo, vec3 hi) : origin(lo) {
+    step = glm::max(hi - lo, vec3(0.0f)) / MAX_SHORT;
+
+    // A flat box still needs steps to divide by
+    for (int axis = 0; axis < 3; ++axis) {
+        if (!(step[axis] > 0.0f)) {
+            step[axis] = 1.0f;
+        }
+    }
+}
+
+PackedTreeInstance TreeQuantizer::pack(const TreeInstance &tree, float fade)
+    const {
+    vec3 q = (tree.position - origin) / step;
+
+    float turns = tree.rotation / TWO_PI;
+    turns -= std::floor(turns);
+    uint32_t rotation = (uint32_t)std::lround(turns * 65536.0f) & 0xffff;
+
+    PackedTreeInstance packed;
+    packed.xz = quantize(q.x, MAX_SHORT) | (quantize(q.z, MAX_SHORT) << 16);
+    packed.y_rotation = quantize(q.y, MAX_SHORT) | (rotation << 16);
+    packed.scale_variant_fade = quantize(tree.scale * SCALE_STEPS, MAX_SHORT) |
+                                ((tree.variant & 0xff) << 16) |
+                                (quantize(fade * MAX_BYTE, MAX_BYTE) << 24);
+    return packed;
+}
+
+TreeInstance TreeQuantizer::unpack(const PackedTreeInstance &tree, float &fade)
+    const {
+    vec3 q(
+        (float)(tree.xz & 0xffff),
+        (float)(tree.y_rotation & 0xffff),
+        (float)(tree.xz >> 16));
+
+    TreeInstance unpacked;
+    unpacked.position = origin + (q * step);
+    unpacked.rotation = (float)(tree.y_rotation >> 16) * (TWO_PI / 65536.0f);
+    unpacked.scale = (float)(tree.scale_variant_fade & 0xffff) / SCALE_STEPS;
+    unpacked.variant = (tree.scale_variant_fade >> 16) & 0xff;
+    fade = (float)(tree.scale_variant_fade >> 24) / MAX_BYTE;
+    return unpacked;
+}
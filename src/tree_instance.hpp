@@ -0,0 +1,79 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+using glm::vec3;
+
+/**
+ * One tree standing in the world.
+ */
+struct TreeInstance {
+    // Base of the trunk, in world units
+    vec3 position;
+
+    // Uniform scale of the tree model
+    float scale;
+
+    // Around Y, in radians
+    float rotation;
+
+    // Picks one of the tree models
+    uint32_t variant;
+};
+
+/**
+ * A tree as the GPU gets it: 12 bytes rather than TreeInstance's 24,
+ * or a matrix's 64. Made and read by TreeQuantizer.
+ */
+struct PackedTreeInstance {
+    // X in the low 16 bits, Z in the high ones, as steps from the
+    // quantizer's origin
+    uint32_t xz;
+
+    // Y likewise, then the rotation in 65536ths of a turn
+    uint32_t y_rotation;
+
+    // Scale in 4096ths in the low 16 bits, then the variant and how
+    // much of the tree is drawn as a mesh, in 255ths, a byte each
+    uint32_t scale_variant_fade;
+};
+
+/**
+ * Packs trees inside a box into PackedTreeInstance, spreading 16 bits
+ * of position over each side of the box, so the smaller it is the
+ * finer they're placed. tree.vert unpacks them the same way as
+ * unpack(), from get_origin() and get_step().
+ *
+ * Variants must be less than 256 and scales less than 16.
+ */
+class TreeQuantizer {
+public:
+    TreeQuantizer() : TreeQuantizer(vec3(0.0f), vec3(0.0f)) {}
+
+    /**
+     * @param lo: corner of the box with the least X, Y and Z
+     * @param hi: the opposite corner
+     */
+    TreeQuantizer(vec3 lo, vec3 hi);
+
+    PackedTreeInstance pack(const TreeInstance &tree, float fade) const;
+
+    TreeInstance unpack(const PackedTreeInstance &tree, float &fade) const;
+
+    vec3 get_origin() const {
+        return origin;
+    }
+
+    /**
+     * Size of one step along each axis.
+     */
+    vec3 get_step() const {
+        return step;
+    }
+
+private:
+    vec3 origin;
+    vec3 step;
+};
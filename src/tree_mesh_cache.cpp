@@ -0,0 +1,68 @@
+#include "tree_mesh_cache.hpp"
+
+#include "noise.hpp"
+#include "thread_pool.hpp"
+
+#include <functional>
+
+TreeMeshCache::TreeMeshCache(ThreadPool &p, TreeGenerator::Params prm) :
+    pool(p),
+    generator(prm) {}
+
+TreeMeshCache::~TreeMeshCache() {
+    // Jobs hold a reference to the generator, which goes away with us
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &entry : meshes) {
+        entry.second.wait();
+    }
+}
+
+void TreeMeshCache::request(
+    const TreeSpecies &species,
+    uint32_t seed,
+    size_t lod) {
+    find_or_request(species, seed, lod);
+}
+
+std::shared_ptr<const TreeMesh> TreeMeshCache::get(
+    const TreeSpecies &species,
+    uint32_t seed,
+    size_t lod) {
+    // Wait outside the lock, so other threads can still request
+    return find_or_request(species, seed, lod).get();
+}
+
+size_t TreeMeshCache::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return meshes.size();
+}
+
+size_t TreeMeshCache::KeyHash::operator()(const Key &key) const {
+    uint32_t h = hash_combine((uint32_t)key.seed, (uint32_t)key.lod);
+    return hash_combine(h, (uint32_t)std::hash<std::string>()(key.species));
+}
+
+TreeMeshCache::MeshFuture TreeMeshCache::find_or_request(
+    const TreeSpecies &species,
+    uint32_t seed,
+    size_t lod) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Key key = {species.name, seed, lod};
+    auto it = meshes.find(key);
+    if (it != meshes.end()) {
+        return it->second;
+    }
+
+    // The job gets its own copy of the species, which the caller may
+    // not keep around
+    auto job = [this, species, seed, lod]() {
+        auto mesh = std::make_shared<TreeMesh>(
+            generator.generate(species, seed, lod));
+        return std::shared_ptr<const TreeMesh>(mesh);
+    };
+
+    MeshFuture future = pool.submit(job).share();
+    meshes.emplace(key, future);
+    return future;
+}
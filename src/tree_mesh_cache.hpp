@@ -0,0 +1,86 @@
+#pragma once
+
+#include "tree_generator.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class ThreadPool;
+
+/**
+ * Generated tree meshes, by species, seed and level of detail, so each
+ * one is only ever grown once however many trees use it.
+ *
+ * Meshes are grown on the thread pool. request() starts one without
+ * waiting, so everything needed can be started up front and grown in
+ * parallel; get() waits for it.
+ */
+class TreeMeshCache {
+public:
+    explicit TreeMeshCache(ThreadPool &p) :
+        TreeMeshCache(p, TreeGenerator::Params()) {}
+
+    TreeMeshCache(ThreadPool &pool, TreeGenerator::Params p);
+
+    /**
+     * Waits for any meshes still growing.
+     */
+    ~TreeMeshCache();
+
+    TreeMeshCache(const TreeMeshCache &) = delete;
+    TreeMeshCache &operator=(const TreeMeshCache &) = delete;
+
+    /**
+     * Start growing a mesh, unless it's already cached or growing.
+     * Species are told apart by name.
+     */
+    void request(const TreeSpecies &species, uint32_t seed, size_t lod);
+
+    /**
+     * A mesh, requesting it first if need be, once it's grown.
+     * Rethrows anything generating it threw.
+     */
+    std::shared_ptr<const TreeMesh> get(
+        const TreeSpecies &species,
+        uint32_t seed,
+        size_t lod);
+
+    /**
+     * Number of meshes cached or growing.
+     */
+    size_t size() const;
+
+private:
+    struct Key {
+        std::string species;
+        uint32_t seed;
+        size_t lod;
+
+        bool operator==(const Key &other) const {
+            return species == other.species && seed == other.seed &&
+                   lod == other.lod;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key &key) const;
+    };
+
+    typedef std::shared_future<std::shared_ptr<const TreeMesh>> MeshFuture;
+
+    ThreadPool &pool;
+    TreeGenerator generator;
+
+    mutable std::mutex mutex;
+    std::unordered_map<Key, MeshFuture, KeyHash> meshes;
+
+    MeshFuture find_or_request(
+        const TreeSpecies &species,
+        uint32_t seed,
+        size_t lod);
+};
@@ -0,0 +1,498 @@
+#include "tree_renderer.hpp"
+
+#include "frustum.hpp"
+#include "tree_mesh_cache.hpp"
+#include "util.hpp"
+
+#include <glad/glad.h>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Texture units the instance buffer and the impostor atlases are read
+// through
+static const GLuint INSTANCE_UNIT = 4;
+static const GLuint IMPOSTOR_COLOR_UNIT = 5;
+static const GLuint IMPOSTOR_NORMAL_UNIT = 6;
+
+TreeRenderer::TreeRenderer(Params p) : params(p) {
+    if (!(params.fade_width > 0.0f) ||
+        params.fade_width > params.impostor_distance) {
+        std::string err_msg = "Bad tree fade: ";
+        err_msg.append(std::to_string(params.fade_width));
+        err_msg.append(" wide, ending at ");
+        err_msg.append(std::to_string(params.impostor_distance));
+        throw std::invalid_argument(err_msg);
+    }
+
+    if (get_variant_count() == 0 || !(params.lod_distance > 0.0f)) {
+        throw std::invalid_argument("Trees need a species, a seed and a "
+                                    "level of detail distance");
+    }
+
+    // Variants get a byte in the instance buffer
+    if (get_variant_count() > 256) {
+        std::string err_msg = "Too many tree variants: ";
+        err_msg.append(std::to_string(get_variant_count()));
+        throw std::invalid_argument(err_msg);
+    }
+
+    batches.resize(get_batch(get_variant_count(), 0));
+    batch_starts.resize(batches.size());
+}
+
+void TreeRenderer::request_meshes(TreeMeshCache &cache) const {
+    for (uint32_t v = 0; v < get_variant_count(); ++v) {
+        const TreeSpecies &species = params.species[v % params.species.size()];
+        uint32_t seed = v / (uint32_t)params.species.size();
+        for (size_t lod = 0; lod < TREE_LODS; ++lod) {
+            cache.request(species, seed, lod);
+        }
+    }
+}
+
+void TreeRenderer::init(TreeMeshCache &cache) {
+    auto vert = compile_shader("../src/tree.vert", GL_VERTEX_SHADER);
+    auto frag = compile_shader("../src/tree.frag", GL_FRAGMENT_SHADER);
+    auto bake_frag =
+        compile_shader("../src/tree_bake.frag", GL_FRAGMENT_SHADER);
+    auto impostor_vert =
+        compile_shader("../src/tree_impostor.vert", GL_VERTEX_SHADER);
+    auto impostor_frag =
+        compile_shader("../src/tree_impostor.frag", GL_FRAGMENT_SHADER);
+    program = link_program({vert, frag});
+    impostor_program = link_program({impostor_vert, impostor_frag});
+    GLuint bake_program = link_program({vert, bake_frag});
+
+    glDeleteShader(vert);
+    glDeleteShader(frag);
+    glDeleteShader(bake_frag);
+    glDeleteShader(impostor_vert);
+    glDeleteShader(impostor_frag);
+
+    // Every mesh of every variant goes in one vertex buffer
+    request_meshes(cache);
+
+    vector<TreeVertex> vertices;
+    variants.resize(get_variant_count());
+    for (uint32_t v = 0; v < get_variant_count(); ++v) {
+        const TreeSpecies &species = params.species[v % params.species.size()];
+        uint32_t seed = v / (uint32_t)params.species.size();
+
+        Variant &variant = variants[v];
+        for (size_t lod = 0; lod < TREE_LODS; ++lod) {
+            auto mesh = cache.get(species, seed, lod);
+            variant.first[lod] = (GLint)vertices.size();
+            variant.count[lod] = (GLsizei)mesh->vertices.size();
+            vertices.insert(
+                vertices.end(), mesh->vertices.begin(), mesh->vertices.end());
+        }
+
+        // Bounds from the finest mesh, which the others stay close to
+        const TreeVertex *finest = &vertices[(size_t)variant.first[0]];
+        float top = 0.0f;
+        for (GLsizei i = 0; i < variant.count[0]; ++i) {
+            top = std::max(top, finest[i].position.y);
+        }
+        variant.center_height = top * 0.5f;
+        variant.radius = 0.0f;
+        for (GLsizei i = 0; i < variant.count[0]; ++i) {
+            vec3 p = finest[i].position;
+            p.y -= variant.center_height;
+            variant.radius = std::max(variant.radius, glm::length(p));
+        }
+
+        height = std::max(height, top);
+    }
+
+    // One sphere around them all, about halfway up the tallest
+    center_height = height * 0.5f;
+    radius = 0.0f;
+    for (const Variant &variant : variants) {
+        float offset = std::abs(variant.center_height - center_height);
+        radius = std::max(radius, offset + variant.radius);
+    }
+
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+
+    glGenBuffers(1, &vertex_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+    glBufferData(
+        GL_ARRAY_BUFFER,
+        (GLsizeiptr)(vertices.size() * sizeof(TreeVertex)),
+        vertices.data(),
+        GL_STATIC_DRAW);
+
+    GLuint pos_attrib = 0;
+    glEnableVertexAttribArray(pos_attrib);
+    glVertexAttribPointer(
+        pos_attrib,
+        3,
+        GL_FLOAT,
+        GL_FALSE,
+        sizeof(TreeVertex),
+        (char *)nullptr + offsetof(TreeVertex, position));
+
+    GLuint norm_attrib = 1;
+    glEnableVertexAttribArray(norm_attrib);
+    glVertexAttribPointer(
+        norm_attrib,
+        3,
+        GL_FLOAT,
+        GL_FALSE,
+        sizeof(TreeVertex),
+        (char *)nullptr + offsetof(TreeVertex, normal));
+
+    GLuint color_attrib = 2;
+    glEnableVertexAttribArray(color_attrib);
+    glVertexAttribPointer(
+        color_attrib,
+        3,
+        GL_FLOAT,
+        GL_FALSE,
+        sizeof(TreeVertex),
+        (char *)nullptr + offsetof(TreeVertex, color));
+
+    glBindVertexArray(0);
+
+    glGenBuffers(1, &instance_buffer);
+    glGenTextures(1, &instance_texture);
+
+    // Bake each variant's impostors from one tree, as it is in the mesh
+    TreeInstance model = {vec3(0.0f), 1.0f, 0.0f, 0};
+    batches[0] = {{model, 1.0f}};
+    pack_instances();
+    upload_instances();
+    batches[0].clear();
+
+    glUseProgram(bake_program);
+    GLint first_instance_attrib = 8;
+    glUniform1i(first_instance_attrib, 0);
+    set_quantizer_uniforms();
+
+    for (Variant &variant : variants) {
+        variant.atlas = std::make_unique<ImpostorAtlas>(params.atlas);
+        variant.atlas->bake(
+            [&variant, this](const mat4 &view, const mat4 &projection) {
+                GLint view_attrib = 3;
+                glUniformMatrix4fv(view_attrib, 1, GL_FALSE, value_ptr(view));
+
+                GLint persp_attrib = 4;
+                glUniformMatrix4fv(
+                    persp_attrib, 1, GL_FALSE, value_ptr(projection));
+
+                glBindVertexArray(vao);
+                glDrawArraysInstanced(
+                    GL_TRIANGLES, variant.first[0], variant.count[0], 1);
+            },
+            vec3(0.0f, variant.center_height, 0.0f),
+            variant.radius);
+    }
+    glDeleteProgram(bake_program);
+}
+
+void TreeRenderer::cleanup() {
+    for (Variant &variant : variants) {
+        if (variant.atlas) {
+            variant.atlas->cleanup();
+        }
+    }
+    variants.clear();
+
+    glDeleteTextures(1, &instance_texture);
+    glDeleteBuffers(1, &instance_buffer);
+    glDeleteBuffers(1, &vertex_buffer);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(impostor_program);
+    glDeleteProgram(program);
+}
+
+void TreeRenderer::cull(
+    const Frustum &frustum,
+    vec3 eye,
+    const vector<InstanceSpan> &spans) {
+    for (vector<Visible> &batch : batches) {
+        batch.clear();
+    }
+
+    // Fully a mesh up to near_distance, fully an impostor from
+    // impostor_distance on
+    float near_distance = params.impostor_distance - params.fade_width;
+    uint32_t variant_count = get_variant_count();
+
+    auto add = [&](const TreeInstance &tree) {
+        vec3 d = tree.position - eye;
+        float dist = std::sqrt(glm::dot(d, d));
+
+        float fade = 1.0f;
+        if (dist >= params.impostor_distance) {
+            fade = 0.0f;
+        } else if (dist > near_distance) {
+            fade = (params.impostor_distance - dist) / params.fade_width;
+        }
+
+        TreeInstance visible = tree;
+        visible.variant = tree.variant % variant_count;
+        if (fade > 0.0f) {
+            size_t lod = std::min(
+                (size_t)(dist / params.lod_distance), TREE_LODS - 1);
+            batches[get_batch(visible.variant, lod)].push_back(
+                {visible, fade});
+        }
+        if (fade < 1.0f) {
+            batches[get_batch(visible.variant, TREE_LODS)].push_back(
+                {visible, fade});
+        }
+    };
+
+    for (const InstanceSpan &span : spans) {
+        const TreeInstance *trees = span.first;
+        size_t count = span.count;
+        size_t i = 0;
+
+        // Already known to be in the frustum, reach and all
+        if (span.inside) {
+            for (; i < count; ++i) {
+                add(trees[i]);
+            }
+            continue;
+        }
+
+#ifdef __SSE2__
+        __m128 center_y = _mm_set1_ps(center_height);
+        __m128 r = _mm_set1_ps(radius);
+
+        for (; i + 4 <= count; i += 4) {
+            const TreeInstance *t = trees + i;
+            __m128 s = _mm_setr_ps(
+                t[0].scale, t[1].scale, t[2].scale, t[3].scale);
+            __m128 x = _mm_setr_ps(
+                t[0].position.x,
+                t[1].position.x,
+                t[2].position.x,
+                t[3].position.x);
+            __m128 y = _mm_setr_ps(
+                t[0].position.y,
+                t[1].position.y,
+                t[2].position.y,
+                t[3].position.y);
+            __m128 z = _mm_setr_ps(
+                t[0].position.z,
+                t[1].position.z,
+                t[2].position.z,
+                t[3].position.z);
+
+            // The bounding spheres, scaled with their trees
+            y = _mm_add_ps(y, _mm_mul_ps(center_y, s));
+            __m128 neg_r = _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(r, s));
+
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (size_t p = 0; p < 6; ++p) {
+                const vec4 &plane = frustum.get_plane(p);
+                __m128 d = _mm_mul_ps(_mm_set1_ps(plane.x), x);
+                d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(plane.y), y));
+                d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(plane.z), z));
+                d = _mm_add_ps(d, _mm_set1_ps(plane.w));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(d, neg_r));
+            }
+
+            int mask = _mm_movemask_ps(inside);
+            for (int lane = 0; lane < 4; ++lane) {
+                if (mask & (1 << lane)) {
+                    add(t[lane]);
+                }
+            }
+        }
+#endif
+        for (; i < count; ++i) {
+            const TreeInstance &tree = trees[i];
+            float y = tree.position.y + (center_height * tree.scale);
+            float neg_r = 0.0f - (radius * tree.scale);
+
+            bool inside = true;
+            for (size_t p = 0; p < 6; ++p) {
+                const vec4 &plane = frustum.get_plane(p);
+                float d = plane.x * tree.position.x;
+                d += plane.y * y;
+                d += plane.z * tree.position.z;
+                d += plane.w;
+                inside = inside && d >= neg_r;
+            }
+
+            if (inside) {
+                add(tree);
+            }
+        }
+    }
+
+    pack_instances();
+}
+
+size_t TreeRenderer::get_mesh_count() const {
+    size_t count = 0;
+    for (uint32_t v = 0; v < get_variant_count(); ++v) {
+        for (size_t lod = 0; lod < TREE_LODS; ++lod) {
+            count += batches[get_batch(v, lod)].size();
+        }
+    }
+    return count;
+}
+
+size_t TreeRenderer::get_impostor_count() const {
+    size_t count = 0;
+    for (uint32_t v = 0; v < get_variant_count(); ++v) {
+        count += batches[get_batch(v, TREE_LODS)].size();
+    }
+    return count;
+}
+
+void TreeRenderer::draw(const mat4 &view, const mat4 &perspective, vec3 eye) {
+    glUseProgram(program);
+
+    upload_instances();
+    if (variants.empty()) {
+        return;
+    }
+
+    GLint view_attrib = 3;
+    glUniformMatrix4fv(view_attrib, 1, GL_FALSE, value_ptr(view));
+
+    GLint persp_attrib = 4;
+    glUniformMatrix4fv(persp_attrib, 1, GL_FALSE, value_ptr(perspective));
+
+    GLint first_instance_attrib = 8;
+    set_quantizer_uniforms();
+
+    glBindVertexArray(vao);
+    for (uint32_t v = 0; v < get_variant_count(); ++v) {
+        const Variant &variant = variants[v];
+        for (size_t lod = 0; lod < TREE_LODS; ++lod) {
+            size_t b = get_batch(v, lod);
+            if (batches[b].empty()) {
+                continue;
+            }
+
+            glUniform1i(first_instance_attrib, (GLint)batch_starts[b]);
+            glDrawArraysInstanced(
+                GL_TRIANGLES,
+                variant.first[lod],
+                variant.count[lod],
+                (GLsizei)(batches[b].size()));
+        }
+    }
+
+    glUseProgram(impostor_program);
+    glUniformMatrix4fv(view_attrib, 1, GL_FALSE, value_ptr(view));
+    glUniformMatrix4fv(persp_attrib, 1, GL_FALSE, value_ptr(perspective));
+
+    GLint eye_pos_attrib = 5;
+    glUniform3fv(eye_pos_attrib, 1, value_ptr(eye));
+
+    GLint frames_attrib = 6;
+    glUniform1i(frames_attrib, (GLint)params.atlas.frames);
+    set_quantizer_uniforms();
+
+    GLint bounds_attrib = 7;
+
+    // The quads' corners come from gl_VertexID, so no attributes are
+    // read; any VAO will do
+    for (uint32_t v = 0; v < get_variant_count(); ++v) {
+        const Variant &variant = variants[v];
+        size_t b = get_batch(v, TREE_LODS);
+        if (batches[b].empty()) {
+            continue;
+        }
+
+        glUniform2f(bounds_attrib, variant.center_height, variant.radius);
+        glUniform1i(first_instance_attrib, (GLint)batch_starts[b]);
+
+        glActiveTexture(GL_TEXTURE0 + IMPOSTOR_COLOR_UNIT);
+        glBindTexture(GL_TEXTURE_2D, variant.atlas->get_color_texture());
+        glActiveTexture(GL_TEXTURE0 + IMPOSTOR_NORMAL_UNIT);
+        glBindTexture(GL_TEXTURE_2D, variant.atlas->get_normal_texture());
+        glActiveTexture(GL_TEXTURE0);
+
+        glDrawArraysInstanced(
+            GL_TRIANGLE_STRIP, 0, 4, (GLsizei)(batches[b].size()));
+    }
+}
+
+void TreeRenderer::pack_instances() {
+    vec3 lo(FLT_MAX);
+    vec3 hi(-FLT_MAX);
+    size_t count = 0;
+    for (size_t b = 0; b < batches.size(); ++b) {
+        batch_starts[b] = count;
+        count += batches[b].size();
+        for (const Visible &visible : batches[b]) {
+            lo = glm::min(lo, visible.tree.position);
+            hi = glm::max(hi, visible.tree.position);
+        }
+    }
+
+    instances.clear();
+    if (count == 0) {
+        return;
+    }
+
+    quantizer = TreeQuantizer(lo, hi);
+    instances.reserve(count);
+    for (const vector<Visible> &batch : batches) {
+        for (const Visible &visible : batch) {
+            instances.push_back(quantizer.pack(visible.tree, visible.fade));
+        }
+    }
+}
+
+void TreeRenderer::upload_instances() {
+    if (instances.empty()) {
+        return;
+    }
+
+    // Grow the buffer in powers of two; the texture keeps pointing at
+    // it when its storage is replaced
+    glBindBuffer(GL_TEXTURE_BUFFER, instance_buffer);
+    if (instances.size() > instance_capacity) {
+        instance_capacity = std::max(instance_capacity, (size_t)1024);
+        while (instance_capacity < instances.size()) {
+            instance_capacity *= 2;
+        }
+
+        glBufferData(
+            GL_TEXTURE_BUFFER,
+            (GLsizeiptr)(instance_capacity * sizeof(PackedTreeInstance)),
+            nullptr,
+            GL_STREAM_DRAW);
+        glBindTexture(GL_TEXTURE_BUFFER, instance_texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGB32UI, instance_buffer);
+    }
+
+    glBufferSubData(
+        GL_TEXTURE_BUFFER,
+        0,
+        (GLsizeiptr)(instances.size() * sizeof(PackedTreeInstance)),
+        instances.data());
+
+    glActiveTexture(GL_TEXTURE0 + INSTANCE_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, instance_texture);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void TreeRenderer::set_quantizer_uniforms() const {
+    GLint origin_attrib = 9;
+    glUniform3fv(origin_attrib, 1, value_ptr(quantizer.get_origin()));
+
+    GLint step_attrib = 10;
+    glUniform3fv(step_attrib, 1, value_ptr(quantizer.get_step()));
+}
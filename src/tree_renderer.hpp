@@ -0,0 +1,212 @@
+#pragma once
+
+#include "impostor_atlas.hpp"
+#include "instance_grid.hpp"
+#include "tree_generator.hpp"
+#include "tree_instance.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+using glm::mat4;
+using glm::vec3;
+
+using std::vector;
+
+typedef unsigned int GLuint;
+typedef int GLint;
+typedef int GLsizei;
+
+class Frustum;
+class TreeMeshCache;
+
+/**
+ * Draws whole forests with a few instanced draw calls per frame.
+ *
+ * Trees come in variants: a few seeds of each species, grown by
+ * TreeGenerator at every level of detail. Every tree is one of those
+ * meshes, moved, turned and scaled in the vertex shader by its own
+ * entry in an instance buffer, which the shader reads through a buffer
+ * texture indexed by gl_InstanceID. Entries are packed into 12 bytes by
+ * a TreeQuantizer fitted around the visible trees each frame, so even
+ * big forests are cheap to upload. Each frame the trees are tested
+ * against the view frustum on the CPU, four at a time with SSE2 when
+ * it's available, and the visible ones are sorted by variant and level
+ * of detail into the buffer, one draw call per non-empty batch.
+ *
+ * Far trees are drawn as impostors instead: one camera-facing quad
+ * each, showing their variant as baked from the nearest of many
+ * directions into an ImpostorAtlas when the renderer is set up. Across
+ * a band of distances a tree is drawn both ways, with complementary
+ * dithering, so it crossfades rather than pops.
+ *
+ * Has its own shader programs, since the trees' vertices look nothing
+ * like the terrain's.
+ */
+class TreeRenderer {
+public:
+    struct Params {
+        // Distance from the camera where trees are all impostor
+        float impostor_distance = 150.0f;
+
+        // Width of the band before it where trees crossfade
+        float fade_width = 30.0f;
+
+        // Meshes get a level of detail coarser every this far from the
+        // camera
+        float lod_distance = 50.0f;
+
+        vector<TreeSpecies> species = TreeGenerator::get_default_species();
+
+        // Variants of each species, grown from different seeds
+        uint32_t seeds = 2;
+
+        ImpostorAtlas::Params atlas;
+    };
+
+    TreeRenderer() : TreeRenderer(Params()) {}
+
+    explicit TreeRenderer(Params p);
+
+    TreeRenderer(const TreeRenderer &) = delete;
+    TreeRenderer &operator=(const TreeRenderer &) = delete;
+
+    /**
+     * Number of tree variants; TreeInstance::variant picks one, modulo
+     * this.
+     */
+    uint32_t get_variant_count() const {
+        return (uint32_t)params.species.size() * params.seeds;
+    }
+
+    /**
+     * Start growing every mesh init() will need, so they grow while
+     * other things are set up.
+     */
+    void request_meshes(TreeMeshCache &cache) const;
+
+    /**
+     * Upload the tree meshes, build the shader programs and bake the
+     * impostors. Needs a GL context; waits for the meshes.
+     */
+    void init(TreeMeshCache &cache);
+
+    void cleanup();
+
+    /**
+     * Height of the tallest unscaled tree above its base.
+     */
+    float get_height() const {
+        return height;
+    }
+
+    /**
+     * Pack the trees that are at least partly in the frustum, as
+     * meshes or impostors by their distance from the eye. Safe to call
+     * without a GL context.
+     *
+     * @param spans: runs of trees to test, e.g. from
+     * InstanceGrid::query_frustum()
+     */
+    void cull(
+        const Frustum &frustum,
+        vec3 eye,
+        const vector<InstanceSpan> &spans);
+
+    /**
+     * Trees drawn as meshes by the last cull(), including ones fading
+     * out.
+     */
+    size_t get_mesh_count() const;
+
+    /**
+     * Trees drawn as impostors by the last cull(), including ones
+     * fading in.
+     */
+    size_t get_impostor_count() const;
+
+    /**
+     * Draw the trees found by the last cull(). Leaves a tree program
+     * bound.
+     */
+    void draw(const mat4 &view, const mat4 &perspective, vec3 eye);
+
+private:
+    // One tree model: where its meshes are in the vertex buffer, and
+    // its impostors
+    struct Variant {
+        GLint first[TREE_LODS];
+        GLsizei count[TREE_LODS];
+
+        std::unique_ptr<ImpostorAtlas> atlas;
+
+        // Bounding sphere of the unscaled tree: its center's height
+        // above the base, and its radius
+        float center_height;
+        float radius;
+    };
+
+    Params params;
+
+    GLuint program = 0;
+    GLuint impostor_program = 0;
+
+    GLuint vao = 0;
+    GLuint vertex_buffer = 0;
+
+    // The instance buffer and the buffer texture it's read through
+    GLuint instance_buffer = 0;
+    GLuint instance_texture = 0;
+    size_t instance_capacity = 0;
+
+    vector<Variant> variants;
+
+    // A bounding sphere around every variant, for culling
+    float center_height = 0.0f;
+    float radius = 0.0f;
+    float height = 0.0f;
+
+    // A tree that passed culling, and how much of it is drawn as a
+    // mesh
+    struct Visible {
+        TreeInstance tree;
+        float fade;
+    };
+
+    // Visible trees, for each variant a batch per level of detail and
+    // then one of impostors
+    vector<vector<Visible>> batches;
+
+    // Where each batch starts in the instance buffer, in trees
+    vector<size_t> batch_starts;
+
+    // The batches, one after the other, packed to go in the instance
+    // buffer
+    TreeQuantizer quantizer;
+    vector<PackedTreeInstance> instances;
+
+    size_t get_batch(uint32_t variant, size_t slot) const {
+        return ((size_t)variant * (TREE_LODS + 1)) + slot;
+    }
+
+    /**
+     * Pack the batches, one after the other, with a quantizer fitted
+     * around their trees.
+     */
+    void pack_instances();
+
+    /**
+     * Copy the packed trees into the instance buffer and bind its
+     * texture.
+     */
+    void upload_instances();
+
+    /**
+     * Set the uniforms the bound tree program unpacks trees with.
+     */
+    void set_quantizer_uniforms() const;
+};
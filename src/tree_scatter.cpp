@@ -0,0 +1,218 @@
+#include "tree_scatter.hpp"
+
+#include "noise.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+static const float TWO_PI = 6.28318531f;
+
+/**
+ * Bridson's Poisson-disk sampling on a square that wraps around at the
+ * edges: grow the pattern from random points of an annulus around
+ * points that still have room next to them.
+ *
+ * @param size: length of the square's sides
+ * @param radius: distance kept between points, at most size / 4
+ */
+static vector<vec2> poisson_disk(float size, float radius, uint32_t seed) {
+    const int ATTEMPTS = 30;
+
+    // Cells small enough to hold a single point each, sized to fit the
+    // square exactly so the grid wraps with it
+    const size_t n = (size_t)std::ceil(size / (radius / std::sqrt(2.0f)));
+    const float cell = size / (float)n;
+    vector<int32_t> grid(n * n, -1);
+
+    vector<vec2> points;
+    vector<size_t> active;
+    Rng rng(seed);
+
+    auto cell_of = [&](float v) {
+        return std::min((size_t)(v / cell), n - 1);
+    };
+
+    auto add = [&](vec2 p) {
+        grid[(cell_of(p.y) * n) + cell_of(p.x)] = (int32_t)points.size();
+        active.push_back(points.size());
+        points.push_back(p);
+    };
+
+    // Neighbours can be up to two cells away, across the edges too
+    auto fits = [&](vec2 p) {
+        size_t cx = cell_of(p.x);
+        size_t cy = cell_of(p.y);
+        for (size_t dy = 0; dy < 5; ++dy) {
+            size_t y = (cy + n + dy - 2) % n;
+            for (size_t dx = 0; dx < 5; ++dx) {
+                size_t x = (cx + n + dx - 2) % n;
+                int32_t other = grid[(y * n) + x];
+                if (other < 0) {
+                    continue;
+                }
+
+                vec2 d = glm::abs(points[(size_t)other] - p);
+                d = glm::min(d, vec2(size) - d);
+                if (glm::dot(d, d) < radius * radius) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    };
+
+    add(vec2(rng.next_range(0.0f, size), rng.next_range(0.0f, size)));
+    while (!active.empty()) {
+        size_t slot = rng.next_u32() % active.size();
+        vec2 center = points[active[slot]];
+
+        bool found = false;
+        for (int i = 0; i < ATTEMPTS && !found; ++i) {
+            // Uniform over the annulus between radius and twice that
+            float angle = rng.next_range(0.0f, TWO_PI);
+            float dist = radius * std::sqrt(rng.next_range(1.0f, 4.0f));
+            vec2 p = center + (vec2(std::cos(angle), std::sin(angle)) * dist);
+
+            p -= glm::floor(p / size) * size;
+            p = glm::min(p, vec2(std::nextafter(size, 0.0f)));
+
+            if (fits(p)) {
+                add(p);
+                found = true;
+            }
+        }
+
+        if (!found) {
+            active[slot] = active.back();
+            active.pop_back();
+        }
+    }
+
+    return points;
+}
+
+TreeScatter::TreeScatter(const ChunkBuilder &b, Params p) :
+    builder(b),
+    params(p) {
+    float size = builder.get_chunk_size();
+    if (!(params.min_distance > 0.0f) ||
+        params.min_distance > size / 4.0f) {
+        std::string err_msg = "Tree distance must be above 0 and at most ";
+        err_msg.append(std::to_string(size / 4.0f));
+        err_msg.append(", but got ");
+        err_msg.append(std::to_string(params.min_distance));
+
+        throw std::invalid_argument(err_msg);
+    }
+
+    pattern = poisson_disk(size, params.min_distance, params.seed);
+}
+
+void TreeScatter::place(
+    ChunkCoord coord,
+    const Heightfield &heights,
+    vector<TreeInstance> &out) const {
+    if (heights.get_width() != CHUNK_SAMPLES ||
+        heights.get_height() != CHUNK_SAMPLES) {
+        throw std::invalid_argument("chunk heights have the wrong size");
+    }
+
+    out.clear();
+
+    const size_t quads = CHUNK_SAMPLES - 1;
+    const float inv_spacing = 1.0f / builder.get_params().spacing;
+    const uint32_t variants = std::max(params.variants, 1u);
+    vec2 origin = builder.get_origin(coord);
+    uint32_t chunk_seed = hash_2d(coord.x, coord.z, params.seed);
+
+    // The density noise is smooth, so it's sampled on a lattice of
+    // world positions around the chunk and interpolated from there
+    // rather than evaluated at every point
+    const float step = params.density_size / 8.0f;
+    const float inv_step = 1.0f / step;
+    float size = builder.get_chunk_size();
+    int32_t lx = (int32_t)std::floor(origin.x * inv_step);
+    int32_t lz = (int32_t)std::floor(origin.y * inv_step);
+    size_t nx = (size_t)((int32_t)std::floor((origin.x + size) * inv_step) -
+                         lx + 2);
+    size_t nz = (size_t)((int32_t)std::floor((origin.y + size) * inv_step) -
+                         lz + 2);
+
+    vector<float> lattice(nx * nz);
+    for (size_t z = 0; z < nz; ++z) {
+        for (size_t x = 0; x < nx; ++x) {
+            lattice[(z * nx) + x] = density_at(
+                vec2((float)(lx + (int32_t)x), (float)(lz + (int32_t)z)) *
+                step);
+        }
+    }
+
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        // The triangle under the point, split like the chunks are drawn
+        vec2 grid = pattern[i] * inv_spacing;
+        size_t x = std::min((size_t)grid.x, quads - 1);
+        size_t y = std::min((size_t)grid.y, quads - 1);
+        float fx = grid.x - (float)x;
+        float fy = grid.y - (float)y;
+
+        float h00 = heights.at(x, y);
+        float h10 = heights.at(x + 1, y);
+        float h01 = heights.at(x, y + 1);
+        float h11 = heights.at(x + 1, y + 1);
+
+        float dx;
+        float dy;
+        if (fx >= fy) {
+            dx = h10 - h00;
+            dy = h11 - h10;
+        } else {
+            dx = h11 - h01;
+            dy = h01 - h00;
+        }
+
+        float height = h00 + (dx * fx) + (dy * fy);
+        if (height < params.min_height || height > params.max_height) {
+            continue;
+        }
+
+        // The triangle's normal is (-dx, 1, -dy) in world units,
+        // normalized
+        dx *= inv_spacing;
+        dy *= inv_spacing;
+        float normal_y = 1.0f / std::sqrt(1.0f + (dx * dx) + (dy * dy));
+        if (1.0f - normal_y > params.max_steepness) {
+            continue;
+        }
+
+        vec2 pos = origin + pattern[i];
+        vec2 cell = (pos * inv_step) - vec2((float)lx, (float)lz);
+        size_t cx = std::min((size_t)cell.x, nx - 2);
+        size_t cz = std::min((size_t)cell.y, nz - 2);
+        vec2 t = cell - vec2((float)cx, (float)cz);
+        const float *d = &lattice[(cz * nx) + cx];
+        float density = glm::mix(
+            glm::mix(d[0], d[1], t.x), glm::mix(d[nx], d[nx + 1], t.x), t.y);
+
+        uint32_t h = hash_combine(chunk_seed, (uint32_t)i);
+        if (hash_to_unit(h) >= density) {
+            continue;
+        }
+
+        Rng rng(h);
+        TreeInstance tree;
+        tree.position = vec3(pos.x, height, pos.y);
+        tree.scale = rng.next_range(params.min_scale, params.max_scale);
+        tree.rotation = rng.next_range(0.0f, TWO_PI);
+        tree.variant = rng.next_u32() % variants;
+        out.push_back(tree);
+    }
+}
+
+float TreeScatter::density_at(vec2 pos) const {
+    float inv_size = 1.0f / params.density_size;
+    uint32_t seed = hash_combine(params.seed, 0x74726565u);
+    return params.coverage +
+           fbm(pos.x * inv_size, pos.y * inv_size, seed, 3);
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "chunk.hpp"
+#include "heightfield.hpp"
+#include "tree_instance.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+using glm::vec2;
+
+using std::vector;
+
+/**
+ * Scatters trees over terrain chunks as blue noise: no two trees
+ * closer than a minimum distance, without the clumps and gaps of
+ * uniformly random positions.
+ *
+ * One Poisson-disk pattern the size of a chunk is made up front, with
+ * distances measured around the edges as if it wrapped, so copies of
+ * it laid side by side still keep their distance across the seams.
+ * Every chunk starts from that pattern and drops points with noise:
+ * a hash of the chunk and the point thinned against a low-frequency
+ * density field, so forests have clearings and thick patches, and the
+ * repetition doesn't show. Points on ground that's too steep, too low
+ * or too high are dropped as well.
+ *
+ * Everything depends only on the seed, the chunk and its heights, so
+ * a chunk always gets the same trees and nothing has to be stored.
+ * Placing is a hash, a little noise and a height lookup per point, and
+ * safe to run on several chunks at once.
+ */
+class TreeScatter {
+public:
+    struct Params {
+        uint32_t seed = 1;
+
+        // Closest two trees can be, in world units
+        float min_distance = 5.0f;
+
+        // Fraction of the pattern's points that get a tree, on average
+        float coverage = 0.6f;
+
+        // World units per lattice cell of the density noise
+        float density_size = 160.0f;
+
+        // Steepest ground trees grow on, as 1 - the normal's Y
+        float max_steepness = 0.2f;
+
+        // Range of heights trees grow at, in world units
+        float min_height = -10.0f;
+        float max_height = 14.0f;
+
+        // Range of the trees' sizes
+        float min_scale = 0.8f;
+        float max_scale = 1.25f;
+
+        // How many tree models there are to pick from
+        uint32_t variants = 1;
+    };
+
+    explicit TreeScatter(const ChunkBuilder &b) :
+        TreeScatter(b, Params()) {}
+
+    TreeScatter(const ChunkBuilder &builder, Params p);
+
+    const Params &get_params() const {
+        return params;
+    }
+
+    /**
+     * Points of the pattern, in world units from a chunk's origin.
+     */
+    const vector<vec2> &get_pattern() const {
+        return pattern;
+    }
+
+    /**
+     * Place the trees of a chunk.
+     *
+     * @param heights: the chunk's CHUNK_SAMPLES x CHUNK_SAMPLES heights
+     * @param out: replaced with the trees, in world space
+     */
+    void place(
+        ChunkCoord coord,
+        const Heightfield &heights,
+        vector<TreeInstance> &out) const;
+
+private:
+    const ChunkBuilder &builder;
+    Params params;
+
+    vector<vec2> pattern;
+
+    /**
+     * Chance of a point of the pattern at a world XZ position getting
+     * a tree, before looking at the ground.
+     */
+    float density_at(vec2 pos) const;
+};
@@ -11,7 +11,7 @@ using std::array;
 using std::unique_ptr;
 using std::vector;
 
-vector<char> read_file(const std::string &filename) {
+inline vector<char> read_file(const std::string &filename) {
     // File will be opened at the end so that we can get the size
     std::ifstream file(filename, std::ios::ate | std::ios::binary);
     if (!file.is_open()) {
@@ -31,7 +31,9 @@ vector<char> read_file(const std::string &filename) {
     return buffer;
 }
 
-GLuint compile_shader(const std::string &filename, GLenum shader_type) {
+inline GLuint compile_shader(
+    const std::string &filename,
+    GLenum shader_type) {
     GLuint shader = glCreateShader(shader_type);
 
     const auto source_vec = read_file(filename);
@@ -60,7 +62,7 @@ GLuint compile_shader(const std::string &filename, GLenum shader_type) {
     return shader;
 }
 
-GLuint link_program(const std::vector<GLuint> &shaders) {
+inline GLuint link_program(const std::vector<GLuint> &shaders) {
     GLuint program = glCreateProgram();
     for (GLuint shader : shaders) {
         glAttachShader(program, shader);
@@ -0,0 +1,43 @@
+#version 420 core
+#extension GL_ARB_explicit_uniform_location : enable
+
+// Interpolated from the vertex shader
+in vec3 worldPosition;
+in vec3 normal;
+
+layout(location = 13) uniform vec3 eyePos;
+
+// Direction towards the sun
+layout(location = 5) uniform vec3 lightDir;
+layout(location = 6) uniform vec3 ambientLightColor;
+layout(location = 7) uniform vec3 diffuseLightColor;
+
+// A lamp at the eye, so caves aren't pitch black
+layout(location = 8) uniform vec3 lampColor;
+
+out vec4 fragColor;
+
+const vec3 grassColor = vec3(0.20, 0.42, 0.12);
+const vec3 rockColor = vec3(0.42, 0.38, 0.33);
+
+// How far the lamp reaches, in world units
+const float lampRange = 48.0;
+
+void main() {
+    vec3 n = normalize(normal);
+
+    // Grass on ground that faces up, bare rock on walls and ceilings
+    float grass = smoothstep(0.6, 0.8, n.y);
+    vec3 albedo = mix(rockColor, grassColor, grass);
+
+    float sunWeight = max(0.0, dot(n, lightDir));
+
+    vec3 toEye = eyePos - worldPosition;
+    float eyeDistance = length(toEye);
+    float falloff = clamp(1.0 - (eyeDistance / lampRange), 0.0, 1.0);
+    float lampWeight = max(0.0, dot(n, toEye / eyeDistance)) * falloff;
+
+    vec3 light = ambientLightColor + (diffuseLightColor * sunWeight) +
+                 (lampColor * lampWeight);
+    fragColor = vec4(albedo * light, 1.0);
+}
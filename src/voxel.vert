@@ -0,0 +1,24 @@
+#version 420 core
+#extension GL_ARB_explicit_uniform_location : enable
+
+// Position in the chunk's grid, in cubes, and the normal out of the
+// ground
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNorm;
+
+// Chunks are only moved and uniformly scaled, so normals go through
+// unchanged
+layout(location = 2) uniform mat4 uModel;
+layout(location = 3) uniform mat4 uView;
+layout(location = 4) uniform mat4 uPersp;
+
+out vec3 worldPosition;
+out vec3 normal;
+
+void main() {
+    vec4 world = uModel * vec4(aPos, 1.0);
+    worldPosition = world.xyz;
+    normal = aNorm;
+
+    gl_Position = uPersp * uView * world;
+}
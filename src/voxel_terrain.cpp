@@ -0,0 +1,283 @@
+#include "voxel_terrain.hpp"
+
+#include "frustum.hpp"
+#include "thread_pool.hpp"
+
+#include <glad/glad.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+
+VoxelTerrain::VoxelTerrain(
+    ThreadPool &p,
+    const DensityField &f,
+    Params prm) :
+    pool(p),
+    field(f),
+    params(prm),
+    cubes(prm.cells) {
+    int r = params.view_radius;
+    int v = params.vertical_radius;
+    for (int dy = -v; dy <= v; ++dy) {
+        for (int dz = -r; dz <= r; ++dz) {
+            for (int dx = -r; dx <= r; ++dx) {
+                box.push_back({dx, dy, dz});
+            }
+        }
+    }
+
+    std::stable_sort(
+        box.begin(), box.end(), [](VoxelCoord lhs, VoxelCoord rhs) {
+            return (lhs.x * lhs.x) + (lhs.y * lhs.y) + (lhs.z * lhs.z) <
+                   (rhs.x * rhs.x) + (rhs.y * rhs.y) + (rhs.z * rhs.z);
+        });
+}
+
+VoxelTerrain::~VoxelTerrain() {
+    // Builds hold a reference to the field, which may go away with us
+    wait_for_builds();
+}
+
+void VoxelTerrain::cleanup() {
+    wait_for_builds();
+    ready.clear();
+
+    for (auto &entry : loaded) {
+        release(entry.second);
+    }
+    loaded.clear();
+}
+
+void VoxelTerrain::update(vec3 camera_pos) {
+    VoxelCoord center = coord_at(camera_pos);
+    int margin = params.unload_margin;
+
+    // Release whatever is now too far away
+    for (auto it = loaded.begin(); it != loaded.end();) {
+        if (!in_range(it->first, center, margin)) {
+            release(it->second);
+            it = loaded.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    ready.erase(
+        std::remove_if(
+            ready.begin(),
+            ready.end(),
+            [&](const BuiltChunk &chunk) {
+                return !in_range(chunk.coord, center, margin);
+            }),
+        ready.end());
+
+    // Collect finished builds, dropping ones we've moved away from
+    for (auto it = building.begin(); it != building.end();) {
+        auto status = it->second.wait_for(std::chrono::seconds(0));
+        if (status != std::future_status::ready) {
+            ++it;
+            continue;
+        }
+
+        BuiltChunk chunk = it->second.get();
+        if (in_range(chunk.coord, center, margin)) {
+            ready.push_back(std::move(chunk));
+        }
+        it = building.erase(it);
+    }
+
+    // Upload the nearest finished chunks, a few per frame
+    auto dist_sq = [&center](VoxelCoord c) {
+        int dx = c.x - center.x;
+        int dy = c.y - center.y;
+        int dz = c.z - center.z;
+        return (dx * dx) + (dy * dy) + (dz * dz);
+    };
+
+    std::sort(
+        ready.begin(),
+        ready.end(),
+        [&dist_sq](const BuiltChunk &lhs, const BuiltChunk &rhs) {
+            return dist_sq(lhs.coord) < dist_sq(rhs.coord);
+        });
+
+    size_t count = std::min(params.uploads_per_frame, ready.size());
+    for (size_t i = 0; i < count; ++i) {
+        upload(std::move(ready[i]));
+    }
+    ready.erase(ready.begin(), ready.begin() + (ptrdiff_t)count);
+
+    // Queue up missing chunks, nearest first
+    size_t max_pending = params.max_pending;
+    if (max_pending == 0) {
+        max_pending = 2 * pool.size();
+    }
+
+    for (VoxelCoord offset : box) {
+        if (building.size() + ready.size() >= max_pending) {
+            break;
+        }
+
+        VoxelCoord coord = {
+            center.x + offset.x, center.y + offset.y, center.z + offset.z};
+        if (loaded.count(coord) > 0 || building.count(coord) > 0 ||
+            std::any_of(
+                ready.begin(), ready.end(), [&](const BuiltChunk &chunk) {
+                    return chunk.coord == coord;
+                })) {
+            continue;
+        }
+
+        building.emplace(
+            coord, pool.submit([this, coord]() { return build(coord); }));
+    }
+}
+
+void VoxelTerrain::draw(const Frustum &frustum, GLint model_loc) const {
+    for (const auto &entry : loaded) {
+        const LoadedChunk &chunk = entry.second;
+        if (chunk.elements == 0 ||
+            !frustum.intersects_box(chunk.box_min, chunk.box_max)) {
+            continue;
+        }
+
+        glUniformMatrix4fv(model_loc, 1, GL_FALSE, value_ptr(chunk.model));
+        glBindVertexArray(chunk.vao);
+        glDrawElements(
+            GL_TRIANGLES,
+            chunk.elements,
+            GL_UNSIGNED_INT,
+            (char *)nullptr + 0);
+    }
+}
+
+VoxelCoord VoxelTerrain::coord_at(vec3 pos) const {
+    float size = get_chunk_size();
+    return {
+        (int32_t)std::floor(pos.x / size),
+        (int32_t)std::floor(pos.y / size),
+        (int32_t)std::floor(pos.z / size)};
+}
+
+vec3 VoxelTerrain::get_origin(VoxelCoord coord) const {
+    return vec3((float)coord.x, (float)coord.y, (float)coord.z) *
+           get_chunk_size();
+}
+
+bool VoxelTerrain::in_range(VoxelCoord coord, VoxelCoord center, int margin)
+    const {
+    return std::abs(coord.x - center.x) <= params.view_radius + margin &&
+           std::abs(coord.z - center.z) <= params.view_radius + margin &&
+           std::abs(coord.y - center.y) <= params.vertical_radius + margin;
+}
+
+VoxelTerrain::BuiltChunk VoxelTerrain::build(VoxelCoord coord) const {
+    // One sample of margin all around, for the gradients on the
+    // chunk's faces
+    size_t samples = cubes.get_samples();
+    vec3 origin = get_origin(coord) - params.spacing;
+
+    vector<float> density;
+    field.sample(origin, samples, samples, samples, params.spacing, density);
+
+    BuiltChunk chunk;
+    chunk.coord = coord;
+
+    // Most chunks are all air or all rock; no need to look at every cube
+    auto inside = [](float d) { return d > 0.0f; };
+    bool any_inside = std::any_of(density.begin(), density.end(), inside);
+    bool all_inside = std::all_of(density.begin(), density.end(), inside);
+    if (any_inside && !all_inside) {
+        cubes.extract(density, chunk.mesh);
+    }
+
+    return chunk;
+}
+
+void VoxelTerrain::upload(BuiltChunk &&chunk) {
+    const VoxelMesh &mesh = chunk.mesh;
+
+    LoadedChunk loaded_chunk = {};
+    vec3 origin = get_origin(chunk.coord);
+    loaded_chunk.model = glm::scale(
+        glm::translate(mat4(1.0f), origin), vec3(params.spacing));
+
+    if (mesh.indices.empty()) {
+        loaded.emplace(chunk.coord, loaded_chunk);
+        return;
+    }
+
+    vec3 lo = mesh.positions[0];
+    vec3 hi = mesh.positions[0];
+    for (vec3 p : mesh.positions) {
+        lo = glm::min(lo, p);
+        hi = glm::max(hi, p);
+    }
+    loaded_chunk.box_min = origin + (lo * params.spacing);
+    loaded_chunk.box_max = origin + (hi * params.spacing);
+
+    glGenVertexArrays(1, &loaded_chunk.vao);
+    glBindVertexArray(loaded_chunk.vao);
+
+    // Every position, then every normal
+    GLsizeiptr positions_size =
+        (GLsizeiptr)(mesh.positions.size() * sizeof(vec3));
+    glGenBuffers(1, &loaded_chunk.vertex_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, loaded_chunk.vertex_buffer);
+    glBufferData(
+        GL_ARRAY_BUFFER, 2 * positions_size, nullptr, GL_STATIC_DRAW);
+    glBufferSubData(
+        GL_ARRAY_BUFFER, 0, positions_size, mesh.positions.data());
+    glBufferSubData(
+        GL_ARRAY_BUFFER, positions_size, positions_size, mesh.normals.data());
+
+    GLuint pos_attrib = 0;
+    glEnableVertexAttribArray(pos_attrib);
+    glVertexAttribPointer(
+        pos_attrib, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), (char *)nullptr + 0);
+
+    GLuint norm_attrib = 1;
+    glEnableVertexAttribArray(norm_attrib);
+    glVertexAttribPointer(
+        norm_attrib,
+        3,
+        GL_FLOAT,
+        GL_FALSE,
+        sizeof(vec3),
+        (char *)nullptr + positions_size);
+
+    glGenBuffers(1, &loaded_chunk.index_buffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, loaded_chunk.index_buffer);
+    glBufferData(
+        GL_ELEMENT_ARRAY_BUFFER,
+        (GLsizeiptr)(mesh.indices.size() * sizeof(uint32_t)),
+        mesh.indices.data(),
+        GL_STATIC_DRAW);
+    loaded_chunk.elements = (GLsizei)mesh.indices.size();
+
+    glBindVertexArray(0);
+    loaded.emplace(chunk.coord, loaded_chunk);
+}
+
+void VoxelTerrain::release(LoadedChunk &chunk) {
+    // Meshes differ in size from chunk to chunk, so buffers aren't
+    // recycled like ChunkManager's
+    if (chunk.vao != 0) {
+        glDeleteBuffers(1, &chunk.vertex_buffer);
+        glDeleteBuffers(1, &chunk.index_buffer);
+        glDeleteVertexArrays(1, &chunk.vao);
+    }
+    chunk = {};
+}
+
+void VoxelTerrain::wait_for_builds() {
+    for (auto &entry : building) {
+        entry.second.wait();
+    }
+    building.clear();
+}
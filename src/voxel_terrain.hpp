@@ -0,0 +1,166 @@
+#pragma once
+
+#include "density_field.hpp"
+#include "marching_cubes.hpp"
+#include "noise.hpp"
+
+#include <glm/glm.hpp>
+
+#include <future>
+#include <unordered_map>
+#include <vector>
+
+using glm::mat4;
+using glm::vec3;
+
+typedef unsigned int GLuint;
+typedef int GLint;
+typedef int GLsizei;
+
+class Frustum;
+class ThreadPool;
+
+struct VoxelCoord {
+    int32_t x;
+    int32_t y;
+    int32_t z;
+
+    bool operator==(const VoxelCoord &other) const {
+        return x == other.x && y == other.y && z == other.z;
+    }
+
+    bool operator!=(const VoxelCoord &other) const {
+        return !(*this == other);
+    }
+};
+
+struct VoxelCoordHash {
+    size_t operator()(const VoxelCoord &c) const {
+        return hash_3d(c.x, c.y, c.z, 0);
+    }
+};
+
+/**
+ * Keeps a box of marching-cubes chunks of a density field loaded
+ * around the camera, for terrain that heightfields can't do: caves,
+ * arches and overhangs.
+ *
+ * Like ChunkManager, missing chunks are sampled and meshed on the
+ * thread pool, nearest first, and uploaded a few per frame on the GL
+ * thread. Chunks with no surface in them, like ones up in the air, are
+ * remembered without any GPU state so they aren't built again.
+ */
+class VoxelTerrain {
+public:
+    struct Params {
+        // Cubes along each side of a chunk
+        size_t cells = 32;
+
+        // World units per cube
+        float spacing = 1.0f;
+
+        // Chunks loaded in each horizontal direction from the camera's
+        // chunk
+        int view_radius = 4;
+
+        // Chunks loaded above and below the camera's chunk
+        int vertical_radius = 2;
+
+        // Extra distance, in chunks, before a loaded chunk is released
+        int unload_margin = 1;
+
+        // Most chunks uploaded to the GPU in a single update()
+        size_t uploads_per_frame = 4;
+
+        // Most chunks being built or waiting for upload at once, or 0
+        // for twice the number of worker threads
+        size_t max_pending = 0;
+    };
+
+    VoxelTerrain(ThreadPool &p, const DensityField &f) :
+        VoxelTerrain(p, f, Params()) {}
+
+    VoxelTerrain(ThreadPool &pool, const DensityField &field, Params p);
+
+    ~VoxelTerrain();
+
+    VoxelTerrain(const VoxelTerrain &) = delete;
+    VoxelTerrain &operator=(const VoxelTerrain &) = delete;
+
+    /**
+     * Free all GPU state, after waiting for any chunks still being
+     * built.
+     */
+    void cleanup();
+
+    /**
+     * Release far chunks, upload finished ones, and start building
+     * missing ones around the camera position.
+     */
+    void update(vec3 camera_pos);
+
+    /**
+     * Draw every loaded chunk in the view frustum with the currently
+     * bound program.
+     *
+     * @param model_loc: uniform location of the model matrix
+     */
+    void draw(const Frustum &frustum, GLint model_loc) const;
+
+    float get_chunk_size() const {
+        return (float)params.cells * params.spacing;
+    }
+
+    VoxelCoord coord_at(vec3 pos) const;
+
+    vec3 get_origin(VoxelCoord coord) const;
+
+    size_t get_loaded_count() const {
+        return loaded.size();
+    }
+
+private:
+    struct BuiltChunk {
+        VoxelCoord coord;
+        VoxelMesh mesh;
+    };
+
+    struct LoadedChunk {
+        // All 0 for a chunk with nothing to draw
+        GLuint vao;
+        GLuint vertex_buffer;
+        GLuint index_buffer;
+        GLsizei elements;
+
+        mat4 model;
+
+        // World space bounding box, for culling
+        vec3 box_min;
+        vec3 box_max;
+    };
+
+    ThreadPool &pool;
+    const DensityField &field;
+    Params params;
+
+    MarchingCubes cubes;
+
+    // Offsets from the camera's chunk that should be loaded, nearest
+    // first
+    vector<VoxelCoord> box;
+
+    std::unordered_map<VoxelCoord, LoadedChunk, VoxelCoordHash> loaded;
+    std::unordered_map<VoxelCoord, std::future<BuiltChunk>, VoxelCoordHash>
+        building;
+    vector<BuiltChunk> ready;
+
+    bool in_range(VoxelCoord coord, VoxelCoord center, int margin) const;
+
+    BuiltChunk build(VoxelCoord coord) const;
+
+    void upload(BuiltChunk &&chunk);
+
+    void release(LoadedChunk &chunk);
+
+    void wait_for_builds();
+};
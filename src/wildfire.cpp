@@ -0,0 +1,411 @@
+#include "wildfire.hpp"
+
+#include "noise.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const size_t DIRECTIONS = 8;
+
+// Where a cell's neighbour is, in grid units, for each direction fire
+// can reach it from. Must match the order step_rows() reads the masks
+// in.
+static const int DIRECTION_X[DIRECTIONS] = {0, 0, -1, 1, -1, 1, -1, 1};
+static const int DIRECTION_Y[DIRECTIONS] = {-1, 1, 0, 0, -1, -1, 1, 1};
+
+static const float SQRT_2 = 1.41421356f;
+
+// Each word's cells moved one column along, so that every cell holds
+// its neighbour's bit from the west (the one with one less X), or from
+// the east. Words are padded on both sides, so i - 1 and i + 1 are
+// always there.
+static inline uint64_t from_west(const uint64_t *row, size_t i) {
+    return (row[i] << 1) | (row[i - 1] >> 63);
+}
+
+static inline uint64_t from_east(const uint64_t *row, size_t i) {
+    return (row[i] >> 1) | (row[i + 1] << 63);
+}
+
+#ifdef __SSE2__
+// The same, for words i and i + 1 at once
+static inline __m128i from_west_2(const uint64_t *row, size_t i) {
+    __m128i words = _mm_loadu_si128((const __m128i *)(row + i));
+    __m128i before = _mm_loadu_si128((const __m128i *)(row + i - 1));
+    return _mm_or_si128(_mm_slli_epi64(words, 1), _mm_srli_epi64(before, 63));
+}
+
+static inline __m128i from_east_2(const uint64_t *row, size_t i) {
+    __m128i words = _mm_loadu_si128((const __m128i *)(row + i));
+    __m128i after = _mm_loadu_si128((const __m128i *)(row + i + 1));
+    return _mm_or_si128(_mm_srli_epi64(words, 1), _mm_slli_epi64(after, 63));
+}
+
+static inline __m128i load_2(const uint64_t *words, size_t i) {
+    return _mm_loadu_si128((const __m128i *)(words + i));
+}
+#endif
+
+static inline size_t count_bits(uint64_t x) {
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (size_t)((x * 0x0101010101010101ULL) >> 56);
+}
+
+static size_t count_bits(const vector<uint64_t> &board) {
+    size_t count = 0;
+    for (uint64_t word : board) {
+        count += count_bits(word);
+    }
+    return count;
+}
+
+WildfireSimulator::WildfireSimulator(
+    ThreadPool &p,
+    const Heightfield &f,
+    const Heightfield &h,
+    vec2 o,
+    float s,
+    Params prm) :
+    pool(p),
+    params(prm),
+    origin(o),
+    cell_size(s),
+    width(f.get_width()),
+    height(f.get_height()),
+    fuel_density(f),
+    heights(h) {
+    if (width == 0 || height == 0 || heights.get_width() != width ||
+        heights.get_height() != height) {
+        std::string err_msg = "Bad wildfire grid: ";
+        err_msg.append(std::to_string(width));
+        err_msg.append("x");
+        err_msg.append(std::to_string(height));
+        err_msg.append(" cells of fuel, ");
+        err_msg.append(std::to_string(heights.get_width()));
+        err_msg.append("x");
+        err_msg.append(std::to_string(heights.get_height()));
+        err_msg.append(" of heights");
+        throw std::invalid_argument(err_msg);
+    }
+    if (!(cell_size > 0.0f) || params.mask_sets == 0 ||
+        params.band_height == 0) {
+        std::string err_msg = "Bad wildfire: cells of ";
+        err_msg.append(std::to_string(cell_size));
+        err_msg.append(", ");
+        err_msg.append(std::to_string(params.mask_sets));
+        err_msg.append(" mask sets, bands of ");
+        err_msg.append(std::to_string(params.band_height));
+        err_msg.append(" rows");
+        throw std::invalid_argument(err_msg);
+    }
+
+    // An even number of words, then the padding
+    stride = (((width + 127) / 128) * 2) + 2;
+
+    size_t words = (height + 2) * stride;
+    initial_fuel.assign(words, 0);
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t x = 0; x < width; ++x) {
+            if (fuel_density.at(x, y) > 0.0f) {
+                initial_fuel[word_index(x, y)] |= bit(x);
+            }
+        }
+    }
+
+    lit.assign(words, 0);
+    masks.resize((size_t)params.mask_sets * DIRECTIONS);
+    reset();
+    build_masks();
+}
+
+Heightfield WildfireSimulator::fuel_from_trees(
+    const vector<TreeInstance> &trees,
+    vec2 origin,
+    float cell_size,
+    size_t width,
+    size_t height) {
+    Heightfield fuel(width, height);
+    for (const TreeInstance &tree : trees) {
+        float x = std::floor((tree.position.x - origin.x) / cell_size);
+        float y = std::floor((tree.position.z - origin.y) / cell_size);
+        if (x < 0.0f || y < 0.0f || x >= (float)width || y >= (float)height) {
+            continue;
+        }
+
+        float &cell = fuel.at((size_t)x, (size_t)y);
+        cell = std::min(cell + tree.scale, 1.0f);
+    }
+
+    return fuel;
+}
+
+void WildfireSimulator::set_wind(vec2 wind, float strength) {
+    params.wind = wind;
+    params.wind_strength = strength;
+    build_masks();
+}
+
+bool WildfireSimulator::ignite(vec2 xz) {
+    size_t x;
+    size_t y;
+    if (!cell_at(xz, x, y)) {
+        return false;
+    }
+
+    size_t i = word_index(x, y);
+    if (!(fuel[i] & bit(x))) {
+        return false;
+    }
+
+    fuel[i] &= ~bit(x);
+    burning[i] |= bit(x);
+    caught[i] |= bit(x);
+    return true;
+}
+
+void WildfireSimulator::reset() {
+    fuel = initial_fuel;
+    burning.assign(initial_fuel.size(), 0);
+    burnt.assign(initial_fuel.size(), 0);
+    caught.assign(initial_fuel.size(), 0);
+    steps_taken = 0;
+}
+
+void WildfireSimulator::step(uint32_t steps) {
+    size_t num_bands = (height + params.band_height - 1) / params.band_height;
+    std::fill(caught.begin(), caught.end(), 0);
+
+    for (uint32_t s = 0; s < steps; ++s) {
+        // Steps count from the last reset, so the same fire started
+        // again burns the same way
+        uint32_t set =
+            hash_combine(params.seed, steps_taken) % params.mask_sets;
+
+        auto run_band = [&](size_t band) {
+            size_t row_begin = band * params.band_height;
+            size_t row_end = std::min(row_begin + params.band_height, height);
+            step_rows(set, row_begin, row_end);
+        };
+
+        if (num_bands > 1) {
+            pool.parallel_for(0, num_bands, run_band);
+        } else {
+            run_band(0);
+        }
+
+        std::swap(burning, lit);
+        ++steps_taken;
+    }
+}
+
+size_t WildfireSimulator::get_burning_count() const {
+    return count_bits(burning);
+}
+
+size_t WildfireSimulator::get_burnt_count() const {
+    return count_bits(burnt);
+}
+
+bool WildfireSimulator::has_burnt(vec2 xz) const {
+    size_t x;
+    size_t y;
+    if (!cell_at(xz, x, y)) {
+        return false;
+    }
+
+    size_t i = word_index(x, y);
+    return ((burning[i] | burnt[i]) & bit(x)) != 0;
+}
+
+bool WildfireSimulator::caught_fire(vec2 lo, vec2 hi) const {
+    float x0 = std::floor((lo.x - origin.x) / cell_size);
+    float y0 = std::floor((lo.y - origin.y) / cell_size);
+    float x1 = std::floor((hi.x - origin.x) / cell_size);
+    float y1 = std::floor((hi.y - origin.y) / cell_size);
+    if (!(x1 >= 0.0f) || !(y1 >= 0.0f) || !(x0 < (float)width) ||
+        !(y0 < (float)height)) {
+        return false;
+    }
+
+    size_t first_x = (size_t)std::max(x0, 0.0f);
+    size_t first_y = (size_t)std::max(y0, 0.0f);
+    size_t last_x = (size_t)std::min(x1, (float)(width - 1));
+    size_t last_y = (size_t)std::min(y1, (float)(height - 1));
+
+    // Whole words, but for the cells of the end ones outside the box
+    uint64_t first_mask = ~(uint64_t)0 << (first_x % 64);
+    uint64_t last_mask = ~(uint64_t)0 >> (63 - (last_x % 64));
+    for (size_t y = first_y; y <= last_y; ++y) {
+        size_t first = word_index(first_x, y);
+        size_t last = word_index(last_x, y);
+        for (size_t i = first; i <= last; ++i) {
+            uint64_t mask = ~(uint64_t)0;
+            if (i == first) {
+                mask &= first_mask;
+            }
+            if (i == last) {
+                mask &= last_mask;
+            }
+            if (caught[i] & mask) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool WildfireSimulator::cell_at(vec2 xz, size_t &x, size_t &y) const {
+    float fx = std::floor((xz.x - origin.x) / cell_size);
+    float fy = std::floor((xz.y - origin.y) / cell_size);
+    if (!(fx >= 0.0f) || !(fy >= 0.0f) || fx >= (float)width ||
+        fy >= (float)height) {
+        return false;
+    }
+
+    x = (size_t)fx;
+    y = (size_t)fy;
+    return true;
+}
+
+void WildfireSimulator::build_masks() {
+    size_t words = (height + 2) * stride;
+    for (vector<uint64_t> &mask : masks) {
+        mask.assign(words, 0);
+    }
+
+    vec2 wind(0.0f);
+    float wind_length = std::sqrt(
+        (params.wind.x * params.wind.x) + (params.wind.y * params.wind.y));
+    if (wind_length > 0.0f) {
+        wind = params.wind / wind_length;
+    }
+
+    auto draw_row = [&](size_t y) {
+        for (size_t x = 0; x < width; ++x) {
+            float density = fuel_density.at(x, y);
+            if (!(density > 0.0f)) {
+                continue;
+            }
+
+            size_t i = word_index(x, y);
+            for (size_t d = 0; d < DIRECTIONS; ++d) {
+                int nx = (int)x + DIRECTION_X[d];
+                int ny = (int)y + DIRECTION_Y[d];
+                if (nx < 0 || ny < 0 || nx >= (int)width || ny >= (int)height) {
+                    continue;
+                }
+
+                // Fire travels from the neighbour to this cell
+                float run = (DIRECTION_X[d] != 0 && DIRECTION_Y[d] != 0)
+                                ? SQRT_2
+                                : 1.0f;
+                vec2 travel(
+                    (float)-DIRECTION_X[d] / run, (float)-DIRECTION_Y[d] / run);
+                float downwind = (wind.x * travel.x) + (wind.y * travel.y);
+                float rise = heights.at(x, y) - heights.at(
+                                                    (size_t)nx, (size_t)ny);
+                float grade = rise / (run * cell_size);
+
+                float chance = params.spread * density *
+                               std::exp(
+                                   (params.wind_strength * downwind) +
+                                   (params.slope_factor * grade)) /
+                               run;
+
+                for (uint32_t set = 0; set < params.mask_sets; ++set) {
+                    uint32_t h = hash_3d(
+                        (int32_t)x,
+                        (int32_t)y,
+                        (int32_t)((set * DIRECTIONS) + d),
+                        params.seed);
+                    if (hash_to_unit(h) < chance) {
+                        masks[(set * DIRECTIONS) + d][i] |= bit(x);
+                    }
+                }
+            }
+        }
+    };
+
+    // Rows only set bits in their own words
+    pool.parallel_for(0, height, draw_row);
+}
+
+void WildfireSimulator::step_rows(
+    uint32_t set,
+    size_t row_begin,
+    size_t row_end) {
+    const uint64_t *m[DIRECTIONS];
+    for (size_t d = 0; d < DIRECTIONS; ++d) {
+        m[d] = masks[(set * DIRECTIONS) + d].data();
+    }
+
+    for (size_t y = row_begin; y < row_end; ++y) {
+        size_t row = (y + 1) * stride;
+        const uint64_t *center = &burning[row];
+        const uint64_t *north = center - stride;
+        const uint64_t *south = center + stride;
+        uint64_t *out = &lit[row];
+        uint64_t *left = &fuel[row];
+        uint64_t *gone = &burnt[row];
+        uint64_t *news = &caught[row];
+
+        size_t i = 1;
+#ifdef __SSE2__
+        for (; i + 1 < stride - 1; i += 2) {
+            size_t w = row + i;
+            __m128i spread = _mm_and_si128(load_2(north, i), load_2(m[0], w));
+            spread = _mm_or_si128(
+                spread, _mm_and_si128(load_2(south, i), load_2(m[1], w)));
+            spread = _mm_or_si128(
+                spread, _mm_and_si128(from_west_2(center, i), load_2(m[2], w)));
+            spread = _mm_or_si128(
+                spread, _mm_and_si128(from_east_2(center, i), load_2(m[3], w)));
+            spread = _mm_or_si128(
+                spread, _mm_and_si128(from_west_2(north, i), load_2(m[4], w)));
+            spread = _mm_or_si128(
+                spread, _mm_and_si128(from_east_2(north, i), load_2(m[5], w)));
+            spread = _mm_or_si128(
+                spread, _mm_and_si128(from_west_2(south, i), load_2(m[6], w)));
+            spread = _mm_or_si128(
+                spread, _mm_and_si128(from_east_2(south, i), load_2(m[7], w)));
+
+            __m128i fuel_left = load_2(left, i);
+            spread = _mm_and_si128(spread, fuel_left);
+            _mm_storeu_si128((__m128i *)(out + i), spread);
+            _mm_storeu_si128(
+                (__m128i *)(news + i), _mm_or_si128(load_2(news, i), spread));
+            _mm_storeu_si128(
+                (__m128i *)(left + i), _mm_andnot_si128(spread, fuel_left));
+            _mm_storeu_si128(
+                (__m128i *)(gone + i),
+                _mm_or_si128(load_2(gone, i), load_2(center, i)));
+        }
+#endif
+        for (; i < stride - 1; ++i) {
+            size_t w = row + i;
+            uint64_t spread = (north[i] & m[0][w]) | (south[i] & m[1][w]) |
+                              (from_west(center, i) & m[2][w]) |
+                              (from_east(center, i) & m[3][w]) |
+                              (from_west(north, i) & m[4][w]) |
+                              (from_east(north, i) & m[5][w]) |
+                              (from_west(south, i) & m[6][w]) |
+                              (from_east(south, i) & m[7][w]);
+
+            spread &= left[i];
+            out[i] = spread;
+            news[i] |= spread;
+            left[i] &= ~spread;
+            gone[i] |= center[i];
+        }
+    }
+}
@@ -0,0 +1,216 @@
+#pragma once
+
+#include "heightfield.hpp"
+#include "tree_instance.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+using glm::vec2;
+
+using std::vector;
+
+class ThreadPool;
+
+/**
+ * Wildfire spreading through a forest, as a cellular automaton over a
+ * grid of square cells.
+ *
+ * A cell either has fuel left, is burning, or has burnt (or never had
+ * anything to burn). Each step, every burning cell burns out, and
+ * lights each of its 8 neighbours that still has fuel with some
+ * chance: more for a neighbour with more fuel, downwind or uphill of
+ * it, less for one across a corner.
+ *
+ * The grid is kept as bitboards, a bit per cell and 64 cells to a
+ * word, each row padded with an empty word at either end and the grid
+ * with an empty row above and below. Rolling the dice for every cell
+ * every step would be far too slow, so they're rolled up front
+ * instead: for each of the 8 directions, a mask with a bit set for
+ * every cell that catches from its neighbour that way, drawn with that
+ * cell's chance. There are a few sets of masks, a hashed pick of them
+ * per step, so fire doesn't take the same paths every time. A step is
+ * then nothing but shifts, ANDs and ORs over whole words, two at a time
+ * with SSE2 when the compiler targets it, and the scalar fallback gives
+ * identical results. Rows are stepped in bands on the thread pool;
+ * each reads only the last step's fire, so the result doesn't depend
+ * on how many threads there are.
+ *
+ * Only the masks depend on the wind, so changing it costs about as
+ * much as building the simulation, and a fire can be put out and
+ * started again somewhere else without either. Which masks a step uses
+ * depends only on how many steps came before it, so a fire started
+ * again in the same place and the same wind burns exactly the same
+ * way: trying out a firebreak or a change in the wind changes only
+ * what it touches.
+ */
+class WildfireSimulator {
+public:
+    struct Params {
+        uint32_t seed = 1;
+
+        // Chance a burning cell lights a direct neighbour full of fuel,
+        // on flat ground with no wind
+        float spread = 0.5f;
+
+        // Direction the wind blows towards in XZ, and how strongly;
+        // the chance of spreading straight downwind is scaled by
+        // exp(wind_strength), and upwind by exp(-wind_strength)
+        vec2 wind = vec2(1.0f, 0.0f);
+        float wind_strength = 1.0f;
+
+        // The chance of spreading up a slope is scaled by
+        // exp(slope_factor * rise / run), and down one by its inverse
+        float slope_factor = 2.0f;
+
+        // Sets of masks steps pick from
+        uint32_t mask_sets = 4;
+
+        // Rows handed to a worker at a time
+        size_t band_height = 64;
+    };
+
+    /**
+     * @param fuel: how much there is to burn in each cell, from 0 to 1
+     * @param heights: the ground's height at each cell's center, in
+     * world units; the same size as fuel
+     * @param origin: the corner of the grid with the least X and Z
+     * @param cell_size: side of a cell, in world units
+     */
+    WildfireSimulator(
+        ThreadPool &pool,
+        const Heightfield &fuel,
+        const Heightfield &heights,
+        vec2 origin,
+        float cell_size,
+        Params p);
+
+    WildfireSimulator(const WildfireSimulator &) = delete;
+    WildfireSimulator &operator=(const WildfireSimulator &) = delete;
+
+    /**
+     * Fuel for a grid from the trees standing on it: each tree adds
+     * its scale to its cell's fuel, up to 1.
+     */
+    static Heightfield fuel_from_trees(
+        const vector<TreeInstance> &trees,
+        vec2 origin,
+        float cell_size,
+        size_t width,
+        size_t height);
+
+    /**
+     * Change the wind, redrawing the masks. Fire already burning
+     * carries on.
+     */
+    void set_wind(vec2 wind, float strength);
+
+    /**
+     * Set the cell under a world XZ position burning.
+     *
+     * @return whether it had fuel to burn
+     */
+    bool ignite(vec2 xz);
+
+    /**
+     * Put every fire out and grow all the fuel back.
+     */
+    void reset();
+
+    /**
+     * Spread the fire some number of steps.
+     */
+    void step(uint32_t steps = 1);
+
+    /**
+     * Steps taken since the simulation was built or last reset.
+     */
+    uint32_t get_step() const {
+        return steps_taken;
+    }
+
+    size_t get_burning_count() const;
+
+    size_t get_burnt_count() const;
+
+    /**
+     * Whether the cell under a world XZ position is burning or has
+     * burnt, having had fuel. False outside the grid.
+     */
+    bool has_burnt(vec2 xz) const;
+
+    /**
+     * Whether any cell overlapping an XZ box caught fire during the
+     * last call to step(), or was ignited since, so the box only needs
+     * looking at again if it did.
+     */
+    bool caught_fire(vec2 lo, vec2 hi) const;
+
+private:
+    ThreadPool &pool;
+    Params params;
+
+    vec2 origin;
+    float cell_size;
+
+    size_t width;
+    size_t height;
+
+    // Words in a row, including its padding; always even, so rows can
+    // be stepped two words at a time
+    size_t stride;
+
+    // Bitboards, (height + 2) * stride words each
+    vector<uint64_t> initial_fuel;
+    vector<uint64_t> fuel;
+    vector<uint64_t> burning;
+    vector<uint64_t> burnt;
+
+    // Where a step puts the cells it lights, before it becomes the
+    // burning cells
+    vector<uint64_t> lit;
+
+    // Cells lit by the last call to step() or by ignite() since
+    vector<uint64_t> caught;
+
+    // For each set, a mask per direction of the cells that catch from
+    // their neighbour that way
+    vector<vector<uint64_t>> masks;
+
+    // Kept to redraw the masks
+    Heightfield fuel_density;
+    Heightfield heights;
+
+    uint32_t steps_taken = 0;
+
+    /**
+     * Index of a cell's word in a bitboard, and its bit in the word.
+     * Cells are in grid units, from 0.
+     */
+    size_t word_index(size_t x, size_t y) const {
+        return ((y + 1) * stride) + 1 + (x / 64);
+    }
+
+    static uint64_t bit(size_t x) {
+        return (uint64_t)1 << (x % 64);
+    }
+
+    /**
+     * The cell under a world XZ position, if there is one.
+     */
+    bool cell_at(vec2 xz, size_t &x, size_t &y) const;
+
+    /**
+     * Draw every set of masks for the current wind.
+     */
+    void build_masks();
+
+    /**
+     * Spread the fire over rows [row_begin, row_end) of the grid, from
+     * one set of masks.
+     */
+    void step_rows(uint32_t set, size_t row_begin, size_t row_end);
+};